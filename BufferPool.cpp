@@ -0,0 +1,219 @@
+// Copyright 2000-2021 Mark H. P. Lord
+
+#include "BufferPool.h"
+#include "Log.h"
+
+namespace Prime {
+
+namespace {
+
+    BufferPool* CreateGlobalBufferPool()
+    {
+        BufferPool* pool = new BufferPool;
+        pool->init(Log::getGlobal());
+        return pool;
+    }
+}
+
+BufferPool* BufferPool::getGlobal()
+{
+    // Deliberately leaked: threads may release buffers while the process is shutting down.
+    static BufferPool* global = CreateGlobalBufferPool();
+    return global;
+}
+
+BufferPool::BufferPool()
+    : _initialised(false)
+    , _threadCacheCount(0)
+    , _sharedCacheCount(0)
+{
+}
+
+BufferPool::~BufferPool()
+{
+    // The ThreadSpecificData would otherwise hand this thread's cache to threadDestroyed() after we've deleted
+    // it. Other threads must have finished with the pool.
+    if (_initialised) {
+        _threadCache.set(NULL);
+    }
+
+    for (size_t i = 0; i != _threadCaches.size(); ++i) {
+        for (int sizeClass = 0; sizeClass != sizeClassCount; ++sizeClass) {
+            freeBuffers(_threadCaches[i]->buffers[sizeClass]);
+        }
+
+        delete _threadCaches[i];
+    }
+
+    for (int sizeClass = 0; sizeClass != sizeClassCount; ++sizeClass) {
+        freeBuffers(_shared[sizeClass]);
+    }
+}
+
+bool BufferPool::init(Log* log, size_t threadCacheCount, size_t sharedCacheCount)
+{
+    PRIME_ASSERT(!_initialised);
+
+    if (!_mutex.init(log, "BufferPool mutex")) {
+        return false;
+    }
+
+    if (!_threadCache.init(log, &BufferPool::threadDestroyed, "BufferPool thread cache")) {
+        return false;
+    }
+
+    _threadCacheCount = threadCacheCount;
+    _sharedCacheCount = sharedCacheCount;
+    _initialised = true;
+    return true;
+}
+
+int BufferPool::getSizeClass(size_t size)
+{
+    if (size > maxPooledSize) {
+        return -1;
+    }
+
+    int sizeClass = 0;
+    while (getSizeClassSize(sizeClass) < size) {
+        ++sizeClass;
+    }
+
+    return sizeClass;
+}
+
+void BufferPool::freeBuffers(std::vector<void*>& buffers)
+{
+    for (size_t i = 0; i != buffers.size(); ++i) {
+        delete[](char*) buffers[i];
+    }
+
+    buffers.clear();
+}
+
+void BufferPool::threadDestroyed(void* cache)
+{
+    ThreadCache* threadCache = reinterpret_cast<ThreadCache*>(cache);
+    BufferPool* pool = threadCache->pool;
+
+    Mutex::ScopedLock lock(&pool->_mutex);
+
+    for (int sizeClass = 0; sizeClass != sizeClassCount; ++sizeClass) {
+        std::vector<void*>& buffers = threadCache->buffers[sizeClass];
+        for (size_t i = 0; i != buffers.size(); ++i) {
+            pool->addToSharedCache(sizeClass, buffers[i]);
+        }
+
+        buffers.clear();
+    }
+
+    threadCache->inUse = false;
+}
+
+BufferPool::ThreadCache* BufferPool::getThreadCache()
+{
+    ThreadCache* cache = reinterpret_cast<ThreadCache*>(_threadCache.get());
+    if (cache) {
+        return cache;
+    }
+
+    Mutex::ScopedLock lock(&_mutex);
+
+    // Reuse the cache of a thread that has exited, so a server that keeps creating threads doesn't accumulate
+    // caches.
+    for (size_t i = 0; i != _threadCaches.size(); ++i) {
+        if (!_threadCaches[i]->inUse) {
+            cache = _threadCaches[i];
+            break;
+        }
+    }
+
+    if (!cache) {
+        cache = new ThreadCache;
+        cache->pool = this;
+        _threadCaches.push_back(cache);
+    }
+
+    cache->inUse = true;
+
+    _threadCache.set(cache);
+    return cache;
+}
+
+void BufferPool::addToSharedCache(int sizeClass, void* buffer)
+{
+    std::vector<void*>& shared = _shared[sizeClass];
+    if (shared.size() < _sharedCacheCount) {
+        shared.push_back(buffer);
+    } else {
+        delete[](char*) buffer;
+    }
+}
+
+void* BufferPool::allocate(size_t size)
+{
+    int sizeClass = getSizeClass(size);
+    if (sizeClass < 0) {
+        return new char[size];
+    }
+
+    // Allocate the whole size class even if we're not initialised, since deallocate() may pool the buffer.
+    if (!_initialised) {
+        return new char[getSizeClassSize(sizeClass)];
+    }
+
+    std::vector<void*>& cached = getThreadCache()->buffers[sizeClass];
+    if (!cached.empty()) {
+        void* buffer = cached.back();
+        cached.pop_back();
+        return buffer;
+    }
+
+    {
+        Mutex::ScopedLock lock(&_mutex);
+        std::vector<void*>& shared = _shared[sizeClass];
+        if (!shared.empty()) {
+            void* buffer = shared.back();
+            shared.pop_back();
+            return buffer;
+        }
+    }
+
+    return new char[getSizeClassSize(sizeClass)];
+}
+
+void BufferPool::deallocate(void* buffer, size_t size)
+{
+    if (!buffer) {
+        return;
+    }
+
+    int sizeClass = getSizeClass(size);
+    if (sizeClass < 0 || !_initialised) {
+        delete[](char*) buffer;
+        return;
+    }
+
+    std::vector<void*>& cached = getThreadCache()->buffers[sizeClass];
+    if (cached.size() < _threadCacheCount) {
+        cached.push_back(buffer);
+        return;
+    }
+
+    Mutex::ScopedLock lock(&_mutex);
+    addToSharedCache(sizeClass, buffer);
+}
+
+void BufferPool::trim()
+{
+    if (!_initialised) {
+        return;
+    }
+
+    Mutex::ScopedLock lock(&_mutex);
+
+    for (int sizeClass = 0; sizeClass != sizeClassCount; ++sizeClass) {
+        freeBuffers(_shared[sizeClass]);
+    }
+}
+}
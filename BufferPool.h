@@ -0,0 +1,87 @@
+// Copyright 2000-2021 Mark H. P. Lord
+
+#ifndef PRIME_BUFFERPOOL_H
+#define PRIME_BUFFERPOOL_H
+
+#include "Mutex.h"
+#include "RefCounting.h"
+#include "ThreadSpecificData.h"
+#include <vector>
+
+namespace Prime {
+
+/// Recycles buffers (e.g., the storage of per-connection StreamBuffers) so that short lived objects don't keep
+/// allocating, and faulting in, fresh memory. Sizes are rounded up to a power of two size class. Each thread
+/// keeps a few released buffers of each class that it can reuse without locking, backed by a shared cache.
+/// Buffers larger than maxPooledSize are allocated and freed directly.
+class PRIME_PUBLIC BufferPool : public RefCounted {
+public:
+    enum { minPooledSizeShift = 10, maxPooledSizeShift = 20 };
+    enum { minPooledSize = 1u << minPooledSizeShift, maxPooledSize = 1u << maxPooledSizeShift };
+
+    enum { defaultThreadCacheCount = 4, defaultSharedCacheCount = 64 };
+
+    /// Returns a process wide BufferPool, which is never destructed so that it outlives every thread.
+    static BufferPool* getGlobal();
+
+    BufferPool();
+
+    ~BufferPool();
+
+    /// The counts are the maximum number of buffers of each size class to keep in each thread's cache and in
+    /// the shared cache. Until init() has succeeded, buffers are allocated and freed directly.
+    bool init(Log* log, size_t threadCacheCount = defaultThreadCacheCount,
+        size_t sharedCacheCount = defaultSharedCacheCount);
+
+    bool isInitialised() const { return _initialised; }
+
+    /// Returns a buffer of at least size bytes. Thread safe.
+    void* allocate(size_t size);
+
+    /// Return a buffer obtained from allocate(), which may be called on a different thread. size must be the
+    /// size that was passed to allocate(). Thread safe.
+    void deallocate(void* buffer, size_t size);
+
+    /// Free the buffers in the shared cache. Buffers cached by threads are kept until the threads exit.
+    void trim();
+
+private:
+    enum { sizeClassCount = maxPooledSizeShift - minPooledSizeShift + 1 };
+
+    struct ThreadCache {
+        BufferPool* pool;
+        std::vector<void*> buffers[sizeClassCount];
+
+        /// Set while a thread is using this cache. Once the thread exits, the cache's buffers are moved to
+        /// the shared cache and the (empty) cache is handed to the next new thread.
+        bool inUse;
+    };
+
+    /// Returns -1 if buffers of the specified size aren't pooled.
+    static int getSizeClass(size_t size);
+
+    static size_t getSizeClassSize(int sizeClass) { return (size_t)1 << (sizeClass + minPooledSizeShift); }
+
+    static void threadDestroyed(void* cache);
+
+    /// Returns the calling thread's cache, claiming one if necessary.
+    ThreadCache* getThreadCache();
+
+    /// Must be called with the mutex locked.
+    void addToSharedCache(int sizeClass, void* buffer);
+
+    static void freeBuffers(std::vector<void*>& buffers);
+
+    bool _initialised;
+    size_t _threadCacheCount;
+    size_t _sharedCacheCount;
+    ThreadSpecificData _threadCache;
+    Mutex _mutex;
+    std::vector<void*> _shared[sizeClassCount];
+    std::vector<ThreadCache*> _threadCaches;
+
+    PRIME_UNCOPYABLE(BufferPool);
+};
+}
+
+#endif
@@ -1,6 +1,8 @@
 // Copyright 2000-2021 Mark H. P. Lord
 
 #include "ChunkedWriter.h"
+#include "StringUtils.h"
+#include <algorithm>
 
 namespace Prime {
 
@@ -40,21 +42,43 @@ ptrdiff_t ChunkedWriter::writeSome(const void* memory, size_t maximumBytes, Log*
         return 0;
     }
 
-    _needEndWrite = true;
+    ConstIOVector vector;
+    vector.bytes = memory;
+    vector.size = maximumBytes;
 
-    if (!_stream->printf(log, "%" PRIxPTR "\r\n", maximumBytes)) {
-        return -1;
-    }
-    if (!_stream->writeExact(memory, maximumBytes, log)) {
-        return -1;
+    return writeVectored(&vector, 1, log);
+}
+
+ptrdiff_t ChunkedWriter::writeVectored(const ConstIOVector* vectors, size_t vectorCount, Log* log)
+{
+    // Leave room for the chunk header and trailer.
+    vectorCount = PRIME_MIN(vectorCount, (size_t)maxIOVectors - 2);
+
+    size_t chunkSize = getTotalSize(vectors, vectorCount);
+
+    // A zero length chunk would mark the end of the stream.
+    if (chunkSize == 0) {
+        return 0;
     }
-    if (!_stream->printf(log, "\r\n")) {
+
+    _needEndWrite = true;
+
+    FormatBuffer<32> header("%" PRIxPTR "\r\n", chunkSize);
+
+    ConstIOVector chunk[maxIOVectors];
+    chunk[0].bytes = header.c_str();
+    chunk[0].size = header.getLength();
+    std::copy(vectors, vectors + vectorCount, chunk + 1);
+    chunk[vectorCount + 1].bytes = "\r\n";
+    chunk[vectorCount + 1].size = 2;
+
+    if (!_stream->writeVectoredExact(chunk, vectorCount + 2, log)) {
         return -1;
     }
 
-    _bytesWritten += maximumBytes;
+    _bytesWritten += chunkSize;
 
-    return (ptrdiff_t)maximumBytes;
+    return (ptrdiff_t)chunkSize;
 }
 
 bool ChunkedWriter::end(Log* log)
@@ -23,6 +23,11 @@ public:
 
     /// Returns 0 at the end of the stream. It's up to the caller to read any trailing headers.
     virtual ptrdiff_t writeSome(const void* memory, size_t maximumBytes, Log* log) PRIME_OVERRIDE;
+
+    /// Writes all the buffers as a single chunk, with the chunk header and trailer, in one writeVectored() on
+    /// the underlying stream.
+    virtual ptrdiff_t writeVectored(const ConstIOVector* vectors, size_t vectorCount, Log* log) PRIME_OVERRIDE;
+
     virtual bool close(Log* log) PRIME_OVERRIDE;
 
     Offset getBytesWritten() const { return _bytesWritten; }
@@ -3,11 +3,14 @@
 #include "DirectHTTPConnection.h"
 #include "ChunkedReader.h"
 #include "ChunkedWriter.h"
+#include "Clocks.h"
 #include "DirectSocketConnector.h"
 #include "HTTPHeaderBuilder.h"
+#include "SocketStream.h"
 #include "Substream.h"
 #include "UnclosableStream.h"
 #include "UnownedPtr.h"
+#include <algorithm>
 // #include "Spew.h"
 //#include "Spew2.h"
 
@@ -29,6 +32,7 @@ public:
     virtual void setMethod(StringView method) PRIME_OVERRIDE;
     virtual void setRequestHeader(StringView key, StringView value) PRIME_OVERRIDE;
     virtual void setRequestBody(Stream* stream) PRIME_OVERRIDE;
+    virtual void setTimeout(int milliseconds) PRIME_OVERRIDE;
     virtual int sendRequest(Log* log) PRIME_OVERRIDE;
     virtual int getResponseCode() const PRIME_OVERRIDE;
     virtual StringView getResponseCodeText() const PRIME_OVERRIDE;
@@ -54,6 +58,12 @@ private:
 
     bool discardResponse();
 
+    /// Release our buffer without returning it to the pool.
+    void closeBuffer();
+
+    /// Apply the factory's timeouts and our deadline to a new or pooled connection.
+    void applyTimeouts();
+
     RefPtr<Stream> beginWrite(Log* log, int64_t contentLength = -1);
 
     enum SpecialLengths {
@@ -77,6 +87,8 @@ private:
 
     bool _isKeepAlive;
 
+    Timeout _deadline;
+
     HTTPParser _response;
     UnownedPtr<const char> _failed;
     int64_t _responseLength;
@@ -151,11 +163,20 @@ bool DirectHTTPConnectionFactory::Host::operator==(const Host& rhs) const
 DirectHTTPConnectionFactory::DirectHTTPConnectionFactory(int readTimeoutMilliseconds, int writeTimeoutMilliseconds)
 {
     _mutex.init(Log::getGlobal(), "DirectHTTPConnectionFactory mutex");
+    _connectionAvailable.init(&_mutex, Log::getGlobal(), "DirectHTTPConnectionFactory condition");
+
+    _nextTicket = 0;
+
+    _maxIdleConnectionsPerHost = 8;
+    _maxConnectionsPerHost = 0;
+    _idleTimeoutSeconds = 30;
+    _poolWaitTimeoutMilliseconds = 30000;
 
     _maxRedirects = 10;
     _maxRetries = 2;
 
     _connector = PassRef(new DirectSocketConnector(readTimeoutMilliseconds, writeTimeoutMilliseconds));
+    _connector->setAddressCache(PassRef(new SocketAddressCache));
 }
 
 void DirectHTTPConnectionFactory::setSocketConnector(SocketConnector* connector)
@@ -168,35 +189,133 @@ RefPtr<HTTPConnection> DirectHTTPConnectionFactory::createConnection(const URLVi
     return PassRef(new Connection(this, url));
 }
 
+bool DirectHTTPConnectionFactory::waitForConnection(HostPool& pool, Mutex::ScopedLock& lock, Log* log)
+{
+    const uint64_t ticket = ++_nextTicket;
+    pool.waiters.push_back(ticket);
+
+    const double deadline = _poolWaitTimeoutMilliseconds < 0 ? -1.0 : Clock::getMonotonicSeconds() + _poolWaitTimeoutMilliseconds / 1000.0;
+
+    for (;;) {
+        if (pool.waiters.front() == ticket && (!pool.idle.empty() || pool.active < _maxConnectionsPerHost)) {
+            pool.waiters.pop_front();
+
+            // The next waiter may also be able to proceed.
+            if (!pool.waiters.empty()) {
+                _connectionAvailable.wakeAll();
+            }
+
+            return true;
+        }
+
+        if (deadline < 0) {
+            _connectionAvailable.wait(lock);
+            continue;
+        }
+
+        int remainingMilliseconds = (int)((deadline - Clock::getMonotonicSeconds()) * 1000.0);
+        if (remainingMilliseconds <= 0) {
+            pool.waiters.erase(std::find(pool.waiters.begin(), pool.waiters.end(), ticket));
+            _connectionAvailable.wakeAll();
+
+            log->error(PRIME_LOCALISE("Timed out waiting for a connection."));
+            return false;
+        }
+
+        _connectionAvailable.timedWait(lock, remainingMilliseconds);
+    }
+}
+
+void DirectHTTPConnectionFactory::removeExpiredConnections(HostPool& pool, double now,
+    std::vector<RefPtr<StreamBuffer>>& expired)
+{
+    while (!pool.idle.empty() && now - pool.idle.front().idleSince >= _idleTimeoutSeconds) {
+        PRIME_SPEW2("closing idle connection");
+        expired.push_back(PRIME_MOVE(pool.idle.front().buffer));
+        pool.idle.pop_front();
+    }
+}
+
+void DirectHTTPConnectionFactory::removePoolIfUnused(PoolMap::iterator iter)
+{
+    const HostPool& pool = iter->second;
+    if (pool.active == 0 && pool.idle.empty() && pool.waiters.empty()) {
+        _pools.erase(iter);
+    }
+}
+
+bool DirectHTTPConnectionFactory::isConnectionAlive(StreamBuffer* buffer)
+{
+    NetworkStream* networkStream = UIDCast<NetworkStream>(buffer->getUnderlyingStream());
+    if (!networkStream) {
+        return true;
+    }
+
+    // Check the socket itself, since a TLS stream may have nothing to decrypt.
+    NetworkStream* probe = networkStream->getSocketStream();
+    if (!probe) {
+        probe = networkStream;
+    }
+
+    // An idle connection should have nothing to read. If it's readable, the server has closed it (or is
+    // misbehaving).
+    return probe->waitRead(0, Log::getNullLog()) == NetworkStream::WaitResultTimedOut;
+}
+
 RefPtr<StreamBuffer> DirectHTTPConnectionFactory::connect(const URLView& url, bool& isKeepAlive, Log* log)
 {
+    isKeepAlive = false;
+
     // Check the pool.
     if (_mutex.isInitialised()) {
-        RecursiveMutex::ScopedLock lock(&_mutex);
-
         Host find(url);
-        if (find.port != -1) {
-            KeepAlivesMap::iterator iter = _keepAlives.find(find);
+        std::vector<RefPtr<StreamBuffer>> expired;
 
-            if (iter != _keepAlives.end()) {
-                RefPtr<StreamBuffer> stream = PRIME_MOVE(iter->second);
+        Mutex::ScopedLock lock(&_mutex);
 
-                PRIME_SPEW2("%s: reusing connection", iter->first.host.c_str());
-                _keepAlives.erase(iter);
+        PoolMap::iterator iter = _pools.insert(PoolMap::value_type(PRIME_MOVE(find), HostPool())).first;
+        HostPool& pool = iter->second;
 
+        if (_maxConnectionsPerHost > 0 && !waitForConnection(pool, lock, log)) {
+            removePoolIfUnused(iter);
+            return NULL;
+        }
+
+        while (!pool.idle.empty()) {
+            removeExpiredConnections(pool, Clock::getMonotonicSeconds(), expired);
+            if (pool.idle.empty()) {
+                break;
+            }
+
+            RefPtr<StreamBuffer> stream = PRIME_MOVE(pool.idle.back().buffer);
+            pool.idle.pop_back();
+            ++pool.active;
+
+            lock.unlock();
+
+            if (isConnectionAlive(stream)) {
+                PRIME_SPEW2("%s: reusing connection", iter->first.host.c_str());
                 isKeepAlive = true;
                 return stream;
             }
+
+            PRIME_SPEW2("%s: pooled connection was closed by the server", iter->first.host.c_str());
+            stream.release();
+
+            lock.lock(&_mutex);
+            --pool.active;
         }
-    }
 
-    isKeepAlive = false;
+        // Reserve a slot for the new connection. If the connection fails, connectionClosed() gives it back.
+        ++pool.active;
+    }
 
     const bool isHTTPS = StringsEqual(url.getProtocol(), "https");
     const int defaultPort = isHTTPS ? 443 : 80;
 
     RefPtr<NetworkStream> networkStream = _connector->connect(url.getHostWithPort().c_str(), defaultPort, log);
     if (!networkStream) {
+        connectionClosed(url);
         return NULL;
     }
 
@@ -205,11 +324,14 @@ RefPtr<StreamBuffer> DirectHTTPConnectionFactory::connect(const URLView& url, bo
     if (isHTTPS) {
         if (!_sslCallback) {
             log->error(PRIME_LOCALISE("HTTPS not available."));
+            connectionClosed(url);
             return NULL;
         }
 
-        streamToBuffer = _sslCallback(networkStream, log);
+        std::string hostName(url.getHost().begin(), url.getHost().end());
+        streamToBuffer = _sslCallback(networkStream, hostName.c_str(), ToInt(url.getPort(), defaultPort), log);
         if (!streamToBuffer) {
+            connectionClosed(url);
             return NULL;
         }
     }
@@ -226,8 +348,10 @@ RefPtr<StreamBuffer> DirectHTTPConnectionFactory::connect(const URLView& url, bo
 #endif
 
     RefPtr<StreamBuffer> buffer = PassRef(new StreamBuffer);
+    buffer->setBufferPool(BufferPool::getGlobal());
     if (!buffer->init(streamToBuffer, bufferSize)) {
         log->error(PRIME_LOCALISE("Couldn't allocate buffer."));
+        connectionClosed(url);
         return NULL;
     }
 
@@ -240,21 +364,95 @@ void DirectHTTPConnectionFactory::returnToPool(const URLView& url, StreamBuffer*
         return;
     }
 
-    if (!PRIME_GUARD(stream->getReadPointer() == stream->getTopPointer())) {
+    if (!PRIME_GUARD(stream->getReadPointer() == stream->getTopPointer()) || !PRIME_GUARD(!stream->isDirty())) {
+        connectionClosed(url);
         return;
     }
 
-    if (!PRIME_GUARD(!stream->isDirty())) {
+    std::vector<RefPtr<StreamBuffer>> expired;
+
+    Mutex::ScopedLock lock(&_mutex);
+    PRIME_SPEW2("%s: returning connection to pool", url.getHost().c_str());
+
+    PoolMap::iterator iter = _pools.find(Host(url));
+    if (!PRIME_GUARD(iter != _pools.end())) {
         return;
     }
 
-    RecursiveMutex::ScopedLock lock(&_mutex);
-    PRIME_SPEW2("%s: returning connection to pool", url.getHost().c_str());
+    HostPool& pool = iter->second;
+    --pool.active;
+
+    double now = Clock::getMonotonicSeconds();
+    removeExpiredConnections(pool, now, expired);
+
+    if (iter->first.port >= 0 && (int)pool.idle.size() < _maxIdleConnectionsPerHost) {
+        IdleConnection idle;
+        idle.buffer = stream;
+        idle.idleSince = now;
+        pool.idle.push_back(PRIME_MOVE(idle));
+    }
+
+    if (!pool.waiters.empty()) {
+        _connectionAvailable.wakeAll();
+    }
+
+    removePoolIfUnused(iter);
+}
+
+void DirectHTTPConnectionFactory::connectionClosed(const URLView& url)
+{
+    if (!_mutex.isInitialised()) {
+        return;
+    }
 
-    Host host(url);
-    if (host.port >= 0) {
-        _keepAlives.insert(KeepAlivesMap::value_type(host, stream));
+    Mutex::ScopedLock lock(&_mutex);
+
+    PoolMap::iterator iter = _pools.find(Host(url));
+    if (!PRIME_GUARD(iter != _pools.end())) {
+        return;
+    }
+
+    --iter->second.active;
+
+    if (!iter->second.waiters.empty()) {
+        _connectionAvailable.wakeAll();
     }
+
+    removePoolIfUnused(iter);
+}
+
+void DirectHTTPConnectionFactory::closeIdleConnections()
+{
+    std::vector<RefPtr<StreamBuffer>> idle;
+
+    Mutex::ScopedLock lock(&_mutex);
+
+    PoolMap::iterator iter = _pools.begin();
+    while (iter != _pools.end()) {
+        HostPool& pool = iter->second;
+        for (size_t i = 0; i != pool.idle.size(); ++i) {
+            idle.push_back(PRIME_MOVE(pool.idle[i].buffer));
+        }
+        pool.idle.clear();
+
+        if (!pool.waiters.empty()) {
+            _connectionAvailable.wakeAll();
+        }
+
+        removePoolIfUnused(iter++);
+    }
+}
+
+size_t DirectHTTPConnectionFactory::getIdleConnectionCount() const
+{
+    Mutex::ScopedLock lock(&_mutex);
+
+    size_t count = 0;
+    for (PoolMap::const_iterator iter = _pools.begin(); iter != _pools.end(); ++iter) {
+        count += iter->second.idle.size();
+    }
+
+    return count;
 }
 
 //
@@ -268,6 +466,7 @@ DirectHTTPConnectionFactory::Connection::Connection(DirectHTTPConnectionFactory*
     _requestLength = SpecialLengthInvalid;
     _requestSent = false;
     _disconnect = false;
+    _deadline.set(-1);
     _failed.reset(NULL);
 
     _request.setURL(url);
@@ -299,10 +498,25 @@ void DirectHTTPConnectionFactory::Connection::close()
 
         if (!_disconnect) {
             _factory->returnToPool(_request.getURL(), _buffer);
+            _buffer.release();
+            return;
         }
     }
 
+    closeBuffer();
+}
+
+void DirectHTTPConnectionFactory::Connection::closeBuffer()
+{
+    if (!_buffer) {
+        return;
+    }
+
     _buffer.release();
+
+    if (_factory) {
+        _factory->connectionClosed(_request.getURL());
+    }
 }
 
 bool DirectHTTPConnectionFactory::Connection::discardResponse()
@@ -366,6 +580,28 @@ void DirectHTTPConnectionFactory::Connection::setRequestBody(Stream* stream)
     _requestBody = stream;
 }
 
+void DirectHTTPConnectionFactory::Connection::setTimeout(int milliseconds)
+{
+    _deadline.set(milliseconds);
+
+    if (_buffer) {
+        applyTimeouts();
+    }
+}
+
+void DirectHTTPConnectionFactory::Connection::applyTimeouts()
+{
+    NetworkStream* networkStream = UIDCast<NetworkStream>(_buffer->getUnderlyingStream());
+    if (!networkStream) {
+        return;
+    }
+
+    // A pooled connection may still have the deadline of the request that last used it.
+    networkStream->setReadTimeout(_factory->getReadTimeout());
+    networkStream->setWriteTimeout(_factory->getWriteTimeout());
+    networkStream->setDeadline(_deadline);
+}
+
 bool DirectHTTPConnectionFactory::Connection::beginRequest(Log* log)
 {
     PRIME_ASSERT(!_requestSent);
@@ -404,9 +640,12 @@ bool DirectHTTPConnectionFactory::Connection::beginRequest(Log* log)
             return false;
         }
 
+        applyTimeouts();
+
         if (!_request.send(_buffer, log) || !_buffer->flushWrites(log)) {
             if (_isKeepAlive) {
                 log->trace("Unable to send request on keep-alive connection, retrying with another connection...");
+                closeBuffer();
                 goto try_another_connection;
             }
 
@@ -509,7 +748,7 @@ int DirectHTTPConnectionFactory::Connection::sendRequest(Log* log)
                     ++retryCount;
                 }
 
-                _buffer.release();
+                closeBuffer();
 
                 if (prepareToResend(log)) {
                     continue;
@@ -3,6 +3,7 @@
 #ifndef PRIME_DIRECTHTTPCONNECTION_H
 #define PRIME_DIRECTHTTPCONNECTION_H
 
+#include "Condition.h"
 #include "HTTPConnection.h"
 #include "Mutex.h"
 #include "URL.h"
@@ -11,6 +12,7 @@
 #endif
 #include "SocketConnector.h"
 #include "StreamBuffer.h"
+#include <deque>
 #include <functional>
 #include <map>
 
@@ -22,7 +24,10 @@
 namespace Prime {
 
 /// An HTTPConnectionFactory whose HTTPConnection connects to the server using a SocketConnector, bypassing
-/// any OS specific services.
+/// any OS specific services. Keep-alive connections are pooled per host (protocol, host and port): idle
+/// connections are reused most recently used first, are closed once they've been idle for too long and are
+/// checked to still be open before being reused. The number of connections to each host can be limited, in
+/// which case requests wait their turn for a connection.
 class PRIME_PUBLIC DirectHTTPConnectionFactory : public HTTPConnectionFactory {
 public:
     explicit DirectHTTPConnectionFactory(int readTimeoutMilliseconds = -1, int writeTimeoutMilliseconds = -1);
@@ -42,14 +47,41 @@ public:
 
     void setSocketConnector(SocketConnector* connector);
 
+    /// Keep at most this many idle connections to each host (default 8). Zero disables connection reuse.
+    int getMaxIdleConnectionsPerHost() const { return _maxIdleConnectionsPerHost; }
+    void setMaxIdleConnectionsPerHost(int value) { _maxIdleConnectionsPerHost = value; }
+
+    /// Limit the number of connections, in use or idle, to each host. Once the limit is reached, requests wait
+    /// (in the order they arrived) for a connection to be returned to the pool or closed. Zero (the default)
+    /// means no limit.
+    int getMaxConnectionsPerHost() const { return _maxConnectionsPerHost; }
+    void setMaxConnectionsPerHost(int value) { _maxConnectionsPerHost = value; }
+
+    /// Idle connections are closed rather than reused after this long (default 30 seconds), since the server
+    /// has probably timed them out.
+    double getIdleTimeoutSeconds() const { return _idleTimeoutSeconds; }
+    void setIdleTimeoutSeconds(double value) { _idleTimeoutSeconds = value; }
+
+    /// How long to wait for a connection when the host is at its connection limit. -1 waits forever. The
+    /// default is 30 seconds.
+    int getPoolWaitTimeout() const { return _poolWaitTimeoutMilliseconds; }
+    void setPoolWaitTimeout(int milliseconds) { _poolWaitTimeoutMilliseconds = milliseconds; }
+
+    /// Close all the idle connections in the pool.
+    void closeIdleConnections();
+
+    /// Returns the number of idle connections in the pool.
+    size_t getIdleConnectionCount() const;
+
     int getReadTimeout() const { return _connector->getReadTimeout(); }
     int getWriteTimeout() const { return _connector->getWriteTimeout(); }
 
-/// The callback should wrap the raw Stream with an OpenSSLStream.
+/// The callback should wrap the raw Stream with an OpenSSLStream. It's given the host name and port being
+/// connected to, for the TLS server name and so that sessions can be resumed.
 #ifdef PRIME_CXX11_STL
-    typedef std::function<RefPtr<Stream>(Stream*, Log*)> SSLCallback;
+    typedef std::function<RefPtr<Stream>(Stream*, const char*, int, Log*)> SSLCallback;
 #else
-    typedef Callback2<RefPtr<Stream>, Stream*, Log*> SSLCallback;
+    typedef Callback4<RefPtr<Stream>, Stream*, const char*, int, Log*> SSLCallback;
 #endif
 
     const SSLCallback& getSSLCallback() const
@@ -71,8 +103,12 @@ protected:
 
     virtual RefPtr<StreamBuffer> connect(const URLView& url, bool& isKeepAlive, Log* log);
 
+    /// Called when a connection returned by connect() has finished its response and can be reused.
     virtual void returnToPool(const URLView& url, StreamBuffer* stream);
 
+    /// Called when a connection returned by connect() has been closed, or won't be reused.
+    virtual void connectionClosed(const URLView& url);
+
 private:
     struct Host {
         std::string host;
@@ -96,10 +132,55 @@ private:
         PRIME_IMPLIED_COMPARISONS_OPERATORS(const Host&)
     };
 
-    typedef std::multimap<Host, RefPtr<StreamBuffer>> KeepAlivesMap;
-    KeepAlivesMap _keepAlives;
+    struct IdleConnection {
+        RefPtr<StreamBuffer> buffer;
+        double idleSince;
+    };
+
+    struct HostPool {
+        /// Oldest at the front.
+        std::deque<IdleConnection> idle;
+
+        /// Connections handed out by connect() and not yet returned or closed.
+        int active;
+
+        /// Tickets of the threads waiting for a connection, in the order they started waiting.
+        std::deque<uint64_t> waiters;
+
+        HostPool()
+            : active(0)
+        {
+        }
+    };
+
+    typedef std::map<Host, HostPool> PoolMap;
+
+    /// Wait for this thread's turn to take a connection from (or open a new connection to) the host. Returns
+    /// false on timeout.
+    bool waitForConnection(HostPool& pool, Mutex::ScopedLock& lock, Log* log);
+
+    /// Remove the connections that have been idle too long. The caller should release them after unlocking.
+    void removeExpiredConnections(HostPool& pool, double now, std::vector<RefPtr<StreamBuffer>>& expired);
+
+    /// Remove the pool if it's no longer tracking anything.
+    void removePoolIfUnused(PoolMap::iterator iter);
+
+    /// Returns false if the server has closed the connection, or sent something unexpected, while it was idle.
+    static bool isConnectionAlive(StreamBuffer* buffer);
+
+    PoolMap _pools;
+
+    /// Protects _pools.
+    mutable Mutex _mutex;
+
+    Condition _connectionAvailable;
+
+    uint64_t _nextTicket;
 
-    RecursiveMutex _mutex;
+    int _maxIdleConnectionsPerHost;
+    int _maxConnectionsPerHost;
+    double _idleTimeoutSeconds;
+    int _poolWaitTimeoutMilliseconds;
 
     int _maxRedirects;
     int _maxRetries;
@@ -1,8 +1,11 @@
 // Copyright 2000-2021 Mark H. P. Lord
 
 #include "DirectSocketConnector.h"
+#include "Clocks.h"
+#include "ScopedPtr.h"
 #include "SocketAddressParser.h"
 #include "SocketStream.h"
+#include <algorithm>
 
 namespace Prime {
 
@@ -10,6 +13,7 @@ PRIME_DEFINE_UID_CAST(DirectSocketConnector)
 
 DirectSocketConnector::DirectSocketConnector(int readTimeoutMilliseconds, int writeTimeoutMilliseconds)
     : SocketConnector(readTimeoutMilliseconds, writeTimeoutMilliseconds)
+    , _connectionAttemptDelay(250)
 {
 }
 
@@ -23,14 +27,185 @@ RefPtr<NetworkStream> DirectSocketConnector::connect(const char* hostname, int d
 
     RefPtr<SocketStream> socketStream = PassRef(new SocketStream(getReadTimeout(), getWriteTimeout()));
 
-    SocketAddress addr;
-    if (!sap.createAndConnectSocket(socketStream->accessSocket(), sap.getPort(defaultPort), SOCK_STREAM, IPPROTO_TCP,
-            Socket::Options(), getReadTimeout(), log, &addr)) {
-        // log->error(PRIME_LOCALISE("Couldn't connect to server: %s"), hostWithPort.c_str());
+    if (sap.getResult() != SocketAddressParser::ResultHostName) {
+        // There's only one address to try.
+        SocketAddress addr;
+        if (!sap.createAndConnectSocket(socketStream->accessSocket(), sap.getPort(defaultPort), SOCK_STREAM, IPPROTO_TCP,
+                Socket::Options(), getReadTimeout(), log, &addr)) {
+            // log->error(PRIME_LOCALISE("Couldn't connect to server: %s"), hostWithPort.c_str());
+            return NULL;
+        }
+
+        return socketStream;
+    }
+
+    std::vector<SocketAddress::AddressInfo> addresses;
+    if (!resolve(addresses, sap.getHostName(), sap.getPort(defaultPort), SOCK_STREAM, IPPROTO_TCP, log)) {
+        return NULL;
+    }
+
+    sortAddressesForConnecting(addresses);
+
+    if (addresses.empty() || !connectToFirst(socketStream->accessSocket(), addresses, log)) {
         return NULL;
     }
 
     return socketStream;
 }
 
+void DirectSocketConnector::sortAddressesForConnecting(std::vector<SocketAddress::AddressInfo>& addresses)
+{
+    std::vector<SocketAddress::AddressInfo> first;
+    std::vector<SocketAddress::AddressInfo> second;
+
+    for (size_t i = 0; i != addresses.size(); ++i) {
+        const SocketAddress::AddressInfo& ai = addresses[i];
+
+        bool duplicate = false;
+        for (size_t j = 0; j != i; ++j) {
+            if (addresses[j].address == ai.address) {
+                duplicate = true;
+                break;
+            }
+        }
+
+        if (!duplicate) {
+            (ai.address.getFamily() == addresses[0].address.getFamily() ? first : second).push_back(ai);
+        }
+    }
+
+    addresses.clear();
+
+    for (size_t i = 0; i != std::max(first.size(), second.size()); ++i) {
+        if (i < first.size()) {
+            addresses.push_back(first[i]);
+        }
+        if (i < second.size()) {
+            addresses.push_back(second[i]);
+        }
+    }
+}
+
+bool DirectSocketConnector::connectToFirst(Socket& socket, const std::vector<SocketAddress::AddressInfo>& addresses,
+    Log* log)
+{
+    // The attempts' errors are expected, so only the last is reported.
+    Log* attemptLog = Log::getNullLog();
+
+    const size_t count = addresses.size();
+    ScopedArrayPtr<Socket> attempts(new Socket[count]);
+    std::vector<Socket::SelectSocket> writes;
+    std::vector<Socket::SelectSocket> errors;
+    std::vector<size_t> waitingFor;
+
+    const int timeout = getReadTimeout();
+    const double deadline = timeout < 0 ? -1.0 : Clock::getMonotonicSeconds() + timeout / 1000.0;
+    double nextAttemptTime = 0;
+    size_t next = 0;
+    size_t inProgress = 0;
+    SocketSupport::ErrorCode lastError = 0;
+
+    for (;;) {
+        double now = Clock::getMonotonicSeconds();
+
+        // Start the next attempt if it's due, or straight away if nothing else is in progress.
+        if (next != count && (inProgress == 0 || now >= nextAttemptTime)) {
+            const SocketAddress::AddressInfo& ai = addresses[next];
+            Socket& attempt = attempts[next];
+            ++next;
+
+            bool connected = false;
+            if (!attempt.createForAddress(ai.address, ai.socketType, ai.protocol, attemptLog, Socket::Options())
+                || !attempt.setNonBlocking(true, attemptLog)
+                || !attempt.beginNonBlockingConnect(ai.address, connected, attemptLog)) {
+                lastError = attempt.getLastError();
+                attempt.close(attemptLog);
+                continue;
+            }
+
+            if (connected) {
+                socket.takeOwnership(attempt);
+                break;
+            }
+
+            ++inProgress;
+            nextAttemptTime = now + _connectionAttemptDelay / 1000.0;
+            continue;
+        }
+
+        if (inProgress == 0) {
+            SocketSupport::logSocketError(log, lastError);
+            return false;
+        }
+
+        // Wait for an attempt to finish, for the next attempt to be due or for the timeout.
+        int waitMilliseconds = -1;
+        if (next != count) {
+            waitMilliseconds = std::max(0, (int)((nextAttemptTime - now) * 1000.0 + 0.5));
+        }
+
+        if (deadline >= 0) {
+            int remainingMilliseconds = (int)((deadline - now) * 1000.0 + 0.5);
+            if (remainingMilliseconds <= 0) {
+                SocketSupport::logSocketError(log, ETIMEDOUT);
+                return false;
+            }
+
+            if (waitMilliseconds < 0 || remainingMilliseconds < waitMilliseconds) {
+                waitMilliseconds = remainingMilliseconds;
+            }
+        }
+
+        writes.clear();
+        errors.clear();
+        waitingFor.clear();
+        for (size_t i = 0; i != next; ++i) {
+            if (attempts[i].isCreated()) {
+                Socket::SelectSocket selectSocket = { &attempts[i], false };
+                writes.push_back(selectSocket);
+                errors.push_back(selectSocket);
+                waitingFor.push_back(i);
+            }
+        }
+
+        Socket::SelectSocket terminator = { NULL, false };
+        writes.push_back(terminator);
+        errors.push_back(terminator);
+
+        Socket::WaitResult waitResult = socket.select(waitMilliseconds, NULL, &writes[0], &errors[0], log);
+        if (waitResult == Socket::WaitResultTimedOut) {
+            continue;
+        }
+
+        if (waitResult != Socket::WaitResultOK) {
+            return false;
+        }
+
+        for (size_t i = 0; i != waitingFor.size(); ++i) {
+            if (!writes[i].isSet && !errors[i].isSet) {
+                continue;
+            }
+
+            Socket& attempt = attempts[waitingFor[i]];
+
+            if (attempt.finishNonBlockingConnect(attemptLog)) {
+                socket.takeOwnership(attempt);
+                break;
+            }
+
+            // Don't wait for the delay before trying the next address.
+            lastError = attempt.getLastError();
+            attempt.close(attemptLog);
+            --inProgress;
+            nextAttemptTime = now;
+        }
+
+        if (socket.isCreated()) {
+            break;
+        }
+    }
+
+    // The other attempts are closed when attempts is destroyed.
+    return socket.setNonBlocking(false, log);
+}
 }
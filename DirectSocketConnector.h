@@ -3,10 +3,19 @@
 #ifndef PRIME_DIRECTSOCKETCONNECTOR_H
 #define PRIME_DIRECTSOCKETCONNECTOR_H
 
+#include "SocketAddress.h"
 #include "SocketConnector.h"
+#include <vector>
 
 namespace Prime {
 
+class Socket;
+
+/// A SocketConnector that connects directly to the host. When a host name resolves to more than one address,
+/// connection attempts are staggered across the addresses, alternating between address families, in the style
+/// of RFC 8305 ("Happy Eyeballs"): if an attempt hasn't succeeded after the connection attempt delay, the next
+/// address is tried without abandoning the first, and the first connection to succeed is used. A broken IPv6
+/// (or IPv4) route therefore costs the delay rather than the whole connect timeout.
 class PRIME_PUBLIC DirectSocketConnector : public SocketConnector {
     PRIME_DECLARE_UID_CAST(SocketConnector, 0xfec7f74e, 0x1cdb45d7, 0xbb539725, 0xe7641917)
 
@@ -14,6 +23,20 @@ public:
     explicit DirectSocketConnector(int readTimeoutMilliseconds = -1, int writeTimeoutMilliseconds = -1);
 
     virtual RefPtr<NetworkStream> connect(const char* hostname, int defaultPort, Log* log) PRIME_OVERRIDE;
+
+    /// How long to wait for a connection attempt before also trying the next address. RFC 8305 recommends
+    /// 250 milliseconds, which is the default.
+    void setConnectionAttemptDelay(int milliseconds) { _connectionAttemptDelay = milliseconds; }
+    int getConnectionAttemptDelay() const { return _connectionAttemptDelay; }
+
+    /// Remove duplicates and interleave the address families, starting with the family of the first address.
+    static void sortAddressesForConnecting(std::vector<SocketAddress::AddressInfo>& addresses);
+
+private:
+    /// Connect to whichever address accepts a connection first. The read timeout applies to the whole process.
+    bool connectToFirst(Socket& socket, const std::vector<SocketAddress::AddressInfo>& addresses, Log* log);
+
+    int _connectionAttemptDelay;
 };
 }
 
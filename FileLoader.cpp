@@ -11,8 +11,22 @@ namespace Prime {
 
 bool FileLoader::load(const char* path, Log* log)
 {
+    reset();
+
     PrefixLog prefixLog(log, path);
 
+#ifdef PRIME_HAVE_MAPPEDFILESTREAM
+    if (_useMapping) {
+        // If the file can't be mapped, read it, which will report any error. Files in /proc and the like claim
+        // to be empty, so empty files are read too.
+        RefPtr<MappedFileStream> mappedFile = PassRef(new MappedFileStream);
+        if (mappedFile->open(path, Log::getNullLog()) && mappedFile->getMappedSize() != 0) {
+            _mappedFile = mappedFile;
+            return true;
+        }
+    }
+#endif
+
     FileStream file;
     if (!file.openForRead(path, prefixLog)) {
         return false;
@@ -29,6 +43,8 @@ bool FileLoader::loadSupportingStdin(const char* path, Log* log)
         return load(path, log);
     }
 
+    _mappedFile.release();
+
     PrefixLog prefixLog(log, "<stdin>");
 
     StdioStream stdio(stdin, false);
@@ -3,19 +3,29 @@
 #ifndef PRIME_FILELOADER_H
 #define PRIME_FILELOADER_H
 
+#include "MappedFileStream.h"
 #include "StreamLoader.h"
 
 #define PRIME_FILELOADER_SUPPORT_STDIN
 
 namespace Prime {
 
-/// Loads a file from the OS file system in to a std::string.
+/// Loads a file from the OS file system in to a std::string, or maps it in to memory.
 class PRIME_PUBLIC FileLoader {
 public:
     FileLoader() PRIME_NOEXCEPT
+        : _useMapping(false)
     {
     }
 
+    /// If enabled, load() maps regular files in to memory (with a MappedFileStream) rather than reading them, so
+    /// large files aren't copied and don't need to fit in the heap. Mapped bytes are read only, so use
+    /// getReadOnlyBytes() or getView(); getBytes(), begin(), end(), getString() and c_str() can't be
+    /// used. Files that can't be mapped (e.g., pipes) are read as usual.
+    void setUseMapping(bool value) PRIME_NOEXCEPT { _useMapping = value; }
+
+    bool getUseMapping() const PRIME_NOEXCEPT { return _useMapping; }
+
     /// Load the contents of a file in to an internal buffer.
     bool load(const char* path, Log* log);
 
@@ -25,30 +35,66 @@ public:
 #endif
 
     /// Free the loaded data and reset the size to zero.
-    void reset() PRIME_NOEXCEPT { _loader.reset(); }
+    void reset() PRIME_NOEXCEPT
+    {
+        _loader.reset();
+        _mappedFile.release();
+    }
 
     /// Returns true if something has been loaded.
-    bool isLoaded() const PRIME_NOEXCEPT { return _loader.isLoaded(); }
+    bool isLoaded() const PRIME_NOEXCEPT { return _mappedFile.get() || _loader.isLoaded(); }
 
     /// Returns true if we haven't loaded anything.
-    bool operator!() const PRIME_NOEXCEPT { return _loader.operator!(); }
+    bool operator!() const PRIME_NOEXCEPT { return !isLoaded(); }
+
+    /// Returns true if the file was mapped rather than read.
+    bool isMapped() const PRIME_NOEXCEPT { return _mappedFile.get() != NULL; }
+
+    /// Returns the mapping if the file was mapped rather than read, e.g., to pass to TextReader::setText().
+    MappedFileStream* getMappedFile() const PRIME_NOEXCEPT { return _mappedFile.get(); }
+
+    /// Returns a pointer to the bytes that were loaded, which may be modified. Can't be used if the file was
+    /// mapped, since the mapping is read only (use getReadOnlyBytes() or getView()).
+    char* getBytes() const PRIME_NOEXCEPT
+    {
+        PRIME_ASSERT(!_mappedFile);
+        return _loader.getBytes();
+    }
 
-    /// Returns a pointer to the bytes that were loaded.
-    char* getBytes() const PRIME_NOEXCEPT { return _loader.getBytes(); }
+    /// Returns a pointer to the bytes that were loaded, whether or not the file was mapped.
+    const char* getReadOnlyBytes() const PRIME_NOEXCEPT { return _mappedFile ? _mappedFile->getBytes() : _loader.getBytes(); }
 
     /// Returns the number of bytes that were loaded.
-    size_t getSize() const PRIME_NOEXCEPT { return _loader.getSize(); }
+    size_t getSize() const PRIME_NOEXCEPT { return _mappedFile ? _mappedFile->getMappedSize() : _loader.getSize(); }
 
-    char* begin() const PRIME_NOEXCEPT { return _loader.begin(); }
-    char* end() const PRIME_NOEXCEPT { return _loader.end(); }
+    /// As with getBytes(), these can't be used if the file was mapped.
+    char* begin() const PRIME_NOEXCEPT { return getBytes(); }
+    char* end() const PRIME_NOEXCEPT { return getBytes() + getSize(); }
 
-    const std::string& getString() const PRIME_NOEXCEPT { return _loader.getString(); }
-    std::string& getString() PRIME_NOEXCEPT { return _loader.getString(); }
+    StringView getView() const PRIME_NOEXCEPT { return StringView(getReadOnlyBytes(), getReadOnlyBytes() + getSize()); }
 
-    const char* c_str() const PRIME_NOEXCEPT { return _loader.c_str(); }
+    const std::string& getString() const PRIME_NOEXCEPT
+    {
+        PRIME_ASSERT(!_mappedFile);
+        return _loader.getString();
+    }
+
+    std::string& getString() PRIME_NOEXCEPT
+    {
+        PRIME_ASSERT(!_mappedFile);
+        return _loader.getString();
+    }
+
+    const char* c_str() const PRIME_NOEXCEPT
+    {
+        PRIME_ASSERT(!_mappedFile);
+        return _loader.c_str();
+    }
 
 private:
     StreamLoader _loader;
+    RefPtr<MappedFileStream> _mappedFile;
+    bool _useMapping;
 
     PRIME_UNCOPYABLE(FileLoader);
 };
@@ -2,7 +2,9 @@
 
 #include "HTTP.h"
 #include "NumberParsing.h"
+#include "NumberUtils.h"
 #include "StringUtils.h"
+#include <algorithm>
 
 // This needs to be 0 (lenient) in real world use
 #define STRICT_COOKIES 0
@@ -100,6 +102,142 @@ bool HTTPSkip(StringView text, StringView skip, StringView& remainingText)
     return false;
 }
 
+//
+// HTTP byte ranges
+//
+
+namespace {
+
+const size_t maxByteRangeSpecs = 64;
+
+bool ParseByteRangeNumber(const char*& ptr, const char* end, int64_t& number)
+{
+    const char* start = ptr;
+    int64_t value = 0;
+
+    for (; ptr != end && *ptr >= '0' && *ptr <= '9'; ++ptr) {
+        if (value > (INT64_MAX - 9) / 10) {
+            return false;
+        }
+
+        value = value * 10 + (*ptr - '0');
+    }
+
+    if (ptr == start) {
+        return false;
+    }
+
+    number = value;
+    return true;
+}
+
+bool CompareByteRanges(const HTTPByteRange& a, const HTTPByteRange& b)
+{
+    return a.first < b.first;
+}
+}
+
+bool HTTPParseByteRanges(StringView header, int64_t size, std::vector<HTTPByteRange>& ranges)
+{
+    ranges.clear();
+
+    const char* end = header.end();
+    const char* ptr = ASCIISkipWhitespace(header.begin(), end);
+
+    if (!ASCIIStartsWithIgnoringCase(StringView(ptr, end), "bytes=")) {
+        return false;
+    }
+
+    ptr += 6;
+
+    size_t specCount = 0;
+
+    for (;;) {
+        ptr = ASCIISkipWhitespace(ptr, end);
+        if (ptr == end) {
+            break;
+        }
+
+        if (*ptr == ',') {
+            ++ptr;
+            continue;
+        }
+
+        if (++specCount > maxByteRangeSpecs) {
+            return false;
+        }
+
+        HTTPByteRange range;
+        bool satisfiable;
+
+        if (*ptr == '-') {
+            // suffix-byte-range-spec, e.g., "-500" for the last 500 bytes.
+            ++ptr;
+            int64_t suffixLength;
+            if (!ParseByteRangeNumber(ptr, end, suffixLength)) {
+                return false;
+            }
+
+            satisfiable = suffixLength != 0 && size != 0;
+            range.first = Max<int64_t>(size - suffixLength, 0);
+            range.last = size - 1;
+        } else {
+            if (!ParseByteRangeNumber(ptr, end, range.first)) {
+                return false;
+            }
+
+            ptr = ASCIISkipWhitespace(ptr, end);
+            if (ptr == end || *ptr != '-') {
+                return false;
+            }
+
+            ptr = ASCIISkipWhitespace(ptr + 1, end);
+            if (ptr != end && *ptr >= '0' && *ptr <= '9') {
+                if (!ParseByteRangeNumber(ptr, end, range.last) || range.last < range.first) {
+                    return false;
+                }
+
+                range.last = Min<int64_t>(range.last, size - 1);
+            } else {
+                range.last = size - 1;
+            }
+
+            satisfiable = range.first < size;
+        }
+
+        if (satisfiable) {
+            ranges.push_back(range);
+        }
+
+        ptr = ASCIISkipWhitespace(ptr, end);
+        if (ptr != end && *ptr != ',') {
+            return false;
+        }
+    }
+
+    if (!specCount) {
+        return false;
+    }
+
+    // Merge overlapping and adjacent ranges so a client can't make us send the same bytes over and over.
+    std::sort(ranges.begin(), ranges.end(), CompareByteRanges);
+
+    size_t merged = 0;
+    for (size_t i = 1; i < ranges.size(); ++i) {
+        if (ranges[i].first <= ranges[merged].last + 1) {
+            ranges[merged].last = Max(ranges[merged].last, ranges[i].last);
+        } else {
+            ranges[++merged] = ranges[i];
+        }
+    }
+
+    if (!ranges.empty()) {
+        ranges.resize(merged + 1);
+    }
+
+    return true;
+}
+
 //
 // HTTP methods
 //
@@ -4,6 +4,7 @@
 #define PRIME_HTTP_H
 
 #include "StringView.h"
+#include <vector>
 
 namespace Prime {
 
@@ -29,6 +30,24 @@ PRIME_PUBLIC std::string HTTPParseTokenOrQuotedString(StringView text, StringVie
 
 PRIME_PUBLIC bool HTTPSkip(StringView text, StringView skip, StringView& remainingText);
 
+//
+// HTTP byte ranges
+//
+
+/// An inclusive range of bytes, as specified by a Range header.
+struct HTTPByteRange {
+    int64_t first;
+    int64_t last;
+
+    int64_t getLength() const { return last - first + 1; }
+};
+
+/// Parse the value of a Range header for a representation of the specified size. Returns false if the header is
+/// not a valid "bytes" range set or specifies an excessive number of ranges, in which case the header should be
+/// ignored. Otherwise, fills ranges with the satisfiable ranges clamped to size, sorted and with any that overlap
+/// or are adjacent merged. If ranges is empty on return then the range is not satisfiable (416).
+PRIME_PUBLIC bool HTTPParseByteRanges(StringView header, int64_t size, std::vector<HTTPByteRange>& ranges);
+
 //
 // HTTP methods
 //
@@ -1,6 +1,7 @@
 // Copyright 2000-2021 Mark H. P. Lord
 
 #include "HTTPConnection.h"
+#include "Clocks.h"
 #include "StringStream.h"
 #include <algorithm>
 
@@ -14,6 +15,204 @@ HTTPConnectionFactory::~HTTPConnectionFactory()
 {
 }
 
+HTTPConnectionFactory::BatchRequest::BatchRequest()
+    : method("GET")
+    , timeoutMilliseconds(-1)
+{
+}
+
+HTTPConnectionFactory::BatchRequest::BatchRequest(const URLView& url, StringView method)
+    : url(url)
+    , method(method.begin(), method.end())
+    , timeoutMilliseconds(-1)
+{
+}
+
+HTTPConnectionFactory::BatchResult::BatchResult()
+    : responseCode(HTTPConnection::invalidHTTPResponseCode)
+    , seconds(0)
+{
+}
+
+/// The state shared by the workers making a batch of requests. Each worker takes the next request until there
+/// are none left, so at most one request per worker is in progress.
+class HTTPConnectionFactory::Batch : public RefCounted {
+public:
+    Batch(HTTPConnectionFactory* factory, const std::vector<BatchRequest>& requests, TaskQueue* queue, Log* log)
+        : _factory(factory)
+        , _requests(requests)
+        , _queue(queue)
+        , _log(log)
+        , _results(NULL)
+        , _next(0)
+        , _workers(0)
+    {
+    }
+
+    /// Results are stored here rather than passed to a callback.
+    void setResults(std::vector<BatchResult>* results) { _results = results; }
+
+    void setCallbacks(const BatchResultCallback& resultCallback, const TaskQueue::Callback& finishCallback)
+    {
+        _resultCallback = resultCallback;
+        _finishCallback = finishCallback;
+    }
+
+    void setWorkerCount(int count) { _workers.set(count); }
+
+    /// Run on one of the queue's threads.
+    void runQueued() { run(_queue); }
+
+    /// Run on a thread which may not belong to the queue.
+    void runOnCallingThread() { run(NULL); }
+
+private:
+    void run(TaskQueue* queue)
+    {
+        {
+            // The requests block on the network, so let the queue (or, on the calling thread, the global
+            // TaskSystem) start another thread to get on with its other work in the meantime.
+            TaskQueue::ScopedYield yield(queue);
+            ScopedYieldThread yieldThread(!queue);
+
+            for (;;) {
+                size_t index = (size_t)(_next.increment() - 1);
+                if (index >= _requests.size()) {
+                    break;
+                }
+
+                if (_results) {
+                    _factory->fetch(_requests[index], (*_results)[index], _log);
+                } else {
+                    BatchResult result;
+                    _factory->fetch(_requests[index], result, _log);
+                    if (_resultCallback) {
+                        _resultCallback(index, result);
+                    }
+                }
+            }
+        }
+
+        if (_workers.decrement() == 0 && _finishCallback) {
+            _finishCallback();
+        }
+    }
+
+    RefPtr<HTTPConnectionFactory> _factory;
+    std::vector<BatchRequest> _requests;
+    RefPtr<TaskQueue> _queue;
+    RefPtr<Log> _log;
+    std::vector<BatchResult>* _results;
+    BatchResultCallback _resultCallback;
+    TaskQueue::Callback _finishCallback;
+    AtomicCounter _next;
+    AtomicCounter _workers;
+};
+
+void HTTPConnectionFactory::fetch(const BatchRequest& request, BatchResult& result, Log* log)
+{
+    double startTime = Clock::getMonotonicSeconds();
+
+    result.connection = createConnection(request.url, log);
+    if (!result.connection) {
+        result.responseCode = HTTPConnection::invalidHTTPResponseCode;
+        result.seconds = Clock::getMonotonicSeconds() - startTime;
+        return;
+    }
+
+    HTTPConnection* connection = result.connection.get();
+
+    connection->setMethod(request.method);
+
+    for (size_t i = 0; i != request.headers.size(); ++i) {
+        connection->setRequestHeader(request.headers[i].first, request.headers[i].second);
+    }
+
+    if (!request.body.empty()) {
+        connection->setRequestBodyString(request.body);
+    }
+
+    if (request.timeoutMilliseconds >= 0) {
+        connection->setTimeout(request.timeoutMilliseconds);
+    }
+
+    result.responseCode = connection->sendRequest(log);
+    if (result.responseCode != HTTPConnection::invalidHTTPResponseCode) {
+        result.content = connection->getResponseContentString(log);
+    }
+
+    // Return the connection to the pool. The response headers remain available.
+    connection->close();
+
+    result.seconds = Clock::getMonotonicSeconds() - startTime;
+}
+
+std::vector<HTTPConnectionFactory::BatchResult> HTTPConnectionFactory::fetchBatch(const std::vector<BatchRequest>& requests,
+    TaskQueue* queue, int maxParallel, Log* log)
+{
+    std::vector<BatchResult> results(requests.size());
+
+    if (requests.empty()) {
+        return results;
+    }
+
+    int workerCount = queue ? (int)std::min<size_t>(requests.size(), (size_t)std::max(maxParallel, 1)) : 1;
+
+    RefPtr<Batch> batch = PassRef(new Batch(this, requests, queue, log));
+    batch->setResults(&results);
+    batch->setWorkerCount(workerCount);
+
+    // The calling thread is one of the workers, so the batch makes progress even if the queue is busy.
+    RefPtr<TaskQueue::TaskGroup> group;
+    if (workerCount > 1) {
+        group = queue->createTaskGroup();
+        for (int i = 1; i != workerCount; ++i) {
+#ifdef PRIME_CXX11_STL
+            group->queue(queue, [batch]() {
+                batch->runQueued();
+            });
+#else
+            group->queue(queue, MethodCallback(batch, &Batch::runQueued));
+#endif
+        }
+    }
+
+    batch->runOnCallingThread();
+
+    if (group) {
+        group->wait();
+    }
+
+    return results;
+}
+
+void HTTPConnectionFactory::queueFetchBatch(const std::vector<BatchRequest>& requests, TaskQueue* queue,
+    int maxParallel, const BatchResultCallback& resultCallback, const TaskQueue::Callback& finishCallback, Log* log)
+{
+    if (requests.empty()) {
+        if (finishCallback) {
+            finishCallback();
+        }
+        return;
+    }
+
+    int workerCount = (int)std::min<size_t>(requests.size(), (size_t)std::max(maxParallel, 1));
+
+    RefPtr<Batch> batch = PassRef(new Batch(this, requests, queue, log));
+    batch->setCallbacks(resultCallback, finishCallback);
+    batch->setWorkerCount(workerCount);
+
+    for (int i = 0; i != workerCount; ++i) {
+#ifdef PRIME_CXX11_STL
+        queue->queue([batch]() {
+            batch->runQueued();
+        });
+#else
+        queue->queue(MethodCallback(batch, &Batch::runQueued));
+#endif
+    }
+}
+
 //
 // HTTPConnection
 //
@@ -22,6 +221,10 @@ HTTPConnection::~HTTPConnection()
 {
 }
 
+void HTTPConnection::setTimeout(int)
+{
+}
+
 void HTTPConnection::setRequestBodyString(StringView string)
 {
     setRequestBody(PassRef(new StringStream(string)));
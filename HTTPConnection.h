@@ -29,7 +29,9 @@
 #include "Dictionary.h"
 #include "HTTP.h"
 #include "Stream.h"
+#include "TaskQueue.h"
 #include "URL.h"
+#include <utility>
 #include <vector>
 
 namespace Prime {
@@ -56,6 +58,12 @@ public:
     /// Set the content to send with the request. The Stream should be rewindable.
     virtual void setRequestBody(Stream* stream) = 0;
 
+    /// Limit the time the whole request may take, measured from this call, including reading the response
+    /// content. Once it has passed, reads and writes fail even if the server is still sending, so a server that
+    /// trickles its response can't keep the request alive. The factory's own timeouts still apply to connecting
+    /// and to each read or write. -1 (the default) sets no limit. Not all implementations support this.
+    virtual void setTimeout(int milliseconds);
+
     /// Send the request and return an HTTP response code or invalidHTTPResponseCode.
     virtual int sendRequest(Log* log) = 0;
 
@@ -112,6 +120,68 @@ public:
 
     /// Not all implementation will support this, but they will hopefully support setMaxRedirects(0) at a minimum.
     virtual void setMaxRedirects(int maxRedirects) = 0;
+
+    //
+    // Batches
+    //
+
+    /// A request made by fetchBatch() or queueFetchBatch().
+    struct PRIME_PUBLIC BatchRequest {
+        URL url;
+        std::string method;
+        std::vector<std::pair<std::string, std::string>> headers;
+
+        /// Sent if not empty.
+        std::string body;
+
+        /// The time allowed for the whole request, or -1 for no limit. See HTTPConnection::setTimeout().
+        int timeoutMilliseconds;
+
+        BatchRequest();
+
+        explicit BatchRequest(const URLView& url, StringView method = "GET");
+    };
+
+    struct PRIME_PUBLIC BatchResult {
+        /// Can be used to read the response headers. Null if a connection couldn't be created.
+        RefPtr<HTTPConnection> connection;
+
+        /// An HTTP response code or HTTPConnection::invalidHTTPResponseCode.
+        int responseCode;
+
+        std::string content;
+
+        /// How long the request took.
+        double seconds;
+
+        BatchResult();
+    };
+
+#ifdef PRIME_CXX11_STL
+    typedef std::function<void(size_t, BatchResult&)> BatchResultCallback;
+#else
+    typedef Callback2<void, size_t, BatchResult&> BatchResultCallback;
+#endif
+
+    /// Make the requests concurrently, at most maxParallel at a time, using the queue (which should be a
+    /// concurrent queue) and the calling thread. Returns once all the requests have completed, with the results
+    /// in the same order as the requests, so the time taken is close to that of the slowest request rather than
+    /// the sum of them all. If queue is null, the requests are made one at a time on the calling thread. Each
+    /// worker yields its thread while it makes requests, so a batch doesn't starve the queue's other work.
+    std::vector<BatchResult> fetchBatch(const std::vector<BatchRequest>& requests, TaskQueue* queue,
+        int maxParallel, Log* log);
+
+    /// Make the requests concurrently, at most maxParallel at a time, on the queue and return immediately.
+    /// resultCallback is invoked, on whichever thread made the request, with the index of each request as it
+    /// completes, then finishCallback (which may be null) is invoked once they have all completed.
+    void queueFetchBatch(const std::vector<BatchRequest>& requests, TaskQueue* queue, int maxParallel,
+        const BatchResultCallback& resultCallback, const TaskQueue::Callback& finishCallback, Log* log);
+
+    /// Make a single BatchRequest on the calling thread.
+    void fetch(const BatchRequest& request, BatchResult& result, Log* log);
+
+private:
+    class Batch;
 };
 }
 
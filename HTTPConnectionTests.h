@@ -0,0 +1,422 @@
+// Copyright 2000-2021 Mark H. P. Lord
+
+#ifndef PRIME_HTTPCONNECTIONTESTS_H
+#define PRIME_HTTPCONNECTIONTESTS_H
+
+#include "Clocks.h"
+#include "DefaultTaskSystem.h"
+#include "HTTPConnection.h"
+#include "Mutex.h"
+#include "NumberParsing.h"
+#include "SocketStream.h"
+#include "StringStream.h"
+#include "StringUtils.h"
+#if defined(PRIME_OS_UNIX)
+#include <sys/socket.h>
+#endif
+
+namespace Prime {
+
+namespace HTTPConnectionTestsPrivate {
+
+    class FakeConnectionFactory;
+
+    /// Responds without touching the network. The response depends on the URL's path: "/error" fails to send,
+    /// "/sleep/<milliseconds>" waits before responding and anything else responds immediately. The content
+    /// describes the request.
+    class FakeConnection : public HTTPConnection {
+    public:
+        FakeConnection(FakeConnectionFactory* factory, const URLView& url)
+            : _factory(factory)
+            , _url(url)
+            , _method("GET")
+            , _timeout(-1)
+            , _responseCode(-1)
+        {
+        }
+
+        virtual void setMethod(StringView method) PRIME_OVERRIDE { _method.assign(method.begin(), method.end()); }
+
+        virtual void setRequestHeader(StringView, StringView) PRIME_OVERRIDE { }
+
+        virtual void setRequestBody(Stream* stream) PRIME_OVERRIDE { _requestBody = stream; }
+
+        virtual void setTimeout(int milliseconds) PRIME_OVERRIDE { _timeout = milliseconds; }
+
+        virtual int sendRequest(Log* log) PRIME_OVERRIDE;
+
+        virtual int getResponseCode() const PRIME_OVERRIDE { return _responseCode; }
+
+        virtual StringView getResponseCodeText() const PRIME_OVERRIDE { return "OK"; }
+
+        virtual const URL& getResponseURL() const PRIME_OVERRIDE { return _url; }
+
+        virtual RefPtr<Stream> getResponseContentStream() const PRIME_OVERRIDE
+        {
+            return PassRef(new StringStream(_content));
+        }
+
+        virtual int64_t getResponseContentLength() const PRIME_OVERRIDE { return (int64_t)_content.size(); }
+
+        virtual StringView getResponseContentType() const PRIME_OVERRIDE { return "text/plain"; }
+
+        virtual StringView getResponseHeader(StringView) PRIME_OVERRIDE { return StringView(); }
+
+        virtual std::vector<StringView> getResponseHeaders(StringView) PRIME_OVERRIDE
+        {
+            return std::vector<StringView>();
+        }
+
+        virtual std::vector<StringView> getResponseHeaderNames() PRIME_OVERRIDE { return std::vector<StringView>(); }
+
+        virtual void close() PRIME_OVERRIDE { }
+
+    private:
+        RefPtr<FakeConnectionFactory> _factory;
+        URL _url;
+        std::string _method;
+        RefPtr<Stream> _requestBody;
+        int _timeout;
+        int _responseCode;
+        std::string _content;
+    };
+
+    /// Creates FakeConnections, failing for the path "/fail", and records how many are sending at once.
+    class FakeConnectionFactory : public HTTPConnectionFactory {
+    public:
+        FakeConnectionFactory()
+            : _active(0)
+            , _maxActive(0)
+        {
+            PRIME_EXPECT(_mutex.init(Log::getGlobal()));
+        }
+
+        virtual RefPtr<HTTPConnection> createConnection(const URLView& url, Log*) PRIME_OVERRIDE
+        {
+            if (url.getPath() == "/fail") {
+                return NULL;
+            }
+
+            return PassRef(new FakeConnection(this, url));
+        }
+
+        virtual void setMaxRedirects(int) PRIME_OVERRIDE { }
+
+        void beginSend()
+        {
+            Mutex::ScopedLock lock(&_mutex);
+            if (++_active > _maxActive) {
+                _maxActive = _active;
+            }
+        }
+
+        void endSend()
+        {
+            Mutex::ScopedLock lock(&_mutex);
+            --_active;
+        }
+
+        int getMaxActive() const
+        {
+            Mutex::ScopedLock lock(&_mutex);
+            return _maxActive;
+        }
+
+    private:
+        mutable Mutex _mutex;
+        int _active;
+        int _maxActive;
+    };
+
+    inline int FakeConnection::sendRequest(Log* log)
+    {
+        StringView path = _url.getPath();
+
+        if (path == "/error") {
+            _responseCode = invalidHTTPResponseCode;
+            return _responseCode;
+        }
+
+        _factory->beginSend();
+
+        if (StringStartsWith(path, "/sleep/")) {
+            int milliseconds;
+            PRIME_TEST(StringToInt(path.substr(7), milliseconds, 10));
+            Clock::sleepMilliseconds((unsigned int)milliseconds);
+        }
+
+        _factory->endSend();
+
+        _content = MakeString(_method, " ", path);
+
+        if (_timeout >= 0) {
+            _content += MakeString(" timeout=", _timeout);
+        }
+
+        if (_requestBody) {
+            StringStream body;
+            PRIME_TEST(body.copyFrom(_requestBody, log, -1, log));
+            _content += " body=";
+            _content += body.getString();
+        }
+
+        _responseCode = 200;
+        return _responseCode;
+    }
+
+    /// Requests which complete in the reverse of the order they're made in, when made concurrently.
+    inline std::vector<HTTPConnectionFactory::BatchRequest> MakeSleepRequests(int count)
+    {
+        std::vector<HTTPConnectionFactory::BatchRequest> requests;
+        for (int i = 0; i != count; ++i) {
+            requests.push_back(HTTPConnectionFactory::BatchRequest(URLView(MakeString("http://example.com/sleep/", (count - i) * 5))));
+        }
+
+        return requests;
+    }
+
+    inline void CheckSleepResults(const std::vector<HTTPConnectionFactory::BatchResult>& results, int count)
+    {
+        PRIME_TEST(results.size() == (size_t)count);
+        for (int i = 0; i != count; ++i) {
+            PRIME_TEST(results[i].responseCode == 200);
+            PRIME_TEST(results[i].connection);
+            PRIME_TEST(results[i].content == MakeString("GET /sleep/", (count - i) * 5));
+        }
+    }
+
+    inline void BatchOrderTests(TaskQueue* queue, Log* log)
+    {
+        static const int count = 8;
+        static const int maxParallel = 3;
+
+        // Results come back in request order, however the requests were spread across the workers.
+        RefPtr<FakeConnectionFactory> factory = PassRef(new FakeConnectionFactory);
+        CheckSleepResults(factory->fetchBatch(MakeSleepRequests(count), queue, maxParallel, log), count);
+        PRIME_TEST(factory->getMaxActive() >= 1 && factory->getMaxActive() <= maxParallel);
+
+        // Without a queue, the requests are made one at a time.
+        factory = PassRef(new FakeConnectionFactory);
+        CheckSleepResults(factory->fetchBatch(MakeSleepRequests(count), NULL, maxParallel, log), count);
+        PRIME_TEST(factory->getMaxActive() == 1);
+
+        PRIME_TEST(factory->fetchBatch(std::vector<HTTPConnectionFactory::BatchRequest>(), queue, maxParallel, log).empty());
+    }
+
+    inline void BatchPartialFailureTests(TaskQueue* queue, Log* log)
+    {
+        std::vector<HTTPConnectionFactory::BatchRequest> requests;
+        requests.push_back(HTTPConnectionFactory::BatchRequest(URLView("http://example.com/first")));
+        requests.push_back(HTTPConnectionFactory::BatchRequest(URLView("http://example.com/fail")));
+        requests.push_back(HTTPConnectionFactory::BatchRequest(URLView("http://example.com/error")));
+        requests.push_back(HTTPConnectionFactory::BatchRequest(URLView("http://example.com/last"), "POST"));
+        requests.back().body = "data";
+
+        RefPtr<FakeConnectionFactory> factory = PassRef(new FakeConnectionFactory);
+        std::vector<HTTPConnectionFactory::BatchResult> results = factory->fetchBatch(requests, queue, 4, log);
+        PRIME_TEST(results.size() == 4);
+
+        // A failed request doesn't affect the others.
+        PRIME_TEST(results[0].responseCode == 200);
+        PRIME_TEST(results[0].content == "GET /first");
+
+        // No connection could be created.
+        PRIME_TEST(!results[1].connection);
+        PRIME_TEST(results[1].responseCode == HTTPConnection::invalidHTTPResponseCode);
+        PRIME_TEST(results[1].content.empty());
+
+        // The connection couldn't send the request, but can still be inspected.
+        PRIME_TEST(results[2].connection);
+        PRIME_TEST(results[2].responseCode == HTTPConnection::invalidHTTPResponseCode);
+        PRIME_TEST(results[2].content.empty());
+
+        PRIME_TEST(results[3].responseCode == 200);
+        PRIME_TEST(results[3].content == "POST /last body=data");
+    }
+
+    inline void BatchTimeoutTests(Log* log)
+    {
+        std::vector<HTTPConnectionFactory::BatchRequest> requests;
+        requests.push_back(HTTPConnectionFactory::BatchRequest(URLView("http://example.com/default")));
+        requests.push_back(HTTPConnectionFactory::BatchRequest(URLView("http://example.com/limited")));
+        requests.back().timeoutMilliseconds = 250;
+
+        // Only a request with a timeout calls setTimeout().
+        RefPtr<FakeConnectionFactory> factory = PassRef(new FakeConnectionFactory);
+        std::vector<HTTPConnectionFactory::BatchResult> results = factory->fetchBatch(requests, NULL, 1, log);
+        PRIME_TEST(results.size() == 2);
+        PRIME_TEST(results[0].content == "GET /default");
+        PRIME_TEST(results[1].content == "GET /limited timeout=250");
+    }
+
+    /// Collects the results of queueFetchBatch().
+    class QueuedResults : public RefCounted {
+    public:
+        explicit QueuedResults(size_t count)
+            : _results(count)
+            , _resultCount(0)
+            , _finishCount(0)
+        {
+            PRIME_EXPECT(_mutex.init(Log::getGlobal()));
+        }
+
+        void result(size_t index, HTTPConnectionFactory::BatchResult& result)
+        {
+            Mutex::ScopedLock lock(&_mutex);
+            PRIME_TEST(index < _results.size());
+            PRIME_TEST(_finishCount == 0);
+            _results[index] = result;
+            ++_resultCount;
+        }
+
+        void finished()
+        {
+            Mutex::ScopedLock lock(&_mutex);
+            ++_finishCount;
+        }
+
+        bool wait(int milliseconds)
+        {
+            for (;;) {
+                {
+                    Mutex::ScopedLock lock(&_mutex);
+                    if (_finishCount != 0) {
+                        return true;
+                    }
+                }
+
+                if (milliseconds <= 0) {
+                    return false;
+                }
+
+                Clock::sleepMilliseconds(10);
+                milliseconds -= 10;
+            }
+        }
+
+        const std::vector<HTTPConnectionFactory::BatchResult>& getResults() const { return _results; }
+
+        size_t getResultCount() const { return _resultCount; }
+
+        int getFinishCount() const { return _finishCount; }
+
+    private:
+        Mutex _mutex;
+        std::vector<HTTPConnectionFactory::BatchResult> _results;
+        size_t _resultCount;
+        int _finishCount;
+    };
+
+    inline void QueuedBatchTests(TaskQueue* queue, Log* log)
+    {
+        static const int count = 6;
+
+        RefPtr<QueuedResults> queued = PassRef(new QueuedResults(count));
+
+#ifdef PRIME_CXX11_STL
+        HTTPConnectionFactory::BatchResultCallback resultCallback = [queued](size_t index, HTTPConnectionFactory::BatchResult& result) {
+            queued->result(index, result);
+        };
+        TaskQueue::Callback finishCallback = [queued]() {
+            queued->finished();
+        };
+#else
+        HTTPConnectionFactory::BatchResultCallback resultCallback = MethodCallback(queued, &QueuedResults::result);
+        TaskQueue::Callback finishCallback = MethodCallback(queued, &QueuedResults::finished);
+#endif
+
+        // Each result is reported against its request's index, and the batch finishes once.
+        RefPtr<FakeConnectionFactory> factory = PassRef(new FakeConnectionFactory);
+        factory->queueFetchBatch(MakeSleepRequests(count), queue, 3, resultCallback, finishCallback, log);
+        PRIME_TEST(queued->wait(5000));
+        Clock::sleepMilliseconds(20);
+        PRIME_TEST(queued->getFinishCount() == 1);
+        PRIME_TEST(queued->getResultCount() == count);
+        CheckSleepResults(queued->getResults(), count);
+    }
+
+#if defined(PRIME_OS_UNIX)
+
+    inline void CreateStreamPair(SocketStream& a, Socket& b)
+    {
+        int fds[2];
+        PRIME_TEST(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+        Socket first(fds[0]);
+        Socket second(fds[1]);
+        a.takeOwnership(first);
+        b.takeOwnership(second);
+    }
+
+    inline void DeadlineTests()
+    {
+        Log* log = Log::getNullLog();
+
+        // The deadline cuts a wait short of the read timeout.
+        {
+            SocketStream stream(5000, 5000);
+            Socket peer;
+            CreateStreamPair(stream, peer);
+
+            stream.setDeadline(Timeout(50));
+
+            double start = Clock::getMonotonicSeconds();
+            char byte;
+            PRIME_TEST(stream.readSome(&byte, 1, log) < 0);
+            PRIME_TEST(Clock::getMonotonicSeconds() - start < 2);
+        }
+
+        // A peer that trickles data stays within the read timeout, but not within the deadline.
+        {
+            SocketStream stream(5000, 5000);
+            Socket peer;
+            CreateStreamPair(stream, peer);
+
+            stream.setDeadline(Timeout(100));
+
+            int reads = 0;
+            for (; reads != 100; ++reads) {
+                PRIME_TEST(peer.send("x", 1, log) == 1);
+
+                char byte;
+                if (stream.readSome(&byte, 1, log) != 1) {
+                    break;
+                }
+
+                Clock::sleepMilliseconds(10);
+            }
+
+            PRIME_TEST(reads != 100);
+
+            // Removing the deadline leaves just the timeouts.
+            stream.setDeadline(Timeout(-1));
+
+            char byte;
+            PRIME_TEST(stream.readSome(&byte, 1, log) == 1);
+        }
+    }
+
+#else
+
+    inline void DeadlineTests()
+    {
+    }
+
+#endif
+}
+
+inline void HTTPConnectionTests(Log* log)
+{
+    using namespace HTTPConnectionTestsPrivate;
+
+    RefPtr<DefaultTaskSystem> taskSystem = PassRef(new DefaultTaskSystem);
+    PRIME_TEST(taskSystem->init(4, 16, 0, log));
+
+    BatchOrderTests(taskSystem->getConcurrentQueue(), log);
+    BatchPartialFailureTests(taskSystem->getConcurrentQueue(), log);
+    BatchTimeoutTests(log);
+    QueuedBatchTests(taskSystem->getConcurrentQueue(), log);
+    DeadlineTests();
+}
+}
+
+#endif
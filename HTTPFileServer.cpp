@@ -1,10 +1,20 @@
 // Copyright 2000-2021 Mark H. P. Lord
 
 #include "HTTPFileServer.h"
+#include "Clocks.h"
+#include "GZipWriter.h"
+#include "HTTP.h"
+#include "Mutex.h"
+#include "NumberUtils.h"
 #include "Path.h"
 #include "PrefixLog.h"
+#include "StreamLoader.h"
 #include "StringStream.h"
+#include "StringUtils.h"
 #include "TextEncoding.h"
+#include <algorithm>
+#include <list>
+#include <map>
 
 namespace Prime {
 
@@ -16,6 +26,9 @@ HTTPFileServer::Options::Options()
     : _expirationSeconds(0)
     , _directoryListings(true)
     , _useGZip(true)
+    , _cacheSizeInBytes(0)
+    , _maxCachedFileSizeInBytes(256 * 1024)
+    , _cacheRevalidateMilliseconds(2000)
 {
 }
 
@@ -25,6 +38,202 @@ HTTPFileServer::Options& HTTPFileServer::Options::setMIMETypes(const MIMETypes*
     return *this;
 }
 
+//
+// HTTPFileServer::CacheEntry
+//
+
+class HTTPFileServer::CacheEntry : public RefCounted {
+public:
+    std::string path;
+    std::string extension;
+    FileSystem::FileProperties fileProperties;
+    std::string etag;
+    std::string body;
+
+    /// Empty if the file isn't worth compressing.
+    std::string gzipBody;
+
+    size_t getCost() const { return path.size() + body.size() + gzipBody.size() + sizeof(*this); }
+
+    bool matches(const FileSystem::FileProperties& other) const
+    {
+        return other.size == fileProperties.size && other.modificationTime == fileProperties.modificationTime;
+    }
+
+private:
+    friend class Cache;
+
+    /// Protected by the Cache's mutex.
+    uint64_t _validatedAt;
+};
+
+//
+// HTTPFileServer::Cache
+//
+
+/// A least-recently-used cache of CacheEntry, bounded by the total size of the entries.
+class HTTPFileServer::Cache : public RefCounted {
+public:
+    Cache(size_t maxBytes, int revalidateMilliseconds)
+        : _bytes(0)
+        , _maxBytes(maxBytes)
+        , _revalidateMilliseconds((uint64_t)Max(revalidateMilliseconds, 0))
+    {
+        _mutex.init(Log::getGlobal(), "HTTPFileServer cache mutex");
+    }
+
+    /// Returns the entry for path if it was loaded or validated recently enough to be trusted.
+    RefPtr<CacheEntry> find(const std::string& path)
+    {
+        Mutex::ScopedLock lock(&_mutex);
+
+        Index::iterator iter = _index.find(path);
+        if (iter == _index.end()) {
+            return NULL;
+        }
+
+        CacheEntry* entry = iter->second->get();
+        if (Clock::getMonotonicMilliseconds64() - entry->_validatedAt > _revalidateMilliseconds) {
+            return NULL;
+        }
+
+        touch(iter->second);
+        return entry;
+    }
+
+    /// Returns the entry for path if it matches the file's current properties, otherwise discards it.
+    RefPtr<CacheEntry> validate(const std::string& path, const FileSystem::FileProperties& fileProperties)
+    {
+        Mutex::ScopedLock lock(&_mutex);
+
+        Index::iterator iter = _index.find(path);
+        if (iter == _index.end()) {
+            return NULL;
+        }
+
+        RefPtr<CacheEntry> entry = *iter->second;
+        if (!entry->matches(fileProperties)) {
+            remove(iter);
+            return NULL;
+        }
+
+        entry->_validatedAt = Clock::getMonotonicMilliseconds64();
+        touch(iter->second);
+        return entry;
+    }
+
+    void insert(CacheEntry* entry)
+    {
+        Mutex::ScopedLock lock(&_mutex);
+
+        Index::iterator existing = _index.find(entry->path);
+        if (existing != _index.end()) {
+            remove(existing);
+        }
+
+        entry->_validatedAt = Clock::getMonotonicMilliseconds64();
+        _entries.push_front(entry);
+        _index[entry->path] = _entries.begin();
+        _bytes += entry->getCost();
+
+        while (_bytes > _maxBytes && !_entries.empty()) {
+            remove(_index.find(_entries.back()->path));
+        }
+    }
+
+private:
+    /// Most recently used first.
+    typedef std::list<RefPtr<CacheEntry>> EntryList;
+    typedef std::map<std::string, EntryList::iterator> Index;
+
+    void touch(EntryList::iterator entry)
+    {
+        _entries.splice(_entries.begin(), _entries, entry);
+    }
+
+    void remove(Index::iterator iter)
+    {
+        _bytes -= (*iter->second)->getCost();
+        _entries.erase(iter->second);
+        _index.erase(iter);
+    }
+
+    Mutex _mutex;
+    EntryList _entries;
+    Index _index;
+    size_t _bytes;
+    size_t _maxBytes;
+    uint64_t _revalidateMilliseconds;
+};
+
+namespace {
+
+/// A read-only Stream over the body of a CacheEntry, which it retains.
+class CacheEntryStream : public Stream {
+public:
+    CacheEntryStream(RefCounted* owner, const std::string& bytes)
+        : _owner(owner)
+        , _bytes(bytes)
+        , _offset(0)
+    {
+    }
+
+    virtual ptrdiff_t readSome(void* buffer, size_t maximumBytes, Log*) PRIME_OVERRIDE
+    {
+        size_t count = Min(maximumBytes, _bytes.size() - _offset);
+        memcpy(buffer, _bytes.data() + _offset, count);
+        _offset += count;
+        return (ptrdiff_t)count;
+    }
+
+    virtual Offset seek(Offset offset, SeekMode mode, Log* log) PRIME_OVERRIDE
+    {
+        Offset newOffset;
+        switch (mode) {
+        case SeekModeAbsolute:
+            newOffset = offset;
+            break;
+        case SeekModeRelative:
+            newOffset = (Offset)_offset + offset;
+            break;
+        case SeekModeRelativeToEnd:
+            newOffset = (Offset)_bytes.size() + offset;
+            break;
+        default:
+            newOffset = -1;
+        }
+
+        if (newOffset < 0 || newOffset > (Offset)_bytes.size()) {
+            log->error(PRIME_LOCALISE("Invalid seek."));
+            return -1;
+        }
+
+        _offset = (size_t)newOffset;
+        return newOffset;
+    }
+
+    virtual Offset getSize(Log*) PRIME_OVERRIDE { return (Offset)_bytes.size(); }
+
+    virtual bool isSeekable() PRIME_OVERRIDE { return true; }
+
+    // Write straight from the cached bytes rather than via a copy buffer.
+    virtual bool tryCopyTo(bool& error, Stream* dest, Log* destLog, Offset length, Log*, size_t, void*) PRIME_OVERRIDE
+    {
+        size_t remaining = _bytes.size() - _offset;
+        size_t count = (length < 0 || (Offset)remaining < length) ? remaining : (size_t)length;
+
+        error = !dest->writeExact(_bytes.data() + _offset, count, destLog);
+        _offset += count;
+        return !error;
+    }
+
+private:
+    RefPtr<RefCounted> _owner;
+    const std::string& _bytes;
+    size_t _offset;
+};
+}
+
 //
 // HTTPFileServer
 //
@@ -45,12 +254,25 @@ void HTTPFileServer::init(FileSystem* fileSystem, const Options& options)
     if (!_options.getMIMETypes()) {
         _options.setMIMETypes(PassRef(new MIMETypes));
     }
+
+    if (_options.getCacheSizeInBytes()) {
+        _cache = PassRef(new Cache(_options.getCacheSizeInBytes(), _options.getCacheRevalidateMilliseconds()));
+    } else {
+        _cache.release();
+    }
 }
 
 bool HTTPFileServer::handleRequest(Request& request, Response& response)
 {
     std::string path = request.getRemainingPathString();
 
+    if (_cache && !request.getPath().isDirectory()) {
+        if (RefPtr<CacheEntry> entry = _cache->find(path)) {
+            sendCacheEntry(request, response, entry);
+            return true;
+        }
+    }
+
     FileSystem::FileProperties fileProperties;
     if (!_fileSystem->test(path.c_str(), &fileProperties)) {
         if (!path.empty()) {
@@ -109,6 +331,18 @@ bool HTTPFileServer::sendFile(Request& request, Response& response, const char*
         }
     }
 
+    if (_cache) {
+        RefPtr<CacheEntry> entry = _cache->validate(path, *knownProps);
+        if (!entry) {
+            entry = loadCacheEntry(request, path, *knownProps);
+        }
+
+        if (entry) {
+            sendCacheEntry(request, response, entry);
+            return true;
+        }
+    }
+
     if (response.shouldGZip() && knownProps->crc32 && knownProps->compressionMethod && knownProps->compressionMethod.value() == FileSystem::CompressionMethodDeflate) {
 
         stream = _fileSystem->open(path, OpenMode().setRead().setBufferSequential(), PrefixLog(request.getLog(), path),
@@ -221,24 +455,35 @@ bool HTTPFileServer::sendStream(Request& request, Response& response, Stream* st
         return false;
     }
 
-    // TODO: check If-Newer, range, etc. in the request!
-    (void)request;
+    std::string extension = Path::exetension(filename);
+
+    setFileHeaders(response, extension, fileProperties, mimeTypes, expireAfterSeconds, createETag(fileProperties));
+
+    if (mimeTypes.isCompressedExtension(extension)) {
+        sendOptions.setAlreadyCompressed(true);
+    }
+
+    if (isNotModified(request, response)) {
+        response.setResponseCode(304);
+        return true;
+    }
 
+    return sendStreamOrRanges(request, response, stream, sendOptions);
+}
+
+void HTTPFileServer::setFileHeaders(Response& response, StringView extension,
+    const FileSystem::FileProperties& fileProperties, const MIMETypes& mimeTypes, int expireAfterSeconds,
+    StringView etag)
+{
     //
     // "Content-Type" header
     //
 
-    std::string extension = Path::exetension(filename);
-
     StringView mimeType = mimeTypes.getMIMETypeForExtension(extension);
     if (!mimeType.empty()) {
         response.setHeader("Content-Type", mimeType);
     }
 
-    if (mimeTypes.isCompressedExtension(extension)) {
-        sendOptions.setAlreadyCompressed(true);
-    }
-
     //
     // "Last-Modified", "Date", "Expires" and "Cache-Control: max-age=" headers
     //
@@ -250,20 +495,105 @@ bool HTTPFileServer::sendStream(Request& request, Response& response, Stream* st
     response.setExpirationSeconds(expireAfterSeconds);
 
     //
-    // "ETag" header (construct it from the modification date/time)
+    // "ETag" header
     //
 
-    if (fileProperties.modificationTime) {
-        char timestr[128];
-        if (PRIME_GUARD(DateTime(fileProperties.modificationTime.value()).toRFC1123(timestr, sizeof(timestr)))) {
-            char base64[192];
-            size_t encodedSize = Base64Encode(base64, sizeof(base64), timestr, strlen(timestr), 0);
-            if (PRIME_GUARD(encodedSize < sizeof(base64))) {
-                base64[encodedSize] = 0;
-            } else {
-                base64[sizeof(base64) - 1] = 0;
+    if (!etag.empty()) {
+        response.setHeader("ETag", etag);
+    }
+}
+
+std::string HTTPFileServer::createETag(const FileSystem::FileProperties& fileProperties)
+{
+    if (!fileProperties.modificationTime) {
+        return std::string();
+    }
+
+    char timestr[128];
+    if (!PRIME_GUARD(DateTime(fileProperties.modificationTime.value()).toRFC1123(timestr, sizeof(timestr)))) {
+        return std::string();
+    }
+
+    char base64[192];
+    size_t encodedSize = Base64Encode(base64, sizeof(base64), timestr, strlen(timestr), 0);
+    if (PRIME_GUARD(encodedSize < sizeof(base64))) {
+        base64[encodedSize] = 0;
+    } else {
+        base64[sizeof(base64) - 1] = 0;
+    }
+
+    return base64;
+}
+
+bool HTTPFileServer::isNotModified(const Request& request, const Response& response)
+{
+    StringView ifNoneMatch = request.getHeader("If-None-Match");
+    StringView etag = response.getHeader("ETag");
+    if (ifNoneMatch.empty() || etag.empty() || (!request.isGet() && request.getMethod() != HTTPMethodHead)) {
+        return false;
+    }
+
+    // A list of (possibly weak) entity tags, or *. Our ETags aren't quoted, but a client may have quoted them.
+    const char* ptr = ifNoneMatch.begin();
+    const char* end = ifNoneMatch.end();
+    for (;;) {
+        ptr = ASCIISkipWhitespace(ptr, end);
+        if (ptr == end) {
+            return false;
+        }
+
+        const char* tagEnd = std::find(ptr, end, ',');
+        StringView tag = StringViewTrim(StringView(ptr, tagEnd));
+
+        if (tag == "*") {
+            return true;
+        }
+
+        if (StringStartsWith(tag, "W/")) {
+            tag.remove_prefix(2);
+        }
+
+        if (tag.size() >= 2 && tag.front() == '"' && tag.back() == '"') {
+            tag = tag.substr(1, tag.size() - 2);
+        }
+
+        if (tag == etag) {
+            return true;
+        }
+
+        if (tagEnd == end) {
+            return false;
+        }
+
+        ptr = tagEnd + 1;
+    }
+}
+
+bool HTTPFileServer::sendStreamOrRanges(Request& request, Response& response, Stream* stream,
+    const Response::SendStreamOptions& sendOptions)
+{
+    //
+    // "Range" and "If-Range" (the content of a range response is never compressed on the fly, so ranges are
+    // always of the bytes we'd otherwise send)
+    //
+
+    Stream::Offset size = stream->getSize(Log::getNullLog());
+
+    if (size >= 0 && stream->isSeekable() && !sendOptions.isRawDeflated()) {
+        response.setHeader("Accept-Ranges", "bytes");
+
+        StringView rangeHeader = request.getHeader("Range");
+        if (!rangeHeader.empty() && request.isGet() && isIfRangeSatisfied(request, response)) {
+            std::vector<HTTPByteRange> ranges;
+            if (HTTPParseByteRanges(rangeHeader, size, ranges)) {
+                if (ranges.empty()) {
+                    response.setHeader("Content-Range", MakeString("bytes */", size));
+                    response.error(request, 416);
+                    return true;
+                }
+
+                return response.sendStreamRanges(stream, size, ranges, request.getLog());
             }
-            response.setHeader("ETag", base64);
         }
     }
 
@@ -273,4 +603,122 @@ bool HTTPFileServer::sendStream(Request& request, Response& response, Stream* st
 
     return response.sendStream(stream, request.getLog(), sendOptions);
 }
+
+RefPtr<HTTPFileServer::CacheEntry> HTTPFileServer::loadCacheEntry(Request& request, const char* path,
+    const FileSystem::FileProperties& fileProperties)
+{
+    if (fileProperties.isDirectory || !fileProperties.size || !fileProperties.modificationTime || fileProperties.size.value() > (Stream::Offset)_options.getMaxCachedFileSizeInBytes()) {
+        return NULL;
+    }
+
+    PrefixLog log(request.getLog(), path);
+
+    FileSystem::FileProperties openedProperties;
+    RefPtr<Stream> stream = _fileSystem->open(path, OpenMode().setRead(), log, FileSystem::OpenOptions(), &openedProperties);
+    if (!stream) {
+        return NULL;
+    }
+
+    RefPtr<CacheEntry> entry = PassRef(new CacheEntry);
+    entry->path = path;
+    entry->extension = Path::exetension(path);
+    entry->fileProperties = fileProperties;
+    entry->etag = createETag(fileProperties);
+
+    StreamLoader loader;
+    if (!loader.load(stream, log)) {
+        return NULL;
+    }
+
+    if ((Stream::Offset)loader.getSize() != fileProperties.size.value()) {
+        // Modified while we were reading it.
+        return NULL;
+    }
+
+    entry->body.swap(loader.getString());
+
+#ifndef PRIME_NO_ZLIB
+    if (!_options.getMIMETypes()->isCompressedExtension(entry->extension) && entry->body.size() >= minCacheGZipSize) {
+        // Prefer a pre-built .gz, but only if it's at least as new as the file.
+        FileSystem::FileProperties gzProperties;
+        std::string gzPath = MakeString(path, ".gz");
+        if (_options.shouldUseGZip() && _fileSystem->test(gzPath.c_str(), &gzProperties) && gzProperties.modificationTime && !(gzProperties.modificationTime.value() < fileProperties.modificationTime.value())) {
+            RefPtr<Stream> gzStream = _fileSystem->open(gzPath.c_str(), OpenMode().setRead(), log);
+            StreamLoader gzLoader;
+            if (gzStream && gzLoader.load(gzStream, log)) {
+                entry->gzipBody.swap(gzLoader.getString());
+            }
+        }
+
+        if (entry->gzipBody.empty()) {
+            StringStream gzipped;
+            GZipWriter gzipWriter;
+            if (gzipWriter.begin(&gzipped, cacheGZipCompressionLevel, log) && gzipWriter.writeExact(entry->body.data(), entry->body.size(), log) && gzipWriter.end(log)) {
+                entry->gzipBody.swap(gzipped.getString());
+            }
+        }
+
+        // Not worth it.
+        if (entry->gzipBody.size() >= entry->body.size()) {
+            entry->gzipBody.clear();
+        }
+    }
+#endif
+
+    _cache->insert(entry);
+    return entry;
+}
+
+void HTTPFileServer::sendCacheEntry(Request& request, Response& response, CacheEntry* entry)
+{
+    setFileHeaders(response, entry->extension, entry->fileProperties, *_options.getMIMETypes(),
+        _options.getExpirationSeconds(), entry->etag);
+
+    // Which body we send depends on Accept-Encoding, so caches mustn't serve one in place of the other.
+    if (!entry->gzipBody.empty()) {
+        response.addHeader("Vary", "Accept-Encoding");
+    }
+
+    if (isNotModified(request, response)) {
+        response.setResponseCode(304);
+        return;
+    }
+
+    // The gzip encoding is only used for whole responses, since ranges are always of the unencoded bytes.
+    if (!entry->gzipBody.empty() && response.shouldGZip() && request.getHeader("Range").empty()) {
+        response.setHeader("Content-Encoding", "gzip");
+
+        RefPtr<CacheEntryStream> gzipStream = PassRef(new CacheEntryStream(entry, entry->gzipBody));
+        response.sendStream(gzipStream, (Stream::Offset)entry->gzipBody.size(), request.getLog(),
+            Response::SendStreamOptions().setAlreadyCompressed(true));
+        return;
+    }
+
+    RefPtr<CacheEntryStream> bodyStream = PassRef(new CacheEntryStream(entry, entry->body));
+    sendStreamOrRanges(request, response, bodyStream, Response::SendStreamOptions().setDoNotCompress());
+}
+
+bool HTTPFileServer::isIfRangeSatisfied(const Request& request, const Response& response)
+{
+    StringView ifRange = request.getHeader("If-Range");
+    if (ifRange.empty()) {
+        return true;
+    }
+
+    // Either a strong entity tag or an HTTP-date, which must exactly match what we'd send. Our ETags aren't
+    // quoted, but a client may have quoted them.
+    StringView etag = response.getHeader("ETag");
+    if (!etag.empty()) {
+        if (ifRange == etag) {
+            return true;
+        }
+
+        if (ifRange.size() == etag.size() + 2 && ifRange.front() == '"' && ifRange.back() == '"' && ifRange.substr(1, etag.size()) == etag) {
+            return true;
+        }
+    }
+
+    StringView lastModified = response.getHeader("Last-Modified");
+    return !lastModified.empty() && ifRange == lastModified;
+}
 }
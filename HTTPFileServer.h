@@ -54,11 +54,39 @@ public:
         }
         bool shouldUseGZip() const { return _useGZip; }
 
+        /// If non-zero, files of up to getMaxCachedFileSizeInBytes() are kept in memory, along with their gzip
+        /// encoding, evicting the least recently used once this many bytes are cached. Cached files are served
+        /// without touching the FileSystem. Zero (the default) disables the cache.
+        Options& setCacheSizeInBytes(size_t value)
+        {
+            _cacheSizeInBytes = value;
+            return *this;
+        }
+        size_t getCacheSizeInBytes() const { return _cacheSizeInBytes; }
+
+        Options& setMaxCachedFileSizeInBytes(size_t value)
+        {
+            _maxCachedFileSizeInBytes = value;
+            return *this;
+        }
+        size_t getMaxCachedFileSizeInBytes() const { return _maxCachedFileSizeInBytes; }
+
+        /// How long a cached file is trusted before its modification time and size are checked again.
+        Options& setCacheRevalidateMilliseconds(int value)
+        {
+            _cacheRevalidateMilliseconds = value;
+            return *this;
+        }
+        int getCacheRevalidateMilliseconds() const { return _cacheRevalidateMilliseconds; }
+
     private:
         int _expirationSeconds;
         bool _directoryListings;
         RefPtr<const MIMETypes> _mimeTypes;
         bool _useGZip;
+        size_t _cacheSizeInBytes;
+        size_t _maxCachedFileSizeInBytes;
+        int _cacheRevalidateMilliseconds;
     };
 
     void init(FileSystem* fileSystem, const Options& options);
@@ -75,8 +103,43 @@ public:
     virtual bool handleRequest(Request& request, Response& response) PRIME_OVERRIDE;
 
 private:
+    class Cache;
+    class CacheEntry;
+
+    enum {
+        /// Files smaller than this aren't worth compressing.
+        minCacheGZipSize = 256,
+
+        /// Files are only compressed once when they're cached, so we can afford a higher compression level.
+        cacheGZipCompressionLevel = 6
+    };
+
+    /// Sets the Content-Type, Last-Modified, expiration and ETag headers.
+    static void setFileHeaders(Response& response, StringView extension, const FileSystem::FileProperties& fileProperties,
+        const MIMETypes& mimeTypes, int expireAfterSeconds, StringView etag);
+
+    /// Construct an ETag from the modification date/time.
+    static std::string createETag(const FileSystem::FileProperties& fileProperties);
+
+    /// Returns true if the request has an If-None-Match header matching the ETag of the response.
+    static bool isNotModified(const Request& request, const Response& response);
+
+    /// Returns true if there's no If-Range header or if it matches the ETag or Last-Modified of the response.
+    static bool isIfRangeSatisfied(const Request& request, const Response& response);
+
+    /// Sends the requested ranges of the stream if the request has a satisfiable Range header, otherwise sends
+    /// the whole stream.
+    static bool sendStreamOrRanges(Request& request, Response& response, Stream* stream,
+        const Response::SendStreamOptions& sendOptions);
+
+    /// Loads a file in to the cache, if it's small enough. Returns null if the file can't be cached.
+    RefPtr<CacheEntry> loadCacheEntry(Request& request, const char* path, const FileSystem::FileProperties& fileProperties);
+
+    void sendCacheEntry(Request& request, Response& response, CacheEntry* entry);
+
     RefPtr<FileSystem> _fileSystem;
     Options _options;
+    RefPtr<Cache> _cache;
 };
 }
 
@@ -2,6 +2,7 @@
 
 #include "HTTPMultiSocketServer.h"
 #include "HTTPServer.h"
+#include "NumberUtils.h"
 #include "SocketListener.h"
 
 namespace Prime {
@@ -22,6 +23,9 @@ bool HTTPMultiSocketServer::init(HTTPServer::Handler* handler, TaskQueue* taskQu
 
     bool allowNonSSL = settings->get("allowNonSSL").toBool(false);
 
+    // The connection limits apply to all the HTTPSocketServers together.
+    _loadCounters = PassRef(new HTTPSocketServer::LoadCounters);
+
     _taskGroup = _taskQueue->createTaskGroup();
     if (!_taskGroup) {
         return false;
@@ -34,6 +38,16 @@ bool HTTPMultiSocketServer::init(HTTPServer::Handler* handler, TaskQueue* taskQu
 
     _terminationCallbacks += MethodCallback(&_closeSignal, static_cast<void (SignalSocket::*)()>(&SignalSocket::signal));
 
+#ifdef PRIME_HAVE_SOCKETREACTOR
+    if (settings->getSettings("HTTPSocketServer")->get("parkKeepAliveConnections").toBool(true)) {
+        _keepAliveReactor = PassRef(new SocketReactor);
+        if (!_keepAliveReactor->init(log)) {
+            log->warning(PRIME_LOCALISE("Couldn't start the keep-alive reactor, keep-alive connections will block threads."));
+            _keepAliveReactor.release();
+        }
+    }
+#endif
+
     Value::Vector addresses = settings->get("address").toVector();
 
     if (addresses.empty()) {
@@ -46,6 +60,20 @@ bool HTTPMultiSocketServer::init(HTTPServer::Handler* handler, TaskQueue* taskQu
     const int redirectThreadCount = socketServerSettings->get("redirectThreadCount").toInt(1);
     const int loopbackThreadCount = socketServerSettings->get("loopbackThreadCount").toInt(1);
 
+    // With SO_REUSEPORT, each address can have several listening sockets, each with its own accept threads, and
+    // the kernel spreads new connections between them. Zero or less means one listener per CPU.
+    int defaultListenerCount = socketServerSettings->get("listenersPerAddress").toInt(1);
+    const bool pinListenerThreads = socketServerSettings->get("pinListenerThreads").toBool(false);
+    const int cpuCount = Max(Thread::getCPUCount(log), 1);
+    int nextCPU = 0;
+
+#ifndef PRIME_OS_HAS_REUSEPORT_BALANCING
+    if (defaultListenerCount != 1) {
+        log->warning(PRIME_LOCALISE("Multiple listeners per address are not supported on this platform."));
+        defaultListenerCount = 1;
+    }
+#endif
+
     bool foundDefaultLoopbackAddress = false;
     SocketAddress defaultLoopbackAddress;
 
@@ -58,6 +86,7 @@ bool HTTPMultiSocketServer::init(HTTPServer::Handler* handler, TaskQueue* taskQu
         bool loopback = false;
         Value::Dictionary redirect;
         int threadCount = 1;
+        int listenerCount = defaultListenerCount;
 
         if (addressDictionary.empty()) {
             address = addressValue.toString();
@@ -85,17 +114,26 @@ bool HTTPMultiSocketServer::init(HTTPServer::Handler* handler, TaskQueue* taskQu
             }
 
             threadCount = ToInt(addressDictionary["threadCount"], thisDefaultThreadCount);
+
+#ifdef PRIME_OS_HAS_REUSEPORT_BALANCING
+            listenerCount = ToInt(addressDictionary["listeners"], listenerCount);
+#endif
+        }
+
+        if (listenerCount <= 0) {
+            listenerCount = cpuCount;
         }
 
         if (allowNonSSL && !ssl && redirect["protocol"].toString() == "https") {
             redirect = Value::Dictionary();
         }
 
+        SocketListener::Options listenerOptions;
+        listenerOptions.setDefaultPort(80).setCloseSignal(&_closeSignal).setReusePort(listenerCount > 1);
+
         RefPtr<SocketListener> listener = PassRef(new SocketListener);
         std::vector<std::string> connectTo;
-        if (!listener->init(address.c_str(),
-                SocketListener::Options().setDefaultPort(80).setCloseSignal(&_closeSignal),
-                log, &connectTo)) {
+        if (!listener->init(address.c_str(), listenerOptions, log, &connectTo)) {
             return false;
         }
 
@@ -144,19 +182,49 @@ bool HTTPMultiSocketServer::init(HTTPServer::Handler* handler, TaskQueue* taskQu
             return false;
         }
 
-        RefPtr<HTTPSocketServer> socketServer = PassRef(new HTTPSocketServer);
-        socketServer->init(listener, &_closeSignal, _taskQueue, _taskGroup, server,
-            settings->getSettings("HTTPSocketServer"), log,
-            ssl ? sslWrapper : HTTPSocketServer::ConnectionWrapper());
+        if (_metrics) {
+            server->setMetrics(_metrics);
+        }
 
-        for (int i = 0; i != threadCount; ++i) {
-            RefPtr<Thread> thread = PassRef(new Thread);
-            if (!thread->create(MethodCallback(socketServer, &HTTPSocketServer::run),
-                    HTTPSocketServer::threadSize, log, "HTTPSocketServer")) {
-                log->error(PRIME_LOCALISE("Couldn't create thread."));
-                return false;
+        for (int listenerIndex = 0; listenerIndex != listenerCount; ++listenerIndex) {
+            if (listenerIndex != 0) {
+                // Bind to the address the first listener actually got, in case it was given port 0.
+                RefPtr<SocketListener> sibling = PassRef(new SocketListener);
+                if (!sibling->init(listener->getLocalAddress(), listenerOptions, log)) {
+                    return false;
+                }
+
+                listener = sibling;
+            }
+
+            RefPtr<HTTPSocketServer> socketServer = PassRef(new HTTPSocketServer);
+            socketServer->init(listener, &_closeSignal, _taskQueue, _taskGroup, server,
+                settings->getSettings("HTTPSocketServer"), log,
+                ssl ? sslWrapper : HTTPSocketServer::ConnectionWrapper());
+            socketServer->setKeepAliveReactor(_keepAliveReactor);
+            socketServer->setLoadCounters(_loadCounters);
+
+            int cpu = nextCPU++ % cpuCount;
+
+            for (int i = 0; i != threadCount; ++i) {
+                RefPtr<Thread> thread = PassRef(new Thread);
+                if (!thread->create(MethodCallback(socketServer, &HTTPSocketServer::run),
+                        HTTPSocketServer::threadSize, log, "HTTPSocketServer")) {
+                    log->error(PRIME_LOCALISE("Couldn't create thread."));
+                    return false;
+                }
+
+                if (pinListenerThreads) {
+                    // Not fatal - the thread will just run wherever the scheduler puts it.
+                    thread->setCPUAffinity(cpu, log);
+                }
+
+                _socketServerThreads.push_back(thread);
             }
-            _socketServerThreads.push_back(thread);
+        }
+
+        if (listenerCount > 1) {
+            log->trace("%s: %d listeners sharing the address.", address.c_str(), listenerCount);
         }
     }
 
@@ -179,6 +247,12 @@ void HTTPMultiSocketServer::close(Log* log)
 
     log->verbose("No longer accepting new connections, waiting for existing connections...");
 
+    // Closing the reactor hands any idle keep-alive connections back to the TaskQueue to be closed, so this must
+    // happen before we wait on the TaskGroup.
+    if (_keepAliveReactor) {
+        _keepAliveReactor->close();
+    }
+
     if (_taskGroup) {
         _taskGroup->wait();
     }
@@ -5,9 +5,11 @@
 
 #include "Callback.h"
 #include "HTTPServer.h"
+#include "HTTPServerMetrics.h"
 #include "HTTPSocketServer.h"
 #include "Settings.h"
 #include "SignalSocket.h"
+#include "SocketReactor.h"
 #include "TaskQueue.h"
 #include "Thread.h"
 
@@ -26,8 +28,15 @@ public:
 
     void close(Log* log);
 
+    /// Record the requests served by every HTTPServer in metrics. Must be called before init().
+    void setMetrics(HTTPServerMetrics* metrics) { _metrics = metrics; }
+
     HTTPServer::Handler* getHandler() { return _handler; }
 
+    /// Returns the connection counts shared by all the HTTPSocketServers, which include the number of
+    /// connections that have been shed (see HTTPSocketServer).
+    HTTPSocketServer::LoadCounters* getLoadCounters() const { return _loadCounters; }
+
     bool hasLoopbackAddress() const { return _hasLoopbackAddress; }
     const SocketAddress& getLoopbackAddress() const
     {
@@ -41,9 +50,12 @@ public:
 private:
     CallbackList0 _terminationCallbacks;
     RefPtr<HTTPServer::Handler> _handler;
+    RefPtr<HTTPServerMetrics> _metrics;
     RefPtr<TaskQueue> _taskQueue;
     RefPtr<TaskQueue::TaskGroup> _taskGroup;
     SignalSocket _closeSignal;
+    RefPtr<SocketReactor> _keepAliveReactor;
+    RefPtr<HTTPSocketServer::LoadCounters> _loadCounters;
     std::vector<RefPtr<Thread>> _socketServerThreads;
     bool _hasLoopbackAddress;
     SocketAddress _loopbackAddress;
@@ -1,13 +1,227 @@
 // Copyright 2000-2021 Mark H. P. Lord
 
 #include "HTTPParser.h"
+#include "NumberUtils.h"
 #include "StringUtils.h"
 #include "TextEncoding.h"
+#include <string.h>
+
+#if defined(PRIME_CPU_HAS_SSE) && (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#define PRIME_HTTPPARSER_SSE2
+#include <emmintrin.h>
+#endif
+
+#if defined(PRIME_HTTPPARSER_SSE2) && defined(__AVX2__)
+#define PRIME_HTTPPARSER_AVX2
+#include <immintrin.h>
+#endif
+
+#if defined(PRIME_HTTPPARSER_SSE2) && defined(_MSC_VER)
+#include <intrin.h>
+#endif
 
 namespace Prime {
 
-HTTPParser::HTTPParser()
+namespace {
+
+    //
+    // Scanning
+    //
+
+#ifdef PRIME_HTTPPARSER_SSE2
+    inline int LowestSetBit(uint32_t mask)
+    {
+#if defined(__GNUC__)
+        return __builtin_ctz(mask);
+#elif defined(_MSC_VER)
+        unsigned long index;
+        _BitScanForward(&index, mask);
+        return (int)index;
+#else
+        return CountLowZeros(mask);
+#endif
+    }
+#endif
+
+    /// Header values may contain any byte other than control characters (except tab) and DEL.
+    inline bool IsHeaderValueTerminator(unsigned char ch)
+    {
+        return (ch < 0x20 && ch != '\t') || ch == 0x7f;
+    }
+
+    /// Returns a pointer to the first byte which can't be part of a header value. These are the newlines, which
+    /// end the value, and invalid characters.
+    inline const char* FindHeaderValueTerminatorScalar(const char* ptr, const char* end)
+    {
+        while (ptr != end && !IsHeaderValueTerminator((unsigned char)*ptr)) {
+            ++ptr;
+        }
+
+        return ptr;
+    }
+
+    /// As FindHeaderValueTerminatorScalar(), but examines 32 or 16 bytes at a time where AVX2 or SSE2 are
+    /// available.
+    const char* FindHeaderValueTerminator(const char* ptr, const char* end)
+    {
+#ifdef PRIME_HTTPPARSER_AVX2
+        if (end - ptr >= 32) {
+            const __m256i maxControl = _mm256_set1_epi8(0x1f);
+            const __m256i tab = _mm256_set1_epi8('\t');
+            const __m256i del = _mm256_set1_epi8(0x7f);
+
+            do {
+                __m256i bytes = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(ptr));
+                __m256i control = _mm256_cmpeq_epi8(_mm256_min_epu8(bytes, maxControl), bytes);
+                control = _mm256_andnot_si256(_mm256_cmpeq_epi8(bytes, tab), control);
+                control = _mm256_or_si256(control, _mm256_cmpeq_epi8(bytes, del));
+
+                uint32_t mask = (uint32_t)_mm256_movemask_epi8(control);
+                if (mask) {
+                    return ptr + LowestSetBit(mask);
+                }
+
+                ptr += 32;
+            } while (end - ptr >= 32);
+        }
+#endif
+
+#ifdef PRIME_HTTPPARSER_SSE2
+        if (end - ptr >= 16) {
+            const __m128i maxControl = _mm_set1_epi8(0x1f);
+            const __m128i tab = _mm_set1_epi8('\t');
+            const __m128i del = _mm_set1_epi8(0x7f);
+
+            do {
+                __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(ptr));
+                __m128i control = _mm_cmpeq_epi8(_mm_min_epu8(bytes, maxControl), bytes);
+                control = _mm_andnot_si128(_mm_cmpeq_epi8(bytes, tab), control);
+                control = _mm_or_si128(control, _mm_cmpeq_epi8(bytes, del));
+
+                uint32_t mask = (uint32_t)_mm_movemask_epi8(control);
+                if (mask) {
+                    return ptr + LowestSetBit(mask);
+                }
+
+                ptr += 16;
+            } while (end - ptr >= 16);
+        }
+#endif
+
+        return FindHeaderValueTerminatorScalar(ptr, end);
+    }
+
+    /// Returns true if ch is a tchar (RFC 7230), i.e., can be part of a header name.
+    inline bool IsTokenChar(unsigned char ch)
+    {
+        static const uint64_t tokenCharsLow = UINT64_C(0x03ff6cfa00000000); // 0x00-0x3f
+        static const uint64_t tokenCharsHigh = UINT64_C(0x57ffffffc7fffffe); // 0x40-0x7f
+
+        return ch < 128 && (((ch < 64 ? tokenCharsLow >> ch : tokenCharsHigh >> (ch - 64)) & 1) != 0);
+    }
+
+    //
+    // Well-known headers
+    //
+
+    /// FNV-1a of the lowercase name.
+    inline uint32_t HashHeaderName(StringView name)
+    {
+        uint32_t hash = 2166136261u;
+        for (const char* ptr = name.begin(); ptr != name.end(); ++ptr) {
+            hash = (hash ^ (uint8_t)ASCIIToLower(*ptr)) * 16777619u;
+        }
+
+        return hash;
+    }
+
+    struct WellKnownHeader {
+        const char* name;
+        uint32_t hash;
+    };
+
+    // The hashes are HashHeaderName(name).
+    const WellKnownHeader wellKnownHeaders[] = {
+        { "Accept", 0x08247e29u },
+        { "Accept-Encoding", 0xc9715a99u },
+        { "Accept-Language", 0x75f67716u },
+        { "Authorization", 0x913657beu },
+        { "Cache-Control", 0x50c8a4cdu },
+        { "Connection", 0x38b99ed9u },
+        { "Content-Disposition", 0xe7d03e5cu },
+        { "Content-Encoding", 0x03e2ed88u },
+        { "Content-Length", 0x4df9451du },
+        { "Content-Type", 0xfcf70995u },
+        { "Cookie", 0x77a740bfu },
+        { "Date", 0xd472dc59u },
+        { "ETag", 0x06c857c0u },
+        { "Expect", 0x96da6b58u },
+        { "Expires", 0x3e8ec783u },
+        { "Host", 0xaffea56fu },
+        { "If-Modified-Since", 0x83e879a9u },
+        { "If-None-Match", 0x972b6177u },
+        { "If-Range", 0x8b887e3eu },
+        { "Keep-Alive", 0xe18edb80u },
+        { "Last-Modified", 0xc0575a6bu },
+        { "Location", 0x0bf5a9a6u },
+        { "Origin", 0xd97f9a4fu },
+        { "Pragma", 0x19fa4625u },
+        { "Range", 0xfadc0cd2u },
+        { "Referer", 0xec9af966u },
+        { "Server", 0x40ac3dd2u },
+        { "Set-Cookie", 0x6e2be738u },
+        { "Transfer-Encoding", 0xddb4744cu },
+        { "Upgrade", 0xdc97cc77u },
+        { "User-Agent", 0x24259beeu },
+        { "X-Forwarded-For", 0xadb2f988u },
+        { "X-Real-IP", 0xe37b3c60u },
+        { "X-Requested-With", 0x5d54fe11u },
+    };
+
+    /// Open addressed (linear probing) on the low bits of the hash. Each entry is one more than an index in to
+    /// wellKnownHeaders, or 0 for an empty slot.
+    const uint8_t wellKnownHeaderSlots[128] = {
+        20, 0, 0, 15, 0, 0, 0, 0, 8, 32, 0, 0, 0, 0, 0, 0,
+        0, 34, 0, 0, 0, 10, 3, 0, 0, 2, 0, 0, 0, 9, 0, 0,
+        0, 0, 0, 0, 0, 24, 22, 0, 0, 1, 17, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 28, 0, 0, 0, 0, 0, 4, 11,
+        13, 19, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 29, 5, 0, 23,
+        0, 0, 25, 27, 0, 0, 0, 0, 14, 6, 12, 0, 7, 0, 0, 0,
+        33, 0, 0, 0, 0, 0, 26, 0, 0, 0, 0, 21, 0, 0, 31, 16,
+        0, 0, 0, 0, 0, 0, 0, 18, 30, 0, 0, 0, 0, 0, 0, 0
+    };
+}
+
+int HTTPParser::findWellKnownHeader(StringView name)
 {
+    PRIME_COMPILE_TIME_ASSERT(PRIME_COUNTOF(wellKnownHeaders) == wellKnownHeaderCount);
+
+    uint32_t hash = HashHeaderName(name);
+
+    for (size_t slot = hash & (PRIME_COUNTOF(wellKnownHeaderSlots) - 1);; slot = (slot + 1) & (PRIME_COUNTOF(wellKnownHeaderSlots) - 1)) {
+        int entry = wellKnownHeaderSlots[slot];
+        if (!entry) {
+            return -1;
+        }
+
+        const WellKnownHeader& header = wellKnownHeaders[entry - 1];
+        if (header.hash == hash && equalHeaders(header.name, name)) {
+            return entry - 1;
+        }
+    }
+}
+
+HTTPParser::HTTPParser(MonotonicArena* arena)
+    : _arena(arena)
+    , _headers(MonotonicArenaAllocator<Header>(arena))
+    , _vectorScanning(true)
+{
+    if (_arena) {
+        // Most requests have fewer than this many headers. Reserving avoids repeatedly abandoning memory in the
+        // arena as the vector grows.
+        _headers.reserve(24);
+    }
+
     reset();
 }
 
@@ -25,6 +239,13 @@ void HTTPParser::reset()
     _requestURL = URLView();
     _headers.clear();
     _copy.clear();
+    _rawHeaders = StringView();
+    memset(_wellKnownHeaders, 0, sizeof(_wellKnownHeaders));
+}
+
+bool HTTPParser::containsEndOfHeaders(StringView text) PRIME_NOEXCEPT
+{
+    return StringFind(text, "\r\n\r\n") != StringView::npos;
 }
 
 bool HTTPParser::parse(ParseMode mode, StreamBuffer* stream, bool copy, Log* log, bool dontAdvanceReadPointer, size_t* headersSize)
@@ -38,25 +259,32 @@ bool HTTPParser::parse(ParseMode mode, StreamBuffer* stream, bool copy, Log* log
     while (!stream->getErrorFlag()) {
         const char* ptr = stream->getReadPointer() + at;
         const char* top = stream->getTopPointer();
-        for (; ptr != top; ++ptr) {
-            if (*ptr == '\r' && foundBeginning) {
-                at = (size_t)(ptr - stream->getReadPointer());
-                if (stream->matchBytes(at, "\r\n\r\n", 4, log)) {
-                    if (!parse(mode, StringView((const char*)stream->getReadPointer(), (const char*)ptr + 4), copy, log)) {
-                        return false;
-                    }
-
-                    if (!dontAdvanceReadPointer) {
-                        stream->setReadPointer(ptr + 4);
-                    }
-                    if (headersSize) {
-                        *headersSize = static_cast<size_t>((ptr + 4) - reinterpret_cast<const char*>(stream->getReadPointer()));
-                    }
-                    return true;
+
+        if (!foundBeginning) {
+            ptr = ASCIISkipSpacesTabsAndNewlines(ptr, top);
+            foundBeginning = ptr != top;
+        }
+
+        // memchr() is vectorised by every C library we care about.
+        while (ptr != top && (ptr = (const char*)memchr(ptr, '\r', (size_t)(top - ptr))) != NULL) {
+            at = (size_t)(ptr - stream->getReadPointer());
+            if (stream->matchBytes(at, "\r\n\r\n", 4, log)) {
+                if (!parse(mode, StringView((const char*)stream->getReadPointer(), (const char*)ptr + 4), copy, log)) {
+                    return false;
                 }
-            } else if (!ASCIIIsSpaceOrTabOrNewline(*ptr)) {
-                foundBeginning = true;
+
+                if (!dontAdvanceReadPointer) {
+                    stream->setReadPointer(ptr + 4);
+                }
+                if (headersSize) {
+                    *headersSize = static_cast<size_t>((ptr + 4) - reinterpret_cast<const char*>(stream->getReadPointer()));
+                }
+                return true;
             }
+
+            // matchBytes() may have refilled the buffer.
+            ptr = stream->getReadPointer() + at + 1;
+            top = stream->getTopPointer();
         }
 
         at = (size_t)(top - stream->getReadPointer());
@@ -90,8 +318,14 @@ bool HTTPParser::parse(ParseMode mode, StringView source, bool copy, Log* log)
     }
 
     if (copy) {
-        StringCopy(_copy, source);
-        source = _copy;
+        if (_arena) {
+            source = _arena->copyString(source);
+        } else {
+            StringCopy(_copy, source);
+            source = _copy;
+        }
+
+        _rawHeaders = source;
     }
 
     // Allow whitespace before the first line.
@@ -264,35 +498,56 @@ bool HTTPParser::parse(ParseMode mode, StringView source, bool copy, Log* log)
 
         const char* nameStart = ptr;
 
-        while (ptr != end && *ptr != ':') {
+        while (ptr != end && IsTokenChar((unsigned char)*ptr)) {
             ++ptr;
         }
 
         Header header;
-        header.name = StringViewRightTrim(StringView(nameStart, ptr));
+        header.name = StringView(nameStart, ptr);
 
-        if (ptr != end) {
-            ++ptr;
+        // Be lenient about whitespace before the colon.
+        ptr = ASCIISkipSpacesAndTabs(ptr, end);
+
+        if (ptr == end || *ptr != ':' || header.name.empty()) {
+            log->error(PRIME_LOCALISE("Invalid HTTP header name."));
+            return false;
         }
 
+        ++ptr;
+
         // Field values have to convert linear whitespace a space, so I build them up in a string.
         const char* valueStart = ptr;
         const char* nextHeader = end;
-        for (; ptr != end; ++ptr) {
-            if (ASCIIIsNewline(*ptr)) {
-                const char* ptr2 = ASCIISkipNextNewline(ptr, end);
-
-                // Could be linear whitespace. The \r\n's will not make it in to the value.
-                if (ptr2 == end || !ASCIIIsSpaceOrTab(*ptr2)) {
-                    nextHeader = ptr2;
-                    break;
-                }
+        for (;;) {
+            ptr = _vectorScanning ? FindHeaderValueTerminator(ptr, end) : FindHeaderValueTerminatorScalar(ptr, end);
+            if (ptr == end) {
+                break;
+            }
+
+            if (!ASCIIIsNewline(*ptr)) {
+                log->error(PRIME_LOCALISE("Invalid character in HTTP header value."));
+                return false;
             }
+
+            const char* ptr2 = ASCIISkipNextNewline(ptr, end);
+
+            // Could be linear whitespace. The \r\n's will not make it in to the value.
+            if (ptr2 == end || !ASCIIIsSpaceOrTab(*ptr2)) {
+                nextHeader = ptr2;
+                break;
+            }
+
+            ptr = ptr2;
         }
 
         header.value = StringViewTrim(StringView(valueStart, ptr));
         ptr = nextHeader;
 
+        int wellKnown = findWellKnownHeader(header.name);
+        if (wellKnown >= 0) {
+            _wellKnownHeaders[wellKnown] = Narrow<uint32_t>(_headers.size() + 1);
+        }
+
         _headers.push_back(header);
     }
 
@@ -323,6 +578,12 @@ URL HTTPParser::getAbsoluteURL(StringView defaultProtocol) const
 
 StringView HTTPParser::get(StringView name) const
 {
+    int wellKnown = findWellKnownHeader(name);
+    if (wellKnown >= 0) {
+        uint32_t index = _wellKnownHeaders[wellKnown];
+        return index ? _headers[index - 1].value : StringView();
+    }
+
     for (size_t i = _headers.size(); i-- > 0;) {
         if (equalHeaders(_headers[i].name, name)) {
             return _headers[i].value;
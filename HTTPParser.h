@@ -4,6 +4,7 @@
 #define PRIME_HTTPPARSER_H
 
 #include "HTTP.h"
+#include "MonotonicArena.h"
 #include "StreamBuffer.h"
 #include "URL.h"
 
@@ -17,10 +18,22 @@ public:
         return ASCIIEqualIgnoringCase(a, b);
     }
 
-    HTTPParser();
+    /// Returns true if text contains the end of a complete set of headers, using the same terminator (two
+    /// CRLFs) that parse() requires.
+    static bool containsEndOfHeaders(StringView text) PRIME_NOEXCEPT;
+
+    /// If an arena is supplied, the header table and any copy of the headers are allocated from it, in which case
+    /// the arena must not be reset during the lifetime of this HTTPParser.
+    explicit HTTPParser(MonotonicArena* arena = NULL);
 
     ~HTTPParser();
 
+    /// Header values are scanned 16 or 32 bytes at a time where SSE2 or AVX2 are available. Disabling this uses
+    /// the byte at a time scanner instead, which is how HTTPParserBenchmark() measures the difference.
+    void setVectorScanning(bool value) { _vectorScanning = value; }
+
+    bool getVectorScanning() const { return _vectorScanning; }
+
     enum ParseMode {
         ParseModeRequest,
         ParseModeResponse,
@@ -31,7 +44,7 @@ public:
     /// protocol is only required if parsing requests and is used to correctly set up the URL.
     /// If copy is true, the region containing the headers is copied to an internal buffer, which is necessary
     /// if the StreamBuffer will be read from again during the lifetime of this HTTPParser. The copy is a single
-    /// memory allocation.
+    /// memory allocation (from the arena, if there is one).
     bool parse(ParseMode mode, StreamBuffer* stream, bool copy, Log* log, bool dontAdvanceReadPointer = false, size_t* headersSize = NULL);
 
     /// protocol is only required if parsing requests and is used to correctly set up the URL.
@@ -67,6 +80,8 @@ public:
         StringView value;
     };
 
+    /// Returns the value of the last header with the specified name. Well-known headers (Host, Content-Type,
+    /// Cookie, etc.) are found without searching.
     StringView get(StringView name) const;
 
     StringView operator[](StringView name) const { return get(name); }
@@ -83,13 +98,18 @@ public:
     bool isKeepAlive() const;
 
     /// May return an empty string.
-    StringView getRawHeaders() const { return _copy; }
+    StringView getRawHeaders() const { return _rawHeaders; }
 
     StringView getEncodedCookie(StringView name) const;
 
     std::string getCookie(StringView name) const;
 
 private:
+    enum { wellKnownHeaderCount = 34 };
+
+    /// Returns the index of a well-known header, or -1.
+    static int findWellKnownHeader(StringView name);
+
     /// Reset ready to re-use this object.
     void reset();
 
@@ -107,9 +127,17 @@ private:
     StringView _responseCodeText;
     URLView _requestURL;
 
-    std::vector<Header> _headers;
+    typedef std::vector<Header, MonotonicArenaAllocator<Header> > HeaderVector;
+
+    MonotonicArena* _arena;
+    HeaderVector _headers;
+    bool _vectorScanning;
+
+    /// For each well-known header, one more than the index in _headers of its last occurrence, or 0.
+    uint32_t _wellKnownHeaders[wellKnownHeaderCount];
 
     std::string _copy;
+    StringView _rawHeaders;
 
     PRIME_UNCOPYABLE(HTTPParser)
 };
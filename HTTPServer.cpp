@@ -5,13 +5,16 @@
 #include "ChunkedWriter.h"
 #include "Clocks.h"
 #include "DowngradeLog.h"
+#include "FileLocations.h"
 #include "GZipFormat.h"
 #include "GZipWriter.h"
+#include "HTTPServerMetrics.h"
 #include "JSONReader.h"
 #include "JSONWriter.h"
 #include "MersenneTwister.h"
 #include "MultiLog.h"
 #include "MultipartParser.h"
+#include "NumberUtils.h"
 #include "PrefixLog.h"
 #include "SecureRNG.h"
 #include "StreamLoader.h"
@@ -45,6 +48,11 @@ HTTPServer::~HTTPServer()
 {
 }
 
+void HTTPServer::setMetrics(HTTPServerMetrics* metrics)
+{
+    _metrics = metrics;
+}
+
 bool HTTPServer::init(Handler* handler, Log* log, Settings* settings)
 {
     _handler = handler;
@@ -66,6 +74,7 @@ bool HTTPServer::init(Handler* handler, Log* log, Settings* settings)
 void HTTPServer::updateSettings(Settings* settings)
 {
     _verboseLevel = settings->get("verboseLevel").toInt(0);
+    _maxPipelineDepth = Max(settings->get("maxPipelineDepth").toInt(defaultMaxPipelineDepth), 1);
 
     _requestOptions.load(settings);
     _responseOptions.load(settings);
@@ -73,8 +82,50 @@ void HTTPServer::updateSettings(Settings* settings)
 
 bool HTTPServer::serve(StreamBuffer* readBuffer, StreamBuffer* writeBuffer, const char* protocol,
     Log* serverLog, PrefixLog* prefixLog, bool canKeepAlive,
-    const Value::Dictionary* requestArguments)
+    const Value::Dictionary* requestArguments, MonotonicArena* arena)
+{
+    // Requests are handled strictly in order and their responses are written to writeBuffer in the same order,
+    // so pipelined responses can be batched up and flushed together.
+    bool keepAlive;
+    int depth = 0;
+    for (;;) {
+        keepAlive = serveRequest(readBuffer, writeBuffer, protocol, serverLog, prefixLog, canKeepAlive,
+            requestArguments, arena);
+
+        if (!keepAlive || ++depth >= _maxPipelineDepth || !hasPipelinedRequest(readBuffer)) {
+            break;
+        }
+    }
+
+    if (!writeBuffer->flush(serverLog)) {
+        return false;
+    }
+
+    return keepAlive;
+}
+
+bool HTTPServer::hasPipelinedRequest(const StreamBuffer* readBuffer)
+{
+    // Only continue without flushing if the client has already sent the next request's headers in full,
+    // otherwise we'd be holding on to responses while blocked reading from the client.
+    size_t available = readBuffer->getBytesAvailable();
+    if (!available) {
+        return false;
+    }
+
+    StringView buffered((const char*)readBuffer->getReadPointer(), available);
+    return HTTPParser::containsEndOfHeaders(buffered);
+}
+
+bool HTTPServer::serveRequest(StreamBuffer* readBuffer, StreamBuffer* writeBuffer, const char* protocol,
+    Log* serverLog, PrefixLog* prefixLog, bool canKeepAlive,
+    const Value::Dictionary* requestArguments, MonotonicArena* arena)
 {
+    // Nothing from the previous request on this connection survives past serveRequest().
+    if (arena) {
+        arena->reset();
+    }
+
     StringStream stringStream;
     StreamLog streamLog(&stringStream);
 
@@ -84,7 +135,7 @@ bool HTTPServer::serve(StreamBuffer* readBuffer, StreamBuffer* writeBuffer, cons
 
     Log* log = &multiLog;
 
-    Request request;
+    Request request(arena);
     request.init(_requestOptions, Clock::getCurrentTime(), log);
     if (requestArguments) {
         request._arguments = *requestArguments;
@@ -118,6 +169,8 @@ bool HTTPServer::serve(StreamBuffer* readBuffer, StreamBuffer* writeBuffer, cons
     response.setErrorLogCallback(MethodCallback(&getter, &StringStreamStringGetter::getString));
 #endif
 
+    Stream::Offset readStartOffset = readBuffer->getEmulatedOffset();
+
     if (!request.parse(readBuffer, protocol)) {
         if (request.connectionWasClosed()) {
             return false;
@@ -130,6 +183,9 @@ bool HTTPServer::serve(StreamBuffer* readBuffer, StreamBuffer* writeBuffer, cons
 
     response.setRequest(request);
 
+    // Latency is measured from when the request's headers have been received.
+    double startTime = _metrics ? Clock::getMonotonicSeconds() : 0;
+
     StringView realIP = request.getRealIP();
     if (!realIP.empty()) {
         prefixLog->setPrefix(MakeString("Client ", realIP));
@@ -145,6 +201,7 @@ bool HTTPServer::serve(StreamBuffer* readBuffer, StreamBuffer* writeBuffer, cons
             response.setConnectionClose();
             response.error(request, 417);
             response.send(log);
+            recordMetrics(request, response, startTime, readStartOffset, readBuffer);
             return false;
         }
     }
@@ -166,10 +223,13 @@ bool HTTPServer::serve(StreamBuffer* readBuffer, StreamBuffer* writeBuffer, cons
     }
 #endif
 
-    if (!response.send(log) || !writeBuffer->flush(log)) {
+    // serve() flushes once all the pipelined requests have been handled.
+    if (!response.send(log)) {
         return false;
     }
 
+    recordMetrics(request, response, startTime, readStartOffset, readBuffer);
+
     bool keepAlive = response.getKeepAlive(); // Value is lost by close(), so remember it
 
     response.close();
@@ -177,6 +237,20 @@ bool HTTPServer::serve(StreamBuffer* readBuffer, StreamBuffer* writeBuffer, cons
     return keepAlive;
 }
 
+void HTTPServer::recordMetrics(const Request& request, const Response& response, double startTime,
+    Stream::Offset readStartOffset, const StreamBuffer* readBuffer)
+{
+    if (!_metrics) {
+        return;
+    }
+
+    Stream::Offset bytesIn = readBuffer->getEmulatedOffset() - readStartOffset;
+
+    _metrics->record(request.getMethod(), request.getRoute(), response.getResponseCode(),
+        (uint64_t)Max<Stream::Offset>(bytesIn, 0), (uint64_t)Max<Stream::Offset>(response.getBytesSent(), 0),
+        Clock::getMonotonicSeconds() - startTime);
+}
+
 //
 // HTTPServer::Request::Options
 //
@@ -194,6 +268,18 @@ bool HTTPServer::Request::Options::load(Settings* settings)
     _multipartMaxHeaderSizeInBytes = settings->get("multipartMaxHeaderSizeInBytes").toUInt(8192);
     _multipartMaxPartSizeInBytes = settings->get("multipartMaxPartSizeInBytes").toUInt(15 * 1024 * 1024);
 
+    // File uploads larger than this are written to a TempFile rather than kept in memory (0 to disable).
+    _multipartSpillThresholdInBytes = settings->get("multipartSpillThresholdInBytes").toUInt(0);
+
+    // Spilled uploads aren't bounded by multipartMaxPartSizeInBytes, so they have their own limit, which
+    // defaults to the part limit.
+    _multipartMaxFileSizeInBytes = settings->get("multipartMaxFileSizeInBytes").toInt64(0);
+    if (_multipartMaxFileSizeInBytes <= 0) {
+        _multipartMaxFileSizeInBytes = (int64_t)_multipartMaxPartSizeInBytes;
+    }
+
+    _multipartSpillPath = settings->get("multipartSpillPath").toString();
+
     return true;
 }
 
@@ -387,6 +473,9 @@ bool HTTPServer::Request::parseMultipartFormData(StreamBuffer* rawStream)
     }
 
     Value::Dictionary& dictionary = _json.resetDictionary();
+    _formFiles.clear();
+
+    std::vector<char> chunk(65536);
 
     while (RefPtr<Stream> stream = multipart.readPart(_log)) {
         StreamBuffer buffer(stream, _options._multipartMaxHeaderSizeInBytes);
@@ -411,6 +500,7 @@ bool HTTPServer::Request::parseMultipartFormData(StreamBuffer* rawStream)
         }
 
         std::string fieldName;
+        bool isFile = false;
 
         for (;;) {
             if (!HTTPSkip(dispositionHeader, ";", dispositionHeader)) {
@@ -425,6 +515,7 @@ bool HTTPServer::Request::parseMultipartFormData(StreamBuffer* rawStream)
                     fieldName.swap(value);
                 } else if (name == "filename") {
                     dictionary.set(fieldName + "__filename", value);
+                    isFile = true;
                 }
             }
         }
@@ -434,11 +525,15 @@ bool HTTPServer::Request::parseMultipartFormData(StreamBuffer* rawStream)
             return false;
         }
 
+        const size_t spillThreshold = isFile ? _options._multipartSpillThresholdInBytes : 0;
+
         std::string fieldValue;
+        RefPtr<TempFile> file;
+        int64_t fileSize = 0;
 
         for (;;) {
-            char buf[256];
-            ptrdiff_t nread = buffer.readSome(&buf, sizeof(buf), _log);
+            // Once the headers' buffer is empty, read straight from the part.
+            ptrdiff_t nread = buffer.getBytesAvailable() ? buffer.readSome(&chunk[0], chunk.size(), _log) : stream->readSome(&chunk[0], chunk.size(), _log);
             if (nread < 0) {
                 return false;
             }
@@ -446,14 +541,48 @@ bool HTTPServer::Request::parseMultipartFormData(StreamBuffer* rawStream)
                 break;
             }
 
-            fieldValue.insert(fieldValue.end(), buf, buf + nread);
+            if (file) {
+                if (!file->writeExact(&chunk[0], (size_t)nread, _log)) {
+                    return false;
+                }
+
+                fileSize += nread;
+                if (fileSize > _options._multipartMaxFileSizeInBytes) {
+                    _log->error(PRIME_LOCALISE("Upload exceeds maximum (%" PRId64 ")"), _options._multipartMaxFileSizeInBytes);
+                    return false;
+                }
+
+                continue;
+            }
+
+            fieldValue.append(&chunk[0], (size_t)nread);
+
+            if (spillThreshold && fieldValue.size() > spillThreshold) {
+                file = createSpillFile();
+                if (!file || !file->writeExact(fieldValue.data(), fieldValue.size(), _log)) {
+                    return false;
+                }
+
+                fileSize = (int64_t)fieldValue.size();
+                std::string().swap(fieldValue);
+                continue;
+            }
+
             if (fieldValue.size() > _options._multipartMaxPartSizeInBytes) {
                 _log->error(PRIME_LOCALISE("Upload exceeds maximum (%" PRIuPTR ")"), _options._multipartMaxPartSizeInBytes);
                 return false;
             }
         }
 
-        dictionary.set(fieldName, fieldValue);
+        if (file) {
+            if (!file->flush(_log) || file->seek(0, Stream::SeekModeAbsolute, _log) != 0) {
+                return false;
+            }
+
+            _formFiles[fieldName] = file;
+        } else {
+            dictionary.set(fieldName, fieldValue);
+        }
     }
 
     if (!multipart.atEnd()) {
@@ -463,6 +592,27 @@ bool HTTPServer::Request::parseMultipartFormData(StreamBuffer* rawStream)
     return true;
 }
 
+RefPtr<TempFile> HTTPServer::Request::createSpillFile()
+{
+    std::string path = _options._multipartSpillPath;
+    if (path.empty()) {
+        path = GetTemporaryPath(_log);
+    }
+
+    RefPtr<TempFile> file = PassRef(new TempFile);
+    if (!file->createInPath(path.c_str(), _log)) {
+        return NULL;
+    }
+
+    return file;
+}
+
+RefPtr<TempFile> HTTPServer::Request::getFormFile(StringView name) const
+{
+    std::map<std::string, RefPtr<TempFile>>::const_iterator iter = _formFiles.find(std::string(name.begin(), name.end()));
+    return iter == _formFiles.end() ? NULL : iter->second;
+}
+
 bool HTTPServer::Request::isAJAXRequest() const
 {
     return ASCIIEqualIgnoringCase(getHeader("X-Requested-With"), "xmlhttprequest");
@@ -613,6 +763,7 @@ bool HTTPServer::Response::Options::load(Settings* settings)
 {
     _responseBufferSize = settings->get("responseBufferSize").toUInt(64 * 1024);
     _useZeroCopy = settings->get("useZeroCopy").toBool(true);
+    _gzipDynamicContent = settings->get("gzipDynamicContent").toBool(true);
     _gzipDynamicContentSizeInBytes = settings->get("gzipDynamicContentSizeInBytes").toInt(1024);
     _gzipStaticContentSizeInBytes = settings->get("gzipStaticContentSizeInBytes").toInt(1024);
     _gzipCompressInMemorySizeInBytes = settings->get("gzipCompressInMemorySizeInBytes").toInt(128 * 1024);
@@ -620,6 +771,26 @@ bool HTTPServer::Response::Options::load(Settings* settings)
     _gzipCompressionLevel = settings->get("gzipCompressionLevel").toInt(4);
     _verboseLevel = settings->get("verboseLevel").toInt(0);
 
+    // If gzipContentTypes isn't set, content of any type may be compressed. Otherwise it's a list (or a comma
+    // separated string) of the media types which may be, e.g., "text/*, application/json, image/svg+xml".
+    _gzipContentTypes.release();
+
+    Value gzipContentTypes = settings->get("gzipContentTypes");
+    if (!gzipContentTypes.isUndefined()) {
+        _gzipContentTypes = PassRef(new ContentTypeList);
+
+        Value::Vector vector = gzipContentTypes.toVector();
+        for (size_t i = 0; i != vector.size(); ++i) {
+            std::vector<std::string> types = StringSplit(vector[i].toString(), ",");
+            for (size_t j = 0; j != types.size(); ++j) {
+                StringView type = StringViewTrim(types[j]);
+                if (!type.empty()) {
+                    _gzipContentTypes->contentTypes.push_back(type.to_string());
+                }
+            }
+        }
+    }
+
     return true;
 }
 
@@ -735,6 +906,10 @@ void HTTPServer::Response::construct()
     _method = HTTPMethodUnknown;
     setResponseCode(200);
     _acceptGZip = false;
+    _gzipContent = false;
+    _canChunk = false;
+    _streamStartOffset = 0;
+    _bytesSentBypassingStream = 0;
 }
 
 HTTPServer::Response::Response()
@@ -754,6 +929,10 @@ void HTTPServer::Response::init(StreamBuffer* stream, const UnixTime& time, cons
 
     _sent = false;
     _keepAlive = false;
+    _gzipContent = options._gzipDynamicContent;
+
+    _streamStartOffset = stream->getEmulatedOffset();
+    _bytesSentBypassingStream = 0;
 
     setHeader("Server", "Prime/1.0");
     setHeader("Date", time);
@@ -768,6 +947,16 @@ void HTTPServer::Response::setRequest(Request& request)
     _headerOnly = (_method == HTTPMethodHead);
 
     _acceptGZip = request.getAcceptEncoding("gzip") > 0;
+    _canChunk = request.isHTTPVersionOrNewer(1, 1);
+}
+
+Stream::Offset HTTPServer::Response::getBytesSent() const
+{
+    if (!_stream) {
+        return _bytesSentBypassingStream;
+    }
+
+    return _stream->getEmulatedOffset() - _streamStartOffset + _bytesSentBypassingStream;
 }
 
 void HTTPServer::Response::close()
@@ -901,6 +1090,33 @@ void HTTPServer::Response::clearContent()
     _content.resize(0);
 }
 
+bool HTTPServer::Response::isGZipContentType(StringView contentType) const
+{
+    if (!_options._gzipContentTypes) {
+        return true;
+    }
+
+    StringView mediaType = StringViewTrim(StringViewBisect(contentType, ';').first);
+    if (mediaType.empty()) {
+        return false;
+    }
+
+    const std::vector<std::string>& allowed = _options._gzipContentTypes->contentTypes;
+    for (size_t i = 0; i != allowed.size(); ++i) {
+        StringView pattern(allowed[i]);
+        if (StringEndsWith(pattern, "/*")) {
+            // Matches "text/*" against "text/html".
+            if (mediaType.size() > pattern.size() - 1 && ASCIIEqualIgnoringCase(mediaType.substr(0, pattern.size() - 1), pattern.substr(0, pattern.size() - 1))) {
+                return true;
+            }
+        } else if (pattern == "*" || ASCIIEqualIgnoringCase(mediaType, pattern)) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
 void HTTPServer::Response::setContentType(StringView type)
 {
     setHeader("Content-Type", type);
@@ -943,8 +1159,17 @@ bool HTTPServer::Response::send(Log* log)
     StringStream gziped;
     bool isGZiped = false;
 
-    if (shouldGZip() && _content.size() >= (size_t)_options._gzipDynamicContentSizeInBytes) {
-        if (getHeader("Content-Encoding").empty()) {
+    if (!_content.empty() && _content.size() >= (size_t)_options._gzipDynamicContentSizeInBytes && isContentCompressible()) {
+        // Whether or not we compress, the response depends on Accept-Encoding.
+        addHeader("Vary", "Accept-Encoding");
+
+        if (!_acceptGZip) {
+            // Send it uncompressed.
+
+        } else if (_content.size() > (size_t)_options._gzipCompressInMemorySizeInBytes && _options._gzipChunked && _canChunk) {
+            return sendContentGZipChunked(log);
+
+        } else {
             PrefixLog gzipPrefixLog(log, "gzip");
             DowngradeLog gzipLog(&gzipPrefixLog, Log::LevelWarning);
 
@@ -968,13 +1193,7 @@ bool HTTPServer::Response::send(Log* log)
 
 #endif
 
-    _sent = true;
-
-    if (_options._verboseLevel >= 2) {
-        log->trace(MakeString("Response headers: ", _headers.getRawHeaders()));
-    }
-
-    if (!_headers.send(_stream, log)) {
+    if (!sendHeaders(log)) {
         return false;
     }
 
@@ -1002,6 +1221,17 @@ bool HTTPServer::Response::send(Log* log)
     return true;
 }
 
+bool HTTPServer::Response::sendHeaders(Log* log)
+{
+    _sent = true;
+
+    if (_options._verboseLevel >= 2) {
+        log->trace(MakeString("Response headers: ", _headers.getRawHeaders()));
+    }
+
+    return _headers.send(_stream, log);
+}
+
 void HTTPServer::Response::redirect(StringView path)
 {
     PRIME_ASSERT(!_sent);
@@ -1072,6 +1302,25 @@ bool HTTPServer::Response::sendStream(Stream* stream, Stream::Offset size, Log*
         }
     }
 
+    if (!sendStreamContent(stream, size, log)) {
+        return false;
+    }
+
+    if (sendOptions.isRawDeflated()) {
+        if (_options._verboseLevel >= 2) {
+            log->trace("Sending gzip footer.");
+        }
+
+        if (!sendGZipFooter(_stream, sendOptions.getUncompressedSize(), sendOptions.getCRC32(), log)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool HTTPServer::Response::sendStreamContent(Stream* stream, Stream::Offset size, Log* log)
+{
     if (_options._useZeroCopy) {
         if (_options._verboseLevel >= 2) {
             log->trace("Sending %" PRIME_PRId_STREAM " bytes from a Stream (trying zero-copy).", size);
@@ -1086,30 +1335,109 @@ bool HTTPServer::Response::sendStream(Stream* stream, Stream::Offset size, Log*
         if (!_stream->getUnderlyingStream()->copyFrom(stream, log, size, log, _options._responseBufferSize)) {
             return false;
         }
-    } else {
 
-        // Send via _stream's buffer, which precludes zero-copy being used.
+        _bytesSentBypassingStream += size;
+        return true;
+    }
 
-        if (_options._verboseLevel >= 2) {
-            log->trace("Sending %" PRIME_PRId_STREAM " bytes from a Stream.", size);
+    // Send via _stream's buffer, which precludes zero-copy being used.
+
+    if (_options._verboseLevel >= 2) {
+        log->trace("Sending %" PRIME_PRId_STREAM " bytes from a Stream.", size);
+    }
+
+    return _stream->copyFrom(stream, log, size, log, _options._responseBufferSize);
+}
+
+bool HTTPServer::Response::sendStreamRanges(Stream* stream, Stream::Offset size, const std::vector<HTTPByteRange>& ranges,
+    Log* log)
+{
+    PRIME_ASSERT(_content.empty());
+    PRIME_ASSERT(!ranges.empty());
+
+    setResponseCode(206);
+
+    if (ranges.size() == 1) {
+        const HTTPByteRange& range = ranges[0];
+
+        setHeader("Content-Range", MakeString("bytes ", range.first, "-", range.last, "/", size));
+        setContentLength((uint64_t)range.getLength());
+
+        if (!send(log)) {
+            return false;
+        }
+
+        if (isHeaderOnly()) {
+            return true;
         }
 
-        if (!_stream->copyFrom(stream, log, size, log, _options._responseBufferSize)) {
+        RefPtr<Substream> region = PassRef(new Substream);
+        if (!region->init(stream, range.first, true, range.getLength(), log)) {
             return false;
         }
+
+        return sendStreamContent(region, range.getLength(), log);
     }
 
-    if (sendOptions.isRawDeflated()) {
-        if (_options._verboseLevel >= 2) {
-            log->trace("Sending gzip footer.");
+    // multipart/byteranges. The boundary only has to be unlikely to appear in the content.
+    char boundary[25];
+    MersenneTwister mt;
+    mt.seed(Clock::getLoopingMonotonicMilliseconds32() ^ (uint32_t)size);
+    for (size_t i = 0; i != sizeof(boundary) - 1; ++i) {
+        static const char symbols[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789";
+        boundary[i] = symbols[mt.generate() % (sizeof(symbols) - 1)];
+    }
+    boundary[sizeof(boundary) - 1] = 0;
+
+    std::string contentType(getHeader("Content-Type").to_string());
+
+    std::vector<std::string> partHeaders(ranges.size());
+    uint64_t contentLength = 0;
+    for (size_t i = 0; i != ranges.size(); ++i) {
+        std::string& partHeader = partHeaders[i];
+        partHeader = MakeString("\r\n--", boundary, "\r\n");
+        if (!contentType.empty()) {
+            partHeader += MakeString("Content-Type: ", contentType, "\r\n");
         }
+        partHeader += MakeString("Content-Range: bytes ", ranges[i].first, "-", ranges[i].last, "/", size, "\r\n\r\n");
 
-        if (!sendGZipFooter(_stream, sendOptions.getUncompressedSize(), sendOptions.getCRC32(), log)) {
+        contentLength += partHeader.size() + (uint64_t)ranges[i].getLength();
+    }
+
+    std::string trailer = MakeString("\r\n--", boundary, "--\r\n");
+    contentLength += trailer.size();
+
+    setHeader("Content-Type", MakeString("multipart/byteranges; boundary=", boundary));
+    setContentLength(contentLength);
+
+    if (!send(log)) {
+        return false;
+    }
+
+    if (isHeaderOnly()) {
+        return true;
+    }
+
+    if (_options._verboseLevel >= 2) {
+        log->trace("Sending %" PRIuPTR " ranges.", ranges.size());
+    }
+
+    for (size_t i = 0; i != ranges.size(); ++i) {
+        if (!_stream->writeExact(partHeaders[i].data(), partHeaders[i].size(), log)) {
+            return false;
+        }
+
+        RefPtr<Substream> region = PassRef(new Substream);
+        if (!region->init(stream, ranges[i].first, true, ranges[i].getLength(), log)) {
+            return false;
+        }
+
+        if (!sendStreamContent(region, ranges[i].getLength(), log)) {
             return false;
         }
     }
 
-    return true;
+    return _stream->writeExact(trailer.data(), trailer.size(), log);
 }
 
 bool HTTPServer::Response::sendGZipHeader(Stream* stream, Log* log)
@@ -1175,13 +1503,26 @@ bool HTTPServer::Response::sendStreamChunked(Stream* stream, Log* log, const Sen
 
 RefPtr<Stream> HTTPServer::Response::beginStream(uint64_t contentLength, Log* log)
 {
+#ifndef PRIME_NO_ZLIB
+
+    if (_options._gzipDynamicContentSizeInBytes >= 0 && contentLength >= (uint64_t)_options._gzipDynamicContentSizeInBytes && isContentCompressible()) {
+        addHeader("Vary", "Accept-Encoding");
+
+        // The compressed length isn't known in advance, so compressing requires chunked encoding.
+        if (_acceptGZip && _options._gzipChunked && _canChunk) {
+            return beginGZipChunked(log);
+        }
+    }
+
+#endif
+
     setContentLength((uint64_t)contentLength);
 
     if (!send(log)) {
         return NULL;
     }
 
-    if (!isHeaderOnly()) {
+    if (isHeaderOnly()) {
         return NULL;
     }
 
@@ -1196,44 +1537,20 @@ RefPtr<Stream> HTTPServer::Response::beginChunked(Log* log, const SendStreamOpti
 {
 #ifndef PRIME_NO_ZLIB
 
-    bool gzip = shouldGZip() && !options.isAlreadyCompressed();
-
-    if (gzip) {
-        setHeader("Content-Encoding", "gzip");
-    }
-
-    setHeader("Transfer-Encoding", "chunked");
-
-    if (!send(log)) {
-        return NULL;
-    }
-
-    if (isHeaderOnly()) {
-        return NULL;
-    }
-
-    RefPtr<ChunkedWriter> chunkedStream = PassRef(new ChunkedWriter(PassRef(new UnclosableStream(_stream))));
-
-    if (!gzip) {
-        return chunkedStream;
-    }
-
-    RefPtr<GZipWriter> gzipStream = PassRef(new GZipWriter);
-    if (!gzipStream->begin(chunkedStream, _options._gzipCompressionLevel, log)) {
-        errorHTML(500, "Couldn't initialise gzip stream");
-        return NULL;
-    }
+    if (!options.isAlreadyCompressed() && isContentCompressible()) {
+        addHeader("Vary", "Accept-Encoding");
 
-    if (_options._verboseLevel >= 2) {
-        log->trace("Returning Stream to application to write response (gzip'd).");
+        if (_acceptGZip) {
+            return beginGZipChunked(log);
+        }
     }
 
-    return gzipStream;
-
 #else
 
     (void)options;
 
+#endif
+
     setHeader("Transfer-Encoding", "chunked");
 
     if (!send(log)) {
@@ -1244,10 +1561,16 @@ RefPtr<Stream> HTTPServer::Response::beginChunked(Log* log, const SendStreamOpti
         return NULL;
     }
 
-    RefPtr<ChunkedWriter> chunkedStream = PassRef(new ChunkedWriter(PassRef(new UnclosableStream(_stream))));
-    return chunkedStream;
+    if (_options._verboseLevel >= 2) {
+        log->trace("Returning Stream to application to write response (chunked).");
+    }
 
-#endif
+    return PassRef(new ChunkedWriter(PassRef(new UnclosableStream(_stream))));
+}
+
+bool HTTPServer::Response::isContentCompressible() const
+{
+    return _gzipContent && isGZipEnabled() && getHeader("Content-Encoding").empty() && isGZipContentType(getHeader("Content-Type"));
 }
 
 #ifndef PRIME_NO_ZLIB
@@ -1322,6 +1645,75 @@ bool HTTPServer::Response::compressAndSendStreamChunked(Stream* stream, Log* log
     return true;
 }
 
+RefPtr<Stream> HTTPServer::Response::beginGZipChunked(Log* log)
+{
+    PRIME_ASSERT(_content.empty());
+
+    removeHeader("Content-Length");
+    setHeader("Transfer-Encoding", "chunked");
+    setHeader("Content-Encoding", "gzip");
+
+    if (!send(log)) {
+        return NULL;
+    }
+
+    if (isHeaderOnly()) {
+        return NULL;
+    }
+
+    if (_options._verboseLevel >= 2) {
+        log->trace("Returning Stream to application to write response (gzip'd).");
+    }
+
+    return createGZipChunkedStream(log);
+}
+
+RefPtr<Stream> HTTPServer::Response::createGZipChunkedStream(Log* log)
+{
+    // application -> deflater -> chunker -> _stream. Each write is compressed as it's made and GZipWriter
+    // writes its output in blocks, so each chunk is a reasonable size.
+
+    RefPtr<ChunkedWriter> chunkedStream = PassRef(new ChunkedWriter(PassRef(new UnclosableStream(_stream))));
+
+    RefPtr<GZipWriter> gzipStream = PassRef(new GZipWriter);
+    if (!gzipStream->begin(chunkedStream, _options._gzipCompressionLevel, log)) {
+        log->error(PRIME_LOCALISE("Couldn't initialise gzip stream."));
+        return NULL;
+    }
+
+    return gzipStream;
+}
+
+bool HTTPServer::Response::sendContentGZipChunked(Log* log)
+{
+    removeHeader("Content-Length");
+    setHeader("Transfer-Encoding", "chunked");
+    setHeader("Content-Encoding", "gzip");
+
+    if (!sendHeaders(log)) {
+        return false;
+    }
+
+    if (isHeaderOnly()) {
+        return true;
+    }
+
+    RefPtr<Stream> gzipStream = createGZipChunkedStream(log);
+    if (!gzipStream) {
+        return false;
+    }
+
+    if (!gzipStream->writeExact(_content.data(), _content.size(), log) || !gzipStream->close(log)) {
+        return false;
+    }
+
+    if (_options._verboseLevel >= 2) {
+        log->trace("Compressed dynamic content of %" PRIuPTR " bytes while sending it.", _content.size());
+    }
+
+    return true;
+}
+
 bool HTTPServer::Response::gzip(Stream* out, Stream* in, Log* log, Stream::Offset* originalSizeOut)
 {
     GZipWriter gziper;
@@ -1429,15 +1821,15 @@ bool HTTPServer::Redirecter::handleRequest(Request& request, Response& response)
 // HTTPServer::Router::Entry
 //
 
-int HTTPServer::Router::Entry::match(const URLPath& with, Value::Dictionary* arguments) const
+int HTTPServer::Router::Entry::match(const URLPath& with, size_t offset, Value::Dictionary* arguments) const
 {
-    size_t withLength = with.getComponentCount();
+    size_t withLength = with.getComponentCount() - offset;
     size_t ourLength = path.getComponentCount();
 
     size_t i;
     for (i = 0; i != ourLength; ++i) {
         StringView ourComponent = path.getComponent(i);
-        StringView withComponent = i >= withLength ? StringView() : with.getComponent(i);
+        StringView withComponent = i >= withLength ? StringView() : with.getComponent(offset + i);
 
         if (!ourComponent.empty() && ourComponent[0] == '=') {
             if (ourComponent.size() >= 2 && ourComponent[1] == '=') {
@@ -1490,6 +1882,7 @@ bool HTTPServer::CallbackHandler::handleRequest(Request& request, Response& resp
 //
 
 HTTPServer::Router::Router()
+    : _nodes(1)
 {
 }
 
@@ -1509,7 +1902,8 @@ void HTTPServer::Router::route(URLPath path, HTTPMethod method, const HandlerCal
     entry.path.swap(path);
     entry.method = method;
     entry.handlerCallback = handler;
-    _entries.push_back(PRIME_MOVE(entry));
+    entry.isRouter = false;
+    addEntry(entry);
 }
 
 void HTTPServer::Router::route(URLPath path, const HandlerCallback& getHandler, const HandlerCallback& postHandler)
@@ -1529,7 +1923,7 @@ void HTTPServer::Router::route(URLPath path, HTTPMethod method, Handler* handler
     entry.method = method;
     entry.handler = handler;
     entry.isRouter = false;
-    _entries.push_back(PRIME_MOVE(entry));
+    addEntry(entry);
 }
 
 void HTTPServer::Router::route(URLPath path, Router* router)
@@ -1539,11 +1933,75 @@ void HTTPServer::Router::route(URLPath path, Router* router)
     entry.method = HTTPMethodUnknown;
     entry.handler = router;
     entry.isRouter = true;
+    addEntry(entry);
+}
+
+void HTTPServer::Router::addEntry(Entry& entry)
+{
+    // A Router mounted at the root path contributes nothing to the route.
+    if (entry.path.getComponentCount() != 0 || !entry.isRouter) {
+        entry.route = entry.path.toString(URLPath::StringOptions().setWithoutEscaping());
+    }
+
+    size_t index = _entries.size();
+    size_t node = 0;
+
+    size_t length = entry.path.getComponentCount();
+    size_t i;
+    for (i = 0; i != length; ++i) {
+        StringView component = entry.path.getComponent(i);
+
+        if (!component.empty() && component[0] == '=') {
+            if (component.size() >= 2 && component[1] == '=') {
+                // Anything following a == is never matched.
+                break;
+            }
+
+            if (!_nodes[node].parameter) {
+                size_t parameter = _nodes.size();
+                _nodes.push_back(Node());
+                _nodes[node].parameter = parameter;
+            }
+
+            node = _nodes[node].parameter;
+            continue;
+        }
+
+        node = findOrCreateChild(node, component);
+    }
+
+    if (i != length) {
+        _nodes[node].wildcards.push_back(index);
+    } else {
+        _nodes[node].entries.push_back(index);
+    }
+
     _entries.push_back(PRIME_MOVE(entry));
 }
 
+size_t HTTPServer::Router::findOrCreateChild(size_t node, StringView component)
+{
+    std::vector<Node::Child>& literals = _nodes[node].literals;
+    std::vector<Node::Child>::iterator iter = std::lower_bound(literals.begin(), literals.end(), component);
+    if (iter != literals.end() && StringsEqual(iter->component, component)) {
+        return iter->node;
+    }
+
+    Node::Child child;
+    child.component = component.to_string();
+    child.node = _nodes.size();
+    literals.insert(iter, child);
+
+    // May invalidate literals.
+    _nodes.push_back(Node());
+
+    return child.node;
+}
+
 bool HTTPServer::Router::reroute(const URLPath& path, Request& request, Response& response)
 {
+    request.setRoute("");
+
     if (routeRequest(path, 0, request, response)) {
         return true;
     }
@@ -1556,7 +2014,7 @@ bool HTTPServer::Router::reroute(const URLPath& path, Request& request, Response
         fixed = path.toDirectory();
     }
 
-    if (fixed.getComponentCount() > 0 && findEntry(fixed, request.getMethod())) {
+    if (fixed.getComponentCount() > 0 && findEntry(fixed, 0, request.getMethod())) {
         URL newURL(request.getURL());
         newURL.setPathComponents(fixed);
         response.redirect(newURL.toString().c_str());
@@ -1582,22 +2040,16 @@ bool HTTPServer::Router::handleRequest(Request& request, Response& response)
 
 bool HTTPServer::Router::routeRequest(const URLPath& path, int pathOffset, Request& request, Response& response)
 {
-    const URLPath* subPath;
-    URLPath pathTail;
-    if (pathOffset <= 0) {
-        subPath = &path;
-    } else {
-        pathTail = path.getTail((unsigned int)pathOffset);
-        subPath = &pathTail;
-    }
+    size_t offset = pathOffset <= 0 ? 0 : Min((size_t)pathOffset, path.getComponentCount());
 
-    const Entry* best = findEntry(*subPath, request.getMethod());
+    const Entry* best = findEntry(path, offset, request.getMethod());
 
     if (best) {
         Value::Dictionary arguments;
         // best->match returns a different value for == when it has an arguments argument
-        int matchLength = best->match(*subPath, &arguments);
-        request.setPathOffset(matchLength + pathOffset);
+        int matchLength = best->match(path, offset, &arguments);
+        request.setPathOffset(matchLength + (int)offset);
+        request.appendRoute(best->route);
         if (request.isVerboseEnabled() && !arguments.empty() && !best->isRouter) {
             request.getLog()->trace(MakeString("Arguments: ", arguments));
         }
@@ -1616,7 +2068,7 @@ bool HTTPServer::Router::routeRequest(const URLPath& path, int pathOffset, Reque
 
         if (best->handler) {
             if (best->isRouter) {
-                return static_cast<Router*>(best->handler.get())->routeRequest(path, pathOffset + matchLength, request, response);
+                return static_cast<Router*>(best->handler.get())->routeRequest(path, (int)offset + matchLength, request, response);
             } else {
                 return best->handler->handleRequest(request, response);
             }
@@ -1626,24 +2078,65 @@ bool HTTPServer::Router::routeRequest(const URLPath& path, int pathOffset, Reque
     return false;
 }
 
-const HTTPServer::Router::Entry* HTTPServer::Router::findEntry(const URLPath& path, HTTPMethod method) const
+const HTTPServer::Router::Entry* HTTPServer::Router::findEntry(const URLPath& path, size_t offset, HTTPMethod method) const
 {
-    const Entry* best = NULL;
-    int bestLength = 0;
+    // Arguments aren't captured during the search: a parameter's value is the path component at the same
+    // depth, so only the winning Entry needs to extract them.
+    Match best;
+    best.entry = 0;
+    best.length = 0;
 
-    for (size_t i = 0; i != _entries.size(); ++i) {
-        const Entry& entry = _entries[i];
+    findEntry(path, offset, method, 0, 0, best);
 
-        if (entry.method == method || entry.method == HTTPMethodUnknown) {
-            int length = entry.match(path, NULL);
-            if (length > bestLength) {
-                bestLength = length;
-                best = &entry;
-            }
+    return best.length > 0 ? &_entries[best.entry] : NULL;
+}
+
+void HTTPServer::Router::findEntry(const URLPath& path, size_t offset, HTTPMethod method, size_t nodeIndex,
+    size_t depth, Match& best) const
+{
+    const Node& node = _nodes[nodeIndex];
+    size_t withLength = path.getComponentCount() - offset;
+
+    // These scores must match those of Entry::match().
+    for (size_t i = 0; i != node.wildcards.size(); ++i) {
+        considerEntry(node.wildcards[i], method, Narrow<int>(depth + (depth < withLength ? 1 : 0)), best);
+    }
+
+    for (size_t i = 0; i != node.entries.size(); ++i) {
+        size_t entry = node.entries[i];
+        if (_entries[entry].isRouter || depth == withLength) {
+            considerEntry(entry, method, Narrow<int>(depth), best);
         }
     }
 
-    return best;
+    if (depth == withLength) {
+        return;
+    }
+
+    StringView component = path.getComponent(offset + depth);
+
+    std::vector<Node::Child>::const_iterator iter = std::lower_bound(node.literals.begin(), node.literals.end(), component);
+    if (iter != node.literals.end() && StringsEqual(iter->component, component)) {
+        findEntry(path, offset, method, iter->node, depth + 1, best);
+    }
+
+    if (node.parameter && !component.empty()) {
+        findEntry(path, offset, method, node.parameter, depth + 1, best);
+    }
+}
+
+void HTTPServer::Router::considerEntry(size_t entry, HTTPMethod method, int length, Match& best) const
+{
+    HTTPMethod entryMethod = _entries[entry].method;
+    if (entryMethod != method && entryMethod != HTTPMethodUnknown) {
+        return;
+    }
+
+    // Longest match wins, with ties going to whichever route was added first.
+    if (length > best.length || (length == best.length && length > 0 && entry < best.entry)) {
+        best.entry = entry;
+        best.length = length;
+    }
 }
 
 //
@@ -1687,6 +2180,30 @@ HTTPServer::Router::FilterCallback HTTPServer::SessionManager::createFilter()
     return MethodCallback(this, &SessionManager::filter);
 }
 
+#ifndef PRIME_CXX11_STL
+namespace {
+    bool GZipFilter(void* enable, HTTPServer::Request&, HTTPServer::Response& response)
+    {
+        response.setGZipContent(enable != NULL);
+        return true;
+    }
+}
+#endif
+
+HTTPServer::Router::FilterCallback HTTPServer::createGZipFilter(bool enable)
+{
+#ifdef PRIME_CXX11_STL
+    return [enable](Request&, Response& response) -> bool {
+        response.setGZipContent(enable);
+        return true;
+    };
+#else
+    // The context pointer is only used as a flag.
+    static char enabled;
+    return FunctionCallback(&GZipFilter, enable ? &enabled : NULL);
+#endif
+}
+
 bool HTTPServer::SessionManager::filter(Request& request, Response& response)
 {
     if (!request.getSession()) {
@@ -8,15 +8,18 @@
 #include "Optional.h"
 #include "Settings.h"
 #include "StreamBuffer.h"
+#include "TempFile.h"
 #ifndef PRIME_NO_EXCEPTIONS
 #include <stdexcept>
 #endif
 #include "Callback.h"
 #include "UnownedPtr.h"
+#include <map>
 
 namespace Prime {
 
 class PrefixLog;
+class HTTPServerMetrics;
 
 /// Parses HTTP requests and routes them to a Handler (of which Router is a subclass) for processing. Knows
 /// nothing about networks or sockets. HTTPServer does not create threads, but serve() can be called from
@@ -69,6 +72,12 @@ public:
         typedef Callback3<const URLPath&, Request&, Response&> RerouteCallback;
 #endif
 
+        /// If an arena is supplied, the parsed headers are allocated from it and it must outlive the Request.
+        explicit Request(MonotonicArena* arena = NULL)
+            : _headers(arena)
+        {
+        }
+
         bool isVerboseEnabled() const
         {
             return _verboseLevel >= 1;
@@ -183,6 +192,13 @@ public:
 
         std::vector<std::string> getFormStringVector(StringView name) const;
 
+        /// Returns the file an uploaded multipart file was spilled to, positioned at the start, or NULL if the
+        /// upload was small enough to be kept in memory (in which case it's in getForm(name)). Uploads are only
+        /// spilled if the multipartSpillThresholdInBytes setting is non-zero, and are limited to
+        /// multipartMaxFileSizeInBytes (which defaults to multipartMaxPartSizeInBytes). The file is removed when
+        /// the Request is destructed.
+        RefPtr<TempFile> getFormFile(StringView name) const;
+
         //
         // Non-form POSTs
         //
@@ -199,6 +215,9 @@ public:
 
         double getAcceptEncoding(StringView name) const;
 
+        /// Returns true if the request's HTTP version is at least major.minor.
+        bool isHTTPVersionOrNewer(int major, int minor) const { return _headers.isVersionOrNewer(major, minor); }
+
         //
         // Accept
         //
@@ -249,6 +268,15 @@ public:
         /// Returns the remainder of a path (i.e., the "==" in an argument capture in a router).
         std::string getRemainingPathString() const;
 
+        /// The pattern of the route that handled the request (e.g., "/item/=id"), built up by the Routers the
+        /// request passed through. Empty if no route was matched. Used to label metrics, since unlike the path it
+        /// can't be chosen by the client.
+        const std::string& getRoute() const { return _route; }
+
+        void setRoute(StringView route) { _route.assign(route.begin(), route.end()); }
+
+        void appendRoute(StringView route) { _route.append(route.begin(), route.end()); }
+
         //
         // Sessions
         //
@@ -283,6 +311,9 @@ public:
             size_t _multipartFormStreamBufferSize;
             size_t _multipartMaxHeaderSizeInBytes;
             size_t _multipartMaxPartSizeInBytes;
+            size_t _multipartSpillThresholdInBytes;
+            int64_t _multipartMaxFileSizeInBytes;
+            std::string _multipartSpillPath;
 
             friend class Request;
         };
@@ -313,6 +344,9 @@ public:
         /// getForm(name) to retrieve form fields.
         bool parseMultipartFormData(StreamBuffer* rawStream);
 
+        /// Create a TempFile to spill a multipart upload to.
+        RefPtr<TempFile> createSpillFile();
+
         /// This is called automatically by parse(stream), but not by parse(StringView). Call getJSON() to
         /// retrieve the JSON.
         bool parseJSON(StreamBuffer* stream);
@@ -338,6 +372,8 @@ public:
         RefPtr<Session> _session;
         bool _expect100;
         size_t _pathOffset;
+        std::string _route;
+        std::map<std::string, RefPtr<TempFile>> _formFiles;
         UnixTime _time;
         Options _options;
         RerouteCallback _rerouteCallback;
@@ -353,13 +389,21 @@ public:
             bool load(Settings* settings);
 
         private:
+            /// Shared between Responses so that copying the Options doesn't copy the strings.
+            class ContentTypeList : public RefCounted {
+            public:
+                std::vector<std::string> contentTypes;
+            };
+
             size_t _responseBufferSize;
             bool _useZeroCopy;
+            bool _gzipDynamicContent;
             int _gzipDynamicContentSizeInBytes;
             int _gzipStaticContentSizeInBytes;
             int _gzipCompressInMemorySizeInBytes;
             bool _gzipChunked;
             int _gzipCompressionLevel;
+            RefPtr<ContentTypeList> _gzipContentTypes;
             int _verboseLevel;
 
             friend class Response;
@@ -395,6 +439,9 @@ public:
         /// Changed by calling setConnectionClose(), setConnectionKeepAlive() or setKeepAlive().
         bool getKeepAlive() const { return _keepAlive; }
 
+        /// Returns the number of bytes (headers and content) that have been sent so far.
+        Stream::Offset getBytesSent() const;
+
         void redirect(StringView path);
 
         //
@@ -575,6 +622,12 @@ public:
         /// processing a HEAD request, the stream is not sent.
         bool sendStream(Stream* stream, Stream::Offset size, Log* log, const SendStreamOptions& options = SendStreamOptions());
 
+        /// Sends a 206 (Partial Content) response containing the specified ranges of a seekable stream whose
+        /// total size is size. A single range is sent with a Content-Range header, multiple ranges are sent as a
+        /// multipart/byteranges body. The ranges should come from HTTPParseByteRanges(). The content is never
+        /// compressed. If processing a HEAD request, the stream is not sent.
+        bool sendStreamRanges(Stream* stream, Stream::Offset size, const std::vector<HTTPByteRange>& ranges, Log* log);
+
         /// Sets the Transfer-Encoding header then sends the headers followed by the content of the stream. If
         /// processing a HEAD request, the stream is not sent.
         bool sendStreamChunked(Stream* stream, Log* log, const SendStreamOptions& options = SendStreamOptions());
@@ -597,13 +650,34 @@ public:
             return _acceptGZip && isGZipEnabled();
         }
 
-        /// Returns a Stream through which you can write raw data. Call close() on the returned Stream to confirm it's
-        /// written correctly.
+        /// Set whether the content (e.g., from setContent() or setJSON(), or written through beginStream() or
+        /// beginChunked()) may be gzip compressed. Defaults to the gzipDynamicContent setting, which defaults to
+        /// true. The content is only compressed if the client accepts gzip, the Content-Type is allowed by the
+        /// gzipContentTypes setting (by default, any type is) and, if the length is known, it is at least
+        /// gzipDynamicContentSizeInBytes. Content set in advance that is larger than
+        /// gzipCompressInMemorySizeInBytes is compressed while it's sent, using chunked Transfer-Encoding (unless
+        /// gzipChunked is false or the client is HTTP/1.0), rather than in to a second buffer. Content which is
+        /// generated as it's sent should be written through beginStream() or beginChunked(), which compress it as
+        /// it's written.
+        void setGZipContent(bool value) { _gzipContent = value; }
+
+        bool getGZipContent() const { return _gzipContent; }
+
+        /// Returns true if the gzipContentTypes setting allows content of the specified type to be compressed.
+        /// gzipContentTypes is a list of media types, which may be wildcards (e.g., "text/*"). If it isn't set,
+        /// any type may be compressed.
+        bool isGZipContentType(StringView contentType) const;
+
+        /// Returns a Stream through which you can write contentLength bytes of content. If the content may be
+        /// compressed (see setGZipContent()), it's compressed as it's written and sent using chunked encoding
+        /// rather than with a Content-Length. Returns null for a HEAD request. Call close() on the returned Stream
+        /// to confirm it's written correctly.
         RefPtr<Stream> beginStream(uint64_t contentLength, Log* log);
 
         /// Returns a Stream through which you can write the response. Uses chunked encoding, so the size of the
-        /// response does not need to be specified in advance. Call close() on the returned Stream to confirm it's
-        /// written correctly.
+        /// response does not need to be specified in advance. If the content may be compressed (see
+        /// setGZipContent()) and isn't already, it's compressed as it's written. Returns null for a HEAD request.
+        /// Call close() on the returned Stream to confirm it's written correctly.
         RefPtr<Stream> beginChunked(Log* log, const SendStreamOptions& options = SendStreamOptions());
 
     private:
@@ -613,8 +687,31 @@ public:
 
         void construct();
 
+        /// Send size bytes from a stream after the headers have been sent, using zero-copy if enabled.
+        bool sendStreamContent(Stream* stream, Stream::Offset size, Log* log);
+
         bool sendGZipHeader(Stream* stream, Log* log);
 
+        /// Send the headers, which must not already have been sent.
+        bool sendHeaders(Log* log);
+
+        /// Returns true if the gzipContent flag, the Content-Encoding and the Content-Type allow the content to
+        /// be compressed. Doesn't consider whether the client accepts gzip.
+        bool isContentCompressible() const;
+
+#ifndef PRIME_NO_ZLIB
+        /// Send the headers and return a Stream which compresses whatever's written to it and sends it with
+        /// chunked encoding. Returns null for a HEAD request.
+        RefPtr<Stream> beginGZipChunked(Log* log);
+
+        /// Returns a GZipWriter which writes through a ChunkedWriter to _stream.
+        RefPtr<Stream> createGZipChunkedStream(Log* log);
+
+        /// Send the headers then stream _content through gzip and a ChunkedWriter, so the compressed content is
+        /// never held in memory.
+        bool sendContentGZipChunked(Log* log);
+#endif
+
         bool sendGZipFooter(Stream* stream, uint32_t originalSize, uint32_t crc32, Log* log);
 
 #ifndef PRIME_NO_ZLIB
@@ -640,10 +737,16 @@ public:
         HTTPMethod _method;
         URL _url;
         bool _acceptGZip;
+        bool _gzipContent;
+        bool _canChunk;
 
         bool _sent;
         bool _keepAlive;
 
+        /// Used by getBytesSent(). Zero-copy writes bypass _stream so have to be counted separately.
+        Stream::Offset _streamStartOffset;
+        Stream::Offset _bytesSentBypassingStream;
+
         ErrorLogCallback _errorLogCallback;
     };
 
@@ -744,18 +847,70 @@ public:
             bool isRouter;
             HandlerCallback handlerCallback;
 
-            int match(const URLPath& with, Value::Dictionary* arguments = NULL) const;
+            /// The path as it's appended to Request::getRoute().
+            std::string route;
+
+            /// Match against the components of with starting at offset.
+            int match(const URLPath& with, size_t offset, Value::Dictionary* arguments = NULL) const;
+        };
+
+        /// Routes are compiled in to a trie keyed on path components, so the cost of finding a route depends on
+        /// the depth of the path rather than the number of routes. Nodes refer to each other, and to _entries,
+        /// by index. Node 0 is the root.
+        struct Node {
+            struct Child {
+                std::string component;
+                size_t node;
+
+                bool operator<(StringView other) const { return StringView(component) < other; }
+            };
+
+            /// Literal components, sorted.
+            std::vector<Child> literals;
+
+            /// The node for "=name" components, or 0 if there isn't one. The names are taken from the Entry.
+            size_t parameter;
+
+            /// Routes whose path ends at this node.
+            std::vector<size_t> entries;
+
+            /// Routes with a "==" (match the rest of the path) component at this depth.
+            std::vector<size_t> wildcards;
+
+            Node()
+                : parameter(0)
+            {
+            }
+        };
+
+        struct Match {
+            size_t entry;
+            int length;
         };
 #if PRIME_MSC_AND_OLDER(1300)
     private:
 #endif
 
-        const Entry* findEntry(const URLPath& path, HTTPMethod method) const;
+        void addEntry(Entry& entry);
+
+        size_t findOrCreateChild(size_t node, StringView component);
+
+        const Entry* findEntry(const URLPath& path, size_t offset, HTTPMethod method) const;
+
+        void findEntry(const URLPath& path, size_t offset, HTTPMethod method, size_t node, size_t depth,
+            Match& best) const;
+
+        void considerEntry(size_t entry, HTTPMethod method, int length, Match& best) const;
 
         std::vector<Entry> _entries;
+        std::vector<Node> _nodes;
         std::vector<FilterCallback> _filters;
     };
 
+    /// Returns a filter that can be passed to a Router to enable (or disable) gzip compression of the content
+    /// of every response it routes (see Response::setGZipContent()).
+    static Router::FilterCallback createGZipFilter(bool enable = true);
+
     class PRIME_PUBLIC Redirecter : public Handler {
     public:
         Redirecter();
@@ -812,22 +967,45 @@ public:
 
     bool init(Handler* handler, Log* log, Settings* settings);
 
-    /// Returns true if the connection should process another request, otherwise returns false.
+    enum { defaultMaxPipelineDepth = 16 };
+
+    /// Returns true if the connection should process another request, otherwise returns false. If the client
+    /// has pipelined further requests which are already in readBuffer, they're handled too (up to the
+    /// maxPipelineDepth setting, which defaults to defaultMaxPipelineDepth; 1 disables pipelining) and all the
+    /// responses are flushed together. If an arena is supplied, each request's allocations are made from it and
+    /// it is reset before each request is parsed, so it should be owned by the connection.
     bool serve(StreamBuffer* readBuffer, StreamBuffer* writeBuffer, const char* protocol, Log* log,
-        PrefixLog* prefixLog, bool canKeepAlive, const Value::Dictionary* requestArguments = NULL);
+        PrefixLog* prefixLog, bool canKeepAlive, const Value::Dictionary* requestArguments = NULL,
+        MonotonicArena* arena = NULL);
 
     int getVerboseLevel() const { return _verboseLevel; }
 
+    /// Record every request served in metrics, which may be shared with other HTTPServers. Must be called
+    /// before serving starts.
+    void setMetrics(HTTPServerMetrics* metrics);
+
 private:
     void updateSettings(Settings* settings);
 
+    /// Handles a single request, leaving the response in writeBuffer. Returns the keep-alive state.
+    bool serveRequest(StreamBuffer* readBuffer, StreamBuffer* writeBuffer, const char* protocol, Log* log,
+        PrefixLog* prefixLog, bool canKeepAlive, const Value::Dictionary* requestArguments, MonotonicArena* arena);
+
+    /// Returns true if readBuffer already contains the complete headers of another request.
+    static bool hasPipelinedRequest(const StreamBuffer* readBuffer);
+
+    void recordMetrics(const Request& request, const Response& response, double startTime,
+        Stream::Offset readStartOffset, const StreamBuffer* readBuffer);
+
     RefPtr<Handler> _handler;
+    RefPtr<HTTPServerMetrics> _metrics;
     RefPtr<Log> _log;
     RefPtr<Settings> _settings;
 
     Settings::Observer _settingsObserver;
 
     int _verboseLevel;
+    int _maxPipelineDepth;
 
     Request::Options _requestOptions;
     Response::Options _responseOptions;
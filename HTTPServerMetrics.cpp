@@ -0,0 +1,524 @@
+// Copyright 2000-2021 Mark H. P. Lord
+
+#include "HTTPServerMetrics.h"
+#include "JSONWriter.h"
+#include "StringUtils.h"
+#include <algorithm>
+#ifdef PRIME_COMPILER_CXX11_ATOMICS
+#include <atomic>
+#endif
+
+namespace Prime {
+
+namespace {
+
+    /// Escape a Prometheus label value.
+    void AppendLabelValue(std::string& output, StringView value)
+    {
+        for (const char* ptr = value.begin(); ptr != value.end(); ++ptr) {
+            switch (*ptr) {
+            case '\\':
+                output += "\\\\";
+                break;
+            case '"':
+                output += "\\\"";
+                break;
+            case '\n':
+                output += "\\n";
+                break;
+            default:
+                output += *ptr;
+                break;
+            }
+        }
+    }
+
+    void AppendLabels(std::string& output, const HTTPServerMetrics::Key& key)
+    {
+        output += "route=\"";
+        AppendLabelValue(output, key.route);
+        output += "\",method=\"";
+        AppendLabelValue(output, GetHTTPMethodName(key.method));
+        output += '"';
+    }
+
+    //
+    // Single writer counters
+    //
+
+    // A shard is only written to by its thread, so counters are updated with a load and a store rather than an
+    // atomic read-modify-write, and new entries are published to readers by a release store of a list head.
+
+#ifdef PRIME_COMPILER_CXX11_ATOMICS
+
+    typedef std::atomic<uint64_t> Counter;
+
+    inline uint64_t LoadCounter(const Counter& counter)
+    {
+        return counter.load(std::memory_order_relaxed);
+    }
+
+    inline void StoreCounter(Counter& counter, uint64_t value)
+    {
+        counter.store(value, std::memory_order_relaxed);
+    }
+
+    template <typename Type>
+    struct Published {
+        typedef std::atomic<Type*> Pointer;
+
+        static Type* load(const Pointer& pointer) { return pointer.load(std::memory_order_acquire); }
+
+        static void store(Pointer& pointer, Type* value) { pointer.store(value, std::memory_order_release); }
+    };
+
+#else
+
+    typedef volatile uint64_t Counter;
+
+    inline uint64_t LoadCounter(const Counter& counter)
+    {
+        return counter;
+    }
+
+    inline void StoreCounter(Counter& counter, uint64_t value)
+    {
+        counter = value;
+    }
+
+    template <typename Type>
+    struct Published {
+        typedef Type* volatile Pointer;
+
+        static Type* load(const Pointer& pointer)
+        {
+            Type* value = pointer;
+            AtomicCounter::fullBarrier();
+            return value;
+        }
+
+        static void store(Pointer& pointer, Type* value)
+        {
+            AtomicCounter::fullBarrier();
+            pointer = value;
+        }
+    };
+
+#endif
+
+    inline void AddToCounter(Counter& counter, uint64_t value)
+    {
+        StoreCounter(counter, LoadCounter(counter) + value);
+    }
+}
+
+//
+// HTTPServerMetrics::Shard
+//
+
+struct HTTPServerMetrics::Shard {
+    struct StatusCount {
+        int code;
+        Counter count;
+        StatusCount* next;
+    };
+
+    struct Route {
+        /// Not modified once the Route has been published.
+        Key key;
+
+        Counter requests;
+        Counter bytesIn;
+        Counter bytesOut;
+        Counter latencyNanoseconds;
+        Counter latencyCounts[latencyBucketCount + 1];
+
+        Published<StatusCount>::Pointer statusCodes;
+
+        Route* next;
+
+        explicit Route(const Key& key)
+            : key(key)
+            , next(NULL)
+        {
+            StoreCounter(requests, 0);
+            StoreCounter(bytesIn, 0);
+            StoreCounter(bytesOut, 0);
+            StoreCounter(latencyNanoseconds, 0);
+            for (size_t i = 0; i != COUNTOF(latencyCounts); ++i) {
+                StoreCounter(latencyCounts[i], 0);
+            }
+            Published<StatusCount>::store(statusCodes, NULL);
+        }
+
+        ~Route()
+        {
+            StatusCount* status = Published<StatusCount>::load(statusCodes);
+            while (status) {
+                StatusCount* next = status->next;
+                delete status;
+                status = next;
+            }
+        }
+
+        /// Only called by the shard's thread.
+        Counter& getStatusCount(int code)
+        {
+            StatusCount* head = Published<StatusCount>::load(statusCodes);
+            for (StatusCount* status = head; status; status = status->next) {
+                if (status->code == code) {
+                    return status->count;
+                }
+            }
+
+            StatusCount* status = new StatusCount;
+            status->code = code;
+            StoreCounter(status->count, 0);
+            status->next = head;
+            Published<StatusCount>::store(statusCodes, status);
+            return status->count;
+        }
+
+        void addTo(RouteMetrics& metrics) const
+        {
+            metrics.requests += LoadCounter(requests);
+            metrics.bytesIn += LoadCounter(bytesIn);
+            metrics.bytesOut += LoadCounter(bytesOut);
+            metrics.latencySum += (double)LoadCounter(latencyNanoseconds) / 1e9;
+
+            for (size_t i = 0; i != COUNTOF(latencyCounts); ++i) {
+                metrics.latencyCounts[i] += LoadCounter(latencyCounts[i]);
+            }
+
+            for (StatusCount* status = Published<StatusCount>::load(statusCodes); status; status = status->next) {
+                metrics.statusCodes[status->code] += LoadCounter(status->count);
+            }
+        }
+    };
+
+    HTTPServerMetrics* metrics;
+
+    /// Every Route this shard has recorded, newest first, for readers.
+    Published<Route>::Pointer routes;
+
+    /// Only used by the shard's thread, to find its Routes.
+    std::map<Key, Route*> index;
+
+    /// Set while a thread is recording in to this shard. Once the thread exits, the shard (and its metrics) are
+    /// handed to the next new thread. Protected by the HTTPServerMetrics' mutex.
+    bool inUse;
+
+    /// Reused by record() to avoid allocating.
+    Key key;
+
+    explicit Shard(HTTPServerMetrics* metrics)
+        : metrics(metrics)
+        , inUse(false)
+    {
+        Published<Route>::store(routes, NULL);
+    }
+
+    ~Shard()
+    {
+        Route* route = Published<Route>::load(routes);
+        while (route) {
+            Route* next = route->next;
+            delete route;
+            route = next;
+        }
+    }
+
+    /// Only called by the shard's thread.
+    Route* getRoute()
+    {
+        std::map<Key, Route*>::const_iterator iter = index.find(key);
+        if (iter != index.end()) {
+            return iter->second;
+        }
+
+        Route* route = new Route(key);
+        route->next = Published<Route>::load(routes);
+        index[key] = route;
+        Published<Route>::store(routes, route);
+        return route;
+    }
+};
+
+const double HTTPServerMetrics::latencyBucketBounds[latencyBucketCount] = {
+    0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1, 2.5, 5, 10
+};
+
+//
+// HTTPServerMetrics::RouteMetrics
+//
+
+HTTPServerMetrics::RouteMetrics::RouteMetrics()
+    : requests(0)
+    , bytesIn(0)
+    , bytesOut(0)
+    , latencySum(0)
+{
+    std::fill(latencyCounts, latencyCounts + COUNTOF(latencyCounts), 0);
+}
+
+void HTTPServerMetrics::RouteMetrics::merge(const RouteMetrics& other)
+{
+    requests += other.requests;
+    bytesIn += other.bytesIn;
+    bytesOut += other.bytesOut;
+    latencySum += other.latencySum;
+
+    for (size_t i = 0; i != COUNTOF(latencyCounts); ++i) {
+        latencyCounts[i] += other.latencyCounts[i];
+    }
+
+    std::map<int, uint64_t>::const_iterator iter = other.statusCodes.begin();
+    for (; iter != other.statusCodes.end(); ++iter) {
+        statusCodes[iter->first] += iter->second;
+    }
+}
+
+//
+// HTTPServerMetrics
+//
+
+HTTPServerMetrics::HTTPServerMetrics()
+    : _initialised(false)
+{
+}
+
+HTTPServerMetrics::~HTTPServerMetrics()
+{
+    // The ThreadSpecificData is destructed after the shards and would otherwise hand this thread's (deleted)
+    // shard to threadDestroyed().
+    if (_initialised) {
+        Mutex::ScopedLock lock(&_mutex);
+        _threadShard.set(NULL);
+    }
+
+    for (size_t i = 0; i != _shards.size(); ++i) {
+        delete _shards[i];
+    }
+}
+
+bool HTTPServerMetrics::init(Log* log)
+{
+    PRIME_ASSERT(!_initialised);
+
+    _log = log;
+
+    if (!_mutex.init(log, "HTTPServerMetrics mutex")) {
+        return false;
+    }
+
+    if (!_threadShard.init(log, &HTTPServerMetrics::threadDestroyed, "HTTPServerMetrics shard")) {
+        return false;
+    }
+
+    _initialised = true;
+    return true;
+}
+
+void HTTPServerMetrics::threadDestroyed(void* shard)
+{
+    Shard* threadShard = reinterpret_cast<Shard*>(shard);
+
+    Mutex::ScopedLock lock(&threadShard->metrics->_mutex);
+    threadShard->inUse = false;
+}
+
+HTTPServerMetrics::Shard* HTTPServerMetrics::getShard()
+{
+    Shard* shard = reinterpret_cast<Shard*>(_threadShard.get());
+    if (shard) {
+        return shard;
+    }
+
+    Mutex::ScopedLock lock(&_mutex);
+
+    // Reuse the shard of a thread that has exited, so a server that keeps creating threads doesn't
+    // accumulate shards.
+    for (size_t i = 0; i != _shards.size(); ++i) {
+        if (!_shards[i]->inUse) {
+            shard = _shards[i];
+            break;
+        }
+    }
+
+    if (!shard) {
+        shard = new Shard(this);
+        _shards.push_back(shard);
+    }
+
+    shard->inUse = true;
+
+    _threadShard.set(shard);
+    return shard;
+}
+
+size_t HTTPServerMetrics::findLatencyBucket(double seconds)
+{
+    return (size_t)(std::lower_bound(latencyBucketBounds, latencyBucketBounds + latencyBucketCount, seconds) - latencyBucketBounds);
+}
+
+void HTTPServerMetrics::record(HTTPMethod method, StringView route, int statusCode, uint64_t bytesIn,
+    uint64_t bytesOut, double seconds)
+{
+    if (!_initialised) {
+        return;
+    }
+
+    Shard* shard = getShard();
+    if (!shard) {
+        return;
+    }
+
+    shard->key.route.assign(route.begin(), route.end());
+    shard->key.method = method;
+
+    Shard::Route* metrics = shard->getRoute();
+    AddToCounter(metrics->requests, 1);
+    AddToCounter(metrics->bytesIn, bytesIn);
+    AddToCounter(metrics->bytesOut, bytesOut);
+    AddToCounter(metrics->latencyNanoseconds, seconds > 0 ? (uint64_t)(seconds * 1e9) : 0);
+    AddToCounter(metrics->latencyCounts[findLatencyBucket(seconds)], 1);
+    AddToCounter(metrics->getStatusCount(statusCode), 1);
+}
+
+void HTTPServerMetrics::getMetrics(RouteMetricsMap& metrics) const
+{
+    metrics.clear();
+
+    Mutex::ScopedLock lock(&_mutex);
+
+    for (size_t i = 0; i != _shards.size(); ++i) {
+        const Shard::Route* route = Published<Shard::Route>::load(_shards[i]->routes);
+        for (; route; route = route->next) {
+            route->addTo(metrics[route->key]);
+        }
+    }
+}
+
+std::string HTTPServerMetrics::toPrometheus() const
+{
+    RouteMetricsMap metrics;
+    getMetrics(metrics);
+
+    std::string output;
+    RouteMetricsMap::const_iterator iter;
+
+    output += "# HELP http_requests_total Requests served, by route, method and status code.\n";
+    output += "# TYPE http_requests_total counter\n";
+    for (iter = metrics.begin(); iter != metrics.end(); ++iter) {
+        std::map<int, uint64_t>::const_iterator code = iter->second.statusCodes.begin();
+        for (; code != iter->second.statusCodes.end(); ++code) {
+            output += "http_requests_total{";
+            AppendLabels(output, iter->first);
+            StringAppendFormat(output, ",code=\"%d\"} %" PRIu64 "\n", code->first, code->second);
+        }
+    }
+
+    output += "# HELP http_request_duration_seconds Time from a request's headers being received to its response being sent.\n";
+    output += "# TYPE http_request_duration_seconds histogram\n";
+    for (iter = metrics.begin(); iter != metrics.end(); ++iter) {
+        const RouteMetrics& route = iter->second;
+
+        uint64_t cumulative = 0;
+        for (size_t i = 0; i != latencyBucketCount + 1; ++i) {
+            cumulative += route.latencyCounts[i];
+            output += "http_request_duration_seconds_bucket{";
+            AppendLabels(output, iter->first);
+            if (i == latencyBucketCount) {
+                StringAppendFormat(output, ",le=\"+Inf\"} %" PRIu64 "\n", cumulative);
+            } else {
+                StringAppendFormat(output, ",le=\"%g\"} %" PRIu64 "\n", latencyBucketBounds[i], cumulative);
+            }
+        }
+
+        output += "http_request_duration_seconds_sum{";
+        AppendLabels(output, iter->first);
+        StringAppendFormat(output, "} %.9g\n", route.latencySum);
+
+        output += "http_request_duration_seconds_count{";
+        AppendLabels(output, iter->first);
+        StringAppendFormat(output, "} %" PRIu64 "\n", route.requests);
+    }
+
+    output += "# HELP http_request_bytes_total Bytes received, including headers.\n";
+    output += "# TYPE http_request_bytes_total counter\n";
+    for (iter = metrics.begin(); iter != metrics.end(); ++iter) {
+        output += "http_request_bytes_total{";
+        AppendLabels(output, iter->first);
+        StringAppendFormat(output, "} %" PRIu64 "\n", iter->second.bytesIn);
+    }
+
+    output += "# HELP http_response_bytes_total Bytes sent, including headers.\n";
+    output += "# TYPE http_response_bytes_total counter\n";
+    for (iter = metrics.begin(); iter != metrics.end(); ++iter) {
+        output += "http_response_bytes_total{";
+        AppendLabels(output, iter->first);
+        StringAppendFormat(output, "} %" PRIu64 "\n", iter->second.bytesOut);
+    }
+
+    return output;
+}
+
+Value::Dictionary HTTPServerMetrics::toDictionary() const
+{
+    RouteMetricsMap metrics;
+    getMetrics(metrics);
+
+    Value::Vector routes;
+    routes.reserve(metrics.size());
+
+    RouteMetricsMap::const_iterator iter = metrics.begin();
+    for (; iter != metrics.end(); ++iter) {
+        const RouteMetrics& route = iter->second;
+
+        Value::Dictionary statusCodes;
+        std::map<int, uint64_t>::const_iterator code = route.statusCodes.begin();
+        for (; code != route.statusCodes.end(); ++code) {
+            statusCodes.set(ToString(code->first), (int64_t)code->second);
+        }
+
+        Value::Vector buckets;
+        for (size_t i = 0; i != latencyBucketCount + 1; ++i) {
+            Value::Dictionary bucket;
+            if (i == latencyBucketCount) {
+                bucket.set("le", "+Inf");
+            } else {
+                bucket.set("le", Format("%g", latencyBucketBounds[i]));
+            }
+            bucket.set("count", (int64_t)route.latencyCounts[i]);
+            buckets.push_back(PRIME_MOVE(bucket));
+        }
+
+        Value::Dictionary dictionary;
+        dictionary.set("route", iter->first.route);
+        dictionary.set("method", GetHTTPMethodName(iter->first.method));
+        dictionary.set("requests", (int64_t)route.requests);
+        dictionary.set("statusCodes", PRIME_MOVE(statusCodes));
+        dictionary.set("bytesIn", (int64_t)route.bytesIn);
+        dictionary.set("bytesOut", (int64_t)route.bytesOut);
+        dictionary.set("latencySum", route.latencySum);
+        dictionary.set("latencyBuckets", PRIME_MOVE(buckets));
+
+        routes.push_back(PRIME_MOVE(dictionary));
+    }
+
+    Value::Dictionary result;
+    result.set("routes", PRIME_MOVE(routes));
+    return result;
+}
+
+bool HTTPServerMetrics::handleRequest(HTTPServer::Request& request, HTTPServer::Response& response)
+{
+    if (request.getQueryString("format") == "json" || request.wantsJSON()) {
+        response.setJSON(toDictionary());
+    } else {
+        response.setContent(toPrometheus(), "text/plain; version=0.0.4; charset=utf-8");
+    }
+
+    return true;
+}
+}
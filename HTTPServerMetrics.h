@@ -0,0 +1,100 @@
+// Copyright 2000-2021 Mark H. P. Lord
+
+#ifndef PRIME_HTTPSERVERMETRICS_H
+#define PRIME_HTTPSERVERMETRICS_H
+
+#include "HTTPServer.h"
+#include "Mutex.h"
+#include "ThreadSpecificData.h"
+#include <map>
+#include <vector>
+
+namespace Prime {
+
+/// Records request counts, status codes, bytes received and sent and latency histograms for each route of an
+/// HTTPServer (see HTTPServer::setMetrics()). Requests are identified by Request::getRoute() rather than their
+/// path, so clients can't create an unbounded number of entries. Each thread records in to its own shard without
+/// locking: only the shard's thread writes to it, and the shards are merged (using relaxed atomic loads) when the
+/// metrics are read. The mutex only guards registering shards and merging them. Also a Handler that can be mounted on a Router to serve the
+/// metrics in the Prometheus text format, or as JSON if the request has a format=json query parameter or
+/// prefers JSON.
+class PRIME_PUBLIC HTTPServerMetrics : public HTTPServer::Handler {
+public:
+    enum { latencyBucketCount = 13 };
+
+    /// The upper bounds, in seconds, of the latency histogram's buckets, excluding the final +Inf bucket.
+    static const double latencyBucketBounds[latencyBucketCount];
+
+    /// Metrics are kept separately for each method of each route.
+    struct Key {
+        std::string route;
+        HTTPMethod method;
+
+        bool operator<(const Key& other) const
+        {
+            int compare = route.compare(other.route);
+            return compare < 0 || (compare == 0 && method < other.method);
+        }
+    };
+
+    struct RouteMetrics {
+        uint64_t requests;
+        uint64_t bytesIn;
+        uint64_t bytesOut;
+        double latencySum;
+
+        /// The number of requests that fell in to each bucket (so these aren't cumulative). The last element is
+        /// the +Inf bucket.
+        uint64_t latencyCounts[latencyBucketCount + 1];
+
+        std::map<int, uint64_t> statusCodes;
+
+        RouteMetrics();
+
+        void merge(const RouteMetrics& other);
+    };
+
+    typedef std::map<Key, RouteMetrics> RouteMetricsMap;
+
+    HTTPServerMetrics();
+
+    ~HTTPServerMetrics();
+
+    bool init(Log* log);
+
+    /// Called by HTTPServer once a request's response has been sent. Thread safe.
+    void record(HTTPMethod method, StringView route, int statusCode, uint64_t bytesIn, uint64_t bytesOut,
+        double seconds);
+
+    /// Merge the shards of every thread. Thread safe.
+    void getMetrics(RouteMetricsMap& metrics) const;
+
+    /// Returns the metrics in the Prometheus text exposition format.
+    std::string toPrometheus() const;
+
+    Value::Dictionary toDictionary() const;
+
+    virtual bool handleRequest(HTTPServer::Request& request, HTTPServer::Response& response) PRIME_OVERRIDE;
+
+private:
+    /// Defined in HTTPServerMetrics.cpp, since it uses atomics.
+    struct Shard;
+
+    static void threadDestroyed(void* shard);
+
+    /// Returns the calling thread's shard, claiming one if necessary.
+    Shard* getShard();
+
+    static size_t findLatencyBucket(double seconds);
+
+    bool _initialised;
+    RefPtr<Log> _log;
+    ThreadSpecificData _threadShard;
+    mutable Mutex _mutex;
+    std::vector<Shard*> _shards;
+
+    PRIME_UNCOPYABLE(HTTPServerMetrics);
+};
+}
+
+#endif
@@ -2,7 +2,7 @@
 
 #include "HTTPSettingsSessionManager.h"
 #include "Clocks.h"
-#include "Mutex.h"
+#include "NumberUtils.h"
 
 namespace Prime {
 
@@ -12,7 +12,8 @@ namespace Prime {
 
 class HTTPSettingsSessionManager::MemorySession : public HTTPServer::Session {
 public:
-    MemorySession(HTTPSettingsSessionManager* sessionManager, std::string sessionID);
+    /// Temporary sessions are never saved.
+    MemorySession(HTTPSettingsSessionManager* sessionManager, std::string sessionID, bool temporary);
 
     MemorySession(HTTPSettingsSessionManager* sessionManager, std::string sessionID, const Value& propertyList);
 
@@ -33,27 +34,44 @@ public:
     void touch(const UnixTime& unixTime)
     {
         if (unixTime.getSeconds() > _lastAccess) {
+            // lastAccess is only used for expiry, so it's not worth saving every change.
+            bool save = unixTime.getSeconds() - _lastSavedAccess >= _sessionManager->_saveIntervalSeconds;
+
             _lastAccess = unixTime.getSeconds();
+
+            if (save) {
+                markDirty();
+            }
         }
     }
 
     const UnixTime getLastAccess() const { return UnixTime(_lastAccess, 0); }
 
+    void markDirty() { _sessionManager->markDirty(this); }
+
+    /// Protected by the shard's dirtyMutex.
+    bool dirty;
+
+    bool isTemporary() const { return _temporary; }
+
 private:
     void construct();
 
-    ReadWriteLock* getLock() const { return &_sessionManager->_lock; }
+    ReadWriteLock* getLock() const { return &_sessionManager->getShard(_id).lock; }
 
     HTTPSettingsSessionManager* _sessionManager;
     std::string _id;
     Value::Dictionary _dictionary;
     volatile int64_t _lastAccess;
+    mutable volatile int64_t _lastSavedAccess;
+    bool _temporary;
 };
 
 HTTPSettingsSessionManager::MemorySession::MemorySession(HTTPSettingsSessionManager* sessionManager,
-    std::string sessionID)
+    std::string sessionID, bool temporary)
     : _sessionManager(sessionManager)
     , _id(PRIME_MOVE(sessionID))
+    , _temporary(temporary)
 {
     construct();
 }
@@ -62,15 +80,19 @@ HTTPSettingsSessionManager::MemorySession::MemorySession(HTTPSettingsSessionMana
     std::string sessionID, const Value& propertyList)
     : _sessionManager(sessionManager)
     , _id(PRIME_MOVE(sessionID))
+    , _temporary(false)
 {
     construct();
     _dictionary = propertyList.getDictionary();
     _lastAccess = _dictionary["lastAccess"].toInteger(0);
+    _lastSavedAccess = _lastAccess;
 }
 
 void HTTPSettingsSessionManager::MemorySession::construct()
 {
+    dirty = false;
     _lastAccess = 0;
+    _lastSavedAccess = 0;
 }
 
 Value HTTPSettingsSessionManager::MemorySession::saveWhenLocked() const
@@ -78,7 +100,8 @@ Value HTTPSettingsSessionManager::MemorySession::saveWhenLocked() const
     Value::Dictionary dict;
     dict.reserve(_dictionary.size() + 1);
     dict = _dictionary;
-    dict.set("lastAccess", _lastAccess);
+    _lastSavedAccess = _lastAccess;
+    dict.set("lastAccess", _lastSavedAccess);
     return dict;
 }
 
@@ -103,18 +126,23 @@ void HTTPSettingsSessionManager::MemorySession::set(const char* key, const Value
 {
     ReadWriteLock::ScopedWriteLock lock(getLock());
     _dictionary.set(key, value);
+    markDirty();
 }
 
 void HTTPSettingsSessionManager::MemorySession::remove(const char* key)
 {
     ReadWriteLock::ScopedWriteLock lock(getLock());
-    _dictionary.erase(key);
+    if (_dictionary.erase(key)) {
+        markDirty();
+    }
 }
 
 Value HTTPSettingsSessionManager::MemorySession::getAndRemove(const char* key)
 {
     Value value;
 
+    ReadWriteLock::ScopedWriteLock lock(getLock());
+
     Value::Dictionary::iterator pair = _dictionary.find(key);
     if (pair == _dictionary.end()) {
         return value;
@@ -122,6 +150,7 @@ Value HTTPSettingsSessionManager::MemorySession::getAndRemove(const char* key)
 
     value.move(pair->second);
     _dictionary.erase(pair);
+    markDirty();
 
     return value;
 }
@@ -132,16 +161,27 @@ Value HTTPSettingsSessionManager::MemorySession::getAndRemove(const char* key)
 
 namespace {
     const char cookieName[] = "SID";
+
+    // Sessions created within this many seconds are saved even if a save isn't otherwise due.
+    const int64_t newSessionSaveDelaySeconds = 5;
 }
 
 PRIME_DEFINE_UID_CAST(HTTPSettingsSessionManager)
 
 HTTPSettingsSessionManager::HTTPSettingsSessionManager()
+    : _saving(0)
+    , _nextSaveTimeOffset(0)
 {
-    _lock.init(Log::getGlobal(), "HTTPSettingsSessionManager lock");
+    for (size_t i = 0; i != shardCount; ++i) {
+        _shards[i].lock.init(Log::getGlobal(), "HTTPSettingsSessionManager lock");
+        _shards[i].dirtyMutex.init(Log::getGlobal(), "HTTPSettingsSessionManager dirty mutex");
+    }
+
+    _saveMutex.init(Log::getGlobal(), "HTTPSettingsSessionManager save mutex");
+    _nextSaveTimeMutex.init(Log::getGlobal(), "HTTPSettingsSessionManager next save time mutex");
 
-    _saveIntervalSeconds = 60; // TODO: make this a setting
-    _lastSaveTime = 0;
+    _saveIntervalSeconds = 60;
+    _saveTimeBase = Clock::getCurrentTime().getSeconds();
     _sessionExpirySeconds = 48 * 60 * 60;
 }
 
@@ -149,23 +189,73 @@ HTTPSettingsSessionManager::~HTTPSettingsSessionManager()
 {
 }
 
+HTTPSettingsSessionManager::Shard& HTTPSettingsSessionManager::getShard(StringView sessionID)
+{
+    // FNV-1a. Session IDs are random so anything would do, but IDs in cookies are chosen by the client.
+    uint32_t hash = 2166136261u;
+    for (const char* ptr = sessionID.begin(); ptr != sessionID.end(); ++ptr) {
+        hash = (hash ^ (uint8_t)*ptr) * 16777619u;
+    }
+
+    return _shards[hash % shardCount];
+}
+
+void HTTPSettingsSessionManager::markDirty(MemorySession* session)
+{
+    if (session->isTemporary()) {
+        return;
+    }
+
+    Shard& shard = getShard(session->getID());
+
+    Mutex::ScopedLock lock(&shard.dirtyMutex);
+    if (!session->dirty) {
+        session->dirty = true;
+        shard.dirty.push_back(session);
+    }
+}
+
+void HTTPSettingsSessionManager::markRemoved(Shard& shard, const std::string& sessionID)
+{
+    Mutex::ScopedLock lock(&shard.dirtyMutex);
+    shard.removed.push_back(sessionID);
+}
+
+bool HTTPSettingsSessionManager::isExpired(const MemorySession* session, int64_t time) const
+{
+    int64_t lastAccess = session->getLastAccess().getSeconds();
+    return time - lastAccess >= _sessionExpirySeconds || lastAccess > time;
+}
+
+size_t HTTPSettingsSessionManager::getSessionCount() const
+{
+    size_t count = 0;
+    for (size_t i = 0; i != shardCount; ++i) {
+        ReadWriteLock::ScopedReadLock lock(&_shards[i].lock);
+        count += _shards[i].sessions.size();
+    }
+
+    return count;
+}
+
 RefPtr<HTTPServer::Session> HTTPSettingsSessionManager::createTemporarySession(Log* log)
 {
     char sessionID[25];
     generateSessionID(sessionID, sizeof(sessionID) - 1, log);
     sessionID[sizeof(sessionID) - 1] = 0;
 
-    return PassRef(new MemorySession(this, sessionID));
+    return PassRef(new MemorySession(this, sessionID, true));
 }
 
 RefPtr<HTTPServer::Session> HTTPSettingsSessionManager::getSessionByID(StringView sessionID)
 {
-    ReadWriteLock::ScopedReadLock lock(&_lock);
-    ReadWriteLock::ScopedWriteLock writeLock;
+    const Shard& shard = getShard(sessionID);
+
+    ReadWriteLock::ScopedReadLock lock(&shard.lock);
 
     // TODO: use C++14 heterogeneous lookup
-    SessionMap::const_iterator iter = _sessionMap.find(sessionID.to_string());
-    if (iter != _sessionMap.end()) {
+    SessionMap::const_iterator iter = shard.sessions.find(sessionID.to_string());
+    if (iter != shard.sessions.end()) {
         return static_cast<MemorySession*>(iter->second.get());
     }
 
@@ -179,19 +269,22 @@ RefPtr<HTTPServer::Session> HTTPSettingsSessionManager::getSession(HTTPServer::R
         return cached;
     }
 
+    flushIfEnoughtTimeHasPassed(request.getLog());
+
     // Acquire an existing session.
-    {
-        ReadWriteLock::ScopedReadLock lock(&_lock);
-        ReadWriteLock::ScopedWriteLock writeLock;
+    std::string sessionID = request.getCookie(cookieName);
+
+    if (!sessionID.empty()) {
+        const Shard& shard = getShard(sessionID);
 
-        flushIfEnoughtTimeHasPassed(&lock, &writeLock, request.getLog());
+        ReadWriteLock::ScopedReadLock lock(&shard.lock);
 
-        std::string sessionID = request.getCookie(cookieName);
+        SessionMap::const_iterator iter = shard.sessions.find(sessionID);
+        if (iter != shard.sessions.end()) {
+            MemorySession* session = static_cast<MemorySession*>(iter->second.get());
 
-        if (!sessionID.empty()) {
-            SessionMap::const_iterator iter = _sessionMap.find(sessionID);
-            if (iter != _sessionMap.end()) {
-                MemorySession* session = static_cast<MemorySession*>(iter->second.get());
+            // The sweep may not have got to it yet.
+            if (!isExpired(session, request.getTime().getSeconds())) {
                 request.setSession(session);
                 session->touch(request.getTime());
 
@@ -202,24 +295,31 @@ RefPtr<HTTPServer::Session> HTTPSettingsSessionManager::getSession(HTTPServer::R
 
     // Create a session.
     if (create && PRIME_GUARDMSG(response, "need a Response object if create enabled")) {
-        ReadWriteLock::ScopedWriteLock lock(&_lock);
-
         for (;;) {
-            char sessionID[25];
-            generateSessionID(sessionID, sizeof(sessionID) - 1, request.getLog());
-            sessionID[sizeof(sessionID) - 1] = 0;
+            char newSessionID[25];
+            generateSessionID(newSessionID, sizeof(newSessionID) - 1, request.getLog());
+            newSessionID[sizeof(newSessionID) - 1] = 0;
 
-            SessionMap::iterator iter = _sessionMap.find(sessionID);
-            if (iter != _sessionMap.end()) {
-                continue;
-            }
+            std::string sessionIDString(newSessionID);
 
-            std::string sessionIDString(sessionID);
+            Shard& shard = getShard(sessionIDString);
 
-            RefPtr<MemorySession> session = PassRef(new MemorySession(this, sessionIDString));
-            session->touch(request.getTime());
+            RefPtr<MemorySession> session;
+            {
+                ReadWriteLock::ScopedWriteLock lock(&shard.lock);
 
-            _sessionMap[sessionIDString] = session;
+                SessionMap::iterator iter = shard.sessions.find(sessionIDString);
+                if (iter != shard.sessions.end()) {
+                    continue;
+                }
+
+                session = PassRef(new MemorySession(this, sessionIDString, false));
+                session->touch(request.getTime());
+
+                shard.sessions[sessionIDString] = session;
+            }
+
+            session->markDirty();
 
             request.setSession(session.get());
 
@@ -227,9 +327,14 @@ RefPtr<HTTPServer::Session> HTTPSettingsSessionManager::getSession(HTTPServer::R
 
             response->setCookie(MakeString(cookieName, "=", sessionIDString, "; Path=/; HTTPOnly"));
 
-            _lastSaveTime = Clock::getCurrentTime().getSeconds() - _saveIntervalSeconds + 5;
-
-            flushIfEnoughtTimeHasPassed(NULL, &lock, request.getLog());
+            // Don't wait a whole interval before saving a new session.
+            int64_t saveBy = request.getTime().getSeconds() + newSessionSaveDelaySeconds;
+            if (getNextSaveTime() > saveBy) {
+                Mutex::ScopedLock nextSaveTimeLock(&_nextSaveTimeMutex);
+                if (getNextSaveTime() > saveBy) {
+                    setNextSaveTime(saveBy);
+                }
+            }
 
             return session;
         }
@@ -247,112 +352,179 @@ void HTTPSettingsSessionManager::deleteSession(HTTPServer::Request& request, HTT
     }
 
     {
-        ReadWriteLock::ScopedWriteLock lock(&_lock);
+        Shard& shard = getShard(sessionID);
+
+        ReadWriteLock::ScopedWriteLock lock(&shard.lock);
 
-        SessionMap::iterator iter = _sessionMap.find(sessionID);
-        if (iter != _sessionMap.end()) {
-            _sessionMap.erase(iter);
+        SessionMap::iterator iter = shard.sessions.find(sessionID);
+        if (iter != shard.sessions.end()) {
+            shard.sessions.erase(iter);
+            markRemoved(shard, sessionID);
         }
     }
 
     response.setCookie(MakeString(cookieName, "=0; Path=/; HTTPOnly"));
 }
 
-Value HTTPSettingsSessionManager::saveWhenLocked(ReadWriteLock::ScopedWriteLock& lock) const
-{
-    PRIME_ASSERT(lock.isLocked());
-    (void)lock;
-
-    Value::Dictionary dict;
-
-    for (SessionMap::const_iterator iter = _sessionMap.begin(); iter != _sessionMap.end(); ++iter) {
-        dict.set(iter->first, static_cast<MemorySession*>(iter->second.get())->saveWhenLocked());
-    }
-
-    return dict;
-}
-
 void HTTPSettingsSessionManager::setSettings(Settings* settings)
 {
-    ReadWriteLock::ScopedWriteLock lock(&_lock);
+    Mutex::ScopedLock saveLock(&_saveMutex);
 
-    loadWhenLocked(lock, settings->get("sessions").getDictionary());
+    load(settings->get("sessions").getDictionary());
 
     _settings = settings;
 }
 
-void HTTPSettingsSessionManager::loadWhenLocked(ReadWriteLock::ScopedWriteLock& lock, const Value::Dictionary& dict)
+void HTTPSettingsSessionManager::load(const Value::Dictionary& dict)
 {
-    PRIME_ASSERT(lock.isLocked());
-    (void)lock;
-
     int64_t time = Clock::getCurrentTime().getSeconds();
 
-    _sessionMap.clear();
+    for (size_t i = 0; i != shardCount; ++i) {
+        ReadWriteLock::ScopedWriteLock lock(&_shards[i].lock);
+        _shards[i].sessions.clear();
+    }
+
+    _savedSessions = dict;
+
     for (size_t i = 0; i != dict.size(); ++i) {
         const Value::Dictionary::value_type& pair = dict.pair(i);
-        std::string sessionID = pair.first;
-        const Value::Dictionary& sessionDictionary = pair.second.getDictionary();
-        int64_t lastAccess = sessionDictionary["lastAccess"].toInteger(0);
-        if (time - lastAccess < _sessionExpirySeconds && lastAccess < time) {
-            RefPtr<MemorySession> session = PassRef(new MemorySession(this, sessionID, Value(sessionDictionary)));
-            _sessionMap[sessionID] = session;
+        const std::string& sessionID = pair.first;
+        Shard& shard = getShard(sessionID);
+
+        RefPtr<MemorySession> session = PassRef(new MemorySession(this, sessionID, pair.second));
+        if (isExpired(session, time)) {
+            markRemoved(shard, sessionID);
+        } else {
+            ReadWriteLock::ScopedWriteLock lock(&shard.lock);
+            shard.sessions[sessionID] = session;
         }
     }
 }
 
 void HTTPSettingsSessionManager::flush(Log* log)
 {
-    ReadWriteLock::ScopedWriteLock lock(&_lock); // Writing to _lastSaveTime
-
-    flushWhenLocked(lock, log);
+    save(log);
 }
 
-void HTTPSettingsSessionManager::flushWhenLocked(ReadWriteLock::ScopedWriteLock& lock, Log* log)
+void HTTPSettingsSessionManager::flushIfEnoughtTimeHasPassed(Log* log)
 {
-    PRIME_ASSERT(lock.isLocked());
-    (void)log;
-    (void)lock;
+    if (Clock::getCurrentTime().getSeconds() < getNextSaveTime()) {
+        return;
+    }
 
-    if (_settings) {
-        _settings->set("sessions", saveWhenLocked(lock));
-        _settings->flush();
-        _lastSaveTime = Clock::getCurrentTime().getSeconds();
+    // Only one save at a time.
+    if (_saving.increment() != 1) {
+        _saving.decrement();
+        return;
+    }
+
+    if (_backgroundQueue) {
+#ifdef PRIME_CXX11_STL
+        RefPtr<HTTPSettingsSessionManager> self(this);
+        _backgroundQueue->queue([self]() {
+            self->backgroundSave();
+        });
+#else
+        _backgroundQueue->queue(MethodCallback(Ref(this), &HTTPSettingsSessionManager::backgroundSave));
+#endif
+    } else {
+        save(log);
+        _saving.set(0);
     }
 }
 
-void HTTPSettingsSessionManager::flushIfEnoughtTimeHasPassed(Log* log)
+void HTTPSettingsSessionManager::backgroundSave()
 {
-    ReadWriteLock::ScopedReadLock lock(&_lock);
-    ReadWriteLock::ScopedWriteLock writeLock;
-
-    flushIfEnoughtTimeHasPassed(&lock, &writeLock, log);
+    save(Log::getGlobal());
+    _saving.set(0);
 }
 
-void HTTPSettingsSessionManager::flushIfEnoughtTimeHasPassed(ReadWriteLock::ScopedReadLock* readLock,
-    ReadWriteLock::ScopedWriteLock* writeLock, Log* log)
+void HTTPSettingsSessionManager::save(Log* log)
 {
-    PRIME_ASSERT((readLock && readLock->isLocked()) || writeLock->isLocked());
+    Mutex::ScopedLock saveLock(&_saveMutex);
 
     int64_t time = Clock::getCurrentTime().getSeconds();
 
-    if (!_settings) {
-        return;
-    }
+    size_t savedCount = 0;
+    size_t removedCount = 0;
 
-    if (time - _lastSaveTime < _saveIntervalSeconds) {
-        return;
-    }
+    for (size_t shardIndex = 0; shardIndex != shardCount; ++shardIndex) {
+        Shard& shard = _shards[shardIndex];
 
-    if (readLock) {
-        readLock->unlock();
-        writeLock->lock(&_lock);
+        // Sweep expired sessions.
+        {
+            ReadWriteLock::ScopedWriteLock lock(&shard.lock);
+
+            SessionMap::iterator iter = shard.sessions.begin();
+            while (iter != shard.sessions.end()) {
+                if (isExpired(static_cast<MemorySession*>(iter->second.get()), time)) {
+                    markRemoved(shard, iter->first);
+                    shard.sessions.erase(iter++);
+                } else {
+                    ++iter;
+                }
+            }
+        }
+
+        std::vector<RefPtr<HTTPServer::Session>> dirty;
+        std::vector<std::string> removed;
+        {
+            Mutex::ScopedLock lock(&shard.dirtyMutex);
+
+            dirty.swap(shard.dirty);
+            removed.swap(shard.removed);
+
+            // Any changes made from here on will mark the session dirty again.
+            for (size_t i = 0; i != dirty.size(); ++i) {
+                static_cast<MemorySession*>(dirty[i].get())->dirty = false;
+            }
+        }
+
+        if (!_settings) {
+            continue;
+        }
+
+        for (size_t i = 0; i != removed.size(); ++i) {
+            if (_savedSessions.erase(removed[i])) {
+                ++removedCount;
+            }
+        }
+
+        for (size_t i = 0; i != dirty.size(); ++i) {
+            MemorySession* session = static_cast<MemorySession*>(dirty[i].get());
+
+            Value value;
+            {
+                ReadWriteLock::ScopedReadLock lock(&shard.lock);
+
+                // It may have been deleted or expired since it was modified.
+                SessionMap::const_iterator iter = shard.sessions.find(session->getID());
+                if (iter == shard.sessions.end() || iter->second != session) {
+                    continue;
+                }
+
+                value = session->saveWhenLocked();
+            }
+
+            _savedSessions.set(session->getID(), PRIME_MOVE(value));
+            ++savedCount;
+        }
     }
 
-    if (time - _lastSaveTime < _saveIntervalSeconds) {
-        return; // Another thread saved.
+    if (savedCount || removedCount) {
+        _settings->set("sessions", _savedSessions);
+        _settings->flush();
+
+        log->trace("Saved %" PRIuPTR " sessions, removed %" PRIuPTR " sessions.", savedCount, removedCount);
     }
 
-    flushWhenLocked(*writeLock, log);
+    Mutex::ScopedLock nextSaveTimeLock(&_nextSaveTimeMutex);
+    setNextSaveTime(time + _saveIntervalSeconds);
+}
+
+void HTTPSettingsSessionManager::setNextSaveTime(int64_t time)
+{
+    int64_t offset = Clamp<int64_t>(time - _saveTimeBase, 0, INT32_MAX);
+    _nextSaveTimeOffset.set((AtomicCounter::Value)offset);
 }
 }
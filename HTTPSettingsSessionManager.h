@@ -4,9 +4,12 @@
 #define PRIME_HTTPSETTINGSSESSIONMANAGER_H
 
 #include "HTTPServer.h"
+#include "Mutex.h"
 #include "ReadWriteLock.h"
 #include "Settings.h"
+#include "TaskQueue.h"
 #include <map>
+#include <vector>
 
 namespace Prime {
 
@@ -14,10 +17,18 @@ namespace Prime {
 // implement saving)
 
 /// An HTTPServer::SessionManager that stores session contents in memory and persists them via a Settings.
+/// Sessions are spread across shards by a hash of their ID, each with its own lock, so requests for different
+/// sessions rarely contend. Sessions are saved write-behind: a modified session is marked dirty, and every
+/// saveIntervalSeconds only the dirty sessions are re-serialised, as a batch, and patched in to a copy of the
+/// saved "sessions" setting (so saving never has to lock every session). Sessions that haven't been used for
+/// sessionExpirySeconds are removed at the same time. Saving happens on the background TaskQueue if one has been
+/// set, otherwise on whichever request thread notices that it's due.
 class PRIME_PUBLIC HTTPSettingsSessionManager : public HTTPServer::SessionManager {
     PRIME_DECLARE_UID_CAST(HTTPServer::SessionManager, 0xae34f56f, 0x79c84835, 0x85f86326, 0xf6d322bd)
 
 public:
+    enum { shardCount = 16 };
+
     HTTPSettingsSessionManager();
 
     virtual ~HTTPSettingsSessionManager();
@@ -34,31 +45,82 @@ public:
     /// The session list can be persisted in settings. When this is called, the sessions are loaded.
     void setSettings(Settings* settings);
 
+    /// Save dirty sessions and remove expired sessions on this queue rather than on a request thread.
+    void setBackgroundQueue(TaskQueue* queue) { _backgroundQueue = queue; }
+
+    void setSaveIntervalSeconds(int64_t seconds) { _saveIntervalSeconds = seconds; }
+
+    void setSessionExpirySeconds(int64_t seconds) { _sessionExpirySeconds = seconds; }
+
+    /// Save the dirty sessions and remove expired sessions now.
     virtual void flush(Log* log) PRIME_OVERRIDE;
 
     void flushIfEnoughtTimeHasPassed(Log* log);
 
+    size_t getSessionCount() const;
+
 private:
-    Value saveWhenLocked(ReadWriteLock::ScopedWriteLock&) const;
+    class MemorySession;
+    friend class MemorySession;
 
-    void loadWhenLocked(ReadWriteLock::ScopedWriteLock&, const Value::Dictionary& dict);
+    typedef std::map<std::string, RefPtr<HTTPServer::Session>, StringView::Less> SessionMap;
 
-    void flushIfEnoughtTimeHasPassed(ReadWriteLock::ScopedReadLock* readLock,
-        ReadWriteLock::ScopedWriteLock* writeLock, Log* log);
+    struct Shard {
+        /// Protects sessions and the contents of the sessions.
+        mutable ReadWriteLock lock;
+        SessionMap sessions;
 
-    void flushWhenLocked(ReadWriteLock::ScopedWriteLock&, Log* log);
+        /// Protects dirty, removed and the sessions' dirty flags. Sessions are marked dirty while only a read
+        /// lock is held, so this can't be protected by lock.
+        Mutex dirtyMutex;
+        std::vector<RefPtr<HTTPServer::Session>> dirty;
+        std::vector<std::string> removed;
+    };
 
-    class MemorySession;
-    friend class MemorySession;
+    Shard& getShard(StringView sessionID);
 
-    mutable ReadWriteLock _lock;
+    const Shard& getShard(StringView sessionID) const { return const_cast<HTTPSettingsSessionManager*>(this)->getShard(sessionID); }
 
-    typedef std::map<std::string, RefPtr<HTTPServer::Session>, StringView::Less> SessionMap;
-    SessionMap _sessionMap;
+    void markDirty(MemorySession* session);
+
+    void markRemoved(Shard& shard, const std::string& sessionID);
+
+    bool isExpired(const MemorySession* session, int64_t time) const;
+
+    /// Write the dirty sessions to the Settings and sweep expired sessions.
+    void save(Log* log);
+
+    void backgroundSave();
+
+    int64_t getNextSaveTime() const { return _saveTimeBase + _nextSaveTimeOffset.get(); }
+
+    /// Must be called with _nextSaveTimeMutex locked.
+    void setNextSaveTime(int64_t time);
+
+    void load(const Value::Dictionary& dict);
+
+    Shard _shards[shardCount];
 
     RefPtr<Settings> _settings;
 
-    int64_t _lastSaveTime;
+    RefPtr<TaskQueue> _backgroundQueue;
+
+    /// Serialises save() and protects _savedSessions.
+    Mutex _saveMutex;
+
+    /// What was last written to the "sessions" setting.
+    Value::Dictionary _savedSessions;
+
+    /// Non-zero while a save is queued or in progress.
+    AtomicCounter _saving;
+
+    /// Serialises changes to the next save time. Request threads read it without locking.
+    Mutex _nextSaveTimeMutex;
+
+    /// The next save time is stored as an offset, in seconds, from _saveTimeBase so that it fits in an
+    /// AtomicCounter.
+    int64_t _saveTimeBase;
+    AtomicCounter _nextSaveTimeOffset;
 
     int64_t _saveIntervalSeconds;
 
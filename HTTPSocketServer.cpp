@@ -1,6 +1,8 @@
 // Copyright 2000-2021 Mark H. P. Lord
 
 #include "HTTPSocketServer.h"
+#include "Clocks.h"
+#include "StringUtils.h"
 
 #if 0
 #define HTTP_SOCKET_SERVER_ENABLE_STDERR_TRANTSCRIPT
@@ -10,7 +12,26 @@
 
 namespace Prime {
 
+//
+// HTTPSocketServer::LoadCounters
+//
+
+HTTPSocketServer::LoadCounters::LoadCounters()
+    : connections(0)
+    , activeConnections(0)
+    , queuedConnections(0)
+    , rejectedConnections(0)
+    , acceptPauses(0)
+    , _lastReportTime(0)
+{
+}
+
+//
+// HTTPSocketServer
+//
+
 HTTPSocketServer::HTTPSocketServer()
+    : _load(PassRef(new LoadCounters))
 {
     _initialised = false;
 }
@@ -50,6 +71,15 @@ void HTTPSocketServer::updateSettings(Settings* settings)
     _writeTimeoutInMilliseconds = (int)(settings->get("writeTimeoutInSeconds").toDouble(15.0) * 1000.0);
     _keepAliveTimeoutInMilliseconds = (int)(settings->get("keepAliveTimeoutInSeconds").toDouble(5.0) * 1000.0);
     _reverseLookup = settings->get("reverseLookup").toBool(true);
+    _parkKeepAliveConnections = settings->get("parkKeepAliveConnections").toBool(true);
+
+    // Zero means unlimited.
+    _maxConnections = settings->get("maxConnections").toInt(0);
+    _maxActiveConnections = settings->get("maxActiveConnections").toInt(0);
+    _maxQueuedConnections = settings->get("maxQueuedConnections").toInt(0);
+    _retryAfterSeconds = settings->get("retryAfterSeconds").toInt(1);
+    _pauseAcceptingWhenOverloaded = settings->get("pauseAcceptingWhenOverloaded").toBool(false);
+    _overloadPauseInMilliseconds = (int)(settings->get("overloadPauseInSeconds").toDouble(0.05) * 1000.0);
 }
 
 void HTTPSocketServer::run()
@@ -57,6 +87,10 @@ void HTTPSocketServer::run()
     PRIME_ASSERT(_initialised);
 
     for (;;) {
+        if (_pauseAcceptingWhenOverloaded && !waitUntilNotOverloaded()) {
+            break;
+        }
+
         ScopedPtr<Connection> connection(new Connection);
         if (!_listener->accept(connection->connection)) {
             break;
@@ -64,37 +98,157 @@ void HTTPSocketServer::run()
 
         connection->connection.socket.setCloseSignal(_closeSignal);
 
+        if (!_pauseAcceptingWhenOverloaded) {
+            const char* overloadReason = getOverloadReason();
+            if (overloadReason) {
+                reject(connection->connection.socket, overloadReason);
+                continue;
+            }
+        }
+
+        ++_load->connections;
+
         connection->httpSocketServer = this;
-        if (_taskGroup) {
+        queue(connection.get(), &Connection::run);
+        connection.detach();
+    }
+
+    //Trace("HTTPSocketServer terminated.");
+}
+
+const char* HTTPSocketServer::getOverloadReason() const
+{
+    if (_maxConnections > 0 && _load->connections.get() >= _maxConnections) {
+        return "maxConnections";
+    }
+
+    if (_maxActiveConnections > 0 && _load->activeConnections.get() >= _maxActiveConnections) {
+        return "maxActiveConnections";
+    }
+
+    if (_maxQueuedConnections > 0 && _load->queuedConnections.get() >= _maxQueuedConnections) {
+        return "maxQueuedConnections";
+    }
+
+    return NULL;
+}
+
+bool HTTPSocketServer::waitUntilNotOverloaded()
+{
+    const char* reason = getOverloadReason();
+    if (!reason) {
+        return true;
+    }
+
+    // New connections wait in the listen backlog until we have capacity.
+    ++_load->acceptPauses;
+    reportShedding(reason);
+
+    do {
+        if (_closeSignal) {
+            if (_closeSignal->wait(_overloadPauseInMilliseconds, _log) == Socket::WaitResultOK) {
+                return false;
+            }
+        } else {
+            Clock::sleepMilliseconds(_overloadPauseInMilliseconds);
+        }
+    } while (getOverloadReason());
+
+    return true;
+}
+
+void HTTPSocketServer::reject(Socket& socket, const char* reason)
+{
+    ++_load->rejectedConnections;
+    reportShedding(reason);
+
+    // We can't respond without first completing a TLS handshake, which is the kind of work we're trying to
+    // avoid, so TLS connections are simply closed.
+    if (_sslWrapper) {
+        return;
+    }
+
+    std::string response = Format("HTTP/1.1 503 Service Unavailable\r\n"
+                                  "Retry-After: %d\r\n"
+                                  "Connection: close\r\n"
+                                  "Content-Length: 0\r\n"
+                                  "\r\n",
+        _retryAfterSeconds);
+
+    if (!socket.sendAll(response.data(), response.size(), Log::getNullLog())) {
+        return;
+    }
+
+    // Closing a socket with unread data causes a reset, which can destroy the response before the client has
+    // read it, so discard whatever the client has already sent (within reason - we're overloaded).
+    char discard[2048];
+    for (int i = 0; i != 8; ++i) {
+        if (socket.waitRecv(0, Log::getNullLog()) != Socket::WaitResultOK || socket.recv(discard, sizeof(discard), Log::getNullLog()) <= 0) {
+            break;
+        }
+    }
+}
+
+void HTTPSocketServer::reportShedding(const char* reason)
+{
+    // Log at most once every 10 seconds.
+    int now = (int)Clock::getMonotonicSeconds();
+    int last = _load->_lastReportTime.get();
+    if (last != 0 && now - last < 10) {
+        return;
+    }
+
+    _load->_lastReportTime.set(now == 0 ? 1 : now);
+
+    _log->warning(PRIME_LOCALISE("Server overloaded (%s reached): %d connections rejected, accepting paused %d times."),
+        reason, (int)_load->rejectedConnections.get(), (int)_load->acceptPauses.get());
+}
+
+void HTTPSocketServer::queue(Connection* connection, ConnectionMethod method)
+{
+    ++_load->activeConnections;
+    ++_load->queuedConnections;
+
+    connection->queuedMethod = method;
+
+    if (_taskGroup) {
 #ifdef PRIME_CXX11_STL
-            Connection* connectionPointer = connection;
-            _taskGroup->queue(_taskQueue, [connectionPointer]() {
-                connectionPointer->run();
-            });
+        _taskGroup->queue(_taskQueue, [connection]() {
+            connection->dispatch();
+        });
 #else
-            _taskGroup->queue(_taskQueue, MethodCallback(connection.get(), &Connection::run));
+        _taskGroup->queue(_taskQueue, MethodCallback(connection, &Connection::dispatch));
 #endif
-        } else {
+    } else {
 #ifdef PRIME_CXX11_STL
-            Connection* connectionPointer = connection;
-            _taskQueue->queue([connectionPointer]() {
-                connectionPointer->run();
-            });
+        _taskQueue->queue([connection]() {
+            connection->dispatch();
+        });
 #else
-            _taskQueue->queue(MethodCallback(connection.get(), &Connection::run));
+        _taskQueue->queue(MethodCallback(connection, &Connection::dispatch));
 #endif
-        }
-        connection.detach();
     }
-
-    //Trace("HTTPSocketServer terminated.");
 }
 
 //
 // HTTPSocketServer::Connection
 //
 
-void HTTPSocketServer::Connection::run()
+HTTPSocketServer::Connection::Connection()
+    : queuedMethod(NULL)
+    , _protocol(NULL)
+    , _waitResult(Socket::WaitResultCancelled)
+{
+}
+
+void HTTPSocketServer::Connection::dispatch()
+{
+    --httpSocketServer->_load->queuedConnections;
+
+    (this->*queuedMethod)();
+}
+
+bool HTTPSocketServer::Connection::open()
 {
     char addressDescription[64];
 #ifndef PRIME_NO_IP6
@@ -105,78 +259,156 @@ void HTTPSocketServer::Connection::run()
         connection.address.describe(addressDescription, sizeof(addressDescription));
     }
 
-    PrefixLog log;
-    log.setLog(httpSocketServer->_log);
-    log.setPrefix(MakeString("Client ", addressDescription));
+    _log.setLog(httpSocketServer->_log);
+    _log.setPrefix(MakeString("Client ", addressDescription));
 
     if (httpSocketServer->_server->getVerboseLevel()) {
-        log.trace("Connection opened.");
+        _log.trace("Connection opened.");
     }
 
-    SocketStream socketStream(httpSocketServer->_readTimeoutInMilliseconds,
-        httpSocketServer->_writeTimeoutInMilliseconds);
-    socketStream.takeOwnership(connection.socket);
-
-    RefPtr<NetworkStream> networkStream;
-    const char* protocol;
+    _socketStream.setReadTimeout(httpSocketServer->_readTimeoutInMilliseconds);
+    _socketStream.setWriteTimeout(httpSocketServer->_writeTimeoutInMilliseconds);
+    _socketStream.takeOwnership(connection.socket);
 
     if (httpSocketServer->_sslWrapper) {
-        RefPtr<Stream> stream = httpSocketServer->_sslWrapper(&socketStream, Log::getGlobal());
+        RefPtr<Stream> stream = httpSocketServer->_sslWrapper(&_socketStream, Log::getGlobal());
         if (!stream) {
-            return;
+            return false;
         }
 
-        networkStream = UIDCast<NetworkStream>(stream.get());
-        protocol = "https";
+        _networkStream = UIDCast<NetworkStream>(stream.get());
+        _protocol = "https";
     } else {
-        networkStream = &socketStream;
-        protocol = "http";
+        _networkStream = &_socketStream;
+        _protocol = "http";
     }
 
 #ifdef HTTP_SOCKET_SERVER_ENABLE_STDERR_TRANTSCRIPT
-    MultiStream debug;
-    debug.setReadMode(MultiStream::ReadModeWrite);
-    debug.addStream(networkStream);
-    debug.addStream(PassRef(new StdioStream(stderr, false)));
-    debug.setReadStream(networkStream);
-    networkStream = &debug;
+    RefPtr<MultiStream> debug = PassRef(new MultiStream);
+    debug->setReadMode(MultiStream::ReadModeWrite);
+    debug->addStream(_networkStream);
+    debug->addStream(PassRef(new StdioStream(stderr, false)));
+    debug->setReadStream(_networkStream);
+    _networkStream = debug;
 #endif
 
-    StreamBuffer readBuffer(networkStream, httpSocketServer->_maxHeaderSizeInBytes);
-    StreamBuffer writeBuffer(networkStream, httpSocketServer->_writeBufferSizeInBytes);
+    // Connections are short lived, so recycle their buffers rather than allocating fresh ones every time.
+    _readBuffer.setBufferPool(BufferPool::getGlobal());
+    _writeBuffer.setBufferPool(BufferPool::getGlobal());
+
+    return _readBuffer.init(_networkStream, httpSocketServer->_maxHeaderSizeInBytes) && _writeBuffer.init(_networkStream, httpSocketServer->_writeBufferSizeInBytes);
+}
+
+void HTTPSocketServer::Connection::run()
+{
+    if (!_networkStream && !open()) {
+        finish();
+        return;
+    }
 
     for (;;) {
-        bool keepAlive = httpSocketServer->_server->serve(&readBuffer, &writeBuffer, protocol, log, &log, !httpSocketServer->_disableKeepAlive);
-        writeBuffer.flush(log);
+        bool keepAlive = httpSocketServer->_server->serve(&_readBuffer, &_writeBuffer, _protocol, _log, &_log, !httpSocketServer->_disableKeepAlive, NULL, &_arena);
+        _writeBuffer.flush(_log);
 
         if (!keepAlive) {
             break;
         }
 
-        // This sucks - should be using epoll etc. for keep-alive'ing sockets
+        // Pipelined requests beyond HTTPServer's pipeline depth are already buffered, so the socket may never
+        // become readable again.
+        if (_readBuffer.getBytesAvailable() != 0) {
+            continue;
+        }
+
+        // Once parked, resume() may be called (and we may be deleted) before park() returns.
+        --httpSocketServer->_load->activeConnections;
+
+        if (park()) {
+            // resume() will be called on the TaskQueue when the client sends its next request.
+            return;
+        }
+
+        ++httpSocketServer->_load->activeConnections;
 
         NetworkStream::WaitResult waitResult;
         {
             TaskQueue::ScopedYield yield(httpSocketServer->_taskQueue);
-            waitResult = networkStream->waitRead(httpSocketServer->_keepAliveTimeoutInMilliseconds, log);
+            waitResult = _networkStream->waitRead(httpSocketServer->_keepAliveTimeoutInMilliseconds, _log);
         }
 
         if (waitResult != NetworkStream::WaitResultOK) {
             if (httpSocketServer->_server->getVerboseLevel()) {
-                log->trace("Keep-alive socket not reused.");
+                _log.trace("Keep-alive socket not reused.");
             }
             break;
         }
 
         if (httpSocketServer->_server->getVerboseLevel()) {
-            log->trace("Client reusing connection.");
+            _log.trace("Client reusing connection.");
         }
     }
 
+    finish();
+}
+
+bool HTTPSocketServer::Connection::park()
+{
+    SocketReactor* reactor = httpSocketServer->_keepAliveReactor;
+    if (!reactor || !httpSocketServer->_parkKeepAliveConnections) {
+        return false;
+    }
+
+    // If the next request has already been read (e.g., it's sitting in a TLS buffer) then the socket may never
+    // become readable, so don't park.
+    if (_readBuffer.getBytesAvailable() != 0 || _networkStream->waitRead(0, Log::getNullLog()) == NetworkStream::WaitResultOK) {
+        return false;
+    }
+
+#ifdef PRIME_CXX11_STL
+    SocketReactor::Callback callback = [this](Socket::WaitResult waitResult) {
+        this->reactorCallback(waitResult);
+    };
+#else
+    SocketReactor::Callback callback = MethodCallback(this, &Connection::reactorCallback);
+#endif
+
+    return reactor->parkUntilReadable(_socketStream.getHandle(), httpSocketServer->_keepAliveTimeoutInMilliseconds,
+        callback, _log);
+}
+
+void HTTPSocketServer::Connection::reactorCallback(Socket::WaitResult waitResult)
+{
+    _waitResult = waitResult;
+    httpSocketServer->queue(this, &Connection::resume);
+}
+
+void HTTPSocketServer::Connection::resume()
+{
+    if (_waitResult != Socket::WaitResultOK) {
+        if (httpSocketServer->_server->getVerboseLevel()) {
+            _log.trace("Keep-alive socket not reused.");
+        }
+
+        finish();
+        return;
+    }
+
     if (httpSocketServer->_server->getVerboseLevel()) {
-        log.trace("Connection closed.");
+        _log.trace("Client reusing connection.");
     }
 
+    run();
+}
+
+void HTTPSocketServer::Connection::finish()
+{
+    if (_networkStream && httpSocketServer->_server->getVerboseLevel()) {
+        _log.trace("Connection closed.");
+    }
+
+    --httpSocketServer->_load->activeConnections;
+    --httpSocketServer->_load->connections;
+
     delete this;
 }
 }
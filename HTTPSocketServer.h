@@ -7,8 +7,10 @@
 #ifndef PRIME_CXX11_STL
 #include "Callback.h"
 #endif
+#include "PrefixLog.h"
 #include "SignalSocket.h"
 #include "SocketListener.h"
+#include "SocketReactor.h"
 #include "SocketStream.h"
 #include "TaskQueue.h"
 #include <functional>
@@ -16,12 +18,48 @@
 namespace Prime {
 
 /// Accepts connections from a SocketListener then dispatches tasks on a TaskQueue which route the requests to an
-/// HTTPServer, taking care of keep-alive.
+/// HTTPServer, taking care of keep-alive. To stop an overloaded server's latency growing without bound, the
+/// maxConnections, maxActiveConnections and maxQueuedConnections settings limit the number of open connections,
+/// connections with a request in flight and connections waiting for a TaskQueue thread. A new connection that
+/// would exceed a limit is answered with a 503 (with a Retry-After of retryAfterSeconds) and closed or, if
+/// pauseAcceptingWhenOverloaded is set, left in the listen backlog until the server has capacity. Connections
+/// that have already been accepted are never shed, so clients in the middle of a keep-alive session aren't
+/// penalised.
 class PRIME_PUBLIC HTTPSocketServer : public RefCounted {
 public:
     // We don't need much stack.
     enum { threadSize = 16u * 1024u };
 
+    /// Connection counts, which can be shared between HTTPSocketServers using the same TaskQueue so that the
+    /// limits apply to all of them (HTTPMultiSocketServer does this).
+    class PRIME_PUBLIC LoadCounters : public RefCounted {
+    public:
+        LoadCounters();
+
+        /// Open connections, including idle keep-alive connections.
+        AtomicCounter connections;
+
+        /// Connections that have a task queued or running on the TaskQueue.
+        AtomicCounter activeConnections;
+
+        /// Connections whose tasks are waiting for a TaskQueue thread.
+        AtomicCounter queuedConnections;
+
+        /// Connections that were answered with a 503 because a limit had been reached.
+        AtomicCounter rejectedConnections;
+
+        /// The number of times accepting was paused because a limit had been reached.
+        AtomicCounter acceptPauses;
+
+    private:
+        friend class HTTPSocketServer;
+
+        /// When load shedding was last logged, in monotonic seconds.
+        AtomicCounter _lastReportTime;
+
+        PRIME_UNCOPYABLE(LoadCounters);
+    };
+
     HTTPSocketServer();
 
     ~HTTPSocketServer();
@@ -36,20 +74,79 @@ public:
         TaskQueue::TaskGroup* taskGroup, HTTPServer* server, Settings* settings, Log* log,
         const ConnectionWrapper& sslWrapper = ConnectionWrapper());
 
+    /// Set a SocketReactor to which idle keep-alive connections are handed while they wait for their next
+    /// request, rather than blocking a TaskQueue thread for the duration of the keep-alive timeout. Can be
+    /// disabled with the parkKeepAliveConnections setting.
+    void setKeepAliveReactor(SocketReactor* reactor) { _keepAliveReactor = reactor; }
+
+    /// Share LoadCounters with other HTTPSocketServers. Must be called before run().
+    void setLoadCounters(LoadCounters* loadCounters) { _load = loadCounters; }
+
+    LoadCounters* getLoadCounters() const { return _load; }
+
     void run();
 
 private:
     void updateSettings(Settings* settings);
 
+    /// Returns a description of the limit that has been reached, or NULL if a new connection can be accepted.
+    const char* getOverloadReason() const;
+
+    /// Returns false if the server is closing.
+    bool waitUntilNotOverloaded();
+
+    /// Send a 503 and close the connection.
+    void reject(Socket& socket, const char* reason);
+
+    void reportShedding(const char* reason);
+
     class Connection {
     public:
         RefPtr<HTTPSocketServer> httpSocketServer;
         SocketListener::Connection connection;
 
+        Connection();
+
+        /// Serves requests until the connection closes or is parked in the keep-alive reactor.
         void run();
+
+        /// Invoked on the TaskQueue by queue(), calls the method that was queued.
+        void dispatch();
+
+        typedef void (Connection::*Method)();
+
+        Method queuedMethod;
+
+    private:
+        bool open();
+
+        /// Returns true if the connection has been handed to the keep-alive reactor, in which case the caller
+        /// must not touch this object again.
+        bool park();
+
+        /// Invoked on the reactor's thread.
+        void reactorCallback(Socket::WaitResult waitResult);
+
+        /// Invoked on the TaskQueue after the reactor has called back.
+        void resume();
+
+        void finish();
+
+        PrefixLog _log;
+        SocketStream _socketStream;
+        RefPtr<NetworkStream> _networkStream;
+        const char* _protocol;
+        StreamBuffer _readBuffer;
+        StreamBuffer _writeBuffer;
+        MonotonicArena _arena;
+        Socket::WaitResult _waitResult;
     };
     friend class Connection;
 
+    typedef Connection::Method ConnectionMethod;
+
+    void queue(Connection* connection, ConnectionMethod method);
+
     Settings::Observer _settingsObserver;
     RefPtr<SocketListener> _listener;
     ConnectionWrapper _sslWrapper;
@@ -57,16 +154,25 @@ private:
     RefPtr<TaskQueue> _taskQueue;
     RefPtr<TaskQueue::TaskGroup> _taskGroup;
     RefPtr<SignalSocket> _closeSignal;
+    RefPtr<SocketReactor> _keepAliveReactor;
+    RefPtr<LoadCounters> _load;
     RefPtr<Log> _log;
     bool _initialised;
 
     bool _disableKeepAlive;
     bool _reverseLookup;
+    bool _parkKeepAliveConnections;
     size_t _maxHeaderSizeInBytes;
     size_t _writeBufferSizeInBytes;
     int _readTimeoutInMilliseconds;
     int _writeTimeoutInMilliseconds;
     int _keepAliveTimeoutInMilliseconds;
+    int _maxConnections;
+    int _maxActiveConnections;
+    int _maxQueuedConnections;
+    int _retryAfterSeconds;
+    bool _pauseAcceptingWhenOverloaded;
+    int _overloadPauseInMilliseconds;
 };
 }
 
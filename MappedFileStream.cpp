@@ -0,0 +1,247 @@
+// Copyright 2000-2021 Mark H. P. Lord
+
+#include "MappedFileStream.h"
+#include "NumberUtils.h"
+#include <string.h>
+
+#ifdef PRIME_HAVE_MAPPEDFILESTREAM
+#include "Unix/UnixFileStream.h"
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace Prime {
+
+PRIME_DEFINE_UID_CAST(MappedFileStream)
+
+#ifdef PRIME_HAVE_MAPPEDFILESTREAM
+
+namespace {
+
+    int GetMAdvice(MappedFileStream::Advice advice)
+    {
+        switch (advice) {
+        case MappedFileStream::AdviceSequential:
+            return MADV_SEQUENTIAL;
+        case MappedFileStream::AdviceRandom:
+            return MADV_RANDOM;
+        case MappedFileStream::AdviceWillNeed:
+            return MADV_WILLNEED;
+        case MappedFileStream::AdviceDontNeed:
+            return MADV_DONTNEED;
+        case MappedFileStream::AdviceNormal:
+            break;
+        }
+
+        return MADV_NORMAL;
+    }
+}
+
+#endif
+
+MappedFileStream::MappedFileStream()
+    : _bytes(NULL)
+    , _size(0)
+    , _offset(0)
+    , _open(false)
+{
+}
+
+MappedFileStream::~MappedFileStream()
+{
+    close(Log::getNullLog());
+}
+
+bool MappedFileStream::open(const char* path, Log* log, Advice advice)
+{
+    close(log);
+
+#ifdef PRIME_HAVE_MAPPEDFILESTREAM
+    // The mapping remains valid after the file has been closed.
+    UnixFileStream file;
+    if (!file.openForRead(path, log)) {
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(file.getHandle(), &st) != 0) {
+        log->logErrno(errno);
+        return false;
+    }
+
+    if (!S_ISREG(st.st_mode)) {
+        log->error(PRIME_LOCALISE("Only regular files can be mapped."));
+        return false;
+    }
+
+    if ((uint64_t)st.st_size > (uint64_t)(size_t)-1) {
+        log->error(PRIME_LOCALISE("File is too large to map."));
+        return false;
+    }
+
+    _size = (size_t)st.st_size;
+    _offset = 0;
+
+    // mmap() won't map zero bytes.
+    if (_size != 0) {
+        void* mapping = mmap(NULL, _size, PROT_READ, MAP_PRIVATE, file.getHandle(), 0);
+        if (mapping == MAP_FAILED) {
+            log->logErrno(errno);
+            _size = 0;
+            return false;
+        }
+
+        _bytes = (const char*)mapping;
+
+        if (advice != AdviceNormal) {
+            advise(0, _size, advice, log);
+        }
+    }
+
+    _open = true;
+    return true;
+#else
+    (void)path;
+    (void)advice;
+    log->error(PRIME_LOCALISE("Memory mapped files are not supported on this platform."));
+    return false;
+#endif
+}
+
+bool MappedFileStream::advise(size_t offset, size_t length, Advice advice, Log* log)
+{
+    if (offset >= _size) {
+        return true;
+    }
+
+    length = PRIME_MIN(length, _size - offset);
+
+#ifdef PRIME_HAVE_MAPPEDFILESTREAM
+    // madvise() requires a page aligned address.
+    size_t pageSize = (size_t)sysconf(_SC_PAGESIZE);
+    size_t alignedOffset = offset - offset % pageSize;
+
+    if (madvise((void*)(_bytes + alignedOffset), length + (offset - alignedOffset), GetMAdvice(advice)) != 0) {
+        log->logErrno(errno);
+        return false;
+    }
+
+    return true;
+#else
+    (void)advice;
+    (void)log;
+    return false;
+#endif
+}
+
+bool MappedFileStream::close(Log* log)
+{
+    bool success = true;
+
+#ifdef PRIME_HAVE_MAPPEDFILESTREAM
+    if (_bytes && munmap((void*)_bytes, _size) != 0) {
+        log->logErrno(errno);
+        success = false;
+    }
+#else
+    (void)log;
+#endif
+
+    _bytes = NULL;
+    _size = 0;
+    _offset = 0;
+    _open = false;
+
+    return success;
+}
+
+ptrdiff_t MappedFileStream::readSome(void* buffer, size_t maxBytes, Log*)
+{
+    PRIME_ASSERT(isOpen());
+
+    size_t take = PRIME_MIN(maxBytes, _size - _offset);
+    memcpy(buffer, _bytes + _offset, take);
+    _offset += take;
+
+    return (ptrdiff_t)take;
+}
+
+ptrdiff_t MappedFileStream::readAtOffset(Offset offset, void* buffer, size_t requiredBytes, Log* log)
+{
+    PRIME_ASSERT(isOpen());
+
+    if (offset < 0) {
+        log->error(PRIME_LOCALISE("Invalid offset."));
+        return -1;
+    }
+
+    if ((uint64_t)offset >= (uint64_t)_size) {
+        return 0;
+    }
+
+    size_t take = PRIME_MIN(requiredBytes, _size - (size_t)offset);
+    memcpy(buffer, _bytes + (size_t)offset, take);
+
+    return (ptrdiff_t)take;
+}
+
+Stream::Offset MappedFileStream::seek(Offset offset, SeekMode mode, Log* log)
+{
+    PRIME_ASSERT(isOpen());
+
+    Offset newOffset;
+    switch (mode) {
+    case SeekModeAbsolute:
+        newOffset = offset;
+        break;
+    case SeekModeRelative:
+        newOffset = (Offset)_offset + offset;
+        break;
+    case SeekModeRelativeToEnd:
+        newOffset = (Offset)_size + offset;
+        break;
+    default:
+        PRIME_ASSERT(0);
+        return -1;
+    }
+
+    if (newOffset < 0 || newOffset > (Offset)_size) {
+        log->error(PRIME_LOCALISE("Attempt to seek outside a mapped file."));
+        return -1;
+    }
+
+    _offset = (size_t)newOffset;
+    return newOffset;
+}
+
+Stream::Offset MappedFileStream::getSize(Log*)
+{
+    return (Offset)_size;
+}
+
+bool MappedFileStream::tryCopyTo(bool& error, Stream* dest, Log* destLog, Offset length, Log* sourceLog,
+    size_t, void*)
+{
+    PRIME_ASSERT(isOpen());
+
+    size_t remaining = _size - _offset;
+    if (length > (Offset)remaining) {
+        sourceLog->error(PRIME_LOCALISE("Unexpected end of file."));
+        error = true;
+        return false;
+    }
+
+    size_t size = length < 0 ? remaining : (size_t)length;
+
+    if (!dest->writeExact(_bytes + _offset, size, destLog)) {
+        error = true;
+        return false;
+    }
+
+    _offset += size;
+    error = false;
+    return true;
+}
+}
@@ -0,0 +1,78 @@
+// Copyright 2000-2021 Mark H. P. Lord
+
+#ifndef PRIME_MAPPEDFILESTREAM_H
+#define PRIME_MAPPEDFILESTREAM_H
+
+#include "Stream.h"
+#include "StringView.h"
+
+#ifdef PRIME_OS_UNIX
+#define PRIME_HAVE_MAPPEDFILESTREAM
+#endif
+
+namespace Prime {
+
+/// A read-only Stream over a file that has been memory mapped, so the file's contents can also be accessed
+/// directly (e.g., parsed in place with TextReader::setText()) without being copied in to memory first. Only
+/// available where PRIME_HAVE_MAPPEDFILESTREAM is defined (open() will fail on other platforms). If the file
+/// is truncated while it's mapped, touching the mapping beyond the new end of the file raises SIGBUS, so only
+/// map files that won't be truncated by another process (or handle SIGBUS).
+class PRIME_PUBLIC MappedFileStream : public Stream {
+    PRIME_DECLARE_UID_CAST(Stream, 0x5a1c93e2, 0x0d7e4b6f, 0x9b28c4a1, 0x6e3f7d05)
+
+public:
+    /// How the mapping is going to be accessed, which determines how the OS reads ahead (see madvise()).
+    enum Advice {
+        AdviceNormal,
+        AdviceSequential,
+        AdviceRandom,
+        AdviceWillNeed,
+        AdviceDontNeed
+    };
+
+    MappedFileStream();
+
+    ~MappedFileStream();
+
+    /// Map an entire file, read only. The advice applies to the whole mapping.
+    bool open(const char* path, Log* log, Advice advice = AdviceSequential);
+
+    bool isOpen() const { return _open; }
+
+    /// Give the OS a hint about how a region of the mapping is going to be accessed. Use AdviceDontNeed for
+    /// regions that have been finished with to reduce the process's resident memory.
+    bool advise(size_t offset, size_t length, Advice advice, Log* log);
+
+    /// Returns the mapped bytes, which are only valid until the Stream is closed (or destructed).
+    const char* getBytes() const { return _bytes; }
+
+    size_t getMappedSize() const { return _size; }
+
+    StringView getView() const { return StringView(_bytes, _bytes + _size); }
+
+    /// Returns the bytes that haven't been read yet.
+    StringView getRemainingView() const { return StringView(_bytes + _offset, _bytes + _size); }
+
+    // Stream implementation.
+    virtual bool close(Log* log) PRIME_OVERRIDE;
+    virtual ptrdiff_t readSome(void* buffer, size_t maxBytes, Log* log) PRIME_OVERRIDE;
+    virtual ptrdiff_t readAtOffset(Offset offset, void* buffer, size_t requiredBytes, Log* log) PRIME_OVERRIDE;
+    virtual bool hasConcurrentPositionalIO() const PRIME_OVERRIDE { return true; }
+    virtual Offset seek(Offset offset, SeekMode mode, Log* log) PRIME_OVERRIDE;
+    virtual Offset getSize(Log* log) PRIME_OVERRIDE;
+
+    /// Writes directly from the mapping.
+    virtual bool tryCopyTo(bool& error, Stream* dest, Log* destLog, Offset length, Log* sourceLog,
+        size_t bufferSize = 0, void* buffer = NULL) PRIME_OVERRIDE;
+
+private:
+    const char* _bytes;
+    size_t _size;
+    size_t _offset;
+    bool _open;
+
+    PRIME_UNCOPYABLE(MappedFileStream);
+};
+}
+
+#endif
@@ -0,0 +1,146 @@
+// Copyright 2000-2021 Mark H. P. Lord
+
+#ifndef PRIME_MAPPEDFILESTREAMTESTS_H
+#define PRIME_MAPPEDFILESTREAMTESTS_H
+
+#include "FileLoader.h"
+#include "FileLocations.h"
+#include "MappedFileStream.h"
+#include "TempFile.h"
+#include "TextReader.h"
+
+namespace Prime {
+
+#if defined(PRIME_HAVE_MAPPEDFILESTREAM) && defined(PRIME_HAVE_TEMPFILE)
+
+namespace MappedFileStreamTestsPrivate {
+
+    inline void CreateFile(TempFile& file, StringView contents, Log* log)
+    {
+        PRIME_TEST(file.createInPath(GetTemporaryPath(log).c_str(), log));
+        PRIME_TEST(file.writeString(contents, log));
+        PRIME_TEST(file.flush(log));
+    }
+
+    inline void MappedFileStreamMapTests(Log* log)
+    {
+        static const char contents[] = "first line\nsecond line\n";
+
+        TempFile file;
+        CreateFile(file, contents, log);
+
+        RefPtr<MappedFileStream> mapped = PassRef(new MappedFileStream);
+        PRIME_TEST(mapped->open(file.getPath(), log));
+        PRIME_TEST(mapped->getMappedSize() == sizeof(contents) - 1);
+        PRIME_TEST(mapped->getView() == contents);
+        PRIME_TEST(mapped->getSize(log) == (Stream::Offset)(sizeof(contents) - 1));
+
+        // Reading and seeking go through the mapping.
+        char buffer[6];
+        PRIME_TEST(mapped->readExact(buffer, 5, log));
+        PRIME_TEST(StringView(buffer, buffer + 5) == "first");
+        PRIME_TEST(mapped->getRemainingView() == " line\nsecond line\n");
+        PRIME_TEST(mapped->readExact(11, buffer, 6, log));
+        PRIME_TEST(StringView(buffer, buffer + 6) == "second");
+        PRIME_TEST(mapped->seek(-5, Stream::SeekModeRelativeToEnd, log) == (Stream::Offset)(sizeof(contents) - 6));
+        PRIME_TEST(mapped->readSome(buffer, sizeof(buffer), log) == 5);
+        PRIME_TEST(mapped->readSome(buffer, sizeof(buffer), log) == 0);
+
+        // A TextReader parses the unread part of the mapping in place.
+        PRIME_TEST(mapped->seek(11, Stream::SeekModeAbsolute, log) == 11);
+
+        TextReader textReader;
+        textReader.setStream(mapped, 0);
+        PRIME_TEST(textReader.hasString("second"));
+        textReader.skipChars(7);
+
+        std::string rest;
+        for (int c; (c = textReader.readChar()) >= 0;) {
+            rest += (char)c;
+        }
+        PRIME_TEST(rest == "line\n");
+
+        PRIME_TEST(mapped->close(log));
+        PRIME_TEST(mapped->getView().empty());
+    }
+
+    inline void MappedFileStreamEmptyTests(Log* log)
+    {
+        TempFile file;
+        CreateFile(file, "", log);
+
+        // mmap() can't map zero bytes, but an empty file is still opened.
+        MappedFileStream mapped;
+        PRIME_TEST(mapped.open(file.getPath(), log));
+        PRIME_TEST(mapped.getMappedSize() == 0);
+        PRIME_TEST(mapped.getView().empty());
+
+        char byte;
+        PRIME_TEST(mapped.readSome(&byte, 1, log) == 0);
+
+        TextReader textReader;
+        textReader.setStream(&mapped, 0);
+        PRIME_TEST(textReader.peekChar() == TextReader::EOFChar);
+
+        // FileLoader reads empty files rather than mapping them.
+        FileLoader loader;
+        loader.setUseMapping(true);
+        PRIME_TEST(loader.load(file.getPath(), log));
+        PRIME_TEST(!loader.isMapped());
+        PRIME_TEST(loader.getSize() == 0);
+        PRIME_TEST(loader.getView().empty());
+    }
+
+    inline void FileLoaderMappingTests(Log* log)
+    {
+        static const char contents[] = "mapped contents";
+
+        TempFile file;
+        CreateFile(file, contents, log);
+
+        FileLoader loader;
+        PRIME_TEST(loader.load(file.getPath(), log));
+        PRIME_TEST(!loader.isMapped());
+        PRIME_TEST(loader.getString() == contents);
+        PRIME_TEST(loader.getView() == contents);
+
+        loader.setUseMapping(true);
+        PRIME_TEST(loader.load(file.getPath(), log));
+        PRIME_TEST(loader.isMapped());
+        PRIME_TEST(loader.getSize() == sizeof(contents) - 1);
+        PRIME_TEST(loader.getView() == contents);
+
+        // Mapped bytes are only handed out read only: getReadOnlyBytes() and getView() point in to the mapping,
+        // while getBytes(), begin(), end(), getString() and c_str() assert.
+        const char* bytes = loader.getReadOnlyBytes();
+        PRIME_TEST(bytes == loader.getMappedFile()->getBytes());
+        PRIME_TEST(loader.getView().data() == bytes);
+
+        TextReader textReader;
+        textReader.setText(loader.getMappedFile());
+        PRIME_TEST(textReader.hasString(contents));
+
+        // The TextReader keeps the mapping alive after the FileLoader has let go of it.
+        loader.reset();
+        PRIME_TEST(!loader.isMapped());
+        PRIME_TEST(textReader.hasString(contents));
+    }
+}
+
+inline void MappedFileStreamTests(Log* log)
+{
+    MappedFileStreamTestsPrivate::MappedFileStreamMapTests(log);
+    MappedFileStreamTestsPrivate::MappedFileStreamEmptyTests(log);
+    MappedFileStreamTestsPrivate::FileLoaderMappingTests(log);
+}
+
+#else
+
+inline void MappedFileStreamTests(Log*)
+{
+}
+
+#endif
+}
+
+#endif
@@ -0,0 +1,93 @@
+// Copyright 2000-2021 Mark H. P. Lord
+
+#include "MonotonicArena.h"
+#include "NumberUtils.h"
+#include <string.h>
+
+namespace Prime {
+
+MonotonicArena::MonotonicArena(size_t blockSize)
+    : _blockSize(blockSize)
+    , _blocks(NULL)
+    , _firstBlock(NULL)
+    , _ptr(NULL)
+    , _end(NULL)
+    , _bytesAllocated(0)
+{
+}
+
+MonotonicArena::~MonotonicArena()
+{
+    while (_blocks) {
+        Block* next = _blocks->next;
+        ::operator delete(_blocks);
+        _blocks = next;
+    }
+}
+
+void* MonotonicArena::allocate(size_t size, size_t alignment)
+{
+    PRIME_DEBUG_ASSERT(alignment != 0 && (alignment & (alignment - 1)) == 0);
+
+    uintptr_t aligned = ((uintptr_t)_ptr + (alignment - 1)) & ~(uintptr_t)(alignment - 1);
+    if (_ptr && aligned + size <= (uintptr_t)_end && aligned + size >= aligned) {
+        _ptr = reinterpret_cast<char*>(aligned + size);
+        _bytesAllocated += size;
+        return reinterpret_cast<void*>(aligned);
+    }
+
+    return allocateFromNewBlock(size, alignment);
+}
+
+void* MonotonicArena::allocateFromNewBlock(size_t size, size_t alignment)
+{
+    // Blocks are aligned to defaultAlignment, so only larger alignments need padding.
+    size_t padding = alignment > (size_t)defaultAlignment ? alignment - 1 : 0;
+    size_t capacity = Max(_blockSize, size + padding);
+
+    Block* block = static_cast<Block*>(::operator new(blockHeaderSize + capacity));
+    block->size = capacity;
+    block->next = _blocks;
+    _blocks = block;
+
+    if (!_firstBlock) {
+        _firstBlock = block;
+    }
+
+    char* begin = getBlockBegin(block);
+    uintptr_t aligned = ((uintptr_t)begin + (alignment - 1)) & ~(uintptr_t)(alignment - 1);
+
+    _ptr = reinterpret_cast<char*>(aligned + size);
+    _end = begin + capacity;
+    _bytesAllocated += size;
+
+    return reinterpret_cast<void*>(aligned);
+}
+
+StringView MonotonicArena::copyString(StringView string)
+{
+    if (string.empty()) {
+        return StringView();
+    }
+
+    char* copy = static_cast<char*>(allocate(string.size(), 1));
+    memcpy(copy, string.data(), string.size());
+    return StringView(copy, string.size());
+}
+
+void MonotonicArena::reset()
+{
+    while (_blocks && _blocks != _firstBlock) {
+        Block* next = _blocks->next;
+        ::operator delete(_blocks);
+        _blocks = next;
+    }
+
+    if (_firstBlock) {
+        _ptr = getBlockBegin(_firstBlock);
+        _end = _ptr + _firstBlock->size;
+    }
+
+    _bytesAllocated = 0;
+}
+}
@@ -0,0 +1,136 @@
+// Copyright 2000-2021 Mark H. P. Lord
+
+#ifndef PRIME_MONOTONICARENA_H
+#define PRIME_MONOTONICARENA_H
+
+#include "Config.h"
+#include "StringView.h"
+#include <limits>
+#include <new>
+
+namespace Prime {
+
+/// Allocates memory by bumping a pointer through large blocks. Individual allocations are never freed; instead
+/// everything is released at once by reset(), which keeps the first block for reuse. Intended for short-lived
+/// allocations with a well defined lifetime, such as those made while handling a single HTTP request. Not
+/// thread safe.
+class PRIME_PUBLIC MonotonicArena {
+public:
+    enum { defaultBlockSize = 8u * 1024u };
+
+    /// Suitable for any fundamental type.
+    enum { defaultAlignment = 16 };
+
+    explicit MonotonicArena(size_t blockSize = defaultBlockSize);
+
+    ~MonotonicArena();
+
+    /// Never returns NULL. alignment must be a power of two.
+    void* allocate(size_t size, size_t alignment = defaultAlignment);
+
+    template <typename Type>
+    Type* allocateArray(size_t count)
+    {
+        return static_cast<Type*>(allocate(sizeof(Type) * count, PRIME_ALIGNOF(Type)));
+    }
+
+    /// Copy a string in to the arena. The copy is not null terminated.
+    StringView copyString(StringView string);
+
+    /// Release all allocations. Memory is retained for reuse up to the size of the first block.
+    void reset();
+
+    /// Returns the number of bytes allocated since construction or the last reset().
+    size_t getBytesAllocated() const { return _bytesAllocated; }
+
+private:
+    struct Block {
+        Block* next;
+        size_t size;
+    };
+
+    enum { blockHeaderSize = (sizeof(Block) + defaultAlignment - 1) & ~(size_t)(defaultAlignment - 1) };
+
+    void* allocateFromNewBlock(size_t size, size_t alignment);
+
+    static char* getBlockBegin(Block* block) { return reinterpret_cast<char*>(block) + blockHeaderSize; }
+
+    size_t _blockSize;
+    Block* _blocks;
+    Block* _firstBlock;
+    char* _ptr;
+    char* _end;
+    size_t _bytesAllocated;
+
+    PRIME_UNCOPYABLE(MonotonicArena);
+};
+
+/// An STL allocator which allocates from a MonotonicArena, or from the heap if it doesn't have one. Memory
+/// allocated from the arena is only released when the arena is reset.
+template <typename Type>
+class MonotonicArenaAllocator {
+public:
+    typedef Type value_type;
+    typedef Type* pointer;
+    typedef const Type* const_pointer;
+    typedef Type& reference;
+    typedef const Type& const_reference;
+    typedef size_t size_type;
+    typedef ptrdiff_t difference_type;
+
+    template <typename Other>
+    struct rebind {
+        typedef MonotonicArenaAllocator<Other> other;
+    };
+
+    MonotonicArenaAllocator(MonotonicArena* arena = NULL) PRIME_NOEXCEPT
+        : _arena(arena)
+    {
+    }
+
+    template <typename Other>
+    MonotonicArenaAllocator(const MonotonicArenaAllocator<Other>& other) PRIME_NOEXCEPT
+        : _arena(other.getArena())
+    {
+    }
+
+    MonotonicArena* getArena() const PRIME_NOEXCEPT { return _arena; }
+
+    pointer address(reference value) const PRIME_NOEXCEPT { return &value; }
+
+    const_pointer address(const_reference value) const PRIME_NOEXCEPT { return &value; }
+
+    pointer allocate(size_type count, const void* = NULL)
+    {
+        if (_arena) {
+            return _arena->allocateArray<Type>(count);
+        }
+
+        return static_cast<pointer>(::operator new(count * sizeof(Type)));
+    }
+
+    void deallocate(pointer memory, size_type)
+    {
+        if (!_arena) {
+            ::operator delete(memory);
+        }
+    }
+
+    size_type max_size() const PRIME_NOEXCEPT { return std::numeric_limits<size_type>::max() / sizeof(Type); }
+
+    void construct(pointer memory, const Type& value) { new (memory) Type(value); }
+
+    void destroy(pointer memory) { memory->~Type(); }
+
+    template <typename Other>
+    bool operator==(const MonotonicArenaAllocator<Other>& other) const PRIME_NOEXCEPT { return _arena == other.getArena(); }
+
+    template <typename Other>
+    bool operator!=(const MonotonicArenaAllocator<Other>& other) const PRIME_NOEXCEPT { return _arena != other.getArena(); }
+
+private:
+    MonotonicArena* _arena;
+};
+}
+
+#endif
@@ -3,6 +3,7 @@
 #include "MultipartParser.h"
 #include "HTTP.h"
 #include "StringUtils.h"
+#include <algorithm>
 
 namespace Prime {
 
@@ -23,31 +24,24 @@ public:
         StreamBuffer* buffer = _parent->_buffer;
 
         if (!_bytesChecked) {
-            StringView boundary(_parent->_boundary);
+            const BoundarySearch& boundary = _parent->_boundary;
 
-            if (!buffer->getBytesAvailable()) {
-                if (buffer->fetchMore(log) <= 0) {
-                    return -1;
-                }
-            }
-
-            const char* matchPtr = reinterpret_cast<const char*>(memchr(buffer->getReadPointer(), boundary[0], buffer->getBytesAvailable()));
-            if (matchPtr == buffer->getReadPointer()) {
-                // We only check for the boundary when it may begin at offset zero in the buffer.
+            if (buffer->getBytesAvailable() < boundary.size()) {
                 if (!buffer->requireNumberOfBytes(boundary.size(), log)) {
                     return -1;
                 }
-                if (memcmp(buffer->getReadPointer(), &boundary[0], boundary.size()) == 0) {
-                    // We've found the boundary.
-                    return 0;
-                }
-
-                // Didn't match, so just consume the first byte.
-                _bytesChecked = 1;
+            }
 
-            } else {
-                _bytesChecked = matchPtr ? static_cast<size_t>(matchPtr - buffer->getReadPointer()) : buffer->getBytesAvailable();
+            const char* readPointer = buffer->getReadPointer();
+            const char* matchPtr = boundary.find(readPointer, buffer->getTopPointer());
+            if (matchPtr == readPointer) {
+                // We've found the boundary.
+                return 0;
             }
+
+            // Everything before the boundary is content. If we didn't find one, it may begin in the last
+            // size() - 1 bytes, which we'll check again once we've read more.
+            _bytesChecked = matchPtr ? static_cast<size_t>(matchPtr - readPointer) : buffer->getBytesAvailable() - (boundary.size() - 1);
         }
 
         size_t thisTime = std::min(_bytesChecked, maximumBytes);
@@ -69,6 +63,43 @@ private:
     size_t _bytesChecked;
 };
 
+//
+// MultipartParser::BoundarySearch
+//
+
+void MultipartParser::BoundarySearch::init(StringView needle)
+{
+    PRIME_ASSERT(!needle.empty());
+
+    _needle.assign(needle.begin(), needle.end());
+}
+
+const char* MultipartParser::BoundarySearch::find(const char* begin, const char* end) const
+{
+    const size_t size = _needle.size();
+    if ((size_t)(end - begin) < size) {
+        return NULL;
+    }
+
+    const char* needle = _needle.data();
+
+    // memchr() is vectorised and the first byte ('\r') is rare in binary uploads and only appears once per line
+    // in text, so this moves through content far faster than a skip table can.
+    const char* last = end - size;
+    for (const char* ptr = begin; ptr <= last; ++ptr) {
+        ptr = reinterpret_cast<const char*>(memchr(ptr, needle[0], (size_t)(last - ptr) + 1));
+        if (!ptr) {
+            break;
+        }
+
+        if (memcmp(ptr + 1, needle + 1, size - 1) == 0) {
+            return ptr;
+        }
+    }
+
+    return NULL;
+}
+
 //
 // MultipartParser
 //
@@ -126,9 +157,13 @@ bool MultipartParser::init(StreamBuffer* buffer, StringView boundary, Log* log)
         return false;
     }
 
-    _boundary.reserve(boundary.size() + 4);
-    _boundary = "\r\n--";
-    _boundary += boundary;
+    std::string needle;
+    needle.reserve(boundary.size() + 4);
+    needle = "\r\n--";
+    needle.append(boundary.begin(), boundary.end());
+
+    _boundary.init(needle);
+    _firstBoundary.init(StringView(needle).substr(2));
 
     _firstPart = true;
     _buffer = buffer;
@@ -150,18 +185,20 @@ RefPtr<Stream> MultipartParser::readPart(Log* log)
         return NULL;
     }
 
-    StringView boundary(_boundary);
-    if (_firstPart) {
-        _firstPart = false;
-        boundary = boundary.substr(2);
-    }
+    const BoundarySearch& boundary = _firstPart ? _firstBoundary : _boundary;
+    _firstPart = false;
 
     for (;;) {
-        const char* ptr = _buffer->getReadPointer();
-        const char* matchPtr = reinterpret_cast<const char*>(memchr(ptr, boundary[0], _buffer->getBytesAvailable()));
-        _buffer->setReadPointer(matchPtr ? matchPtr : _buffer->getTopPointer());
-        if (_buffer->getBytesAvailable() < boundary.size() + 2) {
-            if (!_buffer->requireNumberOfBytes(boundary.size() + 2, log)) {
+        const char* matchPtr = boundary.find(_buffer->getReadPointer(), _buffer->getTopPointer());
+        if (!matchPtr) {
+            // Discard everything except the bytes the boundary may begin in.
+            _buffer->setReadPointer(_buffer->getTopPointer() - std::min(_buffer->getBytesAvailable(), boundary.size() - 1));
+        } else {
+            _buffer->setReadPointer(matchPtr);
+        }
+
+        if (!matchPtr || _buffer->getBytesAvailable() < boundary.size() + 2) {
+            if (!_buffer->requireNumberOfBytes(matchPtr ? boundary.size() + 2 : _buffer->getBytesAvailable() + 1, log)) {
                 log->error(PRIME_LOCALISE("multipart content missing boundary"));
                 return NULL;
             }
@@ -169,26 +206,21 @@ RefPtr<Stream> MultipartParser::readPart(Log* log)
             continue;
         }
 
-        if (memcmp(matchPtr, &boundary[0], boundary.size()) == 0) {
-            _buffer->setReadPointer(matchPtr + boundary.size());
-
-            if (memcmp(_buffer->getReadPointer(), "\r\n", 2) == 0) {
-                _buffer->advanceReadPointer(2);
-                return PassRef(new PartStream(this));
-            }
+        _buffer->advanceReadPointer(boundary.size());
 
-            if (memcmp(_buffer->getReadPointer(), "--", 2) == 0) {
-                _buffer->advanceReadPointer(2);
-                _reachedEnd = true;
-                return NULL;
-            }
+        if (memcmp(_buffer->getReadPointer(), "\r\n", 2) == 0) {
+            _buffer->advanceReadPointer(2);
+            return PassRef(new PartStream(this));
+        }
 
-            log->error(PRIME_LOCALISE("multipart boundary missing newline"));
+        if (memcmp(_buffer->getReadPointer(), "--", 2) == 0) {
+            _buffer->advanceReadPointer(2);
+            _reachedEnd = true;
             return NULL;
         }
 
-        // Consume the - and try again
-        _buffer->setReadPointer(matchPtr + 1);
+        log->error(PRIME_LOCALISE("multipart boundary missing newline"));
+        return NULL;
     }
 }
 }
@@ -7,7 +7,8 @@
 
 namespace Prime {
 
-/// Parse mutlipart/form-data and multipart/mixed|alternative
+/// Parse mutlipart/form-data and multipart/mixed|alternative. Boundaries are searched for across everything in
+/// the buffer, so a part's content is returned in buffer sized reads regardless of what it contains.
 class PRIME_PUBLIC MultipartParser : public RefCounted {
 public:
     enum { defaultBufferSize = 65536u };
@@ -43,7 +44,29 @@ private:
     class PartStream;
     friend class PartStream;
 
-    std::string _boundary;
+    /// A memchr() driven search for a boundary.
+    class BoundarySearch {
+    public:
+        void init(StringView needle);
+
+        const std::string& getNeedle() const { return _needle; }
+
+        size_t size() const { return _needle.size(); }
+
+        /// Returns a pointer to the first occurrence of the needle in [begin, end), or NULL. If NULL is returned,
+        /// the needle may still begin in the last size() - 1 bytes.
+        const char* find(const char* begin, const char* end) const;
+
+    private:
+        std::string _needle;
+    };
+
+    /// The boundary that ends a part ("\r\n--" boundary).
+    BoundarySearch _boundary;
+
+    /// The boundary that begins the first part, which doesn't need to be preceded by a newline.
+    BoundarySearch _firstBoundary;
+
     RefPtr<StreamBuffer> _buffer;
     bool _firstPart;
     bool _reachedEnd;
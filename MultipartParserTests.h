@@ -0,0 +1,83 @@
+// Copyright 2000-2021 Mark H. P. Lord
+
+#ifndef PRIME_MULTIPARTPARSERTESTS_H
+#define PRIME_MULTIPARTPARSERTESTS_H
+
+#include "MultipartParser.h"
+#include "StringStream.h"
+
+namespace Prime {
+
+namespace MultipartParserTestsPrivate {
+
+    inline bool ReadAllParts(const std::string& body, size_t bufferSize, size_t readSize,
+        std::vector<std::string>& parts)
+    {
+        parts.clear();
+
+        RefPtr<MultipartParser> parser = PassRef(new MultipartParser);
+        if (!parser->init(PassRef(new StringStream(body)), "b0undary", bufferSize, Log::getNullLog())) {
+            return false;
+        }
+
+        while (RefPtr<Stream> part = parser->readPart(Log::getNullLog())) {
+            std::string content;
+            char buffer[64];
+            ptrdiff_t got;
+            while ((got = part->readSome(buffer, std::min(readSize, sizeof(buffer)), Log::getNullLog())) > 0) {
+                content.append(buffer, (size_t)got);
+            }
+
+            if (got < 0) {
+                return false;
+            }
+
+            parts.push_back(content);
+        }
+
+        return parser->atEnd();
+    }
+}
+
+inline void MultipartParserTests()
+{
+    using namespace MultipartParserTestsPrivate;
+
+    // Content that almost, but doesn't, contain the boundary, so matches have to be rejected at every offset
+    // within the buffer, including across refills.
+    static const char* const contents[] = {
+        "",
+        "simple",
+        "\r\n",
+        "\r\n--b0undar",
+        "--b0undary not at the start of a line",
+        "\r\n-\r\n--\r\n--b0und\r\n--b0undarx\r",
+        "line one\r\nline two\r\n--\r\n"
+    };
+
+    std::string body = "preamble\r\n";
+    for (size_t i = 0; i != COUNTOF(contents); ++i) {
+        body += i == 0 ? "--b0undary\r\n" : "\r\n--b0undary\r\n";
+        body += contents[i];
+    }
+    body += "\r\n--b0undary--\r\n";
+
+    for (size_t bufferSize = 20; bufferSize != 80; ++bufferSize) {
+        for (size_t readSize = 1; readSize <= 64; readSize *= 4) {
+            std::vector<std::string> parts;
+            PRIME_TEST(ReadAllParts(body, bufferSize, readSize, parts));
+            PRIME_TEST(parts.size() == COUNTOF(contents));
+            for (size_t i = 0; i != parts.size() && i != COUNTOF(contents); ++i) {
+                PRIME_TEST(parts[i] == contents[i]);
+            }
+        }
+    }
+
+    // A missing end marker is an error.
+    std::vector<std::string> parts;
+    PRIME_TEST(!ReadAllParts("--b0undary\r\ntruncated", 64, 64, parts));
+    PRIME_TEST(!ReadAllParts("no boundary at all", 64, 64, parts));
+}
+}
+
+#endif
@@ -6,18 +6,37 @@ namespace Prime {
 
 PRIME_DEFINE_UID_CAST(NetworkStream)
 
+int NetworkStream::getWaitMilliseconds(int timeout, bool& deadlineSooner) const
+{
+    int remaining = _deadline.getMillisecondsRemaining();
+
+    deadlineSooner = remaining >= 0 && (timeout < 0 || remaining < timeout);
+
+    return deadlineSooner ? remaining : timeout;
+}
+
 bool NetworkStream::waitReadTimeout(Log* log)
 {
-    if (getReadTimeout() < 0) {
+    bool deadlineSooner;
+    int timeout = getWaitMilliseconds(getReadTimeout(), deadlineSooner);
+
+    if (timeout < 0) {
         return true;
     }
 
-    switch (waitRead(getReadTimeout(), log)) {
+    // Once the deadline has passed, fail even if there's data waiting, otherwise a peer that keeps sending
+    // could keep us reading forever.
+    if (deadlineSooner && timeout == 0) {
+        log->error(PRIME_LOCALISE("Network deadline passed."));
+        return false;
+    }
+
+    switch (waitRead(timeout, log)) {
     case WaitResultCancelled:
         return false;
 
     case WaitResultTimedOut:
-        log->error(PRIME_LOCALISE("Network read timeout."));
+        log->error(deadlineSooner ? PRIME_LOCALISE("Network deadline passed.") : PRIME_LOCALISE("Network read timeout."));
         return false;
 
     case WaitResultOK:
@@ -29,16 +48,24 @@ bool NetworkStream::waitReadTimeout(Log* log)
 
 bool NetworkStream::waitWriteTimeout(Log* log)
 {
-    if (getWriteTimeout() < 0) {
+    bool deadlineSooner;
+    int timeout = getWaitMilliseconds(getWriteTimeout(), deadlineSooner);
+
+    if (timeout < 0) {
         return true;
     }
 
-    switch (waitWrite(getWriteTimeout(), log)) {
+    if (deadlineSooner && timeout == 0) {
+        log->error(PRIME_LOCALISE("Network deadline passed."));
+        return false;
+    }
+
+    switch (waitWrite(timeout, log)) {
     case WaitResultCancelled:
         return false;
 
     case WaitResultTimedOut:
-        log->error(PRIME_LOCALISE("Network write timeout."));
+        log->error(deadlineSooner ? PRIME_LOCALISE("Network deadline passed.") : PRIME_LOCALISE("Network write timeout."));
         return false;
 
     case WaitResultOK:
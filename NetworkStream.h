@@ -4,15 +4,21 @@
 #define PRIME_NETWORKSTREAM_H
 
 #include "Stream.h"
+#include "Timeout.h"
 
 namespace Prime {
 
+class SocketStream;
+
 /// Extend Stream with methods specific to network streams.
 class PRIME_PUBLIC NetworkStream : public Stream {
     PRIME_DECLARE_UID_CAST(Stream, 0x7433cb1b, 0xff49484d, 0x9b30df29, 0xe15831e8)
 
 public:
-    NetworkStream() { }
+    NetworkStream()
+        : _deadline(-1)
+    {
+    }
 
     /// Set the timeout to apply to readSome().
     virtual void setReadTimeout(int milliseconds) = 0;
@@ -26,6 +32,13 @@ public:
     /// Milliseconds.
     virtual int getWriteTimeout() const = 0;
 
+    /// Set a time after which waitReadTimeout() and waitWriteTimeout() fail, even if data keeps arriving or
+    /// the read and write timeouts have not been reached. This bounds the time taken by a whole exchange rather
+    /// than by each read or write. A Timeout of -1 (the default) removes the deadline.
+    void setDeadline(const Timeout& deadline) { _deadline = deadline; }
+
+    const Timeout& getDeadline() const { return _deadline; }
+
     /// Result of a wait operation.
     enum WaitResult {
         /// The wait operation was aborted, possibly because the socket was closed.
@@ -50,17 +63,27 @@ public:
     /// method directly if you need to check for a timeout and don't want writeSome() logging an error.
     virtual WaitResult waitWrite(int milliseconds, Log* log) = 0;
 
-    /// An implementation should call this in its readSome() method. It calls waitRead(getReadTimeout(), log)
-    /// and emits an error to log if timeout occurs. Returns false on timeout or socket close, true if data is
+    /// An implementation should call this in its readSome() method. It calls waitRead(getReadTimeout(), log),
+    /// waiting no later than the deadline, and emits an error to log if timeout occurs. Returns false on timeout or socket close, true if data is
     /// available to read.
     bool waitReadTimeout(Log* log);
 
-    /// An implementation should call this in its writeSome() method. It calls waitWrite(getWriteTimeout(), log)
-    /// and emits an error to log if timeout occurs. Returns false on timeout or socket close, true if buffer
+    /// An implementation should call this in its writeSome() method. It calls waitWrite(getWriteTimeout(), log),
+    /// waiting no later than the deadline, and emits an error to log if timeout occurs. Returns false on timeout or socket close, true if buffer
     /// space is available to write to.
     bool waitWriteTimeout(Log* log);
 
+    /// Returns the SocketStream this stream ultimately performs its I/O on, or null if the stream isn't backed
+    /// by a single socket. Allows the stream to be waited on alongside others with a SocketPoller.
+    virtual SocketStream* getSocketStream() const { return NULL; }
+
 private:
+    /// Returns the number of milliseconds to wait given the read or write timeout, which is < 0 to wait
+    /// forever. Sets deadlineSooner if the deadline is what limits the wait.
+    int getWaitMilliseconds(int timeout, bool& deadlineSooner) const;
+
+    Timeout _deadline;
+
     PRIME_UNCOPYABLE(NetworkStream);
 };
 }
@@ -4,15 +4,93 @@
 
 #ifndef PRIME_NO_OPENSSL
 
+#include "Clocks.h"
 #include "OpenSSLStream.h"
 #include "StringUtils.h"
+#include <openssl/evp.h>
+#include <openssl/hmac.h>
+#include <openssl/rand.h>
 #include <openssl/ssl.h>
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+#include <openssl/core_names.h>
+#endif
+#include <algorithm>
+#include <string.h>
 
 namespace Prime {
 
+namespace {
+
+    const unsigned char sessionIDContext[] = "Prime";
+}
+
+//
+// OpenSSLContextPrivate
+//
+
+struct OpenSSLContextPrivate {
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+    static int ticketKeyCallback(SSL* ssl, unsigned char* keyName, unsigned char* iv, EVP_CIPHER_CTX* cipher,
+        EVP_MAC_CTX* mac, int encrypt)
+#else
+    static int ticketKeyCallback(SSL* ssl, unsigned char* keyName, unsigned char* iv, EVP_CIPHER_CTX* cipher,
+        HMAC_CTX* mac, int encrypt)
+#endif
+    {
+        OpenSSLContext* context = (OpenSSLContext*)SSL_CTX_get_app_data(SSL_get_SSL_CTX(ssl));
+
+        OpenSSLContext::TicketKey key;
+        bool isCurrent;
+        if (!context->getTicketKey(keyName, encrypt != 0, key, isCurrent)) {
+            // When encrypting, no ticket is issued. When decrypting, the ticket is ignored and a full
+            // handshake is performed.
+            return encrypt ? -1 : 0;
+        }
+
+        if (encrypt) {
+            memcpy(keyName, key.name, sizeof(key.name));
+            if (RAND_bytes(iv, EVP_CIPHER_iv_length(EVP_aes_256_cbc())) != 1) {
+                return -1;
+            }
+        }
+
+        if (!EVP_CipherInit_ex(cipher, EVP_aes_256_cbc(), NULL, key.aesKey, iv, encrypt)) {
+            return -1;
+        }
+
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+        OSSL_PARAM params[] = {
+            OSSL_PARAM_construct_octet_string(OSSL_MAC_PARAM_KEY, key.hmacKey, sizeof(key.hmacKey)),
+            OSSL_PARAM_construct_utf8_string(OSSL_MAC_PARAM_DIGEST, (char*)"SHA256", 0),
+            OSSL_PARAM_construct_end()
+        };
+
+        if (!EVP_MAC_CTX_set_params(mac, params)) {
+            return -1;
+        }
+#else
+        if (!HMAC_Init_ex(mac, key.hmacKey, sizeof(key.hmacKey), EVP_sha256(), NULL)) {
+            return -1;
+        }
+#endif
+
+        // 2 tells OpenSSL to issue a new ticket, encrypted with the current key. TLS 1.3 clients only use a
+        // ticket once, so they always need a new one.
+        return (encrypt || (isCurrent && SSL_version(ssl) != TLS1_3_VERSION)) ? 1 : 2;
+    }
+};
+
+//
+// OpenSSLContext
+//
+
 OpenSSLContext::OpenSSLContext()
     : _context(NULL)
     , _warnInvalidCertificate(false)
+    , _sessionCacheSize(1024)
+    , _sessionTimeoutSeconds(2 * 60 * 60)
+    , _ticketKeyRotationSeconds(60 * 60)
+    , _ticketKeyCount(3)
 {
 }
 
@@ -52,9 +130,192 @@ bool OpenSSLContext::createServerContext(const char* certificatePEM, const char*
         return false;
     }
 
+    if (!initSessions(true, log)) {
+        close();
+        return false;
+    }
+
     return true;
 }
 
+bool OpenSSLContext::initSessions(bool server, Log* log)
+{
+    if (!_mutex.isInitialised() && !_mutex.init(log, "OpenSSLContext mutex")) {
+        return false;
+    }
+
+    SSL_CTX_set_app_data(_context, this);
+    SSL_CTX_set_timeout(_context, (long)_sessionTimeoutSeconds);
+
+    if (server) {
+        if (_sessionCacheSize > 0) {
+            SSL_CTX_set_session_cache_mode(_context, SSL_SESS_CACHE_SERVER);
+            SSL_CTX_sess_set_cache_size(_context, (long)_sessionCacheSize);
+        } else {
+            SSL_CTX_set_session_cache_mode(_context, SSL_SESS_CACHE_OFF);
+        }
+
+        // Sessions can only be resumed within the same context.
+        if (!SSL_CTX_set_session_id_context(_context, sessionIDContext, (unsigned int)sizeof(sessionIDContext) - 1)) {
+            log->error(PRIME_LOCALISE("Couldn't set SSL session ID context."));
+            return false;
+        }
+
+        if (_ticketKeyRotationSeconds > 0) {
+            Mutex::ScopedLock lock(&_mutex);
+            _ticketKeys.clear();
+            if (!addTicketKey((int64_t)(Clock::getMonotonicMilliseconds64() / 1000), log)) {
+                return false;
+            }
+
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+            SSL_CTX_set_tlsext_ticket_key_evp_cb(_context, &OpenSSLContextPrivate::ticketKeyCallback);
+#else
+            SSL_CTX_set_tlsext_ticket_key_cb(_context, &OpenSSLContextPrivate::ticketKeyCallback);
+#endif
+        } else {
+            SSL_CTX_set_options(_context, SSL_OP_NO_TICKET);
+        }
+    } else if (_sessionCacheSize > 0) {
+        // OpenSSL's client cache isn't keyed by host, so we keep our own.
+        SSL_CTX_set_session_cache_mode(_context, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+        SSL_CTX_sess_set_new_cb(_context, &OpenSSLContext::newClientSessionCallback);
+    }
+
+    return true;
+}
+
+bool OpenSSLContext::addTicketKey(int64_t now, Log* log)
+{
+    TicketKey key;
+    if (RAND_bytes(key.name, (int)sizeof(key.name)) != 1 || RAND_bytes(key.aesKey, (int)sizeof(key.aesKey)) != 1 || RAND_bytes(key.hmacKey, (int)sizeof(key.hmacKey)) != 1) {
+        log->error(PRIME_LOCALISE("Couldn't generate SSL session ticket key."));
+        return false;
+    }
+
+    key.created = now;
+
+    _ticketKeys.push_front(key);
+    while (_ticketKeys.size() > (size_t)std::max(_ticketKeyCount, 1)) {
+        _ticketKeys.pop_back();
+    }
+
+    return true;
+}
+
+bool OpenSSLContext::rotateTicketKeys(Log* log)
+{
+    Mutex::ScopedLock lock(&_mutex);
+    return addTicketKey((int64_t)(Clock::getMonotonicMilliseconds64() / 1000), log);
+}
+
+bool OpenSSLContext::getTicketKey(const unsigned char* name, bool encrypt, TicketKey& key, bool& isCurrent)
+{
+    Mutex::ScopedLock lock(&_mutex);
+
+    if (encrypt) {
+        int64_t now = (int64_t)(Clock::getMonotonicMilliseconds64() / 1000);
+        if (_ticketKeys.empty() || now - _ticketKeys.front().created >= _ticketKeyRotationSeconds) {
+            if (!addTicketKey(now, Log::getGlobal())) {
+                return false;
+            }
+        }
+
+        key = _ticketKeys.front();
+        isCurrent = true;
+        return true;
+    }
+
+    for (size_t i = 0; i != _ticketKeys.size(); ++i) {
+        if (memcmp(_ticketKeys[i].name, name, sizeof(_ticketKeys[i].name)) == 0) {
+            key = _ticketKeys[i];
+            isCurrent = i == 0;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+int OpenSSLContext::newClientSessionCallback(SSL* ssl, SSL_SESSION* session)
+{
+    OpenSSLStream* stream = (OpenSSLStream*)SSL_get_app_data(ssl);
+    OpenSSLContext* context = (OpenSSLContext*)SSL_CTX_get_app_data(SSL_get_SSL_CTX(ssl));
+    if (!stream || stream->getSessionKey().empty() || !context) {
+        return 0;
+    }
+
+    const std::string& sessionKey = stream->getSessionKey();
+
+    Mutex::ScopedLock lock(&context->_mutex);
+
+    ClientSessionMap::iterator iter = context->_clientSessions.find(sessionKey);
+    if (iter != context->_clientSessions.end()) {
+        SSL_SESSION_free(iter->second);
+        iter->second = session;
+    } else {
+        context->_clientSessions[sessionKey] = session;
+        context->_clientSessionOrder.push_back(sessionKey);
+
+        while (context->_clientSessionOrder.size() > (size_t)context->_sessionCacheSize) {
+            iter = context->_clientSessions.find(context->_clientSessionOrder.front());
+            SSL_SESSION_free(iter->second);
+            context->_clientSessions.erase(iter);
+            context->_clientSessionOrder.pop_front();
+        }
+    }
+
+    // We've taken ownership of the session.
+    return 1;
+}
+
+SSL_SESSION* OpenSSLContext::getClientSession(const std::string& sessionKey)
+{
+    if (!_mutex.isInitialised()) {
+        return NULL;
+    }
+
+    Mutex::ScopedLock lock(&_mutex);
+
+    ClientSessionMap::iterator iter = _clientSessions.find(sessionKey);
+    if (iter == _clientSessions.end()) {
+        return NULL;
+    }
+
+    if (!SSL_SESSION_is_resumable(iter->second)) {
+        return NULL;
+    }
+
+    SSL_SESSION_up_ref(iter->second);
+    return iter->second;
+}
+
+void OpenSSLContext::clearClientSessions()
+{
+    if (!_mutex.isInitialised()) {
+        return;
+    }
+
+    Mutex::ScopedLock lock(&_mutex);
+
+    for (ClientSessionMap::iterator iter = _clientSessions.begin(); iter != _clientSessions.end(); ++iter) {
+        SSL_SESSION_free(iter->second);
+    }
+
+    _clientSessions.clear();
+    _clientSessionOrder.clear();
+}
+
+size_t OpenSSLContext::getClientSessionCount() const
+{
+    if (!_mutex.isInitialised()) {
+        return 0;
+    }
+
+    Mutex::ScopedLock lock(&_mutex);
+    return _clientSessions.size();
+}
+
 bool OpenSSLContext::useCertificate(const char* certificatePEM)
 {
     BIO* bio = BIO_new_mem_buf((void*)certificatePEM, -1);
@@ -121,11 +382,23 @@ bool OpenSSLContext::createClientContext(Log* log)
         return false;
     }
 
+    if (!initSessions(false, log)) {
+        close();
+        return false;
+    }
+
     return true;
 }
 
 void OpenSSLContext::close()
 {
+    clearClientSessions();
+
+    if (_mutex.isInitialised()) {
+        Mutex::ScopedLock lock(&_mutex);
+        _ticketKeys.clear();
+    }
+
     if (_context) {
         SSL_CTX_free(_context);
         _context = NULL;
@@ -133,6 +406,11 @@ void OpenSSLContext::close()
 }
 
 RefPtr<Stream> OpenSSLContext::connect(Stream* stream, Log* log)
+{
+    return connect(stream, NULL, 0, log);
+}
+
+RefPtr<Stream> OpenSSLContext::connect(Stream* stream, const char* hostName, int port, Log* log)
 {
     SocketStream* socketStream = UIDCast<SocketStream>(stream);
     if (!socketStream) {
@@ -142,7 +420,7 @@ RefPtr<Stream> OpenSSLContext::connect(Stream* stream, Log* log)
 
     RefPtr<OpenSSLStream> sslStream = PassRef(new OpenSSLStream);
 
-    if (!sslStream->connect(this, socketStream, log)) {
+    if (!sslStream->connect(this, socketStream, hostName, port, log)) {
         return NULL;
     }
 
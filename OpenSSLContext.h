@@ -5,15 +5,25 @@
 
 #include "Config.h"
 #include "Log.h"
+#include "Mutex.h"
 #include "RefCounting.h"
 #include "Stream.h"
+#include <deque>
+#include <map>
+#include <string>
 
 #ifndef PRIME_NO_OPENSSL
 
 typedef struct ssl_ctx_st SSL_CTX;
+typedef struct ssl_st SSL;
+typedef struct ssl_session_st SSL_SESSION;
 
 namespace Prime {
 
+/// Wraps an OpenSSL SSL_CTX. Server contexts keep a cache of sessions and issue session tickets, encrypted with
+/// keys that are rotated every ticketKeyRotationSeconds, so returning clients can resume without a full
+/// handshake. Client contexts remember the most recent session for each host:port they connect to and offer it
+/// the next time they connect there.
 class PRIME_PUBLIC OpenSSLContext : public RefCounted {
 public:
     OpenSSLContext();
@@ -35,18 +45,94 @@ public:
 
     bool getWarnAboutInvalidCertificates() const { return _warnInvalidCertificate; }
 
+    /// The maximum number of sessions a server context caches, or the number of hosts a client context
+    /// remembers sessions for. 0 disables session resumption (other than by tickets). Must be set before the
+    /// context is created.
+    void setSessionCacheSize(int value) { _sessionCacheSize = value; }
+
+    int getSessionCacheSize() const { return _sessionCacheSize; }
+
+    /// How long a session (or session ticket) can be resumed for. Must be set before the context is created.
+    void setSessionTimeoutSeconds(int value) { _sessionTimeoutSeconds = value; }
+
+    int getSessionTimeoutSeconds() const { return _sessionTimeoutSeconds; }
+
+    /// How often a server context starts encrypting tickets with a new key. Tickets encrypted with the previous
+    /// ticketKeyCount - 1 keys are still accepted, but are replaced. 0 disables session tickets. Must be set
+    /// before the context is created.
+    void setTicketKeyRotationSeconds(int value) { _ticketKeyRotationSeconds = value; }
+
+    int getTicketKeyRotationSeconds() const { return _ticketKeyRotationSeconds; }
+
+    void setTicketKeyCount(int value) { _ticketKeyCount = value; }
+
+    int getTicketKeyCount() const { return _ticketKeyCount; }
+
+    /// Start encrypting tickets with a new key now.
+    bool rotateTicketKeys(Log* log);
+
+    /// Forget the client sessions remembered for every host.
+    void clearClientSessions();
+
+    size_t getClientSessionCount() const;
+
     RefPtr<Stream> connect(Stream* stream, Log* log);
 
+    /// Connect to hostName (which is also sent as the TLS server name), resuming the last session negotiated
+    /// with hostName:port if there is one.
+    RefPtr<Stream> connect(Stream* stream, const char* hostName, int port, Log* log);
+
     RefPtr<Stream> accept(Stream* stream, Log* log);
 
+    /// Used by OpenSSLStream. Returns a session, which the caller must free, to offer when connecting to
+    /// sessionKey, or NULL.
+    SSL_SESSION* getClientSession(const std::string& sessionKey);
+
 private:
+    struct TicketKey {
+        unsigned char name[16];
+        unsigned char aesKey[32];
+        unsigned char hmacKey[32];
+        int64_t created;
+    };
+
+    typedef std::map<std::string, SSL_SESSION*> ClientSessionMap;
+
     bool useCertificate(const char* certificatePEM);
     bool usePrivateKey(const char* privateKeyPEM, const char* passphrase);
 
+    bool initSessions(bool server, Log* log);
+
     static int pemPasswordCallback(char* buf, int size, int rwflag, void* userdata);
 
+    static int newClientSessionCallback(SSL* ssl, SSL_SESSION* session);
+
+    /// Encrypt a ticket with the current key (rotating it if it's too old), or find the key to decrypt one with.
+    /// Returns a copy of the key in key.
+    bool getTicketKey(const unsigned char* name, bool encrypt, TicketKey& key, bool& isCurrent);
+
+    bool addTicketKey(int64_t now, Log* log);
+
     SSL_CTX* _context;
     bool _warnInvalidCertificate;
+
+    int _sessionCacheSize;
+    int _sessionTimeoutSeconds;
+    int _ticketKeyRotationSeconds;
+    int _ticketKeyCount;
+
+    /// Protects _ticketKeys and _clientSessions.
+    mutable Mutex _mutex;
+
+    /// The newest key is at the front.
+    std::deque<TicketKey> _ticketKeys;
+
+    ClientSessionMap _clientSessions;
+
+    /// The order _clientSessions' keys were added in, so the oldest can be removed.
+    std::deque<std::string> _clientSessionOrder;
+
+    friend struct OpenSSLContextPrivate;
 };
 }
 
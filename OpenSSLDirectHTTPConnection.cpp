@@ -29,18 +29,21 @@ bool OpenSSLDirectHTTPConnectionFactory::init(Log* log)
     }
 
     _sslContext = PassRef(new OpenSSLContext);
-    _sslContext->createClientContext(log);
+    if (!_sslContext->createClientContext(log)) {
+        return false;
+    }
 
     //This is forced to true until we have some way of verifying certificates
     _sslContext->setWarnAboutInvalidCertificates(false);
 
 #ifdef PRIME_CXX11_STL
     auto sslContext = _sslContext;
-    setSSLCallback([sslContext](Stream* s, Log* l) -> RefPtr<Stream> {
-        return sslContext->connect(s, l);
+    setSSLCallback([sslContext](Stream* s, const char* hostName, int port, Log* l) -> RefPtr<Stream> {
+        return sslContext->connect(s, hostName, port, l);
     });
 #else
-    setSSLCallback(MethodCallback(_sslContext, &OpenSSLContext::connect));
+    RefPtr<Stream> (OpenSSLContext::*connect)(Stream*, const char*, int, Log*) = &OpenSSLContext::connect;
+    setSSLCallback(MethodCallback(_sslContext, connect));
 #endif
 
     return true;
@@ -5,13 +5,36 @@
 #ifndef PRIME_NO_OPENSSL
 
 #include "OpenSSLSupport.h"
+#include "StringUtils.h"
 #include <openssl/err.h>
 #include <openssl/ssl.h>
+#include <string.h>
 
 namespace Prime {
 
+namespace {
+
+    /// RFC 6066 forbids sending an IP address as the server name.
+    bool IsIPAddressLiteral(const char* hostName)
+    {
+        // Any IPv6 address (bracketed or not) contains a colon, which a host name can't.
+        if (strchr(hostName, ':')) {
+            return true;
+        }
+
+        for (const char* ptr = hostName; *ptr; ++ptr) {
+            if (!ASCIIIsDigit(*ptr) && *ptr != '.') {
+                return false;
+            }
+        }
+
+        return true;
+    }
+}
+
 OpenSSLStream::OpenSSLStream()
     : _ssl(NULL)
+    , _failed(false)
 {
 }
 
@@ -21,6 +44,12 @@ OpenSSLStream::~OpenSSLStream()
 }
 
 bool OpenSSLStream::connect(OpenSSLContext* clientContext, SocketStream* underlyingStream, Log* log)
+{
+    return connect(clientContext, underlyingStream, NULL, 0, log);
+}
+
+bool OpenSSLStream::connect(OpenSSLContext* clientContext, SocketStream* underlyingStream, const char* hostName,
+    int port, Log* log)
 {
     if (!OpenSSLSupport::initSSL(log)) {
         return false;
@@ -39,6 +68,21 @@ bool OpenSSLStream::connect(OpenSSLContext* clientContext, SocketStream* underly
         return false;
     }
 
+    SSL_set_app_data(_ssl, this);
+
+    if (hostName && *hostName) {
+        if (!IsIPAddressLiteral(hostName)) {
+            SSL_set_tlsext_host_name(_ssl, hostName);
+        }
+
+        _sessionKey = Format("%s:%d", hostName, port);
+
+        if (SSL_SESSION* session = clientContext->getClientSession(_sessionKey)) {
+            SSL_set_session(_ssl, session);
+            SSL_SESSION_free(session);
+        }
+    }
+
     // According to: http://openssl.6102.n7.nabble.com/Sockets-windows-64-bit-td36169.html
     // ...this cast to int is safe.
     SSL_set_fd(_ssl, (int)sd); // If we can remove this, we can be modified to operate on any kind of NetworkStream.
@@ -163,6 +207,11 @@ bool OpenSSLStream::hasPending() const
     return SSL_pending(_ssl) > 0;
 }
 
+bool OpenSSLStream::isSessionReused() const
+{
+    return _ssl && SSL_session_reused(_ssl);
+}
+
 NetworkStream::WaitResult OpenSSLStream::waitWrite(int milliseconds, Log* log)
 {
     // It's possible that OpenSSL has space in its own buffers but that the socket itself cannot write.
@@ -170,6 +219,14 @@ NetworkStream::WaitResult OpenSSLStream::waitWrite(int milliseconds, Log* log)
     return _underlyingStream->waitWrite(milliseconds, log);
 }
 
+void OpenSSLStream::checkFailed(int result)
+{
+    int error = SSL_get_error(_ssl, result);
+    if (error == SSL_ERROR_SYSCALL || error == SSL_ERROR_SSL) {
+        _failed = true;
+    }
+}
+
 void OpenSSLStream::closeSSL()
 {
     if (_ssl) {
@@ -179,12 +236,25 @@ void OpenSSLStream::closeSSL()
                 while (SSL_shutdown(_ssl) == 0)
                     {}
 #else
+        // Send a close_notify, without waiting for the peer's, otherwise the peer can't tell the connection
+        // from a truncated one and won't resume the session. This mustn't be done after a fatal error, nor once
+        // the peer has sent its close_notify (SSL_ERROR_ZERO_RETURN), since it may have gone away and the write
+        // could raise SIGPIPE. The socket is blocking, so only write if it won't block on a peer that has
+        // stopped reading.
+        if (!_failed && SSL_is_init_finished(_ssl) && !(SSL_get_shutdown(_ssl) & SSL_RECEIVED_SHUTDOWN)) {
+            if (_underlyingStream && _underlyingStream->waitWrite(0, Log::getNullLog()) == WaitResultOK) {
+                SSL_shutdown(_ssl);
+            }
+        }
+
         SSL_set_shutdown(_ssl, SSL_SENT_SHUTDOWN | SSL_RECEIVED_SHUTDOWN);
 #endif
         SSL_free(_ssl);
         _ssl = NULL;
     }
 
+    _failed = false;
+    _sessionKey.clear();
     _context.release();
 }
 
@@ -208,6 +278,10 @@ ptrdiff_t OpenSSLStream::readSome(void* buffer, size_t maximumBytes, Log* log)
     }
 
     ptrdiff_t bytesRead = SSL_read(_ssl, buffer, (int)maximumBytes);
+    if (bytesRead <= 0) {
+        checkFailed((int)bytesRead);
+    }
+
     if (bytesRead < 0) {
         log->error(PRIME_LOCALISE("SSL socket read error."));
         return -1;
@@ -225,6 +299,10 @@ ptrdiff_t OpenSSLStream::writeSome(const void* memory, size_t maximumBytes, Log*
     }
 
     ptrdiff_t bytesWritten = SSL_write(_ssl, memory, (int)maximumBytes);
+    if (bytesWritten <= 0) {
+        checkFailed((int)bytesWritten);
+    }
+
     if (bytesWritten < 0) {
         log->error(PRIME_LOCALISE("SSL socket write error."));
         return -1;
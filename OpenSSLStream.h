@@ -22,6 +22,11 @@ public:
     /// clientContext is retained.
     bool connect(OpenSSLContext* clientContext, SocketStream* underlyingStream, Log* log);
 
+    /// clientContext is retained. If hostName isn't NULL, it's sent as the TLS server name and any session
+    /// clientContext has for hostName:port is resumed.
+    bool connect(OpenSSLContext* clientContext, SocketStream* underlyingStream, const char* hostName, int port,
+        Log* log);
+
     /// serverContext is retained.
     bool accept(OpenSSLContext* serverContext, SocketStream* underlyingStream, Log* log);
 
@@ -32,6 +37,7 @@ public:
     virtual int getWriteTimeout() const PRIME_OVERRIDE;
     virtual WaitResult waitRead(int milliseconds, Log* log) PRIME_OVERRIDE;
     virtual WaitResult waitWrite(int milliseconds, Log* log) PRIME_OVERRIDE;
+    virtual SocketStream* getSocketStream() const PRIME_OVERRIDE { return _underlyingStream; }
 
     // Stream implementation.
     virtual bool close(Log* log) PRIME_OVERRIDE;
@@ -43,14 +49,27 @@ public:
 
     bool hasPending() const;
 
+    /// Returns true if the handshake resumed a previous session rather than negotiating a new one.
+    bool isSessionReused() const;
+
+    /// The hostName:port the session was negotiated for, if known.
+    const std::string& getSessionKey() const { return _sessionKey; }
+
 private:
     void closeSSL();
 
+    /// Remember whether an SSL_read() or SSL_write() result was a fatal error.
+    void checkFailed(int result);
+
     RefPtr<SocketStream> _underlyingStream;
     RefPtr<OpenSSLContext> _context;
 
     SSL* _ssl;
 
+    bool _failed;
+
+    std::string _sessionKey;
+
     PRIME_UNCOPYABLE(OpenSSLStream);
 };
 }
@@ -11,6 +11,7 @@
 #endif
 #ifdef PRIME_OS_LINUX
 #include <errno.h>
+#include <sched.h>
 #include <unistd.h>
 #endif
 
@@ -121,6 +122,42 @@ bool PthreadsThread::cancel()
 #endif
 }
 
+#ifdef PRIME_OS_LINUX
+
+bool PthreadsThread::setCPUAffinity(int cpu, Log* log)
+{
+    if (!_attached) {
+        return false;
+    }
+
+    if (cpu < 0 || cpu >= CPU_SETSIZE) {
+        log->error(PRIME_LOCALISE("Invalid CPU number: %d"), cpu);
+        return false;
+    }
+
+    cpu_set_t cpuSet;
+    CPU_ZERO(&cpuSet);
+    CPU_SET(cpu, &cpuSet);
+
+    int result = pthread_setaffinity_np(_thread, sizeof(cpuSet), &cpuSet);
+    if (result != 0) {
+        log->logErrno(result, "pthread_setaffinity_np");
+        return false;
+    }
+
+    return true;
+}
+
+#else
+
+bool PthreadsThread::setCPUAffinity(int, Log* log)
+{
+    log->error("CPU affinity not available on this platform.");
+    return false;
+}
+
+#endif
+
 namespace {
 
     using namespace Prime;
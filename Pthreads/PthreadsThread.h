@@ -73,6 +73,9 @@ public:
     /// Attempt to forcibly abort the thread. Not available on all platforms.
     bool cancel();
 
+    /// Restrict the thread to running on a single CPU (0 to getCPUCount() - 1). Not available on all platforms.
+    bool setCPUAffinity(int cpu, Log* log);
+
     const ThreadID getThreadID() { return ThreadID(_thread); }
 
 private:
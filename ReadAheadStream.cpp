@@ -0,0 +1,340 @@
+// Copyright 2000-2021 Mark H. P. Lord
+
+#include "ReadAheadStream.h"
+#include "NumberUtils.h"
+#include <string.h>
+
+namespace Prime {
+
+PRIME_DEFINE_UID_CAST(ReadAheadStream)
+
+ReadAheadStream::ReadAheadStream()
+    : _blockSize(0)
+    , _current(0)
+    , _ptr(0)
+    , _top(0)
+    , _fillState(FillStateIdle)
+    , _threadShouldFill(false)
+    , _threadShouldQuit(false)
+    , _fillResult(0)
+    , _initialised(false)
+{
+}
+
+ReadAheadStream::~ReadAheadStream()
+{
+    // Don't close the underlying stream (StreamBuffer doesn't either), but don't leave a read running on it.
+    stop();
+}
+
+bool ReadAheadStream::init(Stream* underlyingStream, size_t blockSize, Log* log, TaskQueue* taskQueue)
+{
+    stop();
+
+    if (!PRIME_GUARD(underlyingStream)) {
+        return false;
+    }
+
+    if (blockSize == 0) {
+        blockSize = defaultBlockSize;
+    }
+
+    if (!_mutex.isInitialised() && !_mutex.init(log, "ReadAheadStream")) {
+        return false;
+    }
+
+    if (!_filled.isInitialised() && !_filled.init(&_mutex, log)) {
+        return false;
+    }
+
+    if (!_fillRequested.isInitialised() && !_fillRequested.init(&_mutex, log)) {
+        return false;
+    }
+
+    if (blockSize != _blockSize) {
+        _blocks[0].reset(new char[blockSize]);
+        _blocks[1].reset(new char[blockSize]);
+        _blockSize = blockSize;
+    }
+
+    _underlyingStream = underlyingStream;
+    _taskQueue = taskQueue;
+    _fillLog.clear();
+    resetBlocks();
+
+    if (!taskQueue) {
+        _threadShouldFill = false;
+        _threadShouldQuit = false;
+
+#ifdef PRIME_CXX11_STL
+        if (!_thread.create([this] { this->thread(); }, stackSize, log, "ReadAheadStream")) {
+            return false;
+        }
+#else
+        if (!_thread.create(MethodCallback(this, &ReadAheadStream::thread), stackSize, log, "ReadAheadStream")) {
+            return false;
+        }
+#endif
+    }
+
+    _initialised = true;
+    return true;
+}
+
+void ReadAheadStream::stop()
+{
+    if (!_initialised) {
+        return;
+    }
+
+    Mutex::ScopedLock lock(&_mutex);
+    waitForFill(lock);
+
+    if (!_taskQueue) {
+        _threadShouldQuit = true;
+        _fillRequested.wakeOne();
+        lock.unlock();
+
+        _thread.join();
+    }
+
+    _initialised = false;
+}
+
+void ReadAheadStream::resetBlocks()
+{
+    _ptr = _top = 0;
+    _fillState = FillStateIdle;
+    _fillResult = 0;
+}
+
+size_t ReadAheadStream::getReadAheadSize() const
+{
+    size_t size = _top - _ptr;
+
+    if (_fillState == FillStateReady && _fillResult > 0) {
+        size += (size_t)_fillResult;
+    }
+
+    return size;
+}
+
+void ReadAheadStream::startFill(Mutex::ScopedLock& lock)
+{
+    PRIME_ASSERT(_fillState == FillStateIdle);
+
+    _fillState = FillStateFilling;
+
+    if (_taskQueue) {
+        // The queue may run the callback immediately, on this thread.
+        lock.unlock();
+
+#ifdef PRIME_CXX11_STL
+        _taskQueue->queue([this] { this->fill(); });
+#else
+        _taskQueue->queue(MethodCallback(this, &ReadAheadStream::fill));
+#endif
+
+        lock.lock(&_mutex);
+    } else {
+        _threadShouldFill = true;
+        _fillRequested.wakeOne();
+    }
+}
+
+void ReadAheadStream::waitForFill(Mutex::ScopedLock& lock)
+{
+    while (_fillState == FillStateFilling) {
+        _filled.wait(lock);
+    }
+}
+
+void ReadAheadStream::fill()
+{
+    char* block;
+    {
+        Mutex::ScopedLock lock(&_mutex);
+        block = _blocks[1 - _current].get();
+    }
+
+    // _fillLog is only touched by the reader once the fill has finished.
+    ptrdiff_t got = _underlyingStream->readSome(block, _blockSize, &_fillLog);
+
+    Mutex::ScopedLock lock(&_mutex);
+    _fillResult = got;
+    _fillState = FillStateReady;
+    _filled.wakeAll();
+}
+
+void ReadAheadStream::thread()
+{
+    Mutex::ScopedLock lock(&_mutex);
+
+    for (;;) {
+        while (!_threadShouldFill && !_threadShouldQuit) {
+            _fillRequested.wait(lock);
+        }
+
+        if (_threadShouldQuit) {
+            break;
+        }
+
+        _threadShouldFill = false;
+
+        lock.unlock();
+        fill();
+        lock.lock(&_mutex);
+    }
+}
+
+ptrdiff_t ReadAheadStream::readSome(void* buffer, size_t maxBytes, Log* log)
+{
+    PRIME_ASSERT(_initialised);
+
+    if (_ptr == _top) {
+        Mutex::ScopedLock lock(&_mutex);
+
+        if (_fillState == FillStateIdle) {
+            startFill(lock);
+        }
+
+        waitForFill(lock);
+
+        ptrdiff_t got = _fillResult;
+        _fillState = FillStateIdle;
+
+        if (!_fillLog.empty()) {
+            _fillLog.replay(log);
+            _fillLog.clear();
+        }
+
+        if (got <= 0) {
+            // Don't read ahead past the end of the file or an error, but try again if we're called again.
+            return got;
+        }
+
+        _current = 1 - _current;
+        _ptr = 0;
+        _top = (size_t)got;
+
+        // Now that the block we just finished with is free, start filling it.
+        startFill(lock);
+    }
+
+    size_t take = Min(maxBytes, _top - _ptr);
+    memcpy(buffer, _blocks[_current].get() + _ptr, take);
+    _ptr += take;
+
+    return (ptrdiff_t)take;
+}
+
+bool ReadAheadStream::discardReadAhead(Log* log)
+{
+    PRIME_ASSERT(_initialised);
+
+    Mutex::ScopedLock lock(&_mutex);
+    waitForFill(lock);
+
+    size_t readAhead = getReadAheadSize();
+
+    // Errors encountered while reading ahead will be encountered again if the bytes are read again.
+    _fillLog.clear();
+    resetBlocks();
+
+    if (readAhead && _underlyingStream->seek(-(Offset)readAhead, SeekModeRelative, log) < 0) {
+        return false;
+    }
+
+    return true;
+}
+
+ptrdiff_t ReadAheadStream::writeSome(const void* bytes, size_t maxBytes, Log* log)
+{
+    if (!discardReadAhead(log)) {
+        return -1;
+    }
+
+    return _underlyingStream->writeSome(bytes, maxBytes, log);
+}
+
+Stream::Offset ReadAheadStream::seek(Offset offset, SeekMode mode, Log* log)
+{
+    PRIME_ASSERT(_initialised);
+
+    if (mode == SeekModeRelative && offset >= 0 && offset <= (Offset)(_top - _ptr)) {
+        // Covers getOffset() and small skips, neither of which need to discard what we've read ahead.
+        _ptr += (size_t)offset;
+
+        Mutex::ScopedLock lock(&_mutex);
+        waitForFill(lock);
+
+        Offset underlyingOffset = _underlyingStream->seek(0, SeekModeRelative, log);
+        if (underlyingOffset < 0) {
+            return underlyingOffset;
+        }
+
+        return underlyingOffset - (Offset)getReadAheadSize();
+    }
+
+    if (mode == SeekModeRelative) {
+        // Relative to our offset, not the underlying stream's.
+        if (!discardReadAhead(log)) {
+            return -1;
+        }
+    } else {
+        Mutex::ScopedLock lock(&_mutex);
+        waitForFill(lock);
+        _fillLog.clear();
+        resetBlocks();
+    }
+
+    return _underlyingStream->seek(offset, mode, log);
+}
+
+Stream::Offset ReadAheadStream::getSize(Log* log)
+{
+    PRIME_ASSERT(_initialised);
+
+    Mutex::ScopedLock lock(&_mutex);
+    waitForFill(lock);
+
+    return _underlyingStream->getSize(log);
+}
+
+bool ReadAheadStream::setSize(Offset newSize, Log* log)
+{
+    if (!discardReadAhead(log)) {
+        return false;
+    }
+
+    return _underlyingStream->setSize(newSize, log);
+}
+
+bool ReadAheadStream::flush(Log* log)
+{
+    PRIME_ASSERT(_initialised);
+
+    Mutex::ScopedLock lock(&_mutex);
+    waitForFill(lock);
+
+    return _underlyingStream->flush(log);
+}
+
+bool ReadAheadStream::close(Log* log)
+{
+    if (!_underlyingStream) {
+        return true;
+    }
+
+    stop();
+
+    bool success = _underlyingStream->close(log);
+
+    _underlyingStream.release();
+    _taskQueue.release();
+    _fillLog.clear();
+    resetBlocks();
+
+    return success;
+}
+}
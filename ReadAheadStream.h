@@ -0,0 +1,109 @@
+// Copyright 2000-2021 Mark H. P. Lord
+
+#ifndef PRIME_READAHEADSTREAM_H
+#define PRIME_READAHEADSTREAM_H
+
+#include "Condition.h"
+#include "LogRecorder.h"
+#include "Mutex.h"
+#include "ScopedPtr.h"
+#include "Stream.h"
+#include "TaskQueue.h"
+#include "Thread.h"
+
+namespace Prime {
+
+/// Reads an underlying Stream one block ahead of the reader, on a dedicated thread or a TaskQueue, so that
+/// sequential parsing (e.g., a JSONReader or CSVParser reading through a TextReader) overlaps with the I/O
+/// instead of alternating with it. Two blocks are used: the reader consumes one while the other is filled.
+/// Writing and seeking are supported but discard whatever has been read ahead, which requires the underlying
+/// Stream to be seekable if anything had been read ahead.
+class PRIME_PUBLIC ReadAheadStream : public Stream {
+    PRIME_DECLARE_UID_CAST(Stream, 0x2b7e4c19, 0x8d03f5a6, 0xa4c1e972, 0x3f60b8d4)
+
+public:
+    enum { defaultBlockSize = 64 * 1024 };
+
+    ReadAheadStream();
+
+    ~ReadAheadStream();
+
+    /// If taskQueue is null, a thread is created to do the reading. The TaskQueue must be able to run the
+    /// read concurrently with the caller (i.e., it mustn't be the queue the caller is running on if that queue
+    /// is serial), otherwise reads will deadlock.
+    bool init(Stream* underlyingStream, size_t blockSize, Log* log, TaskQueue* taskQueue = NULL);
+
+    bool isInitialised() const { return _initialised; }
+
+    size_t getBlockSize() const { return _blockSize; }
+
+    /// Wait for any read ahead to finish and forget what it read, leaving the underlying Stream positioned at
+    /// our offset. Returns false if the underlying Stream couldn't be seeked back.
+    bool discardReadAhead(Log* log);
+
+    // Stream implementation.
+    virtual bool close(Log* log) PRIME_OVERRIDE;
+    virtual ptrdiff_t readSome(void* buffer, size_t maxBytes, Log* log) PRIME_OVERRIDE;
+    virtual ptrdiff_t writeSome(const void* bytes, size_t maxBytes, Log* log) PRIME_OVERRIDE;
+    virtual Offset seek(Offset offset, SeekMode mode, Log* log) PRIME_OVERRIDE;
+    virtual Offset getSize(Log* log) PRIME_OVERRIDE;
+    virtual bool setSize(Offset newSize, Log* log) PRIME_OVERRIDE;
+    virtual bool flush(Log* log) PRIME_OVERRIDE;
+    virtual Stream* getUnderlyingStream() const PRIME_OVERRIDE { return _underlyingStream; }
+
+private:
+    enum FillState {
+        FillStateIdle,
+        FillStateFilling,
+        FillStateReady
+    };
+
+    /// Must be called with the mutex locked, which may be temporarily released.
+    void startFill(Mutex::ScopedLock& lock);
+
+    /// Waits for any fill in progress to complete. Must be called with the mutex locked.
+    void waitForFill(Mutex::ScopedLock& lock);
+
+    /// Returns the number of bytes we've read from the underlying Stream that haven't been read from us.
+    size_t getReadAheadSize() const;
+
+    void resetBlocks();
+
+    void fill();
+
+    void thread();
+
+    /// Wait for any fill in progress to complete and stop the thread, if we have one.
+    void stop();
+
+    enum { stackSize = 64 * 1024 };
+
+    RefPtr<Stream> _underlyingStream;
+    RefPtr<TaskQueue> _taskQueue;
+    Thread _thread;
+
+    ScopedArrayPtr<char> _blocks[2];
+    size_t _blockSize;
+
+    // The block being read from, which only the reader touches.
+    int _current;
+    size_t _ptr;
+    size_t _top;
+
+    // The state of the other block, which belongs to the filling thread while _fillState is FillStateFilling.
+    Mutex _mutex;
+    Condition _filled;
+    Condition _fillRequested;
+    FillState _fillState;
+    bool _threadShouldFill;
+    bool _threadShouldQuit;
+    ptrdiff_t _fillResult;
+    LogRecorder _fillLog;
+
+    bool _initialised;
+
+    PRIME_UNCOPYABLE(ReadAheadStream);
+};
+}
+
+#endif
@@ -0,0 +1,167 @@
+// Copyright 2000-2021 Mark H. P. Lord
+
+#ifndef PRIME_ROUTERTESTS_H
+#define PRIME_ROUTERTESTS_H
+
+#include "DictionarySettingsStore.h"
+#include "HTTPServer.h"
+#include "PrefixLog.h"
+#include "StringStream.h"
+
+namespace Prime {
+
+namespace RouterTestsPrivate {
+
+    /// Responds with its name followed by the "id" argument and the unmatched remainder of the path, if any.
+    class NamedHandler : public HTTPServer::Handler {
+    public:
+        explicit NamedHandler(const char* name)
+            : _name(name)
+        {
+        }
+
+        virtual bool handleRequest(HTTPServer::Request& request, HTTPServer::Response& response) PRIME_OVERRIDE
+        {
+            std::string text = _name;
+
+            std::string id = request.getArgument("id").toString();
+            if (!id.empty()) {
+                text += " id=";
+                text += id;
+            }
+
+            std::string rest = request.getRemainingPathString();
+            if (!rest.empty()) {
+                text += " rest=";
+                text += rest;
+            }
+
+            response.setPlainText(text);
+            return true;
+        }
+
+    private:
+        std::string _name;
+    };
+
+    inline void Route(HTTPServer::Router* router, const char* path, HTTPMethod method, const char* name)
+    {
+        RefPtr<NamedHandler> handler = PassRef(new NamedHandler(name));
+        router->route(path, method, handler.get());
+    }
+
+    /// Serves a single request and returns the response body, "redirect:<location>" for a redirect, or "" if
+    /// no route matched.
+    inline std::string Serve(HTTPServer::Router* router, const char* method, const char* path)
+    {
+        RefPtr<DictionarySettingsStore> store = PassRef(new DictionarySettingsStore);
+        RefPtr<HTTPServer> server = PassRef(new HTTPServer);
+        PRIME_TEST(server->init(router, Log::getNullLog(), store->getSettings()));
+
+        std::string request = MakeString(method, " ", path, " HTTP/1.1\r\nHost: example.com\r\nContent-Length: 0\r\nConnection: close\r\n\r\n");
+        StreamBuffer readBuffer(request.data(), request.size());
+
+        RefPtr<StringStream> output = PassRef(new StringStream);
+        StreamBuffer writeBuffer(output, 65536);
+        PrefixLog prefixLog(Log::getNullLog(), "");
+
+        server->serve(&readBuffer, &writeBuffer, "http", Log::getNullLog(), &prefixLog, false);
+        PRIME_TEST(writeBuffer.flush(Log::getNullLog()));
+
+        std::string response = output->getString();
+
+        if (StringStartsWith(response, "HTTP/1.1 30")) {
+            size_t location = response.find("\r\nLocation: ");
+            PRIME_TEST(location != std::string::npos);
+            location += 12;
+            return "redirect:" + response.substr(location, response.find("\r\n", location) - location);
+        }
+
+        if (!StringStartsWith(response, "HTTP/1.1 200")) {
+            return "";
+        }
+
+        size_t body = response.find("\r\n\r\n");
+        PRIME_TEST(body != std::string::npos);
+        return response.substr(body + 4);
+    }
+
+    inline void RouterPrecedenceTests()
+    {
+        RefPtr<HTTPServer::Router> router = PassRef(new HTTPServer::Router);
+        Route(router, "/users/=id", HTTPMethodGet, "user");
+        Route(router, "/users/me", HTTPMethodGet, "me");
+        Route(router, "/users/==", HTTPMethodGet, "users-wildcard");
+        Route(router, "/users/=id/posts", HTTPMethodGet, "posts");
+        Route(router, "/files/==", HTTPMethodGet, "files");
+        Route(router, "/files/readme", HTTPMethodGet, "readme");
+        Route(router, "/files/docs/index", HTTPMethodGet, "docs-index");
+        Route(router, "/users/me", HTTPMethodPost, "me-post");
+
+        // A literal, parameter and wildcard all match the same length, so the earliest registration wins.
+        PRIME_TEST(Serve(router, "GET", "/users/me") == "user id=me");
+        PRIME_TEST(Serve(router, "GET", "/users/abc") == "user id=abc");
+        PRIME_TEST(Serve(router, "GET", "/files/readme") == "files rest=readme");
+
+        // Only the POST route matches the method.
+        PRIME_TEST(Serve(router, "POST", "/users/me") == "me-post");
+
+        // Longer matches win regardless of registration order.
+        PRIME_TEST(Serve(router, "GET", "/users/abc/posts") == "posts id=abc");
+        PRIME_TEST(Serve(router, "GET", "/files/docs/index") == "docs-index");
+
+        // Only the wildcards match paths longer than their literal siblings.
+        PRIME_TEST(Serve(router, "GET", "/users/abc/photos/1") == "users-wildcard rest=abc/photos/1");
+        PRIME_TEST(Serve(router, "GET", "/files/docs/other") == "files rest=docs/other");
+
+        // Nothing matches.
+        PRIME_TEST(Serve(router, "GET", "/nothing").empty());
+        PRIME_TEST(Serve(router, "GET", "/").empty());
+        PRIME_TEST(Serve(router, "POST", "/files/readme").empty());
+    }
+
+    inline void RouterTieTests()
+    {
+        RefPtr<HTTPServer::Router> router = PassRef(new HTTPServer::Router);
+        Route(router, "/a/b", HTTPMethodGet, "first");
+        Route(router, "/a/=id", HTTPMethodGet, "second");
+        Route(router, "/a/b", HTTPMethodGet, "third");
+        Route(router, "/a/==", HTTPMethodUnknown, "any");
+
+        PRIME_TEST(Serve(router, "GET", "/a/b") == "first");
+        PRIME_TEST(Serve(router, "GET", "/a/c") == "second id=c");
+
+        // HTTPMethodUnknown routes accept any method.
+        PRIME_TEST(Serve(router, "POST", "/a/b") == "any rest=b");
+        PRIME_TEST(Serve(router, "GET", "/a/b/c") == "any rest=b/c");
+    }
+
+    inline void RouterTrailingSlashTests()
+    {
+        RefPtr<HTTPServer::Router> router = PassRef(new HTTPServer::Router);
+        Route(router, "/docs/", HTTPMethodGet, "docs");
+        Route(router, "/about", HTTPMethodGet, "about");
+        Route(router, "/items/=id", HTTPMethodGet, "item");
+
+        PRIME_TEST(Serve(router, "GET", "/docs/") == "docs");
+        PRIME_TEST(Serve(router, "GET", "/about") == "about");
+
+        // A missing trailing slash is redirected, but an extra one isn't removed.
+        PRIME_TEST(Serve(router, "GET", "/docs") == "redirect:http://example.com/docs/");
+        PRIME_TEST(Serve(router, "GET", "/about/").empty());
+
+        // A parameter doesn't match an empty component.
+        PRIME_TEST(Serve(router, "GET", "/items/7") == "item id=7");
+        PRIME_TEST(Serve(router, "GET", "/items/").empty());
+    }
+}
+
+inline void RouterTests()
+{
+    RouterTestsPrivate::RouterPrecedenceTests();
+    RouterTestsPrivate::RouterTieTests();
+    RouterTestsPrivate::RouterTrailingSlashTests();
+}
+}
+
+#endif
@@ -43,7 +43,8 @@ private:
     std::string _password;
 };
 
-/// Supports SOCKS4 and translates the command to a SOCKS5 command.
+/// Supports SOCKS4 and translates the command to a SOCKS5 command. Once a connection has been confirmed, the
+/// client and target sockets can be handed to a SocketRelay.
 class SOCKSServerCommand {
 public:
     enum Command {
@@ -57,22 +57,21 @@ ptrdiff_t SeekAvoidingStream::writeSome(const void* bytes, size_t maxBytes, Log*
     return got;
 }
 
+// readAtOffset() and writeAtOffset() leave the underlying Stream's offset where it was, so _at is unchanged.
+
 ptrdiff_t SeekAvoidingStream::readAtOffset(Offset offset, void* buffer, size_t requiredBytes, Log* log)
 {
-    ptrdiff_t got = _underlyingStream->readAtOffset(offset, buffer, requiredBytes, log);
-    if (got > 0) {
-        _at = offset + got;
-    }
-    return got;
+    return _underlyingStream->readAtOffset(offset, buffer, requiredBytes, log);
 }
 
 ptrdiff_t SeekAvoidingStream::writeAtOffset(Offset offset, const void* bytes, size_t byteCount, Log* log)
 {
-    ptrdiff_t got = _underlyingStream->writeAtOffset(offset, bytes, byteCount, log);
-    if (got > 0) {
-        _at = offset + got;
-    }
-    return got;
+    return _underlyingStream->writeAtOffset(offset, bytes, byteCount, log);
+}
+
+bool SeekAvoidingStream::hasConcurrentPositionalIO() const
+{
+    return _underlyingStream->hasConcurrentPositionalIO();
 }
 
 Stream::Offset SeekAvoidingStream::seek(Offset offset, SeekMode mode, Log* log)
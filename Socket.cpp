@@ -4,6 +4,7 @@
 #include "NumberUtils.h"
 #include "SignalSocket.h"
 #include <string.h>
+#include <vector>
 
 namespace Prime {
 
@@ -172,82 +173,162 @@ bool Socket::connect(const SocketAddress& address, int milliseconds, Log* log)
 
 bool Socket::nonBlockingConnect(const SocketAddress& address, int milliseconds, Log* log)
 {
+    bool connected;
+    if (!beginNonBlockingConnect(address, connected, log)) {
+        return false;
+    }
+
+    if (connected) {
+        return true;
+    }
+
+    // Wait for the connection to complete (signalled by the socket becoming writable) or for the close
+    // signal to become readable.
+    SelectSocket writes[] = { { this, false }, { NULL, false } };
+    SelectSocket reads[] = { { getCloseSignalSocket(), false }, { NULL, false } };
+
+    WaitResult waitResult = select(milliseconds, reads, writes, NULL, log);
+
+    if (waitResult == WaitResultTimedOut) {
+        handleError(ETIMEDOUT, log);
+        return false; // TODO: need an enum
+    }
+
+    if (waitResult != WaitResultOK) {
+        return false;
+    }
+
+    if (reads[0].isSet) {
+        // Close signal
+        handleError(EINPROGRESS, log);
+        return false;
+    }
+
+    return finishNonBlockingConnect(log);
+}
+
+bool Socket::beginNonBlockingConnect(const SocketAddress& address, bool& connected, Log* log)
+{
+    PRIME_ASSERT(isCreated());
+    PRIME_ASSERT(!address.isNull());
+
     for (;;) {
         if (::connect(getHandle(), address.get(), address.getLength()) >= 0) {
+            connected = true;
             return true;
         }
 
-        if (SocketSupport::getLastSocketError() != EINPROGRESS) {
-            if (!handleError(log)) {
-                return false;
-            }
+        if (SocketSupport::getLastSocketError() == EINPROGRESS) {
+            connected = false;
+            return true;
+        }
 
-            continue;
+        if (!handleError(log)) {
+            return false;
         }
+    }
+}
 
-        for (;;) {
-            struct timeval timeout;
-            timeout.tv_sec = milliseconds / 1000;
-            timeout.tv_usec = (milliseconds % 1000) * 1000;
-
-            fd_set readSet;
-            Handle maxHandle = _handle;
-            FD_ZERO(&readSet);
-            FD_SET(_handle, &readSet);
-            if (_closeSignal) {
-                Handle closeHandle = getCloseSignal()->getSocket().getHandle();
-                FD_SET(closeHandle, &readSet);
-
-                if (closeHandle > maxHandle) {
-                    maxHandle = closeHandle;
-                }
-            }
+bool Socket::finishNonBlockingConnect(Log* log)
+{
+    int error = 0;
+    socklen_t errorLen = static_cast<socklen_t>(sizeof(error));
+    if (getsockopt(_handle, SOL_SOCKET, SO_ERROR, reinterpret_cast<char*>(&error), &errorLen) < 0) {
+        handleError(log);
+        return false;
+    }
 
-            // TODO: also wait on the signal socket?
+    if (errorLen != static_cast<socklen_t>(sizeof(error))) {
+        log->error("getsockopt error length incorrect.");
+        return false;
+    }
 
-            int selected = ::select(maxHandle + 1, NULL, &readSet, NULL, milliseconds < 0 ? NULL : &timeout);
-            if (selected < 0) {
-                if (!handleError(log)) {
-                    return false;
-                }
+    if (!error) {
+        return true;
+    }
 
-                continue;
-            }
+    handleError(error, log);
+    return false;
+}
 
-            if (selected == 0) {
-                // Timeout
-                handleError(ETIMEDOUT, log);
-                return false; // TODO: need an enum
-            }
+#ifdef PRIME_HAVE_SOCKET_POLL
 
-            if (!FD_ISSET(_handle, &readSet)) {
-                // Close signal
-                handleError(EINPROGRESS, log);
-                return false;
-            }
+namespace {
 
-            int error = 0;
-            socklen_t errorLen = static_cast<socklen_t>(sizeof(error));
-            if (getsockopt(_handle, SOL_SOCKET, SO_ERROR, reinterpret_cast<char*>(&error), &errorLen) < 0) {
-                handleError(log);
-                return false;
-            }
+#ifdef PRIME_OS_WINDOWS
+// WSAPoll() rejects POLLPRI.
+const short pollExceptional = POLLRDBAND;
+#else
+const short pollExceptional = POLLPRI;
+#endif
 
-            if (errorLen != static_cast<socklen_t>(sizeof(error))) {
-                log->error("getsockopt error length incorrect.");
-                return false;
+// Like select(), report a socket as readable or writable if it has hung up or has an error, so the caller's
+// subsequent recv()/send() discovers what happened.
+const short pollEvents[3] = { POLLIN, POLLOUT, pollExceptional };
+const short pollResults[3] = { POLLIN | POLLHUP | POLLERR, POLLOUT | POLLHUP | POLLERR, pollExceptional };
+}
+
+Socket::WaitResult Socket::select(int milliseconds, SelectSocket* reads, SelectSocket* writes,
+    SelectSocket* errors, Log* log)
+{
+    SelectSocket* sets[3] = { reads, writes, errors };
+
+    size_t count = 0;
+    for (int setNumber = 0; setNumber != 3; ++setNumber) {
+        for (SelectSocket* ptr = sets[setNumber]; ptr && ptr->socket; ++ptr) {
+            ptr->isSet = false;
+            ++count;
+        }
+    }
+
+    // Almost every call is from waitRecv() or waitSend(), which need at most two descriptors.
+    SocketSupport::PollDescriptor localDescriptors[8];
+    std::vector<SocketSupport::PollDescriptor> heapDescriptors;
+    SocketSupport::PollDescriptor* descriptors = localDescriptors;
+    if (count > COUNTOF(localDescriptors)) {
+        heapDescriptors.resize(count);
+        descriptors = &heapDescriptors[0];
+    }
+
+    size_t index = 0;
+    for (int setNumber = 0; setNumber != 3; ++setNumber) {
+        for (SelectSocket* ptr = sets[setNumber]; ptr && ptr->socket; ++ptr) {
+            descriptors[index].fd = ptr->socket->getHandle();
+            descriptors[index].events = pollEvents[setNumber];
+            descriptors[index].revents = 0;
+            ++index;
+        }
+    }
+
+    for (;;) {
+        int result = SocketSupport::pollSocket(descriptors, count, milliseconds < 0 ? -1 : milliseconds);
+
+        if (result > 0) {
+            index = 0;
+            for (int setNumber = 0; setNumber != 3; ++setNumber) {
+                for (SelectSocket* ptr = sets[setNumber]; ptr && ptr->socket; ++ptr) {
+                    ptr->isSet = (descriptors[index].revents & pollResults[setNumber]) != 0;
+                    ++index;
+                }
             }
 
-            if (!error) {
-                return true;
+            return WaitResultOK;
+        }
+
+        if (result < 0) {
+            if (handleError(log)) {
+                continue;
             }
 
-            handleError(error, log);
-            return false;
+            return WaitResultCancelled;
         }
+
+        return WaitResultTimedOut;
     }
 }
 
+#else
+
 Socket::WaitResult Socket::select(int milliseconds, SelectSocket* reads, SelectSocket* writes,
     SelectSocket* errors, Log* log)
 {
@@ -316,6 +397,8 @@ Socket::WaitResult Socket::select(int milliseconds, SelectSocket* reads, SelectS
     }
 }
 
+#endif
+
 Socket::WaitResult Socket::waitRecv(int milliseconds, Log* log)
 {
     PRIME_ASSERT(isCreated());
@@ -392,6 +475,95 @@ ptrdiff_t Socket::send(const void* buffer, size_t request, Log* log)
     }
 }
 
+ptrdiff_t Socket::recvVectored(const Stream::IOVector* vectors, size_t vectorCount, Log* log)
+{
+    PRIME_ASSERT(isCreated());
+
+    vectorCount = PRIME_MIN(vectorCount, (size_t)Stream::maxIOVectors);
+
+#ifdef PRIME_OS_WINDOWS
+    WSABUF buffers[Stream::maxIOVectors];
+    for (size_t i = 0; i != vectorCount; ++i) {
+        buffers[i].buf = (char*)vectors[i].bytes;
+        buffers[i].len = (ULONG)vectors[i].size;
+    }
+#else
+    struct iovec buffers[Stream::maxIOVectors];
+    for (size_t i = 0; i != vectorCount; ++i) {
+        buffers[i].iov_base = vectors[i].bytes;
+        buffers[i].iov_len = vectors[i].size;
+    }
+
+    struct msghdr message;
+    memset(&message, 0, sizeof(message));
+    message.msg_iov = buffers;
+    message.msg_iovlen = vectorCount;
+#endif
+
+    bool returnZero = false;
+    for (;;) {
+#ifdef PRIME_OS_WINDOWS
+        DWORD received = 0;
+        DWORD flags = 0;
+        int recvd = ::WSARecv(getHandle(), buffers, (DWORD)vectorCount, &received, &flags, NULL, NULL) == 0
+            ? (int)received
+            : -1;
+#else
+        ptrdiff_t recvd = ::recvmsg(getHandle(), &message, 0);
+#endif
+
+        if (recvd < 0 && handleSendRecvError(log, returnZero)) {
+            continue;
+        }
+
+        return returnZero ? 0 : recvd;
+    }
+}
+
+ptrdiff_t Socket::sendVectored(const Stream::ConstIOVector* vectors, size_t vectorCount, Log* log)
+{
+    PRIME_ASSERT(isCreated());
+
+    vectorCount = PRIME_MIN(vectorCount, (size_t)Stream::maxIOVectors);
+
+#ifdef PRIME_OS_WINDOWS
+    WSABUF buffers[Stream::maxIOVectors];
+    for (size_t i = 0; i != vectorCount; ++i) {
+        buffers[i].buf = (char*)vectors[i].bytes;
+        buffers[i].len = (ULONG)vectors[i].size;
+    }
+#else
+    struct iovec buffers[Stream::maxIOVectors];
+    for (size_t i = 0; i != vectorCount; ++i) {
+        buffers[i].iov_base = const_cast<void*>(vectors[i].bytes);
+        buffers[i].iov_len = vectors[i].size;
+    }
+
+    struct msghdr message;
+    memset(&message, 0, sizeof(message));
+    message.msg_iov = buffers;
+    message.msg_iovlen = vectorCount;
+#endif
+
+    bool returnZero = false;
+    for (;;) {
+#ifdef PRIME_OS_WINDOWS
+        DWORD sent = 0;
+        int wrote = ::WSASend(getHandle(), buffers, (DWORD)vectorCount, &sent, 0, NULL, NULL) == 0
+            ? (int)sent
+            : -1;
+#else
+        ptrdiff_t wrote = ::sendmsg(getHandle(), &message, 0);
+#endif
+
+        if (wrote < 0 && handleSendRecvError(log, returnZero)) {
+            continue;
+        }
+
+        return returnZero ? 0 : wrote;
+    }
+}
+
 bool Socket::sendAll(const void* data, size_t length, Log* log)
 {
     if (!length) {
@@ -568,6 +740,27 @@ bool Socket::setNonBlocking(bool value, Log* log)
     }
 }
 
+bool Socket::shutdownSend(Log* log)
+{
+    PRIME_ASSERT(isCreated());
+
+#ifdef PRIME_OS_WINDOWS
+    const int how = SD_SEND;
+#else
+    const int how = SHUT_WR;
+#endif
+
+    for (;;) {
+        if (::shutdown(getHandle(), how) == 0) {
+            return true;
+        }
+
+        if (!handleError(log)) {
+            return false;
+        }
+    }
+}
+
 bool Socket::setBroadcast(bool value, Log* log)
 {
     PRIME_ASSERT(isCreated());
@@ -604,6 +797,30 @@ bool Socket::setReuseAddress(bool value, Log* log)
     }
 }
 
+bool Socket::setReusePort(bool value, Log* log)
+{
+    PRIME_ASSERT(isCreated());
+
+#ifdef SO_REUSEPORT
+    int parm = value ? 1 : 0;
+
+    for (;;) {
+        int res = setsockopt(getHandle(), SOL_SOCKET, SO_REUSEPORT, (char*)&parm, sizeof(parm));
+        if (res >= 0) {
+            return true;
+        }
+
+        if (!handleError(log)) {
+            return false;
+        }
+    }
+#else
+    (void)value;
+    log->error(PRIME_LOCALISE("SO_REUSEPORT is not supported on this platform."));
+    return false;
+#endif
+}
+
 void Socket::takeOwnership(Socket& from)
 {
     if (this != &from) {
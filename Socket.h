@@ -5,6 +5,7 @@
 
 #include "RefCounting.h"
 #include "SocketAddress.h"
+#include "Stream.h"
 
 namespace Prime {
 
@@ -149,6 +150,14 @@ public:
     /// `connect` for a socket which has already been set non-blocking.
     bool nonBlockingConnect(const SocketAddress& address, int milliseconds, Log* log);
 
+    /// Start connecting a socket which has already been set non-blocking, without waiting. Returns false on
+    /// error. Otherwise, sets connected to true if the connection completed immediately, or false if it's in
+    /// progress, in which case wait for the socket to become writable then call finishNonBlockingConnect().
+    bool beginNonBlockingConnect(const SocketAddress& address, bool& connected, Log* log);
+
+    /// Returns true if a connection started by beginNonBlockingConnect(), and now writable, succeeded.
+    bool finishNonBlockingConnect(Log* log);
+
     /// Wait, up to the specified number of milliseconds, for data to become available to read. Returns a member
     /// of the WaitResult enumeration. Specify -1 for milliseconds to wait forever.
     WaitResult waitRecv(int milliseconds, Log* log);
@@ -174,6 +183,14 @@ public:
     /// connection has been closed. On error, returns -1.
     ptrdiff_t send(const void* buffer, size_t request, Log* log);
 
+    /// Read in to a sequence of buffers, filling each in turn, with a single system call. Only the first
+    /// Stream::maxIOVectors buffers are used. Returns the same as recv().
+    ptrdiff_t recvVectored(const Stream::IOVector* vectors, size_t vectorCount, Log* log);
+
+    /// Send a sequence of buffers, in order, with a single system call. Only the first Stream::maxIOVectors
+    /// buffers are sent. Returns the same as send().
+    ptrdiff_t sendVectored(const Stream::ConstIOVector* vectors, size_t vectorCount, Log* log);
+
     /// Repeatedly call send() until all of data has been sent. On error, or if the remote socket was closed
     /// before all the data was written, returns false.
     bool sendAll(const void* data, size_t length, Log* log);
@@ -207,6 +224,9 @@ public:
     /// Set the non-blocking option on this socket. Returns false on error.
     bool setNonBlocking(bool value, Log* log);
 
+    /// Signal end of stream to the remote end (it will read 0 bytes) while continuing to receive.
+    bool shutdownSend(Log* log);
+
     /// Enable broadcast address on this socket. Returns false on error.
     bool setBroadcast(bool value, Log* log);
 
@@ -214,6 +234,11 @@ public:
     /// that is still in TIME_WAIT state.
     bool setReuseAddress(bool value, Log* log);
 
+    /// Enable or disable SO_REUSEPORT, allowing multiple sockets to bind to the same address and port. Where
+    /// PRIME_OS_HAS_REUSEPORT_BALANCING is defined, incoming connections are distributed between the listening
+    /// sockets. Fails on platforms without SO_REUSEPORT.
+    bool setReusePort(bool value, Log* log);
+
     /// Specify whether or not interrupted system calls should be retried. Defaults to true.
     void setRetry(bool retry) { _shouldRetry = retry; }
 
@@ -0,0 +1,217 @@
+// Copyright 2000-2021 Mark H. P. Lord
+
+#include "SocketAddressCache.h"
+#include "Clocks.h"
+
+namespace Prime {
+
+SocketAddressCache::SocketAddressCache()
+    : _ttl(60)
+    , _negativeTTL(5)
+    , _refreshFraction(0.2)
+    , _maxEntries(1024)
+{
+    _mutex.init(Log::getGlobal(), "SocketAddressCache mutex");
+    _lookupFinished.init(&_mutex, Log::getGlobal(), "SocketAddressCache condition");
+}
+
+SocketAddressCache::~SocketAddressCache()
+{
+}
+
+void SocketAddressCache::setRefreshQueue(TaskQueue* queue)
+{
+    Mutex::ScopedLock lock(&_mutex);
+    _refreshQueue = queue;
+}
+
+void SocketAddressCache::copyWithPort(std::vector<SocketAddress::AddressInfo>& output,
+    const std::vector<SocketAddress::AddressInfo>& input, int port)
+{
+    size_t first = output.size();
+    output.insert(output.end(), input.begin(), input.end());
+
+    for (size_t i = first; i != output.size(); ++i) {
+        output[i].address.setPort(port);
+    }
+}
+
+bool SocketAddressCache::resolve(std::vector<SocketAddress::AddressInfo>& addresses, const char* hostname, int port,
+    int socketType, int protocol, Log* log)
+{
+    Key key;
+    key.hostname = hostname;
+    key.socketType = socketType;
+    key.protocol = protocol;
+
+    Mutex::ScopedLock lock(&_mutex);
+
+    for (;;) {
+        double now = Clock::getMonotonicSeconds();
+
+        EntryMap::iterator iter = _entries.find(key);
+        if (iter == _entries.end()) {
+            trim(now);
+            iter = _entries.insert(EntryMap::value_type(key, Entry())).first;
+        }
+
+        Entry& entry = iter->second;
+
+        if (entry.hasResult && now < entry.expires) {
+            entry.lastUsed = now;
+
+            if (!entry.succeeded) {
+                log->error(PRIME_LOCALISE("Unable to resolve host name: %s"), hostname);
+                return false;
+            }
+
+            if (_refreshQueue && !entry.lookingUp && now >= entry.refreshAfter) {
+                entry.lookingUp = true;
+                _refreshKeys.push_back(key);
+
+                RefPtr<SocketAddressCache> self(this);
+#ifdef PRIME_CXX11_STL
+                _refreshQueue->queue([self]() {
+                    self->refreshNext();
+                });
+#else
+                _refreshQueue->queue(MethodCallback(self, &SocketAddressCache::refreshNext));
+#endif
+            }
+
+            copyWithPort(addresses, entry.addresses, port);
+            return true;
+        }
+
+        if (!entry.lookingUp) {
+            entry.lookingUp = true;
+            break;
+        }
+
+        // Another thread is looking up this host name.
+        _lookupFinished.wait(lock);
+    }
+
+    lock.unlock();
+
+    std::vector<SocketAddress::AddressInfo> resolved;
+    bool succeeded = SocketAddress::resolve(resolved, hostname, 0, socketType, protocol, log);
+
+    if (succeeded) {
+        copyWithPort(addresses, resolved, port);
+    }
+
+    lock.lock(&_mutex);
+
+    store(key, succeeded, resolved, false);
+
+    return succeeded;
+}
+
+void SocketAddressCache::store(const Key& key, bool succeeded, std::vector<SocketAddress::AddressInfo>& addresses,
+    bool keepOnFailure)
+{
+    _lookupFinished.wakeAll();
+
+    EntryMap::iterator iter = _entries.find(key);
+    if (!PRIME_GUARD(iter != _entries.end())) {
+        // Entries being looked up should never be removed.
+        return;
+    }
+
+    Entry& entry = iter->second;
+    entry.lookingUp = false;
+
+    if (!succeeded && keepOnFailure && entry.hasResult && entry.succeeded) {
+        // Keep using the old addresses until they expire.
+        return;
+    }
+
+    double now = Clock::getMonotonicSeconds();
+
+    entry.hasResult = true;
+    entry.succeeded = succeeded;
+    entry.lastUsed = now;
+
+    if (succeeded) {
+        entry.addresses.swap(addresses);
+        entry.expires = now + _ttl;
+        entry.refreshAfter = now + _ttl * (1.0 - _refreshFraction);
+    } else {
+        entry.addresses.clear();
+        entry.expires = now + _negativeTTL;
+        entry.refreshAfter = entry.expires;
+    }
+}
+
+void SocketAddressCache::trim(double now)
+{
+    if (_entries.size() < _maxEntries) {
+        return;
+    }
+
+    EntryMap::iterator oldest = _entries.end();
+
+    EntryMap::iterator iter = _entries.begin();
+    while (iter != _entries.end()) {
+        if (iter->second.lookingUp) {
+            ++iter;
+        } else if (now >= iter->second.expires) {
+            _entries.erase(iter++);
+        } else {
+            if (oldest == _entries.end() || iter->second.lastUsed < oldest->second.lastUsed) {
+                oldest = iter;
+            }
+            ++iter;
+        }
+    }
+
+    if (_entries.size() >= _maxEntries && oldest != _entries.end()) {
+        _entries.erase(oldest);
+    }
+}
+
+void SocketAddressCache::refreshNext()
+{
+    Mutex::ScopedLock lock(&_mutex);
+
+    if (_refreshKeys.empty()) {
+        return;
+    }
+
+    Key key = PRIME_MOVE(_refreshKeys.front());
+    _refreshKeys.pop_front();
+
+    lock.unlock();
+
+    std::vector<SocketAddress::AddressInfo> resolved;
+    bool succeeded = SocketAddress::resolve(resolved, key.hostname.c_str(), 0, key.socketType, key.protocol,
+        Log::getGlobal());
+
+    lock.lock(&_mutex);
+
+    store(key, succeeded, resolved, true);
+}
+
+void SocketAddressCache::clear()
+{
+    Mutex::ScopedLock lock(&_mutex);
+
+    // Entries being looked up are kept so their lookups can finish.
+    EntryMap::iterator iter = _entries.begin();
+    while (iter != _entries.end()) {
+        if (iter->second.lookingUp) {
+            iter->second.hasResult = false;
+            ++iter;
+        } else {
+            _entries.erase(iter++);
+        }
+    }
+}
+
+size_t SocketAddressCache::getEntryCount() const
+{
+    Mutex::ScopedLock lock(&_mutex);
+    return _entries.size();
+}
+}
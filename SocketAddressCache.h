@@ -0,0 +1,127 @@
+// Copyright 2000-2021 Mark H. P. Lord
+
+#ifndef PRIME_SOCKETADDRESSCACHE_H
+#define PRIME_SOCKETADDRESSCACHE_H
+
+#include "Condition.h"
+#include "Mutex.h"
+#include "SocketAddress.h"
+#include "TaskQueue.h"
+#include <deque>
+#include <map>
+#include <vector>
+
+namespace Prime {
+
+/// A thread safe cache of SocketAddress::resolve() results, which can be shared by any number of
+/// SocketConnectors (see SocketConnector::setAddressCache()). getaddrinfo() doesn't report record TTLs, so
+/// results are kept for a fixed time, and failures for a shorter time. Only one lookup of a host name is made at
+/// a time: other threads wanting the same host wait for its result rather than making their own. If a refresh
+/// queue has been set, an entry that's used shortly before it expires is looked up again on that queue while the
+/// old result continues to be used, so busy hosts are never waited for.
+class PRIME_PUBLIC SocketAddressCache : public RefCounted {
+public:
+    SocketAddressCache();
+
+    ~SocketAddressCache();
+
+    /// Like SocketAddress::resolve(), but uses the cache.
+    bool resolve(std::vector<SocketAddress::AddressInfo>& addresses, const char* hostname, int port,
+        int socketType, int protocol, Log* log);
+
+    /// How long a successful lookup is used for (default 60 seconds).
+    void setTTL(double seconds) { _ttl = seconds; }
+    double getTTL() const { return _ttl; }
+
+    /// How long a failed lookup is remembered (default 5 seconds).
+    void setNegativeTTL(double seconds) { _negativeTTL = seconds; }
+    double getNegativeTTL() const { return _negativeTTL; }
+
+    /// Entries used in the last part of their TTL (a fraction, default 0.2) are refreshed in the background.
+    /// Requires a refresh queue.
+    void setRefreshFraction(double fraction) { _refreshFraction = fraction; }
+
+    /// Queue on which hot entries are refreshed. Without one, entries are only looked up again once they have
+    /// expired.
+    void setRefreshQueue(TaskQueue* queue);
+
+    /// Limit the number of host names remembered (default 1024).
+    void setMaxEntries(size_t value) { _maxEntries = value; }
+
+    /// Forget everything.
+    void clear();
+
+    size_t getEntryCount() const;
+
+private:
+    struct Key {
+        std::string hostname;
+        int socketType;
+        int protocol;
+
+        bool operator<(const Key& other) const
+        {
+            int compare = hostname.compare(other.hostname);
+            if (compare != 0) {
+                return compare < 0;
+            }
+
+            return socketType < other.socketType || (socketType == other.socketType && protocol < other.protocol);
+        }
+    };
+
+    struct Entry {
+        /// The addresses, with a port of zero.
+        std::vector<SocketAddress::AddressInfo> addresses;
+
+        bool hasResult;
+        bool succeeded;
+        double expires;
+        double refreshAfter;
+        double lastUsed;
+
+        /// Set while a thread (or the refresh queue) is looking up this host name.
+        bool lookingUp;
+
+        Entry()
+            : hasResult(false)
+            , succeeded(false)
+            , expires(0)
+            , refreshAfter(0)
+            , lastUsed(0)
+            , lookingUp(false)
+        {
+        }
+    };
+
+    typedef std::map<Key, Entry> EntryMap;
+
+    /// Store the result of a lookup and wake anyone waiting for it. Called with the lock held.
+    void store(const Key& key, bool succeeded, std::vector<SocketAddress::AddressInfo>& addresses, bool keepOnFailure);
+
+    /// Make room for a new entry. Called with the lock held.
+    void trim(double now);
+
+    static void copyWithPort(std::vector<SocketAddress::AddressInfo>& output,
+        const std::vector<SocketAddress::AddressInfo>& input, int port);
+
+    /// Run on the refresh queue.
+    void refreshNext();
+
+    EntryMap _entries;
+    mutable Mutex _mutex;
+    Condition _lookupFinished;
+
+    std::deque<Key> _refreshKeys;
+    RefPtr<TaskQueue> _refreshQueue;
+
+    double _ttl;
+    double _negativeTTL;
+    double _refreshFraction;
+    size_t _maxEntries;
+
+    PRIME_UNCOPYABLE(SocketAddressCache);
+};
+}
+
+#endif
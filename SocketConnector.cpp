@@ -15,4 +15,14 @@ SocketConnector::SocketConnector(int readTimeoutMilliseconds, int writeTimeoutMi
 SocketConnector::~SocketConnector()
 {
 }
+
+bool SocketConnector::resolve(std::vector<SocketAddress::AddressInfo>& addresses, const char* hostname, int port,
+    int socketType, int protocol, Log* log)
+{
+    if (_addressCache) {
+        return _addressCache->resolve(addresses, hostname, port, socketType, protocol, log);
+    }
+
+    return SocketAddress::resolve(addresses, hostname, port, socketType, protocol, log);
+}
 }
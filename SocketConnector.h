@@ -4,6 +4,7 @@
 #define PRIME_SOCKETCONNECTOR_H
 
 #include "NetworkStream.h"
+#include "SocketAddressCache.h"
 
 namespace Prime {
 
@@ -28,9 +29,20 @@ public:
     void setWriteTimeout(int milliseconds) { _writeTimeout = milliseconds; }
     int getWriteTimeout() const { return _writeTimeout; }
 
+    /// Resolve host names using a cache, which may be shared with other SocketConnectors. If null (the
+    /// default), every connection resolves its host name.
+    void setAddressCache(SocketAddressCache* cache) { _addressCache = cache; }
+    SocketAddressCache* getAddressCache() const { return _addressCache; }
+
+protected:
+    /// Resolve a host name using the address cache, if there is one.
+    bool resolve(std::vector<SocketAddress::AddressInfo>& addresses, const char* hostname, int port, int socketType,
+        int protocol, Log* log);
+
 private:
     int _readTimeout;
     int _writeTimeout;
+    RefPtr<SocketAddressCache> _addressCache;
 };
 }
 
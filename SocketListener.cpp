@@ -44,6 +44,24 @@ bool SocketListener::init(const char* address, const Options& options, Log* log,
         SocketAddress::getAllInterfaceAddresses(*addresses, port, log);
     }
 
+    return open(addr, options, addresses);
+}
+
+bool SocketListener::init(const SocketAddress& addr, const Options& options, Log* log)
+{
+    char description[128];
+    if (!addr.describe(description, sizeof(description), true)) {
+        description[0] = 0;
+    }
+
+    _log.setLog(log);
+    _log.setPrefix(description);
+
+    return open(addr, options, NULL);
+}
+
+bool SocketListener::open(const SocketAddress& addr, const Options& options, std::vector<std::string>* addresses)
+{
     if (!_socket.createForAddress(addr, SOCK_STREAM, IPPROTO_TCP, _log, Socket::Options())) {
         _log.error(PRIME_LOCALISE("Can't create socket."));
         return false;
@@ -59,6 +77,10 @@ bool SocketListener::init(const char* address, const Options& options, Log* log,
 
     _socket.setReuseAddress(true, PrefixLog(_log, "SO_REUSEADDR"));
 
+    if (options.getReusePort() && !_socket.setReusePort(true, PrefixLog(_log, "SO_REUSEPORT"))) {
+        return false;
+    }
+
     const int retryAfterMilliseconds = options.getRetryAfterMilliseconds();
     int retryBindCount = (int)((options.getRetryBindForSeconds() * 1000 + retryAfterMilliseconds) / retryAfterMilliseconds);
     int retryBindRemaining = retryBindCount;
@@ -23,6 +23,7 @@ public:
             : _retryBindForSeconds(30)
             , _retryAfterMilliseconds(250)
             , _defaultPort(80)
+            , _reusePort(false)
         {
         }
 
@@ -54,16 +55,29 @@ public:
         }
         int getDefaultPort() const { return _defaultPort; }
 
+        /// Set SO_REUSEPORT so that several listeners can bind the same address (see Socket::setReusePort()).
+        Options& setReusePort(bool value)
+        {
+            _reusePort = value;
+            return *this;
+        }
+        bool getReusePort() const { return _reusePort; }
+
     private:
         int _retryBindForSeconds;
         int _retryAfterMilliseconds;
         UnownedPtr<SignalSocket> _closeSignal;
         int _defaultPort;
+        bool _reusePort;
     };
 
     /// Start listening for connections.
     bool init(const char* address, const Options& options, Log* log, std::vector<std::string>* addresses = NULL);
 
+    /// Start listening for connections on an address which has already been resolved, e.g., the
+    /// getLocalAddress() of another listener created with Options::setReusePort().
+    bool init(const SocketAddress& address, const Options& options, Log* log);
+
     /// Set a SignalSocket which if signalled causes accept to immediately return.
     void setCloseSignal(SignalSocket* closeSignal) { _socket.setCloseSignal(closeSignal); }
 
@@ -105,7 +119,12 @@ public:
 
     const SocketAddress& getLocalAddress() const { return _localAddress; }
 
+    /// Returns the listening socket, e.g., to wait for connections on many listeners with a SocketPoller.
+    const Socket& getSocket() const { return _socket; }
+
 private:
+    bool open(const SocketAddress& addr, const Options& options, std::vector<std::string>* addresses);
+
     Socket _socket;
     PrefixLog _log;
     SocketAddress _localAddress;
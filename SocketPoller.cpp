@@ -0,0 +1,413 @@
+// Copyright 2000-2021 Mark H. P. Lord
+
+#include "SocketPoller.h"
+#include "Clocks.h"
+#include "SignalSocket.h"
+#include "SocketListener.h"
+#include "SocketStream.h"
+#include <vector>
+#ifdef PRIME_SOCKETPOLLER_EPOLL
+#include <sys/epoll.h>
+#endif
+
+namespace Prime {
+
+SocketPoller::SocketPoller()
+    : _initialised(false)
+#ifdef PRIME_SOCKETPOLLER_EPOLL
+    , _epoll(-1)
+#endif
+{
+}
+
+SocketPoller::~SocketPoller()
+{
+    close();
+}
+
+bool SocketPoller::add(const SocketListener& listener, void* context, Log* log)
+{
+    return add(listener.getSocket().getHandle(), EventRead, context, log);
+}
+
+bool SocketPoller::add(const SignalSocket& signalSocket, void* context, Log* log)
+{
+    return add(signalSocket.getSocket().getHandle(), EventRead, context, log);
+}
+
+bool SocketPoller::add(const NetworkStream& stream, unsigned int events, void* context, Log* log)
+{
+    SocketStream* socketStream = stream.getSocketStream();
+    if (!socketStream) {
+        log->error(PRIME_LOCALISE("Stream is not backed by a socket."));
+        return false;
+    }
+
+    return add(socketStream->getHandle(), events, context, log);
+}
+
+bool SocketPoller::remove(const NetworkStream& stream, Log* log)
+{
+    SocketStream* socketStream = stream.getSocketStream();
+    if (!socketStream) {
+        log->error(PRIME_LOCALISE("Stream is not backed by a socket."));
+        return false;
+    }
+
+    return remove(socketStream->getHandle(), log);
+}
+
+#if defined(PRIME_SOCKETPOLLER_EPOLL)
+
+namespace {
+
+uint32_t eventsToEpoll(unsigned int events)
+{
+    uint32_t epollEvents = 0;
+
+    if (events & SocketPoller::EventRead) {
+        epollEvents |= EPOLLIN | EPOLLRDHUP;
+    }
+
+    if (events & SocketPoller::EventWrite) {
+        epollEvents |= EPOLLOUT;
+    }
+
+    if (events & SocketPoller::EventOneShot) {
+        epollEvents |= EPOLLONESHOT;
+    }
+
+    return epollEvents;
+}
+
+unsigned int epollToEvents(uint32_t epollEvents)
+{
+    unsigned int events = 0;
+
+    if (epollEvents & EPOLLIN) {
+        events |= SocketPoller::EventRead;
+    }
+
+    if (epollEvents & EPOLLOUT) {
+        events |= SocketPoller::EventWrite;
+    }
+
+    if (epollEvents & EPOLLERR) {
+        events |= SocketPoller::EventError;
+    }
+
+    if (epollEvents & (EPOLLHUP | EPOLLRDHUP)) {
+        events |= SocketPoller::EventHangUp;
+    }
+
+    return events;
+}
+}
+
+bool SocketPoller::init(Log* log)
+{
+    PRIME_ASSERT(!_initialised);
+
+    _epoll = epoll_create1(EPOLL_CLOEXEC);
+    if (_epoll < 0) {
+        log->logErrno(errno, "epoll_create1");
+        return false;
+    }
+
+    _initialised = true;
+    return true;
+}
+
+void SocketPoller::close()
+{
+    if (!_initialised) {
+        return;
+    }
+
+    ::close(_epoll);
+    _epoll = -1;
+    _initialised = false;
+}
+
+bool SocketPoller::add(Socket::Handle handle, unsigned int events, void* context, Log* log)
+{
+    struct epoll_event event;
+    event.events = eventsToEpoll(events);
+    event.data.ptr = context;
+    if (epoll_ctl(_epoll, EPOLL_CTL_ADD, handle, &event) != 0) {
+        log->logErrno(errno, "epoll_ctl");
+        return false;
+    }
+
+    return true;
+}
+
+bool SocketPoller::modify(Socket::Handle handle, unsigned int events, void* context, Log* log)
+{
+    struct epoll_event event;
+    event.events = eventsToEpoll(events);
+    event.data.ptr = context;
+    if (epoll_ctl(_epoll, EPOLL_CTL_MOD, handle, &event) != 0) {
+        log->logErrno(errno, "epoll_ctl");
+        return false;
+    }
+
+    return true;
+}
+
+bool SocketPoller::remove(Socket::Handle handle, Log* log)
+{
+    if (epoll_ctl(_epoll, EPOLL_CTL_DEL, handle, NULL) != 0) {
+        log->logErrno(errno, "epoll_ctl");
+        return false;
+    }
+
+    return true;
+}
+
+int SocketPoller::wait(int milliseconds, Event* events, int maxEvents, Log* log)
+{
+    PRIME_ASSERT(maxEvents > 0);
+
+    // epoll_wait() writes in to the caller's array, so wait() needs no buffer of its own (it's called on
+    // threads with small stacks). The events are then converted in place, last first, since an epoll_event is
+    // no larger than an Event.
+    PRIME_COMPILE_TIME_ASSERT(sizeof(struct epoll_event) <= sizeof(Event));
+    struct epoll_event* epollEvents = reinterpret_cast<struct epoll_event*>(events);
+
+    for (;;) {
+        int eventCount = epoll_wait(_epoll, epollEvents, maxEvents, milliseconds);
+        if (eventCount < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            log->logErrno(errno, "epoll_wait");
+            return -1;
+        }
+
+        for (int i = eventCount; i-- != 0;) {
+            unsigned int eventBits = epollToEvents(epollEvents[i].events);
+            void* context = epollEvents[i].data.ptr;
+            events[i].events = eventBits;
+            events[i].context = context;
+        }
+
+        return eventCount;
+    }
+}
+
+#elif defined(PRIME_HAVE_SOCKETPOLLER)
+
+namespace {
+
+short eventsToPoll(unsigned int events)
+{
+    short pollEvents = 0;
+
+    if (events & SocketPoller::EventRead) {
+        pollEvents |= POLLIN;
+    }
+
+    if (events & SocketPoller::EventWrite) {
+        pollEvents |= POLLOUT;
+    }
+
+    return pollEvents;
+}
+
+unsigned int pollToEvents(short pollEvents)
+{
+    unsigned int events = 0;
+
+    if (pollEvents & POLLIN) {
+        events |= SocketPoller::EventRead;
+    }
+
+    if (pollEvents & POLLOUT) {
+        events |= SocketPoller::EventWrite;
+    }
+
+    if (pollEvents & (POLLERR | POLLNVAL)) {
+        events |= SocketPoller::EventError;
+    }
+
+    if (pollEvents & POLLHUP) {
+        events |= SocketPoller::EventHangUp;
+    }
+
+    return events;
+}
+}
+
+bool SocketPoller::init(Log* log)
+{
+    PRIME_ASSERT(!_initialised);
+
+    if (!_mutex.isInitialised() && !_mutex.init(log, "SocketPoller mutex")) {
+        return false;
+    }
+
+    _initialised = true;
+    return true;
+}
+
+void SocketPoller::close()
+{
+    if (!_initialised) {
+        return;
+    }
+
+    Mutex::ScopedLock lock(&_mutex);
+    _registrations.clear();
+    _initialised = false;
+}
+
+bool SocketPoller::add(Socket::Handle handle, unsigned int events, void* context, Log* log)
+{
+    Mutex::ScopedLock lock(&_mutex);
+
+    Registration registration = { events, context };
+    if (!_registrations.insert(std::make_pair(handle, registration)).second) {
+        log->error(PRIME_LOCALISE("Socket is already registered."));
+        return false;
+    }
+
+    return true;
+}
+
+bool SocketPoller::modify(Socket::Handle handle, unsigned int events, void* context, Log* log)
+{
+    Mutex::ScopedLock lock(&_mutex);
+
+    std::map<Socket::Handle, Registration>::iterator iter = _registrations.find(handle);
+    if (iter == _registrations.end()) {
+        log->error(PRIME_LOCALISE("Socket is not registered."));
+        return false;
+    }
+
+    iter->second.events = events;
+    iter->second.context = context;
+    return true;
+}
+
+bool SocketPoller::remove(Socket::Handle handle, Log* log)
+{
+    Mutex::ScopedLock lock(&_mutex);
+
+    if (!_registrations.erase(handle)) {
+        log->error(PRIME_LOCALISE("Socket is not registered."));
+        return false;
+    }
+
+    return true;
+}
+
+int SocketPoller::wait(int milliseconds, Event* events, int maxEvents, Log* log)
+{
+    PRIME_ASSERT(maxEvents > 0);
+
+    std::vector<SocketSupport::PollDescriptor> descriptors;
+
+    {
+        Mutex::ScopedLock lock(&_mutex);
+
+        descriptors.reserve(_registrations.size());
+        std::map<Socket::Handle, Registration>::const_iterator iter = _registrations.begin();
+        for (; iter != _registrations.end(); ++iter) {
+            short pollEvents = eventsToPoll(iter->second.events);
+            if (pollEvents) {
+                SocketSupport::PollDescriptor descriptor;
+                descriptor.fd = iter->first;
+                descriptor.events = pollEvents;
+                descriptor.revents = 0;
+                descriptors.push_back(descriptor);
+            }
+        }
+    }
+
+    if (descriptors.empty()) {
+        // WSAPoll() rejects an empty set.
+        Clock::sleepMilliseconds(milliseconds < 0 ? 1000 : milliseconds);
+        return 0;
+    }
+
+    int result;
+    for (;;) {
+        result = SocketSupport::pollSocket(&descriptors[0], descriptors.size(), milliseconds);
+        if (result >= 0) {
+            break;
+        }
+
+        int error = SocketSupport::getLastSocketError();
+        if (error != EINTR) {
+            SocketSupport::logSocketError(log, error);
+            return -1;
+        }
+    }
+
+    if (result == 0) {
+        return 0;
+    }
+
+    // The registrations may have been changed while we were waiting, so only report sockets which are still
+    // registered and still interested.
+    Mutex::ScopedLock lock(&_mutex);
+
+    int eventCount = 0;
+    for (size_t i = 0; i != descriptors.size() && eventCount != maxEvents; ++i) {
+        if (!descriptors[i].revents) {
+            continue;
+        }
+
+        std::map<Socket::Handle, Registration>::iterator iter = _registrations.find(descriptors[i].fd);
+        if (iter == _registrations.end() || !eventsToPoll(iter->second.events)) {
+            continue;
+        }
+
+        events[eventCount].events = pollToEvents(descriptors[i].revents);
+        events[eventCount].context = iter->second.context;
+        ++eventCount;
+
+        if (iter->second.events & EventOneShot) {
+            iter->second.events = 0;
+        }
+    }
+
+    return eventCount;
+}
+
+#else
+
+bool SocketPoller::init(Log* log)
+{
+    log->error(PRIME_LOCALISE("SocketPoller is not supported on this platform."));
+    return false;
+}
+
+void SocketPoller::close()
+{
+}
+
+bool SocketPoller::add(Socket::Handle, unsigned int, void*, Log*)
+{
+    return false;
+}
+
+bool SocketPoller::modify(Socket::Handle, unsigned int, void*, Log*)
+{
+    return false;
+}
+
+bool SocketPoller::remove(Socket::Handle, Log*)
+{
+    return false;
+}
+
+int SocketPoller::wait(int, Event*, int, Log*)
+{
+    return -1;
+}
+
+#endif
+}
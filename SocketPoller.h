@@ -0,0 +1,128 @@
+// Copyright 2000-2021 Mark H. P. Lord
+
+#ifndef PRIME_SOCKETPOLLER_H
+#define PRIME_SOCKETPOLLER_H
+
+#include "Mutex.h"
+#include "Socket.h"
+#include <map>
+
+#if defined(PRIME_OS_LINUX)
+#define PRIME_HAVE_SOCKETPOLLER
+#define PRIME_SOCKETPOLLER_EPOLL
+#elif defined(PRIME_HAVE_SOCKET_POLL)
+#define PRIME_HAVE_SOCKETPOLLER
+#endif
+
+namespace Prime {
+
+class SignalSocket;
+class SocketListener;
+class NetworkStream;
+
+/// Waits for any number of sockets to become readable or writable. Unlike Socket::select(), sockets are
+/// registered once rather than on every wait and there's no limit on the number of sockets or the values of their
+/// handles. Uses epoll on Linux and poll() (WSAPoll() on Windows) elsewhere. Registrations may be changed from
+/// any thread, including while another thread is in wait(), but with poll() the change won't be seen until the
+/// next wait() (see canChangeWhileWaiting()). Only available where PRIME_HAVE_SOCKETPOLLER is defined (init()
+/// will fail on other platforms).
+class PRIME_PUBLIC SocketPoller {
+public:
+    enum {
+        /// Wait for the socket to become readable (or for the remote end to hang up).
+        EventRead = 1u << 0,
+
+        /// Wait for the socket to become writable.
+        EventWrite = 1u << 1,
+
+        /// Reported (never need be requested) if an error occurred on the socket.
+        EventError = 1u << 2,
+
+        /// Reported (never need be requested) if the remote end hung up.
+        EventHangUp = 1u << 3,
+
+        /// Once an event has been reported for the socket, stop waiting for it until modify() is called.
+        EventOneShot = 1u << 4
+    };
+
+    /// A socket that wait() has found to be ready.
+    struct Event {
+        /// Bitwise combination of EventRead, EventWrite, EventError and EventHangUp.
+        unsigned int events;
+
+        /// The context pointer supplied to add() or modify().
+        void* context;
+    };
+
+    SocketPoller();
+
+    ~SocketPoller();
+
+    bool init(Log* log);
+
+    void close();
+
+    bool isInitialised() const { return _initialised; }
+
+    /// Returns true if add(), modify() and remove() affect a wait() that's already in progress. If not, the
+    /// waiting thread has to be woken (e.g., with a SignalSocket) for changes to take effect.
+    static bool canChangeWhileWaiting()
+    {
+#ifdef PRIME_SOCKETPOLLER_EPOLL
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    /// Start waiting for events on a socket. events should be a combination of EventRead, EventWrite and
+    /// EventOneShot. context is returned with every Event for the socket. A socket may only be added once.
+    bool add(Socket::Handle handle, unsigned int events, void* context, Log* log);
+
+    /// Change the events being waited for, and the context, of a socket that has already been added. Also
+    /// re-arms an EventOneShot registration.
+    bool modify(Socket::Handle handle, unsigned int events, void* context, Log* log);
+
+    /// Stop waiting for events on a socket. Must be called before the socket is closed.
+    bool remove(Socket::Handle handle, Log* log);
+
+    /// Wait for a SocketListener to have a connection ready to accept.
+    bool add(const SocketListener& listener, void* context, Log* log);
+
+    /// Wait for a SignalSocket to be signalled.
+    bool add(const SignalSocket& signalSocket, void* context, Log* log);
+
+    /// Wait on the socket a NetworkStream performs its I/O on. Fails if the stream isn't backed by a socket. Note
+    /// that a stream may have already buffered data (e.g., OpenSSLStream::hasPending()) that won't be signalled.
+    bool add(const NetworkStream& stream, unsigned int events, void* context, Log* log);
+
+    /// Stop waiting on the socket of a NetworkStream added with add().
+    bool remove(const NetworkStream& stream, Log* log);
+
+    /// Wait, up to the specified number of milliseconds (-1 to wait forever), for one or more registered sockets
+    /// to become ready, then fill in up to maxEvents events. Returns the number of events, 0 on timeout or -1 on
+    /// error. Several threads may wait at once.
+    int wait(int milliseconds, Event* events, int maxEvents, Log* log);
+
+private:
+    bool _initialised;
+
+#ifdef PRIME_SOCKETPOLLER_EPOLL
+    int _epoll;
+#else
+    struct Registration {
+        unsigned int events;
+        void* context;
+    };
+
+    /// wait() polls a copy of the registrations, so they can be changed while another thread is waiting. Changes
+    /// take effect the next time wait() is called.
+    Mutex _mutex;
+    std::map<Socket::Handle, Registration> _registrations;
+#endif
+
+    PRIME_UNCOPYABLE(SocketPoller);
+};
+}
+
+#endif
@@ -0,0 +1,252 @@
+// Copyright 2000-2021 Mark H. P. Lord
+
+#include "SocketReactor.h"
+#include "Clocks.h"
+#include "NumberUtils.h"
+#include <vector>
+
+namespace Prime {
+
+SocketReactor::SocketReactor()
+    : _initialised(false)
+    , _quit(false)
+{
+}
+
+SocketReactor::~SocketReactor()
+{
+    close();
+}
+
+#ifdef PRIME_HAVE_SOCKETREACTOR
+
+bool SocketReactor::init(Log* log)
+{
+    PRIME_ASSERT(!_initialised);
+
+    _log = log;
+    _quit = false;
+
+    if (!_mutex.isInitialised() && !_mutex.init(log, "SocketReactor mutex")) {
+        return false;
+    }
+
+    if (!_wakeSignal.init(log)) {
+        return false;
+    }
+
+    if (!_poller.init(log)) {
+        return false;
+    }
+
+    // The wake signal is identified by a NULL context.
+    if (!_poller.add(_wakeSignal, NULL, log)) {
+        _poller.close();
+        return false;
+    }
+
+#ifdef PRIME_CXX11_STL
+    if (!_thread.create([this] { this->thread(); }, threadSize, log, "SocketReactor")) {
+        _poller.close();
+        return false;
+    }
+#else
+    if (!_thread.create(MethodCallback(this, &SocketReactor::thread), threadSize, log, "SocketReactor")) {
+        _poller.close();
+        return false;
+    }
+#endif
+
+    _initialised = true;
+    return true;
+}
+
+void SocketReactor::close()
+{
+    if (!_initialised) {
+        return;
+    }
+
+    {
+        Mutex::ScopedLock lock(&_mutex);
+        _quit = true;
+    }
+
+    _wakeSignal.signal(_log);
+    _thread.join();
+
+    _poller.close();
+    _wakeSignal.close();
+    _initialised = false;
+}
+
+bool SocketReactor::parkUntilReadable(Socket::Handle handle, int milliseconds, const Callback& callback, Log* log)
+{
+    if (!_initialised) {
+        return false;
+    }
+
+    uint64_t deadline = milliseconds < 0 ? UINT64_MAX : Clock::getMonotonicMilliseconds64() + (uint64_t)milliseconds;
+
+    Parked* parked = new Parked;
+    parked->handle = handle;
+    parked->callback = callback;
+
+    bool wake;
+    {
+        Mutex::ScopedLock lock(&_mutex);
+
+        if (_quit) {
+            delete parked;
+            return false;
+        }
+
+        parked->deadline = _deadlines.insert(DeadlineMap::value_type(deadline, parked));
+
+        // EventOneShot means the reactor thread will only ever see one event for this registration, so it can
+        // safely forget about the socket as soon as it's seen it.
+        if (!_poller.add(handle, SocketPoller::EventRead | SocketPoller::EventOneShot, parked, log)) {
+            _deadlines.erase(parked->deadline);
+            delete parked;
+            return false;
+        }
+
+        // If we're now the earliest deadline then the reactor thread may be sleeping for too long. If the poller
+        // can't see new sockets mid-wait then it always needs waking.
+        wake = (parked->deadline == _deadlines.begin() && milliseconds >= 0) || !SocketPoller::canChangeWhileWaiting();
+    }
+
+    // Once the mutex is released the callback may be invoked at any time, so we mustn't touch anything the
+    // caller owns from here on.
+
+    if (wake) {
+        _wakeSignal.signal(Log::getNullLog());
+    }
+
+    return true;
+}
+
+size_t SocketReactor::getParkedCount() const
+{
+    Mutex::ScopedLock lock(&_mutex);
+    return _deadlines.size();
+}
+
+void SocketReactor::unpark(Parked* parked)
+{
+    _poller.remove(parked->handle, Log::getNullLog());
+    _deadlines.erase(parked->deadline);
+}
+
+int SocketReactor::getWaitMilliseconds(uint64_t now) const
+{
+    if (_deadlines.empty()) {
+        return -1;
+    }
+
+    uint64_t deadline = _deadlines.begin()->first;
+    if (deadline == UINT64_MAX) {
+        return -1;
+    }
+
+    if (deadline <= now) {
+        return 0;
+    }
+
+    return (int)Min<uint64_t>(deadline - now, INT_MAX);
+}
+
+void SocketReactor::thread()
+{
+    typedef std::pair<Parked*, Socket::WaitResult> Ready;
+    std::vector<Ready> ready;
+
+    for (;;) {
+        int waitMilliseconds;
+        {
+            Mutex::ScopedLock lock(&_mutex);
+            if (_quit) {
+                break;
+            }
+
+            waitMilliseconds = getWaitMilliseconds(Clock::getMonotonicMilliseconds64());
+        }
+
+        int eventCount = _poller.wait(waitMilliseconds, _events, maxEventsPerWait, _log);
+        if (eventCount < 0) {
+            Clock::sleepMilliseconds(100);
+            continue;
+        }
+
+        {
+            Mutex::ScopedLock lock(&_mutex);
+
+            for (int i = 0; i != eventCount; ++i) {
+                Parked* parked = reinterpret_cast<Parked*>(_events[i].context);
+                if (!parked) {
+                    _wakeSignal.clear();
+                    continue;
+                }
+
+                unpark(parked);
+                ready.push_back(Ready(parked, Socket::WaitResultOK));
+            }
+
+            uint64_t now = Clock::getMonotonicMilliseconds64();
+            while (!_deadlines.empty() && _deadlines.begin()->first <= now) {
+                Parked* parked = _deadlines.begin()->second;
+                unpark(parked);
+                ready.push_back(Ready(parked, Socket::WaitResultTimedOut));
+            }
+        }
+
+        // Invoke the callbacks without the mutex locked so they're free to park their sockets again.
+        for (size_t i = 0; i != ready.size(); ++i) {
+            ready[i].first->callback(ready[i].second);
+            delete ready[i].first;
+        }
+
+        ready.clear();
+    }
+
+    // Hand back everything that's still parked.
+    {
+        Mutex::ScopedLock lock(&_mutex);
+
+        while (!_deadlines.empty()) {
+            Parked* parked = _deadlines.begin()->second;
+            unpark(parked);
+            ready.push_back(Ready(parked, Socket::WaitResultCancelled));
+        }
+    }
+
+    for (size_t i = 0; i != ready.size(); ++i) {
+        ready[i].first->callback(ready[i].second);
+        delete ready[i].first;
+    }
+}
+
+#else
+
+bool SocketReactor::init(Log* log)
+{
+    log->error(PRIME_LOCALISE("SocketReactor is not supported on this platform."));
+    return false;
+}
+
+void SocketReactor::close()
+{
+}
+
+bool SocketReactor::parkUntilReadable(Socket::Handle, int, const Callback&, Log*)
+{
+    return false;
+}
+
+size_t SocketReactor::getParkedCount() const
+{
+    return 0;
+}
+
+#endif
+}
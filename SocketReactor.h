@@ -0,0 +1,97 @@
+// Copyright 2000-2021 Mark H. P. Lord
+
+#ifndef PRIME_SOCKETREACTOR_H
+#define PRIME_SOCKETREACTOR_H
+
+#include "Mutex.h"
+#include "SignalSocket.h"
+#include "Socket.h"
+#include "SocketPoller.h"
+#include "Thread.h"
+#ifndef PRIME_CXX11_STL
+#include "Callback.h"
+#endif
+#include <functional>
+#include <map>
+
+#ifdef PRIME_HAVE_SOCKETPOLLER
+#define PRIME_HAVE_SOCKETREACTOR
+#endif
+
+namespace Prime {
+
+/// Parks idle sockets on a background thread until they become readable, time out or the reactor is closed,
+/// then invokes a callback. Allows a server to keep thousands of idle keep-alive connections open without
+/// tying up a thread for each one. Only available where PRIME_HAVE_SOCKETREACTOR is defined (init() will fail
+/// on other platforms).
+class PRIME_PUBLIC SocketReactor : public RefCounted {
+public:
+#ifdef PRIME_CXX11_STL
+    typedef std::function<void(Socket::WaitResult)> Callback;
+#else
+    typedef Callback1<void, Socket::WaitResult> Callback;
+#endif
+
+    // The callbacks are invoked on the reactor's thread, so leave them some room (e.g., for logging).
+    enum { threadSize = 64u * 1024u };
+
+    SocketReactor();
+
+    ~SocketReactor();
+
+    /// Start the reactor's thread. The Log is retained.
+    bool init(Log* log);
+
+    /// Stop the reactor's thread. Any sockets that are still parked have their callbacks invoked with
+    /// WaitResultCancelled before this returns.
+    void close();
+
+    bool isInitialised() const { return _initialised; }
+
+    /// Wait, on the reactor's thread, for a socket to become readable. The callback is invoked exactly once, on
+    /// the reactor's thread, with WaitResultOK when data (or end of stream) arrives, WaitResultTimedOut if
+    /// milliseconds elapse first (specify -1 to wait forever) or WaitResultCancelled if the reactor is closed.
+    /// The socket must not be closed or used by the caller until the callback has been invoked. Returns false
+    /// if the socket couldn't be parked, in which case the callback will not be invoked.
+    bool parkUntilReadable(Socket::Handle handle, int milliseconds, const Callback& callback, Log* log);
+
+    /// Returns the number of sockets currently parked.
+    size_t getParkedCount() const;
+
+private:
+    enum { maxEventsPerWait = 256 };
+
+    struct Parked;
+    typedef std::multimap<uint64_t, Parked*> DeadlineMap;
+
+    struct Parked {
+        Socket::Handle handle;
+        Callback callback;
+        DeadlineMap::iterator deadline;
+    };
+
+    void thread();
+
+    /// Must be called with _mutex locked. Removes the socket from the poller and forgets about it.
+    void unpark(Parked* parked);
+
+    /// Must be called with _mutex locked. Returns the number of milliseconds until the next deadline.
+    int getWaitMilliseconds(uint64_t now) const;
+
+    bool _initialised;
+    RefPtr<Log> _log;
+    Thread _thread;
+    mutable Mutex _mutex;
+    SignalSocket _wakeSignal;
+    SocketPoller _poller;
+    volatile bool _quit;
+    DeadlineMap _deadlines;
+
+    /// Only used by thread(), but kept off its stack.
+    SocketPoller::Event _events[maxEventsPerWait];
+
+    PRIME_UNCOPYABLE(SocketReactor);
+};
+}
+
+#endif
@@ -0,0 +1,578 @@
+// Copyright 2000-2021 Mark H. P. Lord
+
+#include "SocketRelay.h"
+#include "Clocks.h"
+#include "NumberUtils.h"
+#ifdef PRIME_SOCKETRELAY_SPLICE
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace Prime {
+
+namespace {
+
+    /// Stop pumping a busy tunnel after relaying this many buffers' worth of data, so it can't starve the others.
+    const size_t maxBuffersPerPump = 4;
+}
+
+//
+// SocketRelay::Half
+//
+
+SocketRelay::Half::Half()
+    : pending(0)
+    , sourceClosed(false)
+    , finished(false)
+    , offset(0)
+    , counter(NULL)
+{
+#ifdef PRIME_SOCKETRELAY_SPLICE
+    pipe[0] = pipe[1] = -1;
+#endif
+}
+
+//
+// SocketRelay::Endpoint
+//
+
+SocketRelay::Endpoint::Endpoint()
+    : tunnel(NULL)
+    , events(0)
+    , registered(false)
+    , hungUp(false)
+{
+}
+
+//
+// SocketRelay
+//
+
+SocketRelay::SocketRelay()
+    : _initialised(false)
+    , _useSplice(true)
+    , _bufferSize(65536)
+    , _quit(false)
+    , _nextID(1)
+{
+}
+
+SocketRelay::~SocketRelay()
+{
+    close();
+}
+
+#ifdef PRIME_HAVE_SOCKETRELAY
+
+bool SocketRelay::init(Log* log)
+{
+    PRIME_ASSERT(!_initialised);
+
+    _log = log;
+    _quit = false;
+
+    if (!_mutex.isInitialised() && !_mutex.init(log, "SocketRelay mutex")) {
+        return false;
+    }
+
+    if (!_wakeSignal.init(log)) {
+        return false;
+    }
+
+    if (!_poller.init(log)) {
+        return false;
+    }
+
+    // The wake signal is identified by a NULL context.
+    if (!_poller.add(_wakeSignal, NULL, log)) {
+        _poller.close();
+        return false;
+    }
+
+#ifdef PRIME_CXX11_STL
+    if (!_thread.create([this] { this->thread(); }, threadSize, log, "SocketRelay")) {
+        _poller.close();
+        return false;
+    }
+#else
+    if (!_thread.create(MethodCallback(this, &SocketRelay::thread), threadSize, log, "SocketRelay")) {
+        _poller.close();
+        return false;
+    }
+#endif
+
+    _initialised = true;
+    return true;
+}
+
+void SocketRelay::close()
+{
+    if (!_initialised) {
+        return;
+    }
+
+    {
+        Mutex::ScopedLock lock(&_mutex);
+        _quit = true;
+    }
+
+    _wakeSignal.signal(_log);
+    _thread.join();
+
+    _poller.close();
+    _wakeSignal.close();
+    _initialised = false;
+}
+
+uint64_t SocketRelay::add(Socket& client, Socket& target, const FinishedCallback& callback, Log* log,
+    const void* initialData, size_t initialDataSize)
+{
+    Tunnel* tunnel = new Tunnel;
+    tunnel->client.tunnel = tunnel;
+    tunnel->client.socket.takeOwnership(client);
+    tunnel->target.tunnel = tunnel;
+    tunnel->target.socket.takeOwnership(target);
+    tunnel->callback = callback;
+    tunnel->id = 0;
+    tunnel->closed = false;
+    tunnel->clientToTarget.counter = &tunnel->counters.clientToTarget;
+    tunnel->targetToClient.counter = &tunnel->counters.targetToClient;
+
+    if (initialDataSize) {
+        tunnel->clientToTarget.initial.assign((const char*)initialData, initialDataSize);
+    }
+
+    if (!_initialised || !tunnel->client.socket.setNonBlocking(true, log) || !tunnel->target.socket.setNonBlocking(true, log)) {
+        delete tunnel;
+        return 0;
+    }
+
+    bool wake;
+    uint64_t id;
+    {
+        Mutex::ScopedLock lock(&_mutex);
+
+        if (_quit || !initHalves(tunnel, log)) {
+            remove(tunnel);
+            delete tunnel;
+            return 0;
+        }
+
+        id = tunnel->id = _nextID++;
+
+        if (!updateEvents(tunnel)) {
+            remove(tunnel);
+            delete tunnel;
+            return 0;
+        }
+
+        _tunnels[id] = tunnel;
+
+        wake = !SocketPoller::canChangeWhileWaiting();
+    }
+
+    if (wake) {
+        _wakeSignal.signal(Log::getNullLog());
+    }
+
+    return id;
+}
+
+bool SocketRelay::initHalves(Tunnel* tunnel, Log* log)
+{
+    Half* halves[2] = { &tunnel->clientToTarget, &tunnel->targetToClient };
+
+    for (size_t i = 0; i != COUNTOF(halves); ++i) {
+        Half& half = *halves[i];
+
+#ifdef PRIME_SOCKETRELAY_SPLICE
+        if (_useSplice) {
+            if (pipe2(half.pipe, O_NONBLOCK | O_CLOEXEC) == 0) {
+                // Best effort: if the pipe can't be resized we just move less per splice().
+                fcntl(half.pipe[1], F_SETPIPE_SZ, (int)Min<size_t>(_bufferSize, INT_MAX));
+                continue;
+            }
+
+            // Fall back to copying this half of the tunnel.
+            half.pipe[0] = half.pipe[1] = -1;
+            log->trace("SocketRelay: unable to create pipe (errno %d), copying instead.", errno);
+        }
+#else
+        (void)log;
+#endif
+
+        half.buffer.resize(Max<size_t>(_bufferSize, 1));
+    }
+
+    return true;
+}
+
+void SocketRelay::closeHalf(Half& half)
+{
+#ifdef PRIME_SOCKETRELAY_SPLICE
+    for (size_t i = 0; i != 2; ++i) {
+        if (half.pipe[i] >= 0) {
+            ::close(half.pipe[i]);
+            half.pipe[i] = -1;
+        }
+    }
+#else
+    (void)half;
+#endif
+}
+
+void SocketRelay::remove(Tunnel* tunnel)
+{
+    Endpoint* endpoints[2] = { &tunnel->client, &tunnel->target };
+    for (size_t i = 0; i != COUNTOF(endpoints); ++i) {
+        if (endpoints[i]->registered) {
+            _poller.remove(endpoints[i]->socket.getHandle(), Log::getNullLog());
+            endpoints[i]->registered = false;
+        }
+
+        endpoints[i]->socket.close(Log::getNullLog());
+    }
+
+    _tunnels.erase(tunnel->id);
+    tunnel->closed = true;
+
+    closeHalf(tunnel->clientToTarget);
+    closeHalf(tunnel->targetToClient);
+}
+
+bool SocketRelay::pump(Tunnel* tunnel)
+{
+    if (!pump(tunnel->clientToTarget, tunnel->client.socket, tunnel->target.socket) || !pump(tunnel->targetToClient, tunnel->target.socket, tunnel->client.socket)) {
+        return false;
+    }
+
+    return !(tunnel->clientToTarget.finished && tunnel->targetToClient.finished);
+}
+
+bool SocketRelay::pump(Half& half, Socket& source, Socket& destination)
+{
+    if (half.finished) {
+        return true;
+    }
+
+    while (!half.initial.empty()) {
+        ptrdiff_t sent = destination.send(half.initial.data(), half.initial.size(), Log::getNullLog());
+        if (sent < 0) {
+            return destination.getLastError() == SocketSupport::ErrorWouldBlock;
+        }
+
+        if (sent == 0) {
+            return false;
+        }
+
+        half.initial.erase(0, (size_t)sent);
+        *half.counter += (uint64_t)sent;
+    }
+
+#ifdef PRIME_SOCKETRELAY_SPLICE
+    if (half.pipe[0] >= 0) {
+        return pumpSplice(half, source, destination);
+    }
+#endif
+
+    return pumpCopy(half, source, destination);
+}
+
+#ifdef PRIME_SOCKETRELAY_SPLICE
+
+bool SocketRelay::pumpSplice(Half& half, Socket& source, Socket& destination)
+{
+    const unsigned int flags = SPLICE_F_MOVE | SPLICE_F_NONBLOCK;
+
+    for (size_t budget = maxBuffersPerPump * _bufferSize;;) {
+        if (half.pending) {
+            ssize_t moved = splice(half.pipe[0], NULL, destination.getHandle(), NULL, half.pending, flags);
+            if (moved < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+
+                return errno == EAGAIN;
+            }
+
+            half.pending -= (size_t)moved;
+            *half.counter += (uint64_t)moved;
+            continue;
+        }
+
+        if (half.sourceClosed) {
+            half.finished = true;
+            destination.shutdownSend(Log::getNullLog());
+            return true;
+        }
+
+        if (budget == 0) {
+            return true;
+        }
+
+        ssize_t moved = splice(source.getHandle(), NULL, half.pipe[1], NULL, _bufferSize, flags);
+        if (moved < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            return errno == EAGAIN;
+        }
+
+        if (moved == 0) {
+            half.sourceClosed = true;
+        } else {
+            half.pending = (size_t)moved;
+            budget -= Min<size_t>(budget, (size_t)moved);
+        }
+    }
+}
+
+#else
+
+bool SocketRelay::pumpSplice(Half&, Socket&, Socket&)
+{
+    return false;
+}
+
+#endif
+
+bool SocketRelay::pumpCopy(Half& half, Socket& source, Socket& destination)
+{
+    for (size_t budget = maxBuffersPerPump * half.buffer.size();;) {
+        if (half.pending) {
+            ptrdiff_t sent = destination.send(&half.buffer[half.offset], half.pending, Log::getNullLog());
+            if (sent < 0) {
+                return destination.getLastError() == SocketSupport::ErrorWouldBlock;
+            }
+
+            if (sent == 0) {
+                return false;
+            }
+
+            half.offset += (size_t)sent;
+            half.pending -= (size_t)sent;
+            *half.counter += (uint64_t)sent;
+            continue;
+        }
+
+        if (half.sourceClosed) {
+            half.finished = true;
+            destination.shutdownSend(Log::getNullLog());
+            return true;
+        }
+
+        if (budget == 0) {
+            return true;
+        }
+
+        ptrdiff_t received = source.recv(&half.buffer[0], half.buffer.size(), Log::getNullLog());
+        if (received < 0) {
+            return source.getLastError() == SocketSupport::ErrorWouldBlock;
+        }
+
+        if (received == 0) {
+            half.sourceClosed = true;
+        } else {
+            half.offset = 0;
+            half.pending = (size_t)received;
+            budget -= Min<size_t>(budget, (size_t)received);
+        }
+    }
+}
+
+bool SocketRelay::updateEvents(Tunnel* tunnel)
+{
+    const Half& up = tunnel->clientToTarget;
+    const Half& down = tunnel->targetToClient;
+
+    // Only read from a source once everything previously read from it has been written, so a slow destination
+    // applies back pressure.
+    unsigned int clientEvents = 0;
+    if (!up.finished && !up.sourceClosed && !up.pending && up.initial.empty()) {
+        clientEvents |= SocketPoller::EventRead;
+    }
+    if (!down.finished && down.pending) {
+        clientEvents |= SocketPoller::EventWrite;
+    }
+
+    unsigned int targetEvents = 0;
+    if (!down.finished && !down.sourceClosed && !down.pending) {
+        targetEvents |= SocketPoller::EventRead;
+    }
+    if (!up.finished && (up.pending || !up.initial.empty())) {
+        targetEvents |= SocketPoller::EventWrite;
+    }
+
+    return updateEvents(tunnel->client, clientEvents) && updateEvents(tunnel->target, targetEvents);
+}
+
+bool SocketRelay::updateEvents(Endpoint& endpoint, unsigned int events)
+{
+    Socket::Handle handle = endpoint.socket.getHandle();
+
+    if (!endpoint.registered) {
+        if (endpoint.hungUp && events == 0) {
+            return true;
+        }
+
+        if (!_poller.add(handle, events, &endpoint, _log)) {
+            return false;
+        }
+
+        endpoint.registered = true;
+    } else if (endpoint.hungUp && events == 0) {
+        if (!_poller.remove(handle, _log)) {
+            return false;
+        }
+
+        endpoint.registered = false;
+    } else if (events != endpoint.events) {
+        if (!_poller.modify(handle, events, &endpoint, _log)) {
+            return false;
+        }
+    }
+
+    endpoint.events = events;
+    return true;
+}
+
+bool SocketRelay::getCounters(uint64_t id, Counters& counters) const
+{
+    Mutex::ScopedLock lock(&_mutex);
+
+    TunnelMap::const_iterator iter = _tunnels.find(id);
+    if (iter == _tunnels.end()) {
+        return false;
+    }
+
+    counters = iter->second->counters;
+    return true;
+}
+
+void SocketRelay::getAllCounters(std::vector<std::pair<uint64_t, Counters>>& counters) const
+{
+    Mutex::ScopedLock lock(&_mutex);
+
+    counters.clear();
+    counters.reserve(_tunnels.size());
+
+    for (TunnelMap::const_iterator iter = _tunnels.begin(); iter != _tunnels.end(); ++iter) {
+        counters.push_back(std::make_pair(iter->first, iter->second->counters));
+    }
+}
+
+size_t SocketRelay::getTunnelCount() const
+{
+    Mutex::ScopedLock lock(&_mutex);
+    return _tunnels.size();
+}
+
+void SocketRelay::thread()
+{
+    std::vector<Tunnel*> finished;
+
+    for (;;) {
+        {
+            Mutex::ScopedLock lock(&_mutex);
+            if (_quit) {
+                break;
+            }
+        }
+
+        int eventCount = _poller.wait(-1, _events, maxEventsPerWait, _log);
+        if (eventCount < 0) {
+            Clock::sleepMilliseconds(100);
+            continue;
+        }
+
+        {
+            Mutex::ScopedLock lock(&_mutex);
+
+            for (int i = 0; i != eventCount; ++i) {
+                Endpoint* endpoint = reinterpret_cast<Endpoint*>(_events[i].context);
+                if (!endpoint) {
+                    _wakeSignal.clear();
+                    continue;
+                }
+
+                // Both of a tunnel's sockets may have been reported, and the tunnel may already have finished.
+                Tunnel* tunnel = endpoint->tunnel;
+                if (tunnel->closed) {
+                    continue;
+                }
+
+                if (_events[i].events & SocketPoller::EventHangUp) {
+                    endpoint->hungUp = true;
+                }
+
+                if ((_events[i].events & SocketPoller::EventError) || !pump(tunnel) || !updateEvents(tunnel)) {
+                    remove(tunnel);
+                    finished.push_back(tunnel);
+                }
+            }
+        }
+
+        // Invoke the callbacks without the mutex locked so they're free to add tunnels.
+        for (size_t i = 0; i != finished.size(); ++i) {
+            finished[i]->callback(finished[i]->id, finished[i]->counters);
+            delete finished[i];
+        }
+
+        finished.clear();
+    }
+
+    // Close everything that's still running.
+    {
+        Mutex::ScopedLock lock(&_mutex);
+
+        while (!_tunnels.empty()) {
+            Tunnel* tunnel = _tunnels.begin()->second;
+            remove(tunnel);
+            finished.push_back(tunnel);
+        }
+    }
+
+    for (size_t i = 0; i != finished.size(); ++i) {
+        finished[i]->callback(finished[i]->id, finished[i]->counters);
+        delete finished[i];
+    }
+}
+
+#else
+
+bool SocketRelay::init(Log* log)
+{
+    log->error(PRIME_LOCALISE("SocketRelay is not supported on this platform."));
+    return false;
+}
+
+void SocketRelay::close()
+{
+}
+
+uint64_t SocketRelay::add(Socket& client, Socket& target, const FinishedCallback&, Log* log, const void*, size_t)
+{
+    client.close(log);
+    target.close(log);
+    return 0;
+}
+
+bool SocketRelay::getCounters(uint64_t, Counters&) const
+{
+    return false;
+}
+
+void SocketRelay::getAllCounters(std::vector<std::pair<uint64_t, Counters>>& counters) const
+{
+    counters.clear();
+}
+
+size_t SocketRelay::getTunnelCount() const
+{
+    return 0;
+}
+
+#endif
+}
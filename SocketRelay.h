@@ -0,0 +1,206 @@
+// Copyright 2000-2021 Mark H. P. Lord
+
+#ifndef PRIME_SOCKETRELAY_H
+#define PRIME_SOCKETRELAY_H
+
+#include "Mutex.h"
+#include "SignalSocket.h"
+#include "Socket.h"
+#include "SocketPoller.h"
+#include "Thread.h"
+#ifndef PRIME_CXX11_STL
+#include "Callback.h"
+#endif
+#include <functional>
+#include <map>
+#include <string>
+#include <vector>
+
+#ifdef PRIME_HAVE_SOCKETPOLLER
+#define PRIME_HAVE_SOCKETRELAY
+#endif
+
+#if defined(PRIME_OS_LINUX)
+#define PRIME_SOCKETRELAY_SPLICE
+#endif
+
+namespace Prime {
+
+/// Relays data in both directions between pairs of connected sockets (tunnels), e.g., between a SOCKS client
+/// and the target a SOCKSServerCommand connected it to, until both sides have finished sending or either fails.
+/// All the tunnels are relayed by a single thread waiting on a SocketPoller. On Linux the data is moved with
+/// splice() through a pipe, so it's never copied in to user space, otherwise it's copied through a buffer. Only
+/// available where PRIME_HAVE_SOCKETRELAY is defined (init() will fail on other platforms).
+class PRIME_PUBLIC SocketRelay : public RefCounted {
+public:
+    /// Bytes relayed by a tunnel.
+    struct Counters {
+        uint64_t clientToTarget;
+        uint64_t targetToClient;
+
+        Counters()
+            : clientToTarget(0)
+            , targetToClient(0)
+        {
+        }
+    };
+
+    /// Invoked, on the relay's thread, once a tunnel has finished and its sockets have been closed.
+#ifdef PRIME_CXX11_STL
+    typedef std::function<void(uint64_t, const Counters&)> FinishedCallback;
+#else
+    typedef Callback2<void, uint64_t, const Counters&> FinishedCallback;
+#endif
+
+    // We don't need much stack.
+    enum { threadSize = 16u * 1024u };
+
+    SocketRelay();
+
+    ~SocketRelay();
+
+    /// Start the relay's thread. The Log is retained.
+    bool init(Log* log);
+
+    /// Stop the relay's thread and close every tunnel, invoking their callbacks, before returning.
+    void close();
+
+    bool isInitialised() const { return _initialised; }
+
+    /// Set whether to use splice() where it's available (the default). Must be called before init().
+    void setUseSplice(bool value) { _useSplice = value; }
+
+    bool getUseSplice() const { return _useSplice; }
+
+    /// The size of each direction's pipe or buffer. Must be called before init().
+    void setBufferSize(size_t value) { _bufferSize = value; }
+
+    size_t getBufferSize() const { return _bufferSize; }
+
+    /// Start relaying between two connected sockets, taking ownership of them. initialData has already been read
+    /// from the client (e.g., it's still in the StreamBuffer the SOCKS command was read from) and is sent to the
+    /// target first. Returns an ID for the tunnel, which is also passed to the callback, or 0 if the tunnel
+    /// couldn't be started, in which case the sockets will have been closed and the callback won't be invoked.
+    uint64_t add(Socket& client, Socket& target, const FinishedCallback& callback, Log* log,
+        const void* initialData = NULL, size_t initialDataSize = 0);
+
+    /// Get the bytes relayed so far by a tunnel. Returns false if the tunnel has finished.
+    bool getCounters(uint64_t id, Counters& counters) const;
+
+    /// Get the bytes relayed so far by every tunnel that's still running.
+    void getAllCounters(std::vector<std::pair<uint64_t, Counters>>& counters) const;
+
+    /// Returns the number of tunnels currently being relayed.
+    size_t getTunnelCount() const;
+
+private:
+    enum { maxEventsPerWait = 256 };
+
+    /// One direction of a tunnel.
+    struct Half {
+        /// Bytes read from the source that haven't been written to the destination yet.
+        size_t pending;
+
+        /// Set once the source has reached end of stream.
+        bool sourceClosed;
+
+        /// Set once the destination has been shut down.
+        bool finished;
+
+        /// When copying, pending bytes start at offset in buffer.
+        std::vector<char> buffer;
+        size_t offset;
+
+        /// initialData, which is sent before anything else.
+        std::string initial;
+
+#ifdef PRIME_SOCKETRELAY_SPLICE
+        int pipe[2];
+#endif
+
+        uint64_t* counter;
+
+        Half();
+    };
+
+    struct Tunnel;
+
+    /// One of a tunnel's sockets. This is the context the socket is registered with the poller with.
+    struct Endpoint {
+        Tunnel* tunnel;
+        Socket socket;
+
+        /// The events we're waiting for.
+        unsigned int events;
+
+        /// Set while the socket is registered with the poller.
+        bool registered;
+
+        /// Set once the poller has reported that the remote end hung up. The poller keeps reporting that even
+        /// if we aren't waiting for any events, so from then on the socket is only registered while we are.
+        bool hungUp;
+
+        Endpoint();
+    };
+
+    struct Tunnel {
+        uint64_t id;
+        Endpoint client;
+        Endpoint target;
+        Half clientToTarget;
+        Half targetToClient;
+        Counters counters;
+        FinishedCallback callback;
+
+        /// Set once the sockets have been closed. The tunnel is deleted once the callback has been invoked.
+        bool closed;
+    };
+
+    typedef std::map<uint64_t, Tunnel*> TunnelMap;
+
+    void thread();
+
+    /// Must be called with _mutex locked. Create the pipes (or buffers) for both halves of the tunnel.
+    bool initHalves(Tunnel* tunnel, Log* log);
+
+    /// Must be called with _mutex locked. Move as much data as possible in both directions. Returns false once
+    /// the tunnel has finished.
+    bool pump(Tunnel* tunnel);
+
+    /// Move as much data as possible from source to destination. Returns false on error.
+    bool pump(Half& half, Socket& source, Socket& destination);
+
+    bool pumpSplice(Half& half, Socket& source, Socket& destination);
+
+    bool pumpCopy(Half& half, Socket& source, Socket& destination);
+
+    /// Must be called with _mutex locked. Wait for whatever events the tunnel now needs. Returns false on error.
+    bool updateEvents(Tunnel* tunnel);
+
+    bool updateEvents(Endpoint& endpoint, unsigned int events);
+
+    /// Must be called with _mutex locked. Stop waiting on the tunnel's sockets, close them and forget about it.
+    void remove(Tunnel* tunnel);
+
+    static void closeHalf(Half& half);
+
+    bool _initialised;
+    bool _useSplice;
+    size_t _bufferSize;
+    RefPtr<Log> _log;
+    Thread _thread;
+    mutable Mutex _mutex;
+    SignalSocket _wakeSignal;
+    SocketPoller _poller;
+    volatile bool _quit;
+    uint64_t _nextID;
+    TunnelMap _tunnels;
+
+    /// Kept here rather than on the thread's (small) stack.
+    SocketPoller::Event _events[maxEventsPerWait];
+
+    PRIME_UNCOPYABLE(SocketRelay);
+};
+}
+
+#endif
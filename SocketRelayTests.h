@@ -0,0 +1,216 @@
+// Copyright 2000-2021 Mark H. P. Lord
+
+#ifndef PRIME_SOCKETRELAYTESTS_H
+#define PRIME_SOCKETRELAYTESTS_H
+
+#include "Clocks.h"
+#include "NumberUtils.h"
+#include "SocketRelay.h"
+#if defined(PRIME_HAVE_SOCKETRELAY) && defined(PRIME_OS_UNIX)
+#include <sys/socket.h>
+#endif
+
+namespace Prime {
+
+#if defined(PRIME_HAVE_SOCKETRELAY) && defined(PRIME_OS_UNIX)
+
+namespace SocketRelayTestsPrivate {
+
+    class Finished : public RefCounted {
+    public:
+        Finished()
+            : _done(false)
+        {
+            PRIME_EXPECT(_mutex.init(Log::getGlobal()));
+        }
+
+        void finished(uint64_t, const SocketRelay::Counters& counters)
+        {
+            Mutex::ScopedLock lock(&_mutex);
+            _counters = counters;
+            _done = true;
+        }
+
+        bool wait(int milliseconds, SocketRelay::Counters& counters)
+        {
+            for (;;) {
+                {
+                    Mutex::ScopedLock lock(&_mutex);
+                    if (_done) {
+                        counters = _counters;
+                        return true;
+                    }
+                }
+
+                if (milliseconds <= 0) {
+                    return false;
+                }
+
+                Clock::sleepMilliseconds(10);
+                milliseconds -= 10;
+            }
+        }
+
+    private:
+        Mutex _mutex;
+        bool _done;
+        SocketRelay::Counters _counters;
+    };
+
+    inline bool SendAll(Socket& socket, StringView string, Log* log)
+    {
+        while (!string.empty()) {
+            ptrdiff_t sent = socket.send(string.data(), string.size(), log);
+            if (sent <= 0) {
+                return false;
+            }
+
+            string = string.substr((size_t)sent);
+        }
+
+        return true;
+    }
+
+    inline bool ReceiveExactly(Socket& socket, StringView expected, Log* log)
+    {
+        std::string received;
+        while (received.size() < expected.size()) {
+            char buffer[64];
+            ptrdiff_t got = socket.recv(buffer, Min(sizeof(buffer), expected.size() - received.size()), log);
+            if (got <= 0) {
+                return false;
+            }
+
+            received.append(buffer, (size_t)got);
+        }
+
+        return received == expected;
+    }
+
+    inline bool ReceiveEnd(Socket& socket, Log* log)
+    {
+        char byte;
+        return socket.recv(&byte, 1, log) == 0;
+    }
+
+    inline void CreatePair(Socket& a, Socket& b)
+    {
+        int fds[2];
+        PRIME_TEST(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+        Socket first(fds[0]);
+        Socket second(fds[1]);
+        a.takeOwnership(first);
+        b.takeOwnership(second);
+    }
+
+    inline uint64_t AddTunnel(SocketRelay* relay, Socket& clientApp, Socket& targetApp, Finished* finished,
+        Log* log)
+    {
+        Socket clientRelay;
+        Socket targetRelay;
+        CreatePair(clientApp, clientRelay);
+        CreatePair(targetRelay, targetApp);
+
+#ifdef PRIME_CXX11_STL
+        RefPtr<Finished> retained(finished);
+        SocketRelay::FinishedCallback callback = [retained](uint64_t id, const SocketRelay::Counters& counters) {
+            retained->finished(id, counters);
+        };
+#else
+        SocketRelay::FinishedCallback callback = MethodCallback(Ref(finished), &Finished::finished);
+#endif
+
+        return relay->add(clientRelay, targetRelay, callback, log, "init:", 5);
+    }
+
+    inline void SocketRelayHalfCloseTests(bool useSplice, Log* log)
+    {
+        RefPtr<SocketRelay> relay = PassRef(new SocketRelay);
+        relay->setUseSplice(useSplice);
+        PRIME_TEST(relay->init(log));
+
+        Socket clientApp;
+        Socket targetApp;
+        RefPtr<Finished> finished = PassRef(new Finished);
+        uint64_t id = AddTunnel(relay, clientApp, targetApp, finished, log);
+        PRIME_TEST(id != 0);
+        PRIME_TEST(relay->getTunnelCount() == 1);
+
+        // The initial data goes to the target first.
+        PRIME_TEST(SendAll(clientApp, "hello", log));
+        PRIME_TEST(ReceiveExactly(targetApp, "init:hello", log));
+        PRIME_TEST(SendAll(targetApp, "world!", log));
+        PRIME_TEST(ReceiveExactly(clientApp, "world!", log));
+
+        // The client's end of stream reaches the target while the other direction keeps working.
+        PRIME_TEST(clientApp.shutdownSend(log));
+        PRIME_TEST(ReceiveEnd(targetApp, log));
+        PRIME_TEST(SendAll(targetApp, "more", log));
+        PRIME_TEST(ReceiveExactly(clientApp, "more", log));
+
+        SocketRelay::Counters counters;
+        PRIME_TEST(!finished->wait(0, counters));
+
+        PRIME_TEST(targetApp.shutdownSend(log));
+        PRIME_TEST(ReceiveEnd(clientApp, log));
+
+        PRIME_TEST(finished->wait(5000, counters));
+        PRIME_TEST(counters.clientToTarget == 10);
+        PRIME_TEST(counters.targetToClient == 10);
+        PRIME_TEST(!relay->getCounters(id, counters));
+        PRIME_TEST(relay->getTunnelCount() == 0);
+
+        relay->close();
+    }
+
+    inline void SocketRelayHangUpTests(bool useSplice, Log* log)
+    {
+        RefPtr<SocketRelay> relay = PassRef(new SocketRelay);
+        relay->setUseSplice(useSplice);
+        PRIME_TEST(relay->init(log));
+
+        Socket clientApp;
+        Socket targetApp;
+        RefPtr<Finished> finished = PassRef(new Finished);
+        PRIME_TEST(AddTunnel(relay, clientApp, targetApp, finished, log) != 0);
+
+        // Finish the client's half, then have the client go away entirely. The relay has nothing to read from or
+        // write to the client, so it must stop waiting on it rather than be woken by the hang up forever.
+        PRIME_TEST(clientApp.shutdownSend(log));
+        PRIME_TEST(ReceiveExactly(targetApp, "init:", log));
+        PRIME_TEST(ReceiveEnd(targetApp, log));
+        clientApp.close(log);
+
+        Clock::sleepMilliseconds(50);
+
+        SocketRelay::Counters counters;
+        PRIME_TEST(!finished->wait(0, counters));
+        PRIME_TEST(relay->getTunnelCount() == 1);
+
+        PRIME_TEST(targetApp.shutdownSend(log));
+        PRIME_TEST(finished->wait(5000, counters));
+        PRIME_TEST(counters.clientToTarget == 5);
+        PRIME_TEST(counters.targetToClient == 0);
+
+        relay->close();
+    }
+}
+
+inline void SocketRelayTests(Log* log)
+{
+    SocketRelayTestsPrivate::SocketRelayHalfCloseTests(true, log);
+    SocketRelayTestsPrivate::SocketRelayHalfCloseTests(false, log);
+    SocketRelayTestsPrivate::SocketRelayHangUpTests(true, log);
+    SocketRelayTestsPrivate::SocketRelayHangUpTests(false, log);
+}
+
+#else
+
+inline void SocketRelayTests(Log*)
+{
+}
+
+#endif
+}
+
+#endif
@@ -2,6 +2,7 @@
 
 #include "SocketStream.h"
 #include "FileStream.h"
+#include "NumberUtils.h"
 #include "Substream.h"
 #include <string.h>
 #ifdef PRIME_OS_WINDOWS
@@ -40,6 +41,28 @@ ptrdiff_t SocketStream::writeSome(const void* memory, size_t maximumBytes, Log*
     return _socket.send(memory, maximumBytes, log);
 }
 
+ptrdiff_t SocketStream::readVectored(const IOVector* vectors, size_t vectorCount, Log* log)
+{
+    PRIME_ASSERT(isCreated());
+
+    if (!waitReadTimeout(log)) {
+        return -1;
+    }
+
+    return _socket.recvVectored(vectors, vectorCount, log);
+}
+
+ptrdiff_t SocketStream::writeVectored(const ConstIOVector* vectors, size_t vectorCount, Log* log)
+{
+    PRIME_ASSERT(isCreated());
+
+    if (!waitWriteTimeout(log)) {
+        return -1;
+    }
+
+    return _socket.sendVectored(vectors, vectorCount, log);
+}
+
 bool SocketStream::copyFrom(Stream* source, Log* sourceLog, Offset length, Log* destLog, size_t bufferSize,
     void* buffer)
 {
@@ -63,29 +86,61 @@ bool SocketStream::copyFrom(Stream* source, Log* sourceLog, Offset length, Log*
         length = size - offset;
     }
 
-    // Get down to the actual file handle. This lets us send deflate()d content directly from a zip file.
+    // Get down to the actual file handle. This lets us send deflate()d content directly from a zip file. The
+    // underlying stream's offset doesn't track a positional Substream's, so the fallbacks below must copy from
+    // the original source.
+    Stream* fileSource = source;
+    Stream::Offset fileOffset = offset;
+#if defined(PRIME_OS_WINDOWS) && PRIME_WINVER >= PRIME_WINDOWS_VISTA
+    bool sharedFileSource = false;
+#endif
     for (;;) {
-        Substream* substream = UIDCast<Substream>(source);
+        Substream* substream = UIDCast<Substream>(fileSource);
         if (!substream) {
             break;
         }
 
-        source = substream->getUnderlyingStream();
-        offset += substream->getBaseOffset();
+#if defined(PRIME_OS_WINDOWS) && PRIME_WINVER >= PRIME_WINDOWS_VISTA
+        if (substream->isPositional()) {
+            sharedFileSource = true;
+        }
+#endif
+
+        fileSource = substream->getUnderlyingStream();
+        fileOffset += substream->getBaseOffset();
     }
 
 #if defined(PRIME_OS_LINUX)
 
-    UnixFileStream* unixStream = UIDCast<UnixFileStream>(source);
-
-    if (unixStream && (Offset)(size_t)length == length) {
-        size_t len = (size_t)length;
-        off_t ofs = Narrow<off_t>(offset);
-        // sourceLog->trace("Using sendfile...");
-        ssize_t result = sendfile(_socket.getHandle(), unixStream->getHandle(), &ofs, len);
-        if (result != len) {
-            destLog->logErrno(errno);
-            return false;
+    if (UnixFileStream* unixStream = UIDCast<UnixFileStream>(fileSource)) {
+        // Send in chunks, waiting for the socket to become writable before each one, so the write timeout is
+        // honoured and a slow client can't block us in sendfile() indefinitely.
+        const Offset chunkSize = Max<Offset>((Offset)bufferSize, sendfileChunkSize);
+        off_t ofs = Narrow<off_t>(fileOffset);
+
+        while (length > 0) {
+            if (!waitWriteTimeout(destLog)) {
+                return false;
+            }
+
+            size_t len = (size_t)Min<Offset>(length, chunkSize);
+            // sourceLog->trace("Using sendfile...");
+            ssize_t result = sendfile(_socket.getHandle(), unixStream->getHandle(), &ofs, len);
+            if (result < 0) {
+                if (errno == EINTR || errno == EAGAIN) {
+                    continue;
+                }
+
+                destLog->logErrno(errno);
+                return false;
+            }
+
+            if (result == 0) {
+                sourceLog->error(PRIME_LOCALISE("Unexpected end of file."));
+                return false;
+            }
+
+            length -= result;
         }
 
         return true;
@@ -93,10 +148,10 @@ bool SocketStream::copyFrom(Stream* source, Log* sourceLog, Offset length, Log*
 
 #elif defined(PRIME_OS_BSD)
 
-    if (UnixFileStream* unixStream = UIDCast<UnixFileStream>(source)) {
+    if (UnixFileStream* unixStream = UIDCast<UnixFileStream>(fileSource)) {
         off_t len = length;
         // sourceLog->trace("Using sendfile...");
-        int result = sendfile(unixStream->getHandle(), _socket.getHandle(), offset, &len, NULL, 0);
+        int result = sendfile(unixStream->getHandle(), _socket.getHandle(), fileOffset, &len, NULL, 0);
         if (result != 0 || len != length) {
             destLog->logErrno(errno);
             return false;
@@ -107,11 +162,20 @@ bool SocketStream::copyFrom(Stream* source, Log* sourceLog, Offset length, Log*
 
 #elif defined(PRIME_OS_WINDOWS) && PRIME_WINVER >= PRIME_WINDOWS_VISTA
 
-    if (WindowsFileStream* windowsStream = UIDCast<WindowsFileStream>(source)) {
+    // TransmitFile() sends from the file's current position, which we can't move if other threads are reading
+    // the file through positional Substreams.
+    WindowsFileStream* windowsStream = sharedFileSource ? NULL : UIDCast<WindowsFileStream>(fileSource);
+    if (windowsStream) {
+        if (!windowsStream->setOffset(fileOffset, sourceLog)) {
+            return false;
+        }
+
         if (!TransmitFile(_socket.getHandle(), windowsStream->getHandle(), Narrow<DWORD>(length), 0, NULL, NULL, 0)) {
             destLog->logWindowsError(WSAGetLastError());
             return false;
         }
+
+        return true;
     }
 
 #endif
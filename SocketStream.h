@@ -67,6 +67,7 @@ public:
     virtual int getWriteTimeout() const PRIME_OVERRIDE { return _writeTimeout; }
     virtual WaitResult waitRead(int milliseconds, Log* log) PRIME_OVERRIDE;
     virtual WaitResult waitWrite(int milliseconds, Log* log) PRIME_OVERRIDE;
+    virtual SocketStream* getSocketStream() const PRIME_OVERRIDE { return const_cast<SocketStream*>(this); }
 
     void setBothTimeouts(int milliseconds)
     {
@@ -78,10 +79,15 @@ public:
     virtual bool close(Log* log) PRIME_OVERRIDE;
     virtual ptrdiff_t readSome(void* buffer, size_t maximumBytes, Log* log) PRIME_OVERRIDE;
     virtual ptrdiff_t writeSome(const void* memory, size_t maximumBytes, Log* log) PRIME_OVERRIDE;
+    virtual ptrdiff_t readVectored(const IOVector* vectors, size_t vectorCount, Log* log) PRIME_OVERRIDE;
+    virtual ptrdiff_t writeVectored(const ConstIOVector* vectors, size_t vectorCount, Log* log) PRIME_OVERRIDE;
     virtual bool copyFrom(Stream* source, Log* sourceLog, Offset length, Log* destLog, size_t bufferSize = 0,
         void* buffer = NULL) PRIME_OVERRIDE;
 
 private:
+    /// The most copyFrom() will ask sendfile() to send at once.
+    enum { sendfileChunkSize = 1024 * 1024 };
+
     static NetworkStream::WaitResult mapWaitResult(Socket::WaitResult socketWaitResult)
     {
         return (NetworkStream::WaitResult)(socketWaitResult);
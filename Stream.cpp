@@ -26,6 +26,41 @@ ptrdiff_t Stream::writeSome(const void*, size_t, Log* log)
     return -1;
 }
 
+ptrdiff_t Stream::readVectored(const IOVector* vectors, size_t vectorCount, Log* log)
+{
+    for (size_t i = 0; i != vectorCount; ++i) {
+        if (vectors[i].size) {
+            return readSome(vectors[i].bytes, vectors[i].size, log);
+        }
+    }
+
+    return 0;
+}
+
+ptrdiff_t Stream::writeVectored(const ConstIOVector* vectors, size_t vectorCount, Log* log)
+{
+    ptrdiff_t totalWritten = 0;
+
+    for (size_t i = 0; i != vectorCount; ++i) {
+        if (!vectors[i].size) {
+            continue;
+        }
+
+        ptrdiff_t wrote = writeSome(vectors[i].bytes, vectors[i].size, log);
+        if (wrote < 0) {
+            return wrote;
+        }
+
+        totalWritten += wrote;
+
+        if ((size_t)wrote != vectors[i].size) {
+            break;
+        }
+    }
+
+    return totalWritten;
+}
+
 Stream::Offset Stream::seek(Offset, SeekMode, Log* log)
 {
     log->error(PRIME_LOCALISE("Stream not seekable."));
@@ -96,6 +131,11 @@ ptrdiff_t Stream::writeAtOffset(Offset offset, const void* bytes, size_t byteCou
     return wrote;
 }
 
+bool Stream::hasConcurrentPositionalIO() const
+{
+    return false;
+}
+
 Stream* Stream::getUnderlyingStream() const
 {
     return NULL;
@@ -279,6 +319,80 @@ bool Stream::writeExact(Offset offset, const void* bytes, size_t byteCount, Log*
     return writeExact(bytes, byteCount, log, errorMessage);
 }
 
+bool Stream::writeVectoredExact(const ConstIOVector* vectors, size_t vectorCount, Log* log,
+    const char* errorMessage)
+{
+    size_t totalSize = getTotalSize(vectors, vectorCount);
+    size_t totalWritten = 0;
+
+    while (vectorCount) {
+        if (!vectors->size) {
+            ++vectors;
+            --vectorCount;
+            continue;
+        }
+
+        ptrdiff_t wrote = writeVectored(vectors, vectorCount, log);
+
+        // If there was a write error, writeVectored() will have logged it.
+        if (wrote < 0) {
+            return false;
+        }
+
+        if (wrote == 0) {
+            if (!errorMessage) {
+                errorMessage = "Unable to write";
+            }
+
+            log->error(PRIME_LOCALISE("%s (%" PRIuPTR "/%" PRIuPTR " bytes)."), errorMessage, totalWritten, totalSize);
+            return false;
+        }
+
+        totalWritten += (size_t)wrote;
+
+        size_t remaining = (size_t)wrote;
+        while (vectorCount && remaining >= vectors->size) {
+            remaining -= vectors->size;
+            ++vectors;
+            --vectorCount;
+        }
+
+        if (remaining) {
+            // A buffer was only partly written, so write the rest of it on its own.
+            size_t rest = vectors->size - remaining;
+            if (!writeExact((const char*)vectors->bytes + remaining, rest, log, errorMessage)) {
+                return false;
+            }
+
+            totalWritten += rest;
+            ++vectors;
+            --vectorCount;
+        }
+    }
+
+    return true;
+}
+
+size_t Stream::getTotalSize(const IOVector* vectors, size_t vectorCount)
+{
+    size_t total = 0;
+    for (size_t i = 0; i != vectorCount; ++i) {
+        total += vectors[i].size;
+    }
+
+    return total;
+}
+
+size_t Stream::getTotalSize(const ConstIOVector* vectors, size_t vectorCount)
+{
+    size_t total = 0;
+    for (size_t i = 0; i != vectorCount; ++i) {
+        total += vectors[i].size;
+    }
+
+    return total;
+}
+
 bool Stream::setOffset(Stream::Offset offset, Log* log)
 {
     return seek(offset, SeekModeAbsolute, log) == offset;
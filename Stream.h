@@ -19,6 +19,22 @@ public:
 
 #define PRIME_PRId_STREAM PRId64
 
+    /// A buffer to be filled by readVectored().
+    struct IOVector {
+        void* bytes;
+        size_t size;
+    };
+
+    /// A buffer to be written by writeVectored().
+    struct ConstIOVector {
+        const void* bytes;
+        size_t size;
+    };
+
+    /// The most buffers native readVectored()/writeVectored() implementations pass to the OS at once (any
+    /// further buffers are left for the next call).
+    enum { maxIOVectors = 64 };
+
     Stream()
     {
     }
@@ -39,6 +55,16 @@ public:
     /// backing store is full (or the connection has been closed), -1 on error. Errors are logged.
     virtual ptrdiff_t writeSome(const void* bytes, size_t maxBytes, Log* log);
 
+    /// Read at least one byte from the stream in to a sequence of buffers, filling each buffer before moving
+    /// on to the next. Returns the total number of bytes read, 0 at the end of the file, -1 on error. The default
+    /// implementation calls readSome() for the first non-empty buffer, since a second readSome() could block.
+    virtual ptrdiff_t readVectored(const IOVector* vectors, size_t vectorCount, Log* log);
+
+    /// Write at least one byte from a sequence of buffers, in order, ideally with a single system call. Returns
+    /// the total number of bytes written, 0 if the backing store is full (or the connection has been closed),
+    /// -1 on error. The default implementation calls writeSome() for each buffer until one is written short.
+    virtual ptrdiff_t writeVectored(const ConstIOVector* vectors, size_t vectorCount, Log* log);
+
     /// Read a specific number of bytes at a specified offset. Returns < requiredBytes only if the end of the
     /// file is reached. Returns < 0 on error.
     virtual ptrdiff_t readAtOffset(Offset offset, void* buffer, size_t requiredBytes, Log* log);
@@ -47,6 +73,11 @@ public:
     /// Returns < 0 on error.
     virtual ptrdiff_t writeAtOffset(Offset offset, const void* bytes, size_t byteCount, Log* log);
 
+    /// Returns true if readAtOffset() and writeAtOffset() neither use nor move the stream's offset (e.g., they
+    /// use pread()/pwrite()), so they can be called by any number of threads at once, alongside each other and
+    /// alongside seek() and readSome(). The default implementations seek, so this returns false by default.
+    virtual bool hasConcurrentPositionalIO() const;
+
     enum SeekMode {
         SeekModeAbsolute,
         SeekModeRelative,
@@ -116,6 +147,16 @@ public:
     /// store is filled, logs an error and returns false.
     bool writeExact(Offset offset, const void* bytes, size_t byteCount, Log* log, const char* errorMessage = NULL);
 
+    /// Write every byte of a sequence of buffers, calling writeVectored() until they've all been written. If an
+    /// error occurrs or the backing store is filled, logs an error and returns false.
+    bool writeVectoredExact(const ConstIOVector* vectors, size_t vectorCount, Log* log,
+        const char* errorMessage = NULL);
+
+    /// Returns the total size of a sequence of buffers.
+    static size_t getTotalSize(const IOVector* vectors, size_t vectorCount);
+
+    static size_t getTotalSize(const ConstIOVector* vectors, size_t vectorCount);
+
     /// Seek to an exact position and return true on success, false on error.
     bool setOffset(Stream::Offset offset, Log* log);
 
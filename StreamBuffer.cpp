@@ -2,6 +2,8 @@
 
 #include "StreamBuffer.h"
 #include "NumberUtils.h"
+#include "ReadAheadStream.h"
+#include <algorithm>
 #include <string.h>
 
 namespace Prime {
@@ -17,6 +19,8 @@ void StreamBuffer::zero()
 {
     _underlyingOffset = 0;
     _buffer = NULL;
+    _pooledBuffer = NULL;
+    _pooledBufferSize = 0;
 
     _top = NULL;
     _ptr = NULL;
@@ -45,6 +49,22 @@ StreamBuffer::StreamBuffer(const void* bytes, size_t byteCount)
 StreamBuffer::~StreamBuffer()
 {
     unbuffer(false, Log::getGlobal());
+    releaseBuffer();
+}
+
+void StreamBuffer::releaseBuffer()
+{
+    _allocatedBuffer.reset();
+
+    if (_pooledBuffer) {
+        _bufferPool->deallocate(_pooledBuffer, _pooledBufferSize);
+        _pooledBuffer = NULL;
+        _pooledBufferSize = 0;
+    }
+
+    _buffer = _top = _ptr = _end = NULL;
+    _dirtyBegin = _end;
+    _dirtyEnd = _buffer;
 }
 
 bool StreamBuffer::init(Stream* underlyingStream, size_t bufferSize, void* buffer)
@@ -72,12 +92,21 @@ bool StreamBuffer::init(Stream* underlyingStream, size_t bufferSize, void* buffe
 
     PRIME_ASSERT(bufferSize != 0);
 
-    if (!buffer) {
+    if (buffer) {
+        releaseBuffer();
+        _buffer = (char*)buffer;
+    } else if (_bufferPool) {
+        if (!_pooledBuffer || _pooledBufferSize != bufferSize) {
+            releaseBuffer();
+            _pooledBuffer = (char*)_bufferPool->allocate(bufferSize);
+            _pooledBufferSize = bufferSize;
+        }
+
+        _buffer = _pooledBuffer;
+    } else {
+        releaseBuffer();
         _allocatedBuffer.reset(new char[bufferSize]);
         _buffer = _allocatedBuffer.get();
-    } else {
-        _allocatedBuffer.reset();
-        _buffer = (char*)buffer;
     }
 
     _top = _ptr = _buffer;
@@ -90,11 +119,33 @@ bool StreamBuffer::init(Stream* underlyingStream, size_t bufferSize, void* buffe
     return true;
 }
 
+bool StreamBuffer::enableReadAhead(Log* log, TaskQueue* taskQueue)
+{
+    PRIME_ASSERT(isEmpty() && !isDirty());
+
+    if (!PRIME_GUARD(_underlyingStream)) {
+        return false;
+    }
+
+    if (UIDCast<ReadAheadStream>(_underlyingStream.get())) {
+        return true;
+    }
+
+    // The ReadAheadStream starts at the underlying Stream's offset, so _underlyingOffset remains correct.
+    RefPtr<ReadAheadStream> readAhead = PassRef(new ReadAheadStream);
+    if (!readAhead->init(_underlyingStream, getBufferSize(), log, taskQueue)) {
+        return false;
+    }
+
+    _underlyingStream = readAhead;
+    return true;
+}
+
 void StreamBuffer::init(const void* bytes, size_t byteCount)
 {
     PRIME_ASSERT(isEmpty());
 
-    _allocatedBuffer.reset();
+    releaseBuffer();
     _underlyingStream.release();
     _underlyingOffset = _bufferOffset = 0;
     _seekable = false;
@@ -111,6 +162,11 @@ bool StreamBuffer::close(Log* log)
 {
     bool success = unbuffer(false, log);
 
+    // Return pooled buffers as soon as possible. Other buffers are kept for backwards compatibility.
+    if (_pooledBuffer) {
+        releaseBuffer();
+    }
+
     if (_underlyingStream && !_underlyingStream->close(log)) {
         success = false;
         _error = true;
@@ -195,6 +251,14 @@ ptrdiff_t StreamBuffer::writeSome(const void* bytes, size_t maxBytes, Log* log)
 {
     PRIME_ASSERT(!isReadOnly());
 
+    // Writes that wouldn't fit in an empty buffer go straight out, along with any buffered writes.
+    if (maxBytes >= getBufferSize() && maxBytes > getSpace() && canWriteThrough(1)) {
+        ConstIOVector vector;
+        vector.bytes = bytes;
+        vector.size = maxBytes;
+        return writeThrough(&vector, 1, maxBytes, log);
+    }
+
     for (;;) {
         size_t space = getSpace();
 
@@ -219,6 +283,111 @@ ptrdiff_t StreamBuffer::writeSome(const void* bytes, size_t maxBytes, Log* log)
     }
 }
 
+ptrdiff_t StreamBuffer::readVectored(const IOVector* vectors, size_t vectorCount, Log* log)
+{
+    if (isEmpty() && _underlyingStream && !isDirty() && !_maxPutBack
+        && getTotalSize(vectors, vectorCount) >= getBufferSize()) {
+        // There's nothing worth keeping in the buffer, so read straight in to the caller's buffers.
+        Offset readOffset = _bufferOffset + (_ptr - _buffer);
+        if (readOffset != _underlyingOffset) {
+            PRIME_ASSERTMSG(_seekable, "StreamBuffer had to seek");
+
+            if (!_underlyingStream->setOffset(readOffset, log)) {
+                _error = true;
+                return -1;
+            }
+
+            _underlyingOffset = readOffset;
+        }
+
+        ptrdiff_t got = _underlyingStream->readVectored(vectors, vectorCount, log);
+        if (got < 0) {
+            _error = true;
+            return -1;
+        }
+
+        _underlyingOffset += got;
+        _bufferOffset = _underlyingOffset;
+        _ptr = _top = _buffer;
+        return got;
+    }
+
+    if (isEmpty()) {
+        ptrdiff_t got = fetchMore(log);
+        if (got <= 0) {
+            return got;
+        }
+    }
+
+    size_t totalGot = 0;
+    for (size_t i = 0; i != vectorCount && _ptr != _top; ++i) {
+        size_t take = Min((size_t)(_top - _ptr), vectors[i].size);
+
+        memcpy(vectors[i].bytes, _ptr, take);
+
+        _ptr += take;
+        totalGot += take;
+    }
+
+    return (ptrdiff_t)totalGot;
+}
+
+ptrdiff_t StreamBuffer::writeVectored(const ConstIOVector* vectors, size_t vectorCount, Log* log)
+{
+    PRIME_ASSERT(!isReadOnly());
+
+    size_t totalSize = getTotalSize(vectors, vectorCount);
+    if (totalSize > getSpace() && canWriteThrough(vectorCount)) {
+        return writeThrough(vectors, vectorCount, totalSize, log);
+    }
+
+    return Stream::writeVectored(vectors, vectorCount, log);
+}
+
+bool StreamBuffer::canWriteThrough(size_t vectorCount) const
+{
+    // Nothing after the write pointer can be buffered, any buffered writes must end at the write pointer, and
+    // one vector is needed for the buffered writes.
+    return _underlyingStream && _ptr == _top && (!isDirty() || _dirtyEnd == _ptr)
+        && vectorCount < (size_t)maxIOVectors;
+}
+
+ptrdiff_t StreamBuffer::writeThrough(const ConstIOVector* vectors, size_t vectorCount, size_t totalSize, Log* log)
+{
+    const char* writeBegin = isDirty() ? _dirtyBegin : _ptr;
+    size_t dirtySize = (size_t)(_ptr - writeBegin);
+
+    Offset writeOffset = _bufferOffset + (writeBegin - _buffer);
+    if (_underlyingOffset != writeOffset) {
+        PRIME_ASSERTMSG(_seekable, "StreamBuffer had to seek");
+
+        if (!_underlyingStream->setOffset(writeOffset, log)) {
+            _error = true;
+            return -1;
+        }
+
+        _underlyingOffset = writeOffset;
+    }
+
+    ConstIOVector gathered[maxIOVectors];
+    gathered[0].bytes = writeBegin;
+    gathered[0].size = dirtySize;
+    std::copy(vectors, vectors + vectorCount, gathered + 1);
+
+    if (!_underlyingStream->writeVectoredExact(gathered, vectorCount + 1, log)) {
+        _error = true;
+        return -1;
+    }
+
+    _underlyingOffset += dirtySize + totalSize;
+    _bufferOffset = _underlyingOffset;
+    _ptr = _top = _buffer;
+    _dirtyBegin = _end;
+    _dirtyEnd = _buffer;
+
+    return (ptrdiff_t)totalSize;
+}
+
 bool StreamBuffer::shift(Log* log)
 {
     if (!flushWrites(log)) {
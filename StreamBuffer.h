@@ -3,12 +3,15 @@
 #ifndef PRIME_STREAMBUFFER_H
 #define PRIME_STREAMBUFFER_H
 
+#include "BufferPool.h"
 #include "ScopedPtr.h"
 #include "Stream.h"
 #include "StringView.h"
 
 namespace Prime {
 
+class TaskQueue;
+
 /// A read/write buffer for a Stream. Only seeks the underlying Stream if you alternate reads/writes or explicitly
 /// seek().
 class PRIME_PUBLIC StreamBuffer : public Stream {
@@ -44,6 +47,14 @@ public:
     virtual bool close(Log* log) PRIME_OVERRIDE;
     virtual ptrdiff_t readSome(void* buffer, size_t maxBytes, Log* log) PRIME_OVERRIDE;
     virtual ptrdiff_t writeSome(const void* bytes, size_t maxBytes, Log* log) PRIME_OVERRIDE;
+
+    /// Copies from the buffer if it has anything in it. Otherwise, reads of at least the buffer size go
+    /// directly in to the caller's buffers.
+    virtual ptrdiff_t readVectored(const IOVector* vectors, size_t vectorCount, Log* log) PRIME_OVERRIDE;
+
+    /// Copies in to the buffer if there's room. Otherwise, the buffered writes and the caller's buffers are
+    /// written to the underlying stream with a single writeVectored().
+    virtual ptrdiff_t writeVectored(const ConstIOVector* vectors, size_t vectorCount, Log* log) PRIME_OVERRIDE;
     virtual Offset seek(Offset offset, SeekMode mode, Log* log) PRIME_OVERRIDE;
     virtual Offset getSize(Log* log) PRIME_OVERRIDE;
     virtual bool setSize(Offset newSize, Log* log) PRIME_OVERRIDE;
@@ -71,6 +82,11 @@ public:
 
     Offset getUnderlyingStreamOffset() const { return _underlyingOffset; }
 
+    /// Returns the offset we're emulating (i.e., what getOffset() would return) without touching the underlying
+    /// stream, so it works even if the underlying stream isn't seekable. The difference between two calls is the
+    /// number of bytes read or written in between.
+    Offset getEmulatedOffset() const PRIME_NOEXCEPT { return _bufferOffset + (_ptr - _buffer); }
+
     //
     // Configuration
     //
@@ -82,6 +98,23 @@ public:
     /// Returns the maximum number of bytes that can be put back.
     size_t getMaxPutBack() const PRIME_NOEXCEPT { return _maxPutBack; }
 
+    /// Have init() borrow its buffer from a BufferPool (e.g., BufferPool::getGlobal()) rather than allocating
+    /// one, and return it when the StreamBuffer is closed, re-initialised or destructed. Must be called before
+    /// init().
+    void setBufferPool(BufferPool* bufferPool)
+    {
+        PRIME_ASSERT(!_pooledBuffer);
+        _bufferPool = bufferPool;
+    }
+
+    BufferPool* getBufferPool() const PRIME_NOEXCEPT { return _bufferPool; }
+
+    /// Read the next buffer's worth from the underlying Stream on a thread (or on the TaskQueue, if one is
+    /// supplied) while the current buffer is being consumed, so parsing overlaps with I/O. Must be called after
+    /// init() while the buffer is empty. The underlying Stream is wrapped in a ReadAheadStream, which
+    /// getUnderlyingStream() will then return.
+    bool enableReadAhead(Log* log, TaskQueue* taskQueue = NULL);
+
     //
     // Buffer state
     //
@@ -365,6 +398,13 @@ private:
 
     bool shift(Log* log);
 
+    /// Returns true if writeThrough() can be used.
+    bool canWriteThrough(size_t vectorCount) const;
+
+    /// Write the buffered writes followed by the vectors with a single writeVectored() on the underlying
+    /// stream, leaving the buffer empty.
+    ptrdiff_t writeThrough(const ConstIOVector* vectors, size_t vectorCount, size_t totalSize, Log* log);
+
     bool writeByteBufferFull(int c, Log* log);
 
     void* makeSpaceBufferFull(size_t space, Log* log);
@@ -381,9 +421,15 @@ private:
 
     void zero();
 
+    /// Free (or return to the pool) any buffer we allocated, leaving the buffer empty.
+    void releaseBuffer();
+
     RefPtr<Stream> _underlyingStream;
     Offset _underlyingOffset;
     ScopedArrayPtr<char> _allocatedBuffer;
+    RefPtr<BufferPool> _bufferPool;
+    char* _pooledBuffer;
+    size_t _pooledBufferSize;
     char* _buffer;
 
     char* _top;
@@ -4,9 +4,123 @@
 #define PRIME_STREAMBUFFERTESTS_H
 
 #include "StreamBuffer.h"
+#include "StringStream.h"
+#include <string.h>
 
 namespace Prime {
 
+namespace StreamBufferTestsPrivate {
+
+    inline void StreamBufferVectoredTests(Log* log)
+    {
+        RefPtr<StringStream> stringStream = PassRef(new StringStream);
+        StreamBuffer sb(stringStream, 16);
+
+        // Small writes are buffered...
+        Stream::ConstIOVector small[] = { { "ab", 2 }, { "cd", 2 } };
+        PRIME_TEST(sb.writeVectoredExact(small, COUNTOF(small), log));
+        PRIME_TEST(stringStream->getString().empty());
+
+        // ...larger writes go straight through, after whatever's buffered.
+        Stream::ConstIOVector large[] = { { "0123456789", 10 }, { "", 0 }, { "ABCDEFGHIJ", 10 } };
+        PRIME_TEST(sb.writeVectoredExact(large, COUNTOF(large), log));
+        PRIME_TEST(stringStream->getString() == "abcd0123456789ABCDEFGHIJ");
+
+        PRIME_TEST(sb.writeExact("xyz", 3, log));
+        PRIME_TEST(sb.flush(log));
+        PRIME_TEST(stringStream->getString() == "abcd0123456789ABCDEFGHIJxyz");
+
+        PRIME_TEST(sb.setOffset(0, log));
+
+        std::string read;
+        for (;;) {
+            char first[3];
+            char second[32];
+            Stream::IOVector vectors[] = { { first, sizeof(first) }, { second, sizeof(second) } };
+            ptrdiff_t got = sb.readVectored(vectors, COUNTOF(vectors), log);
+            PRIME_TEST(got >= 0);
+            if (got <= 0) {
+                break;
+            }
+
+            size_t fromFirst = PRIME_MIN((size_t)got, sizeof(first));
+            read.append(first, fromFirst);
+            read.append(second, (size_t)got - fromFirst);
+        }
+
+        PRIME_TEST(read == stringStream->getString());
+    }
+
+    inline void StreamBufferReadAheadTests(Log* log)
+    {
+        std::string content;
+        for (int i = 0; i != 5000; ++i) {
+            content += (char)('a' + i % 23);
+        }
+
+        RefPtr<StringStream> stringStream = PassRef(new StringStream(content));
+
+        StreamBuffer sb(stringStream, 64);
+        PRIME_TEST(sb.enableReadAhead(log));
+
+        std::string read;
+        int c;
+        while ((c = sb.readByte(log)) >= 0) {
+            read += (char)c;
+        }
+
+        PRIME_TEST(!sb.getErrorFlag());
+        PRIME_TEST(read == content);
+
+        // Seeking discards whatever has been read ahead.
+        PRIME_TEST(sb.setOffset(1000, log));
+        char bytes[300];
+        PRIME_TEST(sb.readBytes(bytes, sizeof(bytes), log));
+        PRIME_TEST(memcmp(bytes, content.data() + 1000, sizeof(bytes)) == 0);
+        PRIME_TEST(sb.getOffset(log) == 1300);
+
+        // Writing does too, so the write lands at our offset rather than the underlying stream's.
+        PRIME_TEST(sb.writeExact("XYZ", 3, log));
+        PRIME_TEST(sb.flush(log));
+        PRIME_TEST(stringStream->getString().compare(1300, 3, "XYZ") == 0);
+        PRIME_TEST(sb.readBytes(bytes, 10, log));
+        PRIME_TEST(memcmp(bytes, content.data() + 1303, 10) == 0);
+
+        PRIME_TEST(sb.close(log));
+    }
+
+    inline void StreamBufferBufferPoolTests(Log* log)
+    {
+        RefPtr<BufferPool> pool = PassRef(new BufferPool);
+        PRIME_TEST(pool->init(log));
+
+        // Buffers are reused by anything in the same size class.
+        void* buffer = pool->allocate(3000);
+        pool->deallocate(buffer, 3000);
+        PRIME_TEST(pool->allocate(4096) == buffer);
+        pool->deallocate(buffer, 4096);
+
+        RefPtr<StringStream> stringStream = PassRef(new StringStream);
+        StreamBuffer sb;
+        sb.setBufferPool(pool);
+        PRIME_TEST(sb.init(stringStream, 2000));
+        const char* pooled = sb.getReadPointer();
+
+        PRIME_TEST(sb.writeExact("pooled", 6, log));
+        PRIME_TEST(sb.setOffset(0, log));
+        char bytes[6];
+        PRIME_TEST(sb.readBytes(bytes, sizeof(bytes), log));
+        PRIME_TEST(memcmp(bytes, "pooled", 6) == 0);
+
+        // Closing returns the buffer to the pool.
+        PRIME_TEST(sb.close(log));
+        PRIME_TEST(sb.getBufferSize() == 0);
+        buffer = pool->allocate(2048);
+        PRIME_TEST(buffer == pooled);
+        pool->deallocate(buffer, 2048);
+    }
+}
+
 inline void StreamBufferTests(Log* log)
 {
     static const char text[] = "\n"
@@ -35,6 +149,10 @@ inline void StreamBufferTests(Log* log)
         *newlinePointer = 0;
         log->trace("%d: %s", number, buffer);
     }
+
+    StreamBufferTestsPrivate::StreamBufferVectoredTests(log);
+    StreamBufferTestsPrivate::StreamBufferReadAheadTests(log);
+    StreamBufferTestsPrivate::StreamBufferBufferPoolTests(log);
 }
 }
 
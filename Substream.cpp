@@ -15,6 +15,7 @@ void Substream::construct()
 {
     _discardWriteOverflow = false;
     _writeOverflowed = false;
+    _positional = false;
 }
 
 Substream::Substream(Stream* stream, Offset baseOffset, bool seekToBaseOffset, Offset substreamSize, Log* log, bool seekable)
@@ -29,7 +30,7 @@ bool Substream::close(Log* log)
         return true;
     }
 
-    bool success = _stream->close(log);
+    bool success = _positional || _stream->close(log);
     _stream.release();
 
     return success;
@@ -39,7 +40,7 @@ bool Substream::init(Stream* stream, Offset baseOffset, bool seekToBaseOffset, O
 {
     PRIME_ASSERT(!seekable || stream->isSeekable());
 
-    if (seekToBaseOffset) {
+    if (seekToBaseOffset && !_positional) {
         PRIME_ASSERT(seekable);
         if (!stream->setOffset(baseOffset, log)) {
             return false;
@@ -69,7 +70,8 @@ ptrdiff_t Substream::readSome(void* buffer, size_t maximumBytes, Log* log)
         return 0;
     }
 
-    ptrdiff_t got = _stream->readSome(buffer, maximumBytes, log);
+    ptrdiff_t got = _positional ? _stream->readAtOffset(_base + _position, buffer, maximumBytes, log)
+                                : _stream->readSome(buffer, maximumBytes, log);
 
     if (got < 0) {
         return got;
@@ -93,7 +95,8 @@ ptrdiff_t Substream::writeSome(const void* memory, size_t maximumBytes, Log* log
         bytesToWrite = (size_t)remaining;
     }
 
-    ptrdiff_t wrote = _stream->writeSome(memory, bytesToWrite, log);
+    ptrdiff_t wrote = _positional ? _stream->writeAtOffset(_base + _position, memory, bytesToWrite, log)
+                                  : _stream->writeSome(memory, bytesToWrite, log);
 
     if (wrote < 0) {
         return wrote;
@@ -147,6 +150,10 @@ Stream::Offset Substream::seek(Offset offset, SeekMode mode, Log* log)
 
     _position = newOffset;
 
+    if (_positional) {
+        return _position;
+    }
+
     Offset seekTo = _base + newOffset;
 
     if (!_stream->setOffset(seekTo, log)) {
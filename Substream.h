@@ -32,6 +32,14 @@ public:
 
     void setWriteOverflowed(bool value) { _writeOverflowed = value; }
 
+    /// If enabled, reads and writes use the underlying Stream's readAtOffset() and writeAtOffset() and the
+    /// underlying Stream's offset is never used or moved, so any number of Substreams (on any number of threads)
+    /// can share a Stream for which hasConcurrentPositionalIO() returns true. Since the underlying Stream is
+    /// shared, close() doesn't close it. Must be called before init().
+    void setPositional(bool value) { _positional = value; }
+
+    bool isPositional() const { return _positional; }
+
     Offset getBaseOffset() const { return _base; }
 
     Offset getOffset() const { return _position; }
@@ -56,6 +64,7 @@ private:
     Offset _position;
     Offset _size;
     bool _seekable;
+    bool _positional;
 
     bool _discardWriteOverflow;
     bool _writeOverflowed;
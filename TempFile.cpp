@@ -139,6 +139,31 @@ ptrdiff_t TempFile::writeSome(const void* bytes, size_t maxBytes, Log* log)
     return _fileStream.writeSome(bytes, maxBytes, log);
 }
 
+ptrdiff_t TempFile::readVectored(const IOVector* vectors, size_t vectorCount, Log* log)
+{
+    return _fileStream.readVectored(vectors, vectorCount, log);
+}
+
+ptrdiff_t TempFile::writeVectored(const ConstIOVector* vectors, size_t vectorCount, Log* log)
+{
+    return _fileStream.writeVectored(vectors, vectorCount, log);
+}
+
+ptrdiff_t TempFile::readAtOffset(Offset offset, void* buffer, size_t requiredBytes, Log* log)
+{
+    return _fileStream.readAtOffset(offset, buffer, requiredBytes, log);
+}
+
+ptrdiff_t TempFile::writeAtOffset(Offset offset, const void* bytes, size_t byteCount, Log* log)
+{
+    return _fileStream.writeAtOffset(offset, bytes, byteCount, log);
+}
+
+bool TempFile::hasConcurrentPositionalIO() const
+{
+    return _fileStream.hasConcurrentPositionalIO();
+}
+
 Stream::Offset TempFile::seek(Offset offset, SeekMode mode, Log* log)
 {
     return _fileStream.seek(offset, mode, log);
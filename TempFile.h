@@ -53,6 +53,11 @@ public:
     // Stream implementation.
     virtual ptrdiff_t readSome(void* buffer, size_t maxBytes, Log* log) PRIME_OVERRIDE;
     virtual ptrdiff_t writeSome(const void* bytes, size_t maxBytes, Log* log) PRIME_OVERRIDE;
+    virtual ptrdiff_t readVectored(const IOVector* vectors, size_t vectorCount, Log* log) PRIME_OVERRIDE;
+    virtual ptrdiff_t writeVectored(const ConstIOVector* vectors, size_t vectorCount, Log* log) PRIME_OVERRIDE;
+    virtual ptrdiff_t readAtOffset(Offset offset, void* buffer, size_t requiredBytes, Log* log) PRIME_OVERRIDE;
+    virtual ptrdiff_t writeAtOffset(Offset offset, const void* bytes, size_t byteCount, Log* log) PRIME_OVERRIDE;
+    virtual bool hasConcurrentPositionalIO() const PRIME_OVERRIDE;
     virtual Offset seek(Offset offset, SeekMode mode, Log* log) PRIME_OVERRIDE;
     virtual Offset getSize(Log* log) PRIME_OVERRIDE;
     virtual bool setSize(Offset newSize, Log* log) PRIME_OVERRIDE;
@@ -12,10 +12,16 @@
 #include "DateTimeTests.h"
 #include "DecimalTests.h"
 #include "DoubleLinkListTests.h"
+#include "HTTPConnectionTests.h"
+#include "HTTPParserTests.h"
+#include "MappedFileStreamTests.h"
+#include "MultipartParserTests.h"
 #include "OpenSSLAESTests.h"
 #include "PathTests.h"
 #include "RefCountingTests.h"
+#include "RouterTests.h"
 #include "SharedPtrTests.h"
+#include "SocketRelayTests.h"
 #include "StreamBufferTests.h"
 #include "StringStreamTests.h"
 #include "StringTests.h"
@@ -42,6 +48,12 @@ inline void AllPrimeTests(Log* log)
     DoubleLinkListTests();
     DateTimeTests();
     OpenSSLAESTests();
+    HTTPParserTests();
+    RouterTests();
+    HTTPConnectionTests(log);
+    MappedFileStreamTests(log);
+    MultipartParserTests();
+    SocketRelayTests(log);
 }
 }
 
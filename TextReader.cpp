@@ -75,6 +75,7 @@ void TextReader::setText(StringView source, unsigned int line, unsigned int colu
 
     PRIME_ASSERT(!_firstMarker);
     _stream.release();
+    _mappedFile.release();
     _ptr = _beginLocation.ptr = source.begin();
     _top = source.end();
     _buffer = _bufferEnd = 0;
@@ -85,9 +86,25 @@ void TextReader::setText(StringView source, unsigned int line, unsigned int colu
     setLocation(line, column);
 }
 
+void TextReader::setText(MappedFileStream* mappedFile, unsigned int line, unsigned int column)
+{
+    // Retain the mapping before setText() releases the current one, in case they're the same.
+    RefPtr<MappedFileStream> retain(mappedFile);
+
+    setText(mappedFile->getRemainingView(), line, column);
+
+    _mappedFile = retain;
+}
+
 void TextReader::setStream(Stream* stream, size_t bufferSize, unsigned int line, unsigned int column)
 {
+    if (MappedFileStream* mappedFile = UIDCast<MappedFileStream>(stream)) {
+        setText(mappedFile, line, column);
+        return;
+    }
+
     PRIME_ASSERT(!_firstMarker);
+    _mappedFile.release();
     _stream = stream;
     _streamCheckForBOM = _skipBOM;
     allocBuffer(bufferSize);
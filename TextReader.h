@@ -4,6 +4,7 @@
 #define PRIME_TEXTREADER_H
 
 #include "Config.h"
+#include "MappedFileStream.h"
 #include "Stream.h"
 #include "StringView.h"
 #include <vector>
@@ -93,8 +94,12 @@ public:
     /// Begin parsing the supplied text.
     void setText(StringView source, unsigned int line = 0, unsigned int column = 0);
 
+    /// Begin parsing the unread contents of a memory mapped file, in place. The MappedFileStream is retained
+    /// until another text or Stream is set.
+    void setText(MappedFileStream* mappedFile, unsigned int line = 0, unsigned int column = 0);
+
     /// Set a Stream, which can provide us with more bytes, and allocate a buffer (the buffer will grow if
-    /// necessary).
+    /// necessary). If the Stream is a MappedFileStream, this is the same as calling setText() with it.
     void setStream(Stream* stream, size_t bufferSize, unsigned int line = 0, unsigned int column = 0);
 
     /// Returns a string of the form "(line:column)".
@@ -265,6 +270,9 @@ private:
     RefPtr<Stream> _stream;
     bool _streamCheckForBOM;
 
+    /// Keeps the text alive if it's from a MappedFileStream.
+    RefPtr<MappedFileStream> _mappedFile;
+
     bool _skipBOM;
 
     // The line and column currently at the start of the buffer.
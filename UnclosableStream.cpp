@@ -37,6 +37,16 @@ ptrdiff_t UnclosableStream::writeSome(const void* bytes, size_t maxBytes, Log* l
     return _underlyingStream->writeSome(bytes, maxBytes, log);
 }
 
+ptrdiff_t UnclosableStream::readVectored(const IOVector* vectors, size_t vectorCount, Log* log)
+{
+    return _underlyingStream->readVectored(vectors, vectorCount, log);
+}
+
+ptrdiff_t UnclosableStream::writeVectored(const ConstIOVector* vectors, size_t vectorCount, Log* log)
+{
+    return _underlyingStream->writeVectored(vectors, vectorCount, log);
+}
+
 ptrdiff_t UnclosableStream::readAtOffset(Offset offset, void* buffer, size_t requiredBytes, Log* log)
 {
     return _underlyingStream->readAtOffset(offset, buffer, requiredBytes, log);
@@ -47,6 +57,11 @@ ptrdiff_t UnclosableStream::writeAtOffset(Offset offset, const void* bytes, size
     return _underlyingStream->writeAtOffset(offset, bytes, byteCount, log);
 }
 
+bool UnclosableStream::hasConcurrentPositionalIO() const
+{
+    return _underlyingStream->hasConcurrentPositionalIO();
+}
+
 Stream::Offset UnclosableStream::seek(Offset offset, SeekMode mode, Log* log)
 {
     return _underlyingStream->seek(offset, mode, log);
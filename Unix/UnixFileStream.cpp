@@ -6,6 +6,7 @@
 #include <fcntl.h>
 #include <string.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
 namespace Prime {
@@ -193,6 +194,116 @@ ptrdiff_t UnixFileStream::writeSome(const void* bytes, size_t maxBytes, Log* log
     return bytesWritten;
 }
 
+ptrdiff_t UnixFileStream::readVectored(const IOVector* vectors, size_t vectorCount, Log* log)
+{
+    PRIME_ASSERT(isOpen());
+
+    vectorCount = PRIME_MIN(vectorCount, (size_t)maxIOVectors);
+
+    struct iovec buffers[maxIOVectors];
+    for (size_t i = 0; i != vectorCount; ++i) {
+        buffers[i].iov_base = vectors[i].bytes;
+        buffers[i].iov_len = vectors[i].size;
+    }
+
+    ptrdiff_t bytesRead;
+    for (;;) {
+        bytesRead = ::readv(_handle, buffers, (int)vectorCount);
+        if (bytesRead >= 0) {
+            break;
+        }
+
+        if (errno != EINTR) {
+            log->logErrno(errno);
+            break;
+        }
+    }
+
+    return bytesRead;
+}
+
+ptrdiff_t UnixFileStream::writeVectored(const ConstIOVector* vectors, size_t vectorCount, Log* log)
+{
+    PRIME_ASSERT(isOpen());
+
+    vectorCount = PRIME_MIN(vectorCount, (size_t)maxIOVectors);
+
+    struct iovec buffers[maxIOVectors];
+    for (size_t i = 0; i != vectorCount; ++i) {
+        buffers[i].iov_base = const_cast<void*>(vectors[i].bytes);
+        buffers[i].iov_len = vectors[i].size;
+    }
+
+    ptrdiff_t bytesWritten;
+    for (;;) {
+        bytesWritten = ::writev(_handle, buffers, (int)vectorCount);
+        if (bytesWritten >= 0) {
+            break;
+        }
+
+        if (errno != EINTR) {
+            log->logErrno(errno);
+            break;
+        }
+    }
+
+    return bytesWritten;
+}
+
+ptrdiff_t UnixFileStream::readAtOffset(Offset offset, void* buffer, size_t requiredBytes, Log* log)
+{
+    PRIME_ASSERT(isOpen());
+
+    size_t totalRead = 0;
+    while (totalRead != requiredBytes) {
+        ptrdiff_t bytesRead = ::pread(_handle, (char*)buffer + totalRead, requiredBytes - totalRead,
+            (off_t)(offset + (Offset)totalRead));
+        if (bytesRead < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            log->logErrno(errno);
+            return -1;
+        }
+
+        if (bytesRead == 0) {
+            break;
+        }
+
+        totalRead += (size_t)bytesRead;
+    }
+
+    return (ptrdiff_t)totalRead;
+}
+
+ptrdiff_t UnixFileStream::writeAtOffset(Offset offset, const void* bytes, size_t byteCount, Log* log)
+{
+    PRIME_ASSERT(isOpen());
+
+    size_t totalWritten = 0;
+    while (totalWritten != byteCount) {
+        ptrdiff_t bytesWritten = ::pwrite(_handle, (const char*)bytes + totalWritten, byteCount - totalWritten,
+            (off_t)(offset + (Offset)totalWritten));
+        if (bytesWritten < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            log->logErrno(errno);
+            return -1;
+        }
+
+        if (bytesWritten == 0) {
+            break;
+        }
+
+        totalWritten += (size_t)bytesWritten;
+    }
+
+    return (ptrdiff_t)totalWritten;
+}
+
 Stream::Offset UnixFileStream::seek(Offset offset, SeekMode mode, Log* log)
 {
     PRIME_ASSERT(isOpen());
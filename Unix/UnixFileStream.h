@@ -55,6 +55,20 @@ public:
 
     virtual ptrdiff_t writeSome(const void* bytes, size_t maxBytes, Log* log) PRIME_OVERRIDE;
 
+    /// Uses readv().
+    virtual ptrdiff_t readVectored(const IOVector* vectors, size_t vectorCount, Log* log) PRIME_OVERRIDE;
+
+    /// Uses writev().
+    virtual ptrdiff_t writeVectored(const ConstIOVector* vectors, size_t vectorCount, Log* log) PRIME_OVERRIDE;
+
+    /// Uses pread(), so doesn't move the file offset.
+    virtual ptrdiff_t readAtOffset(Offset offset, void* buffer, size_t requiredBytes, Log* log) PRIME_OVERRIDE;
+
+    /// Uses pwrite(), so doesn't move the file offset.
+    virtual ptrdiff_t writeAtOffset(Offset offset, const void* bytes, size_t byteCount, Log* log) PRIME_OVERRIDE;
+
+    virtual bool hasConcurrentPositionalIO() const PRIME_OVERRIDE { return true; }
+
     virtual Offset seek(Offset offset, SeekMode mode, Log* log) PRIME_OVERRIDE;
 
     virtual Offset getSize(Log* log) PRIME_OVERRIDE;
@@ -9,23 +9,30 @@
 #include <errno.h>
 #include <netdb.h>
 #include <netinet/in.h>
+#include <poll.h>
 #include <sys/ioctl.h>
 #include <sys/param.h>
 #include <sys/select.h>
 #include <sys/socket.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
+#define PRIME_HAVE_SOCKET_POLL
+
 #if defined(PRIME_OS_OSX) || defined(PRIME_OS_BSD)
 #define PRIME_OS_HAS_GETIFADDRS
 #include <ifaddrs.h>
-#include <sys/uio.h>
 #endif
 
 #if defined(PRIME_OS_LINUX)
 #define PRIME_OS_HAS_GETIFADDRS
 #include <ifaddrs.h>
 #include <sys/sendfile.h>
+#ifdef SO_REUSEPORT
+// Linux distributes incoming connections across all the sockets bound to an address with SO_REUSEPORT.
+#define PRIME_OS_HAS_REUSEPORT_BALANCING
+#endif
 #endif
 
 namespace Prime {
@@ -91,6 +98,15 @@ public:
         return ::select(nfds, readfds, writefds, exceptfds, timeout);
     }
 
+    /// Descriptor type accepted by pollSocket().
+    typedef struct pollfd PollDescriptor;
+
+    /// Wrapper around poll(). Unlike select(), has no limit on the value of the handles being waited on.
+    static int pollSocket(PollDescriptor* descriptors, size_t count, int milliseconds)
+    {
+        return ::poll(descriptors, (nfds_t)count, milliseconds);
+    }
+
     /// Set a socket's non-blocking mode.
     static bool setSocketNonBlocking(Handle handle, bool nonBlocking);
 
@@ -10,6 +10,8 @@
 
 #if WINVER < PRIME_WINVER_FOR(PRIME_WINDOWS_VISTA)
 #define PRIME_NO_IP6
+#else
+#define PRIME_HAVE_SOCKET_POLL
 #endif
 
 // TODO: don't have getifaddrs on Windows but do have GetAdaptersAddresses. Need a wrapper.
@@ -85,6 +87,17 @@ public:
         return ::select(nfds, readfds, writefds, exceptfds, timeout);
     }
 
+#ifdef PRIME_HAVE_SOCKET_POLL
+    /// Descriptor type accepted by pollSocket().
+    typedef WSAPOLLFD PollDescriptor;
+
+    /// Wrapper around WSAPoll().
+    static int pollSocket(PollDescriptor* descriptors, size_t count, int milliseconds)
+    {
+        return WSAPoll(descriptors, (ULONG)count, milliseconds);
+    }
+#endif
+
     /// Set a socket's non-blocking mode.
     static bool setSocketNonBlocking(Handle handle, bool nonBlocking);
 
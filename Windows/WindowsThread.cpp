@@ -105,6 +105,25 @@ bool WindowsThread::cancel()
 #endif
 }
 
+bool WindowsThread::setCPUAffinity(int cpu, Log* log)
+{
+    if (!_handle) {
+        return false;
+    }
+
+    if (cpu < 0 || cpu >= (int)(sizeof(DWORD_PTR) * 8)) {
+        log->error(PRIME_LOCALISE("Invalid CPU number: %d"), cpu);
+        return false;
+    }
+
+    if (!SetThreadAffinityMask(_handle, (DWORD_PTR)1 << cpu)) {
+        log->logWindowsError(GetLastError(), "SetThreadAffinityMask");
+        return false;
+    }
+
+    return true;
+}
+
 namespace {
 
     using namespace Prime;
@@ -46,6 +46,9 @@ public:
     /// Attempt to forcibly abort the thread. Not available on all platforms.
     bool cancel();
 
+    /// Restrict the thread to running on a single CPU (0 to getCPUCount() - 1).
+    bool setCPUAffinity(int cpu, Log* log);
+
     ThreadID getThreadID() const { return _threadID; }
 
 private:
@@ -43,6 +43,7 @@ bool ZipReader::reopen(Log* log)
     }
 
     _atEnd = false;
+    _sequential = false;
     _nextEnt = 0;
     _end.signature = 0; // Mark the end record as invalid.
     _triedSequential = false;
@@ -367,7 +368,10 @@ void ZipReader::skipEndRecord(const char* excess, size_t excessSize, Log* log)
 void ZipReader::reachedEnd()
 {
     _atEnd = true;
-    _stream.release();
+
+    if (_sequential || !_stream->hasConcurrentPositionalIO()) {
+        _stream.release();
+    }
 }
 
 bool ZipReader::readCentralDirectoryEntry(Log* log)
@@ -422,21 +426,24 @@ RefPtr<Stream> ZipReader::openFile(const Token& token, const StreamOptions& opti
             token.crc32, token.method, token.decompressedSize, options, log);
     }
 
-    RefPtr<Stream> archiveStream(_fileSystem->openForRead(_archivePath.c_str(), log));
-    if (!archiveStream) {
-        return NULL;
+    // If the archive Stream can be read from at any offset without disturbing it, every file shares it, so any
+    // number of threads can read from the archive at once without reopening it.
+    RefPtr<Stream> archiveStream;
+    if (_stream && _stream->hasConcurrentPositionalIO()) {
+        archiveStream = _stream;
+    } else {
+        archiveStream = _fileSystem->openForRead(_archivePath.c_str(), log);
+        if (!archiveStream) {
+            return NULL;
+        }
     }
 
     // If we're not in sequential mode, we must read the local directory entry.
 
     // TODO: adjust offsets based on the SFX
 
-    if (!archiveStream->setOffset(_zipOffset + token.offset, log)) {
-        return NULL;
-    }
-
     char buffer[Zip::LocalDirectoryEntry::encodedSize];
-    if (!archiveStream->readExact(buffer, Zip::LocalDirectoryEntry::encodedSize, log)) {
+    if (archiveStream->readAtOffset(_zipOffset + token.offset, buffer, sizeof(buffer), log) != (ptrdiff_t)sizeof(buffer)) {
         log->error(PRIME_LOCALISE("Couldn't read local directory entry of archived file."));
         return NULL;
     }
@@ -459,7 +466,8 @@ RefPtr<Stream> ZipReader::streamForRegion(Stream* archiveStream, Stream::Offset
 {
     // Use a Substream to limit access to the relevant portion of the zip file.
     RefPtr<Substream> substream = PassRef(new Substream);
-    if (!substream || !substream->init(archiveStream, where, true, size, log)) {
+    substream->setPositional(!_sequential && archiveStream->hasConcurrentPositionalIO());
+    if (!substream->init(archiveStream, where, true, size, log)) {
         return NULL;
     }
 
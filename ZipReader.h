@@ -14,7 +14,9 @@
 namespace Prime {
 
 /// Only supports deflate-32 or uncompressed files and does not support multi-part archives.
-/// Supports non-seekable Streams (e.g., you can read a zip file from a SocketStream).
+/// Supports non-seekable Streams (e.g., you can read a zip file from a SocketStream). If the archive's Stream
+/// has concurrent positional I/O (e.g., a UnixFileStream), the files opened from it share the archive's Stream,
+/// so they can be read by any number of threads at once without the archive being reopened for each one.
 class PRIME_PUBLIC ZipReader {
 public:
     static UnixTime zipDateTimeToUnixTime(uint16_t zipDate, uint16_t zipTime);
@@ -164,7 +166,8 @@ private:
     bool tryBeginSequentialRead(Log* log);
 
     /// Returns an AddRefd Stream that reads/decompresses data from within the archive. archiveStream should be
-    /// a newly opened Stream for reading the archive.
+    /// a newly opened Stream for reading the archive, or one for which hasConcurrentPositionalIO() returns true,
+    /// in which case it's shared via a positional Substream.
     RefPtr<Stream> streamForRegion(Stream* archiveStream, Stream::Offset where, Stream::Offset size,
         uint32_t crc32, int compressionMethod, Stream::Offset decompressedSize,
         const StreamOptions& options, Log* log);
@@ -172,7 +175,8 @@ private:
     /// Normalise a file name so that it uses only UNIX slashes and does not begin with a path separator or drive letter.
     void normaliseFilename(std::string& filename);
 
-    /// Sets _atEnd to true, closes the Stream and frees the buffer memory.
+    /// Sets _atEnd to true and releases the Stream, unless it's going to be shared by the files opened from the
+    /// archive.
     void reachedEnd();
 
     RefPtr<FileSystem> _fileSystem;